@@ -0,0 +1,820 @@
+/**
+ * @file    cserve_bench.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   End-to-end HTTP benchmark: in-process server, stub backend and load generator.
+ *
+ * @details Starts cserve on a loopback port in a thread, with a stub backend
+ *          standing in for the /api upstream, then drives it from a single
+ *          epoll-based load generator. Everything runs offline in one process,
+ *          so runs are reproducible and comparable across commits.
+ *
+ *          Results (RPS, latency percentiles, CPU per request) are printed to
+ *          stdout as one JSON object. Run with --help for the options.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "http/server.h"
+#include "utils/config.h"
+#include "utils/metrics.h"
+
+#define BENCH_MAX_CONNECTIONS 4096
+#define BENCH_MAX_PIPELINE 64
+#define BENCH_READ_CHUNK 65536
+#define BENCH_STUB_BODY_SIZE 512
+
+typedef enum
+{
+    BENCH_STATIC_SMALL,
+    BENCH_STATIC_LARGE,
+    BENCH_PROXY,
+    BENCH_NOT_FOUND,
+    BENCH_REQUEST_TYPES
+} BenchRequestType;
+
+static const char *const type_names[BENCH_REQUEST_TYPES] = {"static_small", "static_large",
+                                                            "proxy", "not_found"};
+static const char *const type_paths[BENCH_REQUEST_TYPES] = {
+    "/static/small.html", "/static/large.bin", "/api/bench", "/missing"};
+static const int type_status[BENCH_REQUEST_TYPES] = {200, 200, 200, 404};
+
+typedef struct BenchOptions
+{
+    int connections;
+    int pipeline;
+    double duration;
+    double warmup;
+    bool keep_alive;
+    int mix[BENCH_REQUEST_TYPES];
+    size_t small_size;
+    size_t large_size;
+    int log_level;
+} BenchOptions;
+
+typedef struct BenchClient
+{
+    int fd;
+    bool connecting;
+    char *rbuf;
+    size_t rlen;
+    size_t rcap;
+    char wbuf[BENCH_MAX_PIPELINE * 128];
+    size_t wlen;
+    size_t wsent;
+    uint64_t sent_at[BENCH_MAX_PIPELINE]; // FIFO of in-flight requests
+    int types[BENCH_MAX_PIPELINE];
+    int head;
+    int inflight;
+} BenchClient;
+
+typedef struct BenchStats
+{
+    uint64_t requests[BENCH_REQUEST_TYPES];
+    uint64_t errors[BENCH_REQUEST_TYPES];
+    uint64_t connect_errors;
+    uint64_t bytes_received;
+    Histogram latency[BENCH_REQUEST_TYPES];
+    Histogram total;
+} BenchStats;
+
+typedef struct BenchContext
+{
+    BenchOptions opts;
+    int port;
+    int epoll_fd;
+    BenchClient *clients;
+    BenchStats *stats;
+    bool measuring;
+    uint64_t mix_total;
+    uint64_t rng;
+} BenchContext;
+
+// ---------- STUB BACKEND ----------
+
+typedef struct StubBackend
+{
+    int listen_fd;
+    int port;
+    atomic_bool running;
+    pthread_t thread;
+} StubBackend;
+
+/**
+ * @brief   Answers each upstream connection with a fixed JSON body, then closes.
+ *
+ * cserve proxies with "Connection: close" and waits for the response before
+ * serving anything else, so a single blocking loop keeps up with it.
+ */
+static void *stub_backend_loop(void *arg)
+{
+    StubBackend *stub = arg;
+
+    char body[BENCH_STUB_BODY_SIZE + 1];
+    memset(body, 'x', BENCH_STUB_BODY_SIZE);
+    memcpy(body, "{\"data\":\"", 9);
+    memcpy(body + BENCH_STUB_BODY_SIZE - 2, "\"}", 2);
+    body[BENCH_STUB_BODY_SIZE] = '\0';
+
+    char response[BENCH_STUB_BODY_SIZE + 256];
+    int response_len = snprintf(response, sizeof(response),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: application/json\r\n"
+                                "Content-Length: %d\r\n"
+                                "Connection: close\r\n"
+                                "\r\n%s",
+                                BENCH_STUB_BODY_SIZE, body);
+
+    char request[INITIAL_BUFFER_SIZE];
+    while (atomic_load(&stub->running))
+    {
+        int fd = accept4(stub->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        size_t len = 0;
+        while (len < sizeof(request) - 1)
+        {
+            ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+            if (n <= 0) break;
+            len += n;
+            request[len] = '\0';
+            if (strstr(request, "\r\n\r\n")) break;
+        }
+
+        size_t sent = 0;
+        while (sent < (size_t)response_len)
+        {
+            ssize_t n = send(fd, response + sent, response_len - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += n;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(*port);
+    socklen_t addr_len      = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int stub_backend_start(StubBackend *stub)
+{
+    stub->port      = 0;
+    stub->listen_fd = listen_loopback(&stub->port);
+    if (stub->listen_fd < 0) return -1;
+
+    // accept() wakes up periodically so the thread can notice shutdown
+    struct timeval tv = {0, 100000};
+    setsockopt(stub->listen_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    atomic_init(&stub->running, true);
+    return pthread_create(&stub->thread, NULL, stub_backend_loop, stub) == 0 ? 0 : -1;
+}
+
+static void stub_backend_stop(StubBackend *stub)
+{
+    atomic_store(&stub->running, false);
+    pthread_join(stub->thread, NULL);
+    close(stub->listen_fd);
+}
+
+// ---------- IN-PROCESS SERVER ----------
+
+static void *server_thread_main(void *arg)
+{
+    HTTPServer *server = arg;
+    int ret            = server->launch(server);
+    if (ret < 0) fprintf(stderr, "cserve_bench: server launch failed with code %d\n", ret);
+    return NULL;
+}
+
+/**
+ * @brief   Picks a free loopback port for the server.
+ *
+ * The probe socket is closed before the server binds, which leaves a small
+ * window for another process to take the port; fine for a benchmark.
+ */
+static int reserve_port(void)
+{
+    int port = 0;
+    int fd   = listen_loopback(&port);
+    if (fd < 0) return -1;
+    close(fd);
+    return port;
+}
+
+static bool wait_for_port(int port, double timeout)
+{
+    uint64_t deadline = monotonic_ns() + (uint64_t)(timeout * 1e9);
+    while (monotonic_ns() < deadline)
+    {
+        int fd                  = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = {0};
+        addr.sin_family         = AF_INET;
+        addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+        addr.sin_port           = htons(port);
+        int ok                  = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(fd);
+        if (ok) return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+static int write_file(const char *path, size_t size, char fill)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    for (size_t i = 0; i < size; i++)
+        fputc(i % 64 == 63 ? '\n' : fill, f);
+    return fclose(f);
+}
+
+/**
+ * @brief   Creates a scratch document root with the static files the mix requests.
+ *
+ * The server resolves /static paths against the working directory, so the
+ * benchmark chdir()s into the scratch directory.
+ */
+static int prepare_docroot(char *dir, const BenchOptions *opts)
+{
+    if (!mkdtemp(dir)) return -1;
+    if (chdir(dir) < 0 || mkdir("static", 0755) < 0) return -1;
+    if (write_file("static/small.html", opts->small_size, 's') < 0) return -1;
+    if (write_file("static/large.bin", opts->large_size, 'L') < 0) return -1;
+    return 0;
+}
+
+static void remove_docroot(const char *dir)
+{
+    if (chdir(dir) == 0)
+    {
+        unlink("static/small.html");
+        unlink("static/large.bin");
+        rmdir("static");
+    }
+    if (chdir("/") == 0) rmdir(dir);
+}
+
+// ---------- LOAD GENERATOR ----------
+
+static uint64_t next_random(BenchContext *ctx)
+{
+    // xorshift64*, deterministic across runs
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 2685821657736338717ull;
+}
+
+static int pick_request_type(BenchContext *ctx)
+{
+    uint64_t r = next_random(ctx) % ctx->mix_total;
+    for (int t = 0; t < BENCH_REQUEST_TYPES; t++)
+    {
+        if (r < (uint64_t)ctx->opts.mix[t]) return t;
+        r -= ctx->opts.mix[t];
+    }
+    return BENCH_STATIC_SMALL;
+}
+
+static int client_connect(BenchContext *ctx, BenchClient *client)
+{
+    client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(ctx->port);
+    if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(client->fd);
+        client->fd = -1;
+        return -1;
+    }
+
+    client->connecting = true;
+    client->rlen       = 0;
+    client->wlen       = 0;
+    client->wsent      = 0;
+    client->head       = 0;
+    client->inflight   = 0;
+
+    struct epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = client;
+    return epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, client->fd, &ev);
+}
+
+static void client_close(BenchContext *ctx, BenchClient *client)
+{
+    if (client->fd < 0) return;
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+/**
+ * @brief   Tops the client up to its pipelining depth and writes what it can.
+ *
+ * @return  -1 if the connection failed.
+ */
+static int client_send(BenchContext *ctx, BenchClient *client)
+{
+    int depth = ctx->opts.keep_alive ? ctx->opts.pipeline : 1;
+    while (client->inflight < depth && client->wlen + 128 <= sizeof(client->wbuf))
+    {
+        int type = pick_request_type(ctx);
+        int n    = snprintf(client->wbuf + client->wlen, sizeof(client->wbuf) - client->wlen,
+                            "GET %s HTTP/1.1\r\nHost: bench\r\nConnection: %s\r\n\r\n",
+                            type_paths[type], ctx->opts.keep_alive ? "keep-alive" : "close");
+        client->wlen += n;
+
+        int slot              = (client->head + client->inflight) % BENCH_MAX_PIPELINE;
+        client->sent_at[slot] = monotonic_ns();
+        client->types[slot]   = type;
+        client->inflight++;
+    }
+
+    while (client->wsent < client->wlen)
+    {
+        ssize_t n = send(client->fd, client->wbuf + client->wsent, client->wlen - client->wsent,
+                         MSG_NOSIGNAL);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        client->wsent += n;
+    }
+    client->wlen  = 0;
+    client->wsent = 0;
+    return 0;
+}
+
+static void record_response(BenchContext *ctx, BenchClient *client, int status)
+{
+    int type         = client->types[client->head];
+    uint64_t latency = monotonic_ns() - client->sent_at[client->head];
+    client->head     = (client->head + 1) % BENCH_MAX_PIPELINE;
+    client->inflight--;
+
+    if (!ctx->measuring) return;
+
+    BenchStats *stats = ctx->stats;
+    stats->requests[type]++;
+    if (status != type_status[type]) stats->errors[type]++;
+    histogram_record(&stats->latency[type], latency);
+    histogram_record(&stats->total, latency);
+}
+
+/**
+ * @brief   Consumes every complete response in the client's read buffer.
+ *
+ * @return  Number of responses consumed, or -1 on a malformed response.
+ */
+static int client_parse_responses(BenchContext *ctx, BenchClient *client)
+{
+    int consumed_responses = 0;
+    while (client->inflight > 0)
+    {
+        char *headers_end = memmem(client->rbuf, client->rlen, "\r\n\r\n", 4);
+        if (!headers_end) break;
+        size_t header_len = headers_end + 4 - client->rbuf;
+
+        int status = 0;
+        if (client->rlen < 12 || sscanf(client->rbuf, "HTTP/1.%*d %d", &status) != 1) return -1;
+
+        *headers_end   = '\0';
+        char *cl       = strcasestr(client->rbuf, "\r\nContent-Length:");
+        *headers_end   = '\r';
+        size_t content = cl ? strtoul(cl + 17, NULL, 10) : 0;
+        if (client->rlen < header_len + content) break;
+
+        record_response(ctx, client, status);
+        consumed_responses++;
+
+        size_t total = header_len + content;
+        memmove(client->rbuf, client->rbuf + total, client->rlen - total);
+        client->rlen -= total;
+    }
+    return consumed_responses;
+}
+
+static void client_fail(BenchContext *ctx, BenchClient *client)
+{
+    if (ctx->measuring)
+    {
+        ctx->stats->connect_errors++;
+        // Requests in flight on a broken connection count as errors of their type
+        for (int i = 0; i < client->inflight; i++)
+            ctx->stats->errors[client->types[(client->head + i) % BENCH_MAX_PIPELINE]]++;
+    }
+    client_close(ctx, client);
+    client_connect(ctx, client);
+}
+
+static void client_event(BenchContext *ctx, BenchClient *client, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN))
+    {
+        client_fail(ctx, client);
+        return;
+    }
+
+    if (client->connecting && (events & EPOLLOUT))
+    {
+        client->connecting = false;
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = client;
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    }
+
+    if (events & EPOLLIN)
+    {
+        bool eof = false;
+        while (1)
+        {
+            if (client->rcap - client->rlen < BENCH_READ_CHUNK)
+            {
+                client->rcap = client->rcap * 2 + BENCH_READ_CHUNK;
+                client->rbuf = realloc(client->rbuf, client->rcap);
+            }
+            ssize_t n = recv(client->fd, client->rbuf + client->rlen, client->rcap - client->rlen,
+                             0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0)
+            {
+                client_fail(ctx, client);
+                return;
+            }
+            if (n == 0)
+            {
+                eof = true;
+                break;
+            }
+            client->rlen += n;
+            if (ctx->measuring) ctx->stats->bytes_received += n;
+        }
+
+        // A close is only an error if it cut a response short
+        if (client_parse_responses(ctx, client) < 0 || (eof && client->inflight > 0))
+        {
+            client_fail(ctx, client);
+            return;
+        }
+        if (eof || (!ctx->opts.keep_alive && client->inflight == 0))
+        {
+            client_close(ctx, client);
+            client_connect(ctx, client);
+            return;
+        }
+    }
+
+    if (!client->connecting && client_send(ctx, client) < 0) client_fail(ctx, client);
+}
+
+static double cpu_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double process_cpu_seconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+           ru.ru_stime.tv_usec / 1e6;
+}
+
+// ---------- REPORT ----------
+
+static void print_histogram_us(const Histogram *h)
+{
+    uint64_t count = atomic_load(&h->count);
+    printf("{\"avg\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+           count ? atomic_load(&h->sum) / 1e3 / count : 0.0, histogram_percentile(h, 50) / 1e3,
+           histogram_percentile(h, 99) / 1e3, histogram_percentile(h, 99.9) / 1e3,
+           atomic_load(&h->max) / 1e3);
+}
+
+static void print_report(const BenchContext *ctx, double elapsed, double server_cpu,
+                         double process_cpu)
+{
+    const BenchOptions *o   = &ctx->opts;
+    const BenchStats *stats = ctx->stats;
+
+    uint64_t requests = 0, errors = stats->connect_errors;
+    for (int t = 0; t < BENCH_REQUEST_TYPES; t++)
+    {
+        requests += stats->requests[t];
+        errors += stats->errors[t];
+    }
+
+    printf("{\"config\":{\"connections\":%d,\"pipeline\":%d,\"keep_alive\":%s,"
+           "\"duration_s\":%.1f,\"warmup_s\":%.1f,\"small_bytes\":%zu,\"large_bytes\":%zu,"
+           "\"mix\":{",
+           o->connections, o->keep_alive ? o->pipeline : 1, o->keep_alive ? "true" : "false",
+           o->duration, o->warmup, o->small_size, o->large_size);
+    for (int t = 0; t < BENCH_REQUEST_TYPES; t++)
+        printf("%s\"%s\":%d", t ? "," : "", type_names[t], o->mix[t]);
+    printf("}},");
+
+    printf("\"requests\":%lu,\"errors\":%lu,\"connect_errors\":%lu,\"elapsed_s\":%.3f,",
+           (unsigned long)requests, (unsigned long)errors, (unsigned long)stats->connect_errors,
+           elapsed);
+    printf("\"rps\":%.1f,\"bytes_received\":%lu,", requests / elapsed,
+           (unsigned long)stats->bytes_received);
+
+    printf("\"latency_us\":");
+    print_histogram_us(&stats->total);
+
+    printf(",\"cpu_us_per_request\":{\"server\":%.2f,\"process\":%.2f},",
+           requests ? server_cpu * 1e6 / requests : 0.0,
+           requests ? process_cpu * 1e6 / requests : 0.0);
+
+    printf("\"by_type\":{");
+    for (int t = 0; t < BENCH_REQUEST_TYPES; t++)
+    {
+        printf("%s\"%s\":{\"requests\":%lu,\"errors\":%lu,\"latency_us\":", t ? "," : "",
+               type_names[t], (unsigned long)stats->requests[t], (unsigned long)stats->errors[t]);
+        print_histogram_us(&stats->latency[t]);
+        printf("}");
+    }
+    printf("}}\n");
+}
+
+// ---------- OPTIONS ----------
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -c, --connections N   concurrent client connections (default 64)\n"
+            "  -p, --pipeline N      requests in flight per connection (default 1)\n"
+            "  -d, --duration SEC    measured duration (default 5)\n"
+            "  -w, --warmup SEC      unmeasured warmup (default 1)\n"
+            "  -k, --keepalive 0|1   reuse connections (default 1)\n"
+            "  -m, --mix SPEC        weights, e.g. small:60,large:10,proxy:20,404:10\n"
+            "      --small-size N    bytes in the small static file (default 1024)\n"
+            "      --large-size N    bytes in the large static file (default 262144)\n"
+            "      --log-level L     server log level (default ERROR)\n",
+            prog);
+}
+
+static int parse_mix(const char *spec, int *mix)
+{
+    char *copy = strdup(spec);
+    memset(mix, 0, sizeof(int) * BENCH_REQUEST_TYPES);
+
+    for (char *tok = strtok(copy, ","); tok; tok = strtok(NULL, ","))
+    {
+        char *colon = strchr(tok, ':');
+        if (!colon)
+        {
+            free(copy);
+            return -1;
+        }
+        *colon     = '\0';
+        int weight = atoi(colon + 1);
+
+        if (strcmp(tok, "small") == 0)
+            mix[BENCH_STATIC_SMALL] = weight;
+        else if (strcmp(tok, "large") == 0)
+            mix[BENCH_STATIC_LARGE] = weight;
+        else if (strcmp(tok, "proxy") == 0)
+            mix[BENCH_PROXY] = weight;
+        else if (strcmp(tok, "404") == 0)
+            mix[BENCH_NOT_FOUND] = weight;
+        else
+        {
+            free(copy);
+            return -1;
+        }
+    }
+    free(copy);
+    return 0;
+}
+
+static int parse_options(int argc, char **argv, BenchOptions *o)
+{
+    *o = (BenchOptions){.connections = 64,
+                        .pipeline    = 1,
+                        .duration    = 5,
+                        .warmup      = 1,
+                        .keep_alive  = true,
+                        .mix         = {60, 10, 20, 10},
+                        .small_size  = 1024,
+                        .large_size  = 256 * 1024,
+                        .log_level   = LOG_ERROR};
+
+    static const struct option long_options[] = {
+        {"connections", required_argument, NULL, 'c'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"keepalive", required_argument, NULL, 'k'},
+        {"mix", required_argument, NULL, 'm'},
+        {"small-size", required_argument, NULL, 'S'},
+        {"large-size", required_argument, NULL, 'L'},
+        {"log-level", required_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:p:d:w:k:m:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            o->connections = atoi(optarg);
+            break;
+        case 'p':
+            o->pipeline = atoi(optarg);
+            break;
+        case 'd':
+            o->duration = atof(optarg);
+            break;
+        case 'w':
+            o->warmup = atof(optarg);
+            break;
+        case 'k':
+            o->keep_alive = parse_bool(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg, o->mix) < 0) return -1;
+            break;
+        case 'S':
+            o->small_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'L':
+            o->large_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            o->log_level = log_level_from_string(optarg);
+            if (o->log_level < 0) return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (o->connections < 1 || o->connections > BENCH_MAX_CONNECTIONS) return -1;
+    if (o->pipeline < 1 || o->pipeline > BENCH_MAX_PIPELINE) return -1;
+    if (o->duration <= 0 || o->warmup < 0) return -1;
+    return 0;
+}
+
+// ---------- MAIN ----------
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchContext ctx = {0};
+    if (parse_options(argc, argv, &ctx.opts) < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int t = 0; t < BENCH_REQUEST_TYPES; t++)
+        ctx.mix_total += ctx.opts.mix[t];
+    if (ctx.mix_total == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    ctx.rng = 0x9E3779B97F4A7C15ull;
+
+    char docroot[] = "/tmp/cserve_bench.XXXXXX";
+    if (prepare_docroot(docroot, &ctx.opts) < 0)
+    {
+        perror("cserve_bench: failed to prepare document root");
+        return EXIT_FAILURE;
+    }
+
+    logger_set_level(ctx.opts.log_level);
+    logger_init();
+
+    StubBackend stub;
+    if (stub_backend_start(&stub) < 0)
+    {
+        perror("cserve_bench: failed to start stub backend");
+        remove_docroot(docroot);
+        return EXIT_FAILURE;
+    }
+
+    char backend[32];
+    snprintf(backend, sizeof(backend), "127.0.0.1:%d", stub.port);
+    char *backends[] = {backend};
+
+    Config cfg = {0};
+    cfg.port          = reserve_port();
+    cfg.static_dir    = "static";
+    cfg.backends      = backends;
+    cfg.backend_count = 1;
+    cfg.log_level     = ctx.opts.log_level;
+    socket_options_defaults(&cfg.socket_options);
+    static_options_defaults(&cfg.static_options);
+    cfg.socket_options.nodelay = true;
+
+    HTTPServer *server = httpserver_constructor(&cfg);
+    pthread_t server_thread;
+    if (cfg.port < 0 || !server ||
+        pthread_create(&server_thread, NULL, server_thread_main, server) != 0 ||
+        !wait_for_port(cfg.port, 5.0))
+    {
+        fprintf(stderr, "cserve_bench: server did not come up\n");
+        remove_docroot(docroot);
+        return EXIT_FAILURE;
+    }
+    ctx.port = cfg.port;
+
+    clockid_t server_clock;
+    pthread_getcpuclockid(server_thread, &server_clock);
+
+    ctx.stats    = calloc(1, sizeof(BenchStats));
+    ctx.clients  = calloc(ctx.opts.connections, sizeof(BenchClient));
+    ctx.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < ctx.opts.connections; i++)
+    {
+        ctx.clients[i].fd = -1;
+        if (client_connect(&ctx, &ctx.clients[i]) < 0) ctx.stats->connect_errors++;
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    uint64_t start        = monotonic_ns();
+    uint64_t measure_at   = start + (uint64_t)(ctx.opts.warmup * 1e9);
+    uint64_t stop_at      = measure_at + (uint64_t)(ctx.opts.duration * 1e9);
+    double server_cpu0    = 0;
+    double process_cpu0   = 0;
+    uint64_t measure_from = 0;
+
+    while (1)
+    {
+        uint64_t now = monotonic_ns();
+        if (!ctx.measuring && now >= measure_at)
+        {
+            memset(ctx.stats, 0, sizeof(*ctx.stats));
+            ctx.measuring = true;
+            measure_from  = now;
+            server_cpu0   = cpu_seconds(server_clock);
+            process_cpu0  = process_cpu_seconds();
+        }
+        if (now >= stop_at) break;
+
+        int n = epoll_wait(ctx.epoll_fd, events, MAX_EPOLL_EVENTS, 10);
+        for (int i = 0; i < n; i++)
+            client_event(&ctx, events[i].data.ptr, events[i].events);
+    }
+
+    double elapsed     = (monotonic_ns() - measure_from) / 1e9;
+    double server_cpu  = cpu_seconds(server_clock) - server_cpu0;
+    double process_cpu = process_cpu_seconds() - process_cpu0;
+    print_report(&ctx, elapsed, server_cpu, process_cpu);
+    fflush(stdout); // keep server log lines from landing inside the report
+
+    for (int i = 0; i < ctx.opts.connections; i++)
+    {
+        client_close(&ctx, &ctx.clients[i]);
+        free(ctx.clients[i].rbuf);
+    }
+    close(ctx.epoll_fd);
+
+    httpserver_stop(server);
+    pthread_join(server_thread, NULL);
+    httpserver_destructor(server);
+    stub_backend_stop(&stub);
+    remove_docroot(docroot);
+
+    free(ctx.clients);
+    free(ctx.stats);
+    return EXIT_SUCCESS;
+}
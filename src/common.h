@@ -36,19 +36,33 @@
 
 #define INITIAL_BUFFER_SIZE 4096
 #define MAX_EPOLL_EVENTS 1024
-#define MAX_CONNECTIONS 1000
+#define DEFAULT_MAX_CONNECTIONS 1000
 #define MAX_HEADERS 50
 #define MAX_BACKENDS 16
 #define INITIAL_RESPONSE_SIZE 4096
+#define MAX_REQUEST_SIZE (1 << 20)
+#define DEFAULT_LISTEN_BACKLOG SOMAXCONN
+#define DEFAULT_ACCEPT_BATCH 64
+#define DEFAULT_KEEPALIVE_REQUESTS 1000
+#define DEFAULT_KEEPALIVE_TIMEOUT 75
+#define DEFAULT_OVERLOAD_CONNECTIONS(max_connections) ((max_connections) * 9 / 10)
+#define DEFAULT_OVERLOAD_LATENCY_MS 200
+#define DEFAULT_OVERLOAD_RETRY_AFTER 1
+#define FILE_READAHEAD (2 * 1024 * 1024) // bytes of a static body the I/O pool reads ahead
+#define DEFAULT_TUNNEL_TIMEOUT 600        // seconds a WebSocket or CONNECT tunnel may sit idle
 
 #define DEFAULT_CONFIG_PATH "/home/voidp/Projects/samandar/1lang1server/cserver"
 #define BASE_DIR "./"
 
 typedef enum
 {
+    CONN_HANDSHAKE,
     CONN_ESTABLISHED,
     CONN_PROCESSING,
     CONN_SENDING_RESPONSE,
+    CONN_WAITING_UPSTREAM,
+    CONN_WAITING_HANDLER,
+    CONN_TUNNEL, // relaying bytes both ways after an upgrade or CONNECT
     CONN_CLOSING,
     CONN_ERROR
 } ConnectionState;
@@ -0,0 +1,698 @@
+/**
+ * @file    hpack.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   HPACK header compression implementation.
+ *
+ */
+
+#include <pthread.h>
+
+#include "hpack.h"
+
+// ---------- TABLES ----------
+
+typedef struct StaticEntry
+{
+    const char *name;
+    const char *value;
+} StaticEntry;
+
+/* RFC 7541 Appendix A; index 1 is the first entry */
+static const StaticEntry static_table[HPACK_STATIC_COUNT] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/* RFC 7541 Appendix B: code (right-aligned) and bit length per symbol; 256 is EOS */
+static const uint32_t huffman_codes[257] = {
+    0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+    0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+    0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+    0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+    0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+    0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+    0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+    0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+    0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+    0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+    0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+    0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+    0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+    0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+    0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+    0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+    0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+    0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+    0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+    0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+    0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+    0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+    0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+    0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+    0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+    0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+    0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+    0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+    0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+    0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+    0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+    0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+    0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+    0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+    0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+    0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+    0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+    0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+    0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+    0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+    0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+    0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+    0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee, 0x3fffffff,
+};
+
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// ---------- HUFFMAN ----------
+
+/*
+ * Decoding tree: children of internal node n are huffman_tree[n][bit]; a
+ * positive entry is another internal node, a negative one is the leaf
+ * -(symbol + 1). The code is complete, so 256 internal nodes suffice.
+ */
+static int16_t huffman_tree[256][2];
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+static void build_huffman_tree(void)
+{
+    int nodes = 1;
+    for (int sym = 0; sym < 257; sym++)
+    {
+        int node = 0;
+        for (int i = huffman_lengths[sym] - 1; i >= 0; i--)
+        {
+            int bit = (huffman_codes[sym] >> i) & 1;
+            if (i == 0)
+            {
+                huffman_tree[node][bit] = -(sym + 1);
+            }
+            else
+            {
+                if (huffman_tree[node][bit] == 0) huffman_tree[node][bit] = nodes++;
+                node = huffman_tree[node][bit];
+            }
+        }
+    }
+}
+
+/**
+ * @brief   Decodes a Huffman-coded string literal.
+ *
+ * The padding after the last symbol must be fewer than 8 bits, all ones
+ * (a prefix of EOS); an encoded EOS is an error.
+ *
+ * @return  Decoded length, or -1 on a malformed string or if cap is too small.
+ */
+ssize_t hpack_huffman_decode(const uint8_t *src, size_t len, char *dst, size_t cap)
+{
+    pthread_once(&huffman_once, build_huffman_tree);
+
+    size_t n      = 0;
+    int node      = 0;
+    int depth     = 0; // bits read since the last symbol
+    bool all_ones = true;
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int shift = 7; shift >= 0; shift--)
+        {
+            int bit  = (src[i] >> shift) & 1;
+            int next = huffman_tree[node][bit];
+            depth++;
+            all_ones = all_ones && bit;
+            if (next > 0)
+            {
+                node = next;
+                continue;
+            }
+            int sym = -next - 1;
+            if (next == 0 || sym == 256 || n == cap) return -1;
+            dst[n++] = (char)sym;
+            node     = 0;
+            depth    = 0;
+            all_ones = true;
+        }
+    }
+    if (depth > 7 || !all_ones) return -1;
+    return n;
+}
+
+size_t hpack_huffman_encoded_len(const char *src, size_t len)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < len; i++)
+        bits += huffman_lengths[(uint8_t)src[i]];
+    return (bits + 7) / 8;
+}
+
+/**
+ * @brief   Huffman-codes src into dst, which holds hpack_huffman_encoded_len() bytes.
+ *
+ * @return  Bytes written.
+ */
+size_t hpack_huffman_encode(const char *src, size_t len, uint8_t *dst)
+{
+    uint64_t bits = 0; // only the low pending bits matter
+    int pending   = 0;
+    size_t n      = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t c = (uint8_t)src[i];
+        bits      = (bits << huffman_lengths[c]) | huffman_codes[c];
+        pending += huffman_lengths[c];
+        while (pending >= 8)
+        {
+            pending -= 8;
+            dst[n++] = (uint8_t)(bits >> pending);
+        }
+    }
+    if (pending > 0) dst[n++] = (uint8_t)((bits << (8 - pending)) | (0xff >> pending));
+    return n;
+}
+
+// ---------- PRIMITIVES ----------
+
+static size_t encode_int(uint8_t *out, uint8_t first, int prefix, uint64_t value)
+{
+    uint64_t max = (1u << prefix) - 1;
+    if (value < max)
+    {
+        out[0] = first | (uint8_t)value;
+        return 1;
+    }
+
+    out[0] = first | (uint8_t)max;
+    value -= max;
+    size_t n = 1;
+    while (value >= 128)
+    {
+        out[n++] = (uint8_t)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * @brief   Decodes a prefixed integer (RFC 7541 section 5.1), advancing *p.
+ *
+ * Values past 32 bits are rejected; nothing legitimate comes close.
+ */
+static int decode_int(const uint8_t **p, const uint8_t *end, int prefix, uint64_t *out)
+{
+    if (*p >= end) return -1;
+    uint64_t max   = (1u << prefix) - 1;
+    uint64_t value = *(*p)++ & max;
+    if (value < max)
+    {
+        *out = value;
+        return OK;
+    }
+
+    for (int shift = 0; *p < end && shift <= 28; shift += 7)
+    {
+        uint8_t b = *(*p)++;
+        value += (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *out = value;
+            return OK;
+        }
+    }
+    return -1;
+}
+
+static size_t encode_string(uint8_t *out, const char *str, size_t len)
+{
+    size_t huffman_len = hpack_huffman_encoded_len(str, len);
+    if (huffman_len < len)
+    {
+        size_t n = encode_int(out, 0x80, 7, huffman_len);
+        return n + hpack_huffman_encode(str, len, out + n);
+    }
+    size_t n = encode_int(out, 0x00, 7, len);
+    memcpy(out + n, str, len);
+    return n + len;
+}
+
+/* Copies of decoded strings go to the caller's scratch buffer */
+typedef struct Scratch
+{
+    char *buf;
+    size_t cap;
+    size_t used;
+} Scratch;
+
+static const char *scratch_copy(Scratch *s, const char *str, size_t len)
+{
+    if (len > s->cap - s->used) return NULL;
+    char *dst = s->buf + s->used;
+    memcpy(dst, str, len);
+    s->used += len;
+    return dst;
+}
+
+static int decode_string(const uint8_t **p, const uint8_t *end, Scratch *s, const char **out,
+                         size_t *out_len)
+{
+    if (*p >= end) return -1;
+    bool huffman = **p & 0x80;
+    uint64_t len;
+    if (decode_int(p, end, 7, &len) < 0 || len > (uint64_t)(end - *p)) return -1;
+
+    if (huffman)
+    {
+        ssize_t n = hpack_huffman_decode(*p, len, s->buf + s->used, s->cap - s->used);
+        if (n < 0) return -1;
+        *out     = s->buf + s->used;
+        *out_len = n;
+        s->used += n;
+    }
+    else
+    {
+        *out     = scratch_copy(s, (const char *)*p, len);
+        *out_len = len;
+        if (!*out) return -1;
+    }
+    *p += len;
+    return OK;
+}
+
+// ---------- DYNAMIC TABLE ----------
+
+static size_t entry_size(size_t name_len, size_t value_len)
+{
+    return name_len + value_len + 32;
+}
+
+/* i = 0 is the newest entry */
+static HPackEntry *table_get(const HPackTable *t, size_t i)
+{
+    return &t->entries[(t->head + t->cap - i) % t->cap];
+}
+
+static void table_evict_to(HPackTable *t, size_t limit)
+{
+    while (t->size > limit && t->count > 0)
+    {
+        HPackEntry *oldest = table_get(t, t->count - 1);
+        t->size -= entry_size(oldest->name_len, oldest->value_len);
+        free(oldest->name);
+        t->count--;
+    }
+}
+
+/**
+ * @brief   Inserts a field as the newest entry, evicting old ones to make room.
+ *
+ * A field larger than the whole table empties it and is not added.
+ */
+static void table_add(HPackTable *t, const char *name, size_t name_len, const char *value,
+                      size_t value_len)
+{
+    size_t size = entry_size(name_len, value_len);
+    if (size > t->max_size)
+    {
+        table_evict_to(t, 0);
+        return;
+    }
+    table_evict_to(t, t->max_size - size);
+
+    if (t->count == t->cap)
+    {
+        size_t cap          = t->cap ? t->cap * 2 : 16;
+        HPackEntry *entries = malloc(cap * sizeof(HPackEntry));
+        if (!entries) return;
+        for (size_t i = 0; i < t->count; i++)
+            entries[t->count - 1 - i] = *table_get(t, i);
+        free(t->entries);
+        t->entries = entries;
+        t->cap     = cap;
+        t->head    = t->count - 1;
+    }
+
+    char *copy = malloc(name_len + value_len + 1);
+    if (!copy) return;
+    memcpy(copy, name, name_len);
+    memcpy(copy + name_len, value, value_len);
+
+    t->head           = (t->head + 1) % t->cap;
+    HPackEntry *entry = &t->entries[t->head];
+    entry->name       = copy;
+    entry->name_len   = name_len;
+    entry->value_len  = value_len;
+    t->count++;
+    t->size += size;
+}
+
+static void table_init(HPackTable *t, size_t max_size)
+{
+    memset(t, 0, sizeof(*t));
+    t->max_size = max_size;
+}
+
+static void table_free(HPackTable *t)
+{
+    table_evict_to(t, 0);
+    free(t->entries);
+    t->entries = NULL;
+    t->cap     = 0;
+}
+
+/**
+ * @brief   Resolves a 1-based index into the static or dynamic table.
+ */
+static int table_lookup(const HPackTable *t, uint64_t index, HPackField *field)
+{
+    if (index == 0) return -1;
+    if (index <= HPACK_STATIC_COUNT)
+    {
+        const StaticEntry *e = &static_table[index - 1];
+        field->name          = e->name;
+        field->name_len      = strlen(e->name);
+        field->value         = e->value;
+        field->value_len     = strlen(e->value);
+        return OK;
+    }
+    if (index - HPACK_STATIC_COUNT > t->count) return -1;
+    const HPackEntry *e = table_get(t, index - HPACK_STATIC_COUNT - 1);
+    field->name         = e->name;
+    field->name_len     = e->name_len;
+    field->value        = e->name + e->name_len;
+    field->value_len    = e->value_len;
+    return OK;
+}
+
+// ---------- DECODER ----------
+
+void hpack_decoder_init(HPackDecoder *d, size_t max_size)
+{
+    table_init(&d->table, max_size);
+    d->settings_max = max_size;
+}
+
+void hpack_decoder_free(HPackDecoder *d)
+{
+    table_free(&d->table);
+}
+
+/**
+ * @brief   Decodes one complete header block.
+ *
+ * Names and values are copied into scratch, so the fields stay valid
+ * however the block changes the dynamic table. A table size update is only
+ * accepted before the first field.
+ *
+ * @return  Number of fields, or -1 on a decoding error (a connection error
+ *          in HTTP/2) or if fields or scratch run out.
+ */
+int hpack_decode(HPackDecoder *d, const uint8_t *block, size_t len, HPackField *fields,
+                 int max_fields, char *scratch, size_t scratch_cap)
+{
+    const uint8_t *p   = block;
+    const uint8_t *end = block + len;
+    Scratch s          = {scratch, scratch_cap, 0};
+    int count          = 0;
+
+    while (p < end)
+    {
+        uint8_t first = *p;
+        uint64_t index;
+
+        if ((first & 0xe0) == 0x20)
+        {
+            // Dynamic table size update
+            if (count > 0 || decode_int(&p, end, 5, &index) < 0 || index > d->settings_max)
+                return -1;
+            d->table.max_size = index;
+            table_evict_to(&d->table, index);
+            continue;
+        }
+        if (count == max_fields) return -1;
+        HPackField *field = &fields[count];
+
+        if (first & 0x80)
+        {
+            // Indexed field
+            HPackField found;
+            if (decode_int(&p, end, 7, &index) < 0 || table_lookup(&d->table, index, &found) < 0)
+                return -1;
+            field->name      = scratch_copy(&s, found.name, found.name_len);
+            field->name_len  = found.name_len;
+            field->value     = scratch_copy(&s, found.value, found.value_len);
+            field->value_len = found.value_len;
+            if (!field->name || !field->value) return -1;
+            count++;
+            continue;
+        }
+
+        // Literal, with incremental indexing (01), without (0000) or never indexed (0001)
+        bool indexing = first & 0x40;
+        if (decode_int(&p, end, indexing ? 6 : 4, &index) < 0) return -1;
+        if (index == 0)
+        {
+            if (decode_string(&p, end, &s, &field->name, &field->name_len) < 0) return -1;
+        }
+        else
+        {
+            HPackField found;
+            if (table_lookup(&d->table, index, &found) < 0) return -1;
+            field->name     = scratch_copy(&s, found.name, found.name_len);
+            field->name_len = found.name_len;
+            if (!field->name) return -1;
+        }
+        if (decode_string(&p, end, &s, &field->value, &field->value_len) < 0) return -1;
+
+        if (indexing)
+            table_add(&d->table, field->name, field->name_len, field->value, field->value_len);
+        count++;
+    }
+    return count;
+}
+
+// ---------- ENCODER ----------
+
+void hpack_encoder_init(HPackEncoder *e, size_t max_size)
+{
+    table_init(&e->table, max_size);
+    e->pending_min    = max_size;
+    e->resize_pending = false;
+}
+
+void hpack_encoder_free(HPackEncoder *e)
+{
+    table_free(&e->table);
+}
+
+/**
+ * @brief   Applies the peer's SETTINGS_HEADER_TABLE_SIZE.
+ *
+ * The encoder never uses more than HPACK_DEFAULT_TABLE_SIZE. The change is
+ * announced at the start of the next block; if the size went down and back
+ * up in between, both the low point and the final size are announced.
+ */
+void hpack_encoder_set_max_size(HPackEncoder *e, size_t max_size)
+{
+    if (max_size > HPACK_DEFAULT_TABLE_SIZE) max_size = HPACK_DEFAULT_TABLE_SIZE;
+    if (max_size == e->table.max_size) return;
+
+    if (!e->resize_pending || max_size < e->pending_min) e->pending_min = max_size;
+    e->resize_pending = true;
+    e->table.max_size = max_size;
+    table_evict_to(&e->table, max_size);
+}
+
+static bool name_is(const HPackField *f, const char *name)
+{
+    return f->name_len == strlen(name) && memcmp(f->name, name, f->name_len) == 0;
+}
+
+/* Values that change from response to response would only churn the table */
+static bool worth_indexing(const HPackField *f)
+{
+    static const char *volatile_names[] = {
+        "content-length", "date", "etag", "last-modified", "age", "expires", "content-range",
+        "set-cookie",
+    };
+    for (size_t i = 0; i < sizeof(volatile_names) / sizeof(volatile_names[0]); i++)
+    {
+        if (name_is(f, volatile_names[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief   Finds the best table match for a field.
+ *
+ * @return  1-based index of a full match (*full set) or else of a name
+ *          match, or 0 if the name is in neither table.
+ */
+static size_t find_field(const HPackEncoder *e, const HPackField *f, bool *full)
+{
+    size_t name_index = 0;
+    *full             = false;
+    for (size_t i = 0; i < HPACK_STATIC_COUNT; i++)
+    {
+        if (!name_is(f, static_table[i].name)) continue;
+        if (!name_index) name_index = i + 1;
+        if (f->value_len == strlen(static_table[i].value) &&
+            memcmp(f->value, static_table[i].value, f->value_len) == 0)
+        {
+            *full = true;
+            return i + 1;
+        }
+    }
+    for (size_t i = 0; i < e->table.count; i++)
+    {
+        const HPackEntry *entry = table_get(&e->table, i);
+        if (entry->name_len != f->name_len || memcmp(entry->name, f->name, f->name_len) != 0)
+            continue;
+        if (!name_index) name_index = HPACK_STATIC_COUNT + 1 + i;
+        if (entry->value_len == f->value_len &&
+            memcmp(entry->name + entry->name_len, f->value, f->value_len) == 0)
+        {
+            *full = true;
+            return HPACK_STATIC_COUNT + 1 + i;
+        }
+    }
+    return name_index;
+}
+
+/**
+ * @brief   Upper bound on the bytes hpack_encode() writes for these fields.
+ */
+size_t hpack_encode_bound(const HPackField *fields, int count)
+{
+    size_t bound = 12; // two table size updates
+    for (int i = 0; i < count; i++)
+        bound += fields[i].name_len + fields[i].value_len + 16;
+    return bound;
+}
+
+/**
+ * @brief   Encodes one header block; names must already be lowercase.
+ *
+ * @return  Bytes written, or -1 if cap is below hpack_encode_bound().
+ */
+ssize_t hpack_encode(HPackEncoder *e, const HPackField *fields, int count, uint8_t *out,
+                     size_t cap)
+{
+    if (cap < hpack_encode_bound(fields, count)) return -1;
+
+    size_t n = 0;
+    if (e->resize_pending)
+    {
+        if (e->pending_min < e->table.max_size) n += encode_int(out + n, 0x20, 5, e->pending_min);
+        n += encode_int(out + n, 0x20, 5, e->table.max_size);
+        e->resize_pending = false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const HPackField *f = &fields[i];
+        bool full;
+        size_t index = find_field(e, f, &full);
+        if (full)
+        {
+            n += encode_int(out + n, 0x80, 7, index);
+            continue;
+        }
+
+        bool indexing = worth_indexing(f);
+        if (indexing)
+            n += encode_int(out + n, 0x40, 6, index);
+        else
+            n += encode_int(out + n, name_is(f, "set-cookie") ? 0x10 : 0x00, 4, index);
+        if (index == 0) n += encode_string(out + n, f->name, f->name_len);
+        n += encode_string(out + n, f->value, f->value_len);
+
+        if (indexing) table_add(&e->table, f->name, f->name_len, f->value, f->value_len);
+    }
+    return n;
+}
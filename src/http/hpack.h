@@ -0,0 +1,80 @@
+/**
+ * @file    hpack.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   HPACK header compression for HTTP/2 (RFC 7541).
+ *
+ * @details A decoder and an encoder, each owning the dynamic table for one
+ *          direction of a connection. The decoder accepts every
+ *          representation, including Huffman-coded strings and table size
+ *          updates. The encoder uses the static and dynamic tables for
+ *          repeated fields, adds stable fields to the dynamic table, and
+ *          Huffman-codes strings whenever that is shorter.
+ */
+
+#ifndef HTTP_HPACK_H
+#define HTTP_HPACK_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_STATIC_COUNT 61
+
+/* A decoded or to-be-encoded header field; strings are not NUL-terminated */
+typedef struct HPackField
+{
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} HPackField;
+
+typedef struct HPackEntry
+{
+    char *name; // name followed by value, one allocation
+    size_t name_len;
+    size_t value_len;
+} HPackEntry;
+
+/* Dynamic table: a ring of entries, newest first */
+typedef struct HPackTable
+{
+    HPackEntry *entries;
+    size_t cap;
+    size_t count;
+    size_t head;     // slot of the newest entry
+    size_t size;     // sum of entry sizes as defined by RFC 7541 section 4.1
+    size_t max_size; // current limit
+} HPackTable;
+
+typedef struct HPackDecoder
+{
+    HPackTable table;
+    size_t settings_max; // the largest size the peer may pick (our SETTINGS value)
+} HPackDecoder;
+
+typedef struct HPackEncoder
+{
+    HPackTable table;
+    size_t pending_min; // lowest limit since the last block, announced first
+    bool resize_pending;
+} HPackEncoder;
+
+void hpack_decoder_init(HPackDecoder *d, size_t max_size);
+void hpack_decoder_free(HPackDecoder *d);
+int hpack_decode(HPackDecoder *d, const uint8_t *block, size_t len, HPackField *fields,
+                 int max_fields, char *scratch, size_t scratch_cap);
+
+void hpack_encoder_init(HPackEncoder *e, size_t max_size);
+void hpack_encoder_free(HPackEncoder *e);
+void hpack_encoder_set_max_size(HPackEncoder *e, size_t max_size);
+size_t hpack_encode_bound(const HPackField *fields, int count);
+ssize_t hpack_encode(HPackEncoder *e, const HPackField *fields, int count, uint8_t *out,
+                     size_t cap);
+
+ssize_t hpack_huffman_decode(const uint8_t *src, size_t len, char *dst, size_t cap);
+size_t hpack_huffman_encoded_len(const char *src, size_t len);
+size_t hpack_huffman_encode(const char *src, size_t len, uint8_t *dst);
+
+#endif /* HTTP_HPACK_H */
@@ -0,0 +1,1054 @@
+/**
+ * @file    http2.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   HTTP/2 session implementation (RFC 9113).
+ *
+ */
+
+#include "http2.h"
+#include "hpack.h"
+#include "parsers.h"
+
+enum
+{
+    FRAME_DATA          = 0x0,
+    FRAME_HEADERS       = 0x1,
+    FRAME_PRIORITY      = 0x2,
+    FRAME_RST_STREAM    = 0x3,
+    FRAME_SETTINGS      = 0x4,
+    FRAME_PUSH_PROMISE  = 0x5,
+    FRAME_PING          = 0x6,
+    FRAME_GOAWAY        = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION  = 0x9,
+};
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+enum
+{
+    H2_NO_ERROR           = 0x0,
+    H2_PROTOCOL_ERROR     = 0x1,
+    H2_INTERNAL_ERROR     = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED      = 0x5,
+    H2_FRAME_SIZE_ERROR   = 0x6,
+    H2_REFUSED_STREAM     = 0x7,
+    H2_CANCEL             = 0x8,
+    H2_COMPRESSION_ERROR  = 0x9,
+    H2_ENHANCE_YOUR_CALM  = 0xb,
+};
+
+enum
+{
+    SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+    SETTINGS_ENABLE_PUSH            = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+    SETTINGS_MAX_FRAME_SIZE         = 0x5,
+};
+
+#define MAX_WINDOW 0x7fffffff
+#define MAX_FRAME_SIZE_LIMIT 0xffffff
+#define MAX_HEADER_FIELDS 128
+#define MAX_HEADER_BLOCK (64 * 1024)
+
+typedef struct H2Buf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} H2Buf;
+
+/* A piece of a response body: bytes in the response, or a slice of its file */
+typedef struct H2Part
+{
+    const char *data; // NULL for a file slice
+    off_t offset;
+    size_t length;
+} H2Part;
+
+typedef enum
+{
+    STREAM_OPEN,        // the request is still arriving
+    STREAM_HALF_CLOSED, // request complete (half-closed remote); being answered
+} H2StreamState;
+
+typedef struct H2Stream
+{
+    uint32_t id;
+    H2StreamState state;
+    int64_t send_window;
+    bool is_head;
+    H2Buf head;             // the request rewritten as an HTTP/1.1 head, without the blank line
+    H2Buf body;             // request body from DATA frames
+    HTTPResponse *response; // being sent, or NULL until the handler answers
+    int fd;                 // the response's file, owned by the stream, or -1
+    H2Part *parts;
+    int part_count;
+    int part_index;   // first part not fully sent
+    size_t part_sent; // bytes of parts[part_index] already sent
+    struct H2Stream *next;
+} H2Stream;
+
+struct H2Session
+{
+    H2Callbacks cb;
+    HPackDecoder decoder;
+    HPackEncoder encoder;
+    H2Stream *streams; // in the order they were opened
+    int stream_count;
+    uint32_t last_stream_id;
+    int64_t send_window; // connection-level
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    bool preface_received;
+    bool settings_received;
+    uint32_t continuation_stream; // stream whose header block is unfinished, or 0
+    uint8_t continuation_flags;   // flags of the HEADERS frame that began it
+    H2Buf header_block;
+    bool goaway_received;
+    bool failed; // a connection error was sent in GOAWAY
+};
+
+// ---------- FRAMES ----------
+
+static int buf_append(H2Buf *b, const void *data, size_t len)
+{
+    if (b->len + len > b->cap)
+    {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + len)
+            cap *= 2;
+        char *grown = realloc(b->data, cap);
+        if (!grown) return -1;
+        b->data = grown;
+        b->cap  = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return OK;
+}
+
+static void buf_free(H2Buf *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->len  = 0;
+    b->cap  = 0;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int send_frame_header(H2Session *s, uint8_t type, uint8_t flags, uint32_t stream_id,
+                             size_t len)
+{
+    uint8_t header[H2_FRAME_HEADER_LEN];
+    header[0] = len >> 16;
+    header[1] = len >> 8;
+    header[2] = len;
+    header[3] = type;
+    header[4] = flags;
+    put_u32(header + 5, stream_id & MAX_WINDOW);
+    return s->cb.send(s->cb.ctx, (const char *)header, sizeof(header));
+}
+
+static int send_frame(H2Session *s, uint8_t type, uint8_t flags, uint32_t stream_id,
+                      const void *payload, size_t len)
+{
+    if (send_frame_header(s, type, flags, stream_id, len) < 0) return -1;
+    if (len > 0 && s->cb.send(s->cb.ctx, payload, len) < 0) return -1;
+    return OK;
+}
+
+static void send_rst_stream(H2Session *s, uint32_t stream_id, uint32_t code)
+{
+    uint8_t payload[4];
+    put_u32(payload, code);
+    send_frame(s, FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static void send_window_update(H2Session *s, uint32_t stream_id, uint32_t increment)
+{
+    uint8_t payload[4];
+    put_u32(payload, increment);
+    send_frame(s, FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+/**
+ * @brief   Ends the connection with GOAWAY after a connection error.
+ *
+ * @return  -1, for h2_session_recv() to pass on.
+ */
+static int fail(H2Session *s, uint32_t code)
+{
+    if (!s->failed)
+    {
+        LOG(LOG_DEBUG, "HTTP/2 connection error 0x%x after stream %u.", code, s->last_stream_id);
+        uint8_t payload[8];
+        put_u32(payload, s->last_stream_id);
+        put_u32(payload + 4, code);
+        send_frame(s, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+        s->failed = true;
+    }
+    return -1;
+}
+
+// ---------- STREAMS ----------
+
+static H2Stream *find_stream(const H2Session *s, uint32_t id)
+{
+    for (H2Stream *stream = s->streams; stream; stream = stream->next)
+    {
+        if (stream->id == id) return stream;
+    }
+    return NULL;
+}
+
+static H2Stream *open_stream(H2Session *s, uint32_t id)
+{
+    H2Stream *stream = calloc(1, sizeof(H2Stream));
+    if (!stream) return NULL;
+    stream->id          = id;
+    stream->state       = STREAM_OPEN;
+    stream->send_window = s->peer_initial_window;
+    stream->fd          = -1;
+
+    H2Stream **link = &s->streams;
+    while (*link)
+        link = &(*link)->next;
+    *link = stream;
+    s->stream_count++;
+    return stream;
+}
+
+/**
+ * @brief   Forgets a stream that finished or was reset, releasing its file.
+ */
+static void close_stream(H2Session *s, H2Stream *stream)
+{
+    H2Stream **link = &s->streams;
+    while (*link != stream)
+        link = &(*link)->next;
+    *link = stream->next;
+    s->stream_count--;
+
+    if (stream->fd >= 0) s->cb.release_file(s->cb.ctx, stream->fd);
+    httpresponse_free(stream->response);
+    buf_free(&stream->head);
+    buf_free(&stream->body);
+    free(stream->parts);
+    free(stream);
+}
+
+static void reset_stream(H2Session *s, H2Stream *stream, uint32_t code)
+{
+    send_rst_stream(s, stream->id, code);
+    close_stream(s, stream);
+}
+
+/**
+ * @brief   Sends one DATA frame of a stream's response, as large as the windows allow.
+ *
+ * Frames never span two parts, so a file slice always goes out as a frame
+ * header followed by the slice itself.
+ */
+static void send_data_frame(H2Session *s, H2Stream *stream)
+{
+    H2Part *part = &stream->parts[stream->part_index];
+    size_t n     = part->length - stream->part_sent;
+    if (n > s->peer_max_frame) n = s->peer_max_frame;
+    if ((int64_t)n > s->send_window) n = s->send_window;
+    if ((int64_t)n > stream->send_window) n = stream->send_window;
+
+    bool last = stream->part_index == stream->part_count - 1 &&
+                stream->part_sent + n == part->length;
+    send_frame_header(s, FRAME_DATA, last ? FLAG_END_STREAM : 0, stream->id, n);
+    if (part->data)
+        s->cb.send(s->cb.ctx, part->data + stream->part_sent, n);
+    else
+        s->cb.send_file(s->cb.ctx, stream->fd, part->offset + stream->part_sent, n);
+
+    s->send_window -= n;
+    stream->send_window -= n;
+    stream->part_sent += n;
+    if (stream->part_sent == part->length)
+    {
+        stream->part_index++;
+        stream->part_sent = 0;
+    }
+}
+
+/**
+ * @brief   Queues DATA for every answered stream while flow control allows.
+ *
+ * Streams take turns one frame at a time, so a large response does not
+ * hold up the small ones behind it.
+ */
+static void flush_streams(H2Session *s)
+{
+    bool progress = true;
+    while (progress && s->send_window > 0)
+    {
+        progress         = false;
+        H2Stream *stream = s->streams;
+        while (stream && s->send_window > 0)
+        {
+            H2Stream *next = stream->next;
+            if (stream->response && stream->part_index < stream->part_count &&
+                stream->send_window > 0)
+            {
+                send_data_frame(s, stream);
+                if (stream->part_index == stream->part_count) close_stream(s, stream);
+                progress = true;
+            }
+            stream = next;
+        }
+    }
+}
+
+// ---------- RESPONSES ----------
+
+static bool connection_specific(const char *name, size_t len)
+{
+    static const char *names[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (len == strlen(names[i]) && strncasecmp(name, names[i], len) == 0) return true;
+    }
+    return false;
+}
+
+static int send_headers(H2Session *s, uint32_t id, const uint8_t *block, size_t len,
+                        bool end_stream)
+{
+    size_t chunk  = len < s->peer_max_frame ? len : s->peer_max_frame;
+    uint8_t flags = (end_stream ? FLAG_END_STREAM : 0) | (chunk == len ? FLAG_END_HEADERS : 0);
+    if (send_frame(s, FRAME_HEADERS, flags, id, block, chunk) < 0) return -1;
+
+    for (size_t off = chunk; off < len; off += chunk)
+    {
+        chunk = len - off < s->peer_max_frame ? len - off : s->peer_max_frame;
+        flags = off + chunk == len ? FLAG_END_HEADERS : 0;
+        if (send_frame(s, FRAME_CONTINUATION, flags, id, block + off, chunk) < 0) return -1;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Lays out the body of a response as parts; HEAD and bodiless statuses get none.
+ *
+ * A file-backed body moves its descriptor to the stream, which hands it to
+ * release_file() once the last slice is queued or the stream is reset.
+ */
+static int build_parts(H2Stream *stream, HTTPResponse *res, bool bodiless)
+{
+    if (bodiless || stream->is_head) return OK;
+
+    int max       = res->file_fd >= 0 ? res->file_range_count * 2 + 1 : 1;
+    stream->parts = calloc(max, sizeof(H2Part));
+    if (!stream->parts) return -1;
+
+    int n = 0;
+    if (res->file_fd >= 0 && res->file_range_count > 0)
+    {
+        stream->fd   = res->file_fd;
+        res->file_fd = -1;
+        for (int i = 0; i < res->file_range_count; i++)
+        {
+            const ResponseFileRange *range = &res->file_ranges[i];
+            if (range->prefix && *range->prefix)
+                stream->parts[n++] = (H2Part){range->prefix, 0, strlen(range->prefix)};
+            if (range->length > 0)
+                stream->parts[n++] = (H2Part){NULL, range->offset, range->length};
+        }
+        if (res->file_trailer && *res->file_trailer)
+            stream->parts[n++] = (H2Part){res->file_trailer, 0, strlen(res->file_trailer)};
+    }
+    else if (res->body && res->body_length > 0)
+    {
+        stream->parts[n++] = (H2Part){res->body, 0, (size_t)res->body_length};
+    }
+    stream->part_count = n;
+    return OK;
+}
+
+/**
+ * @brief   Sends a response's HEADERS and queues its body on the stream.
+ *
+ * The header list mirrors httpresponse_serialize(): :status, Content-Type,
+ * Content-Length unless the status is bodiless, then the response's own
+ * headers with lowercase names, minus those HTTP/2 forbids.
+ */
+static void answer_stream(H2Session *s, H2Stream *stream, HTTPResponse *res)
+{
+    bool bodiless = res->status_code < 200 || res->status_code == 204 || res->status_code == 304;
+    size_t body_length = (res->body && res->body_length > 0) ? (size_t)res->body_length : 0;
+
+    char status[16], length[24];
+    snprintf(status, sizeof(status), "%03d", res->status_code % 1000);
+    snprintf(length, sizeof(length), "%zu",
+             res->content_length > 0 ? res->content_length : body_length);
+
+    HPackField *fields = calloc(res->header_count + 3, sizeof(HPackField));
+    size_t names_size  = 1;
+    for (int i = 0; i < res->header_count; i++)
+        names_size += strlen(res->headers[i]);
+    char *names = malloc(names_size);
+    if (!fields || !names)
+    {
+        free(fields);
+        free(names);
+        httpresponse_free(res);
+        reset_stream(s, stream, H2_INTERNAL_ERROR);
+        return;
+    }
+
+    int count       = 0;
+    fields[count++] = (HPackField){":status", 7, status, strlen(status)};
+    if (res->content_type)
+        fields[count++] = (HPackField){"content-type", 12, res->content_type,
+                                       strlen(res->content_type)};
+    if (!bodiless) fields[count++] = (HPackField){"content-length", 14, length, strlen(length)};
+
+    char *name = names;
+    for (int i = 0; i < res->header_count; i++)
+    {
+        const char *header = res->headers[i];
+        const char *colon  = strchr(header, ':');
+        if (!colon || colon == header || connection_specific(header, colon - header)) continue;
+
+        size_t name_len = colon - header;
+        for (size_t j = 0; j < name_len; j++)
+            name[j] = tolower((unsigned char)header[j]);
+        const char *value = colon + 1;
+        while (*value == ' ' || *value == '\t')
+            value++;
+        fields[count++] = (HPackField){name, name_len, value, strlen(value)};
+        name += name_len;
+    }
+
+    size_t cap     = hpack_encode_bound(fields, count);
+    uint8_t *block = malloc(cap);
+    ssize_t len    = block ? hpack_encode(&s->encoder, fields, count, block, cap) : -1;
+    free(fields);
+    free(names);
+
+    stream->response = res;
+    if (len < 0 || build_parts(stream, res, bodiless) < 0)
+    {
+        // The encoder state is untouched when hpack_encode() fails
+        free(block);
+        reset_stream(s, stream, H2_INTERNAL_ERROR);
+        return;
+    }
+    send_headers(s, stream->id, block, len, stream->part_count == 0);
+    free(block);
+    if (stream->part_count == 0) close_stream(s, stream);
+}
+
+// ---------- REQUESTS ----------
+
+static bool field_is(const HPackField *f, const char *name)
+{
+    return f->name_len == strlen(name) && memcmp(f->name, name, f->name_len) == 0;
+}
+
+static bool valid_field(const HPackField *f, bool pseudo)
+{
+    for (size_t i = 0; i < f->value_len; i++)
+    {
+        char c = f->value[i];
+        if (c == '\r' || c == '\n' || c == '\0') return false;
+    }
+    if (f->name_len == 0) return false;
+    for (size_t i = pseudo ? 1 : 0; i < f->name_len; i++)
+    {
+        unsigned char c = f->name[i];
+        if (c <= ' ' || c == ':' || c >= 0x7f || isupper(c)) return false;
+    }
+    return true;
+}
+
+static int append_line(H2Buf *b, const char *name, size_t name_len, const char *value,
+                       size_t value_len)
+{
+    if (buf_append(b, name, name_len) < 0 || buf_append(b, ": ", 2) < 0 ||
+        buf_append(b, value, value_len) < 0 || buf_append(b, "\r\n", 2) < 0)
+        return -1;
+    return OK;
+}
+
+/**
+ * @brief   Rewrites a request header list as an HTTP/1.1 request head.
+ *
+ * The pseudo-headers become the request line and a Host header, split
+ * Cookie fields are joined again, and Content-Length is left out: the one
+ * that counts is added from the DATA actually received.
+ *
+ * @return  OK, or -1 if the list is malformed (a stream error).
+ */
+static int compose_request_head(H2Stream *stream, const HPackField *fields, int count)
+{
+    const HPackField *method = NULL, *path = NULL, *scheme = NULL, *authority = NULL;
+    bool regular_seen = false;
+    int cookies       = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        const HPackField *f = &fields[i];
+        bool pseudo         = f->name_len > 0 && f->name[0] == ':';
+        if (!valid_field(f, pseudo)) return -1;
+        if (pseudo)
+        {
+            const HPackField **slot = field_is(f, ":method")      ? &method
+                                      : field_is(f, ":path")      ? &path
+                                      : field_is(f, ":scheme")    ? &scheme
+                                      : field_is(f, ":authority") ? &authority
+                                                                  : NULL;
+            if (regular_seen || !slot || *slot) return -1;
+            *slot = f;
+            continue;
+        }
+        regular_seen = true;
+        if (connection_specific(f->name, f->name_len)) return -1;
+        if (field_is(f, "te") && !(f->value_len == 8 && memcmp(f->value, "trailers", 8) == 0))
+            return -1;
+        if (field_is(f, "cookie")) cookies++;
+    }
+    if (!method || !scheme || !path || path->value_len == 0) return -1;
+    stream->is_head = method->value_len == 4 && memcmp(method->value, "HEAD", 4) == 0;
+
+    H2Buf *b = &stream->head;
+    if (buf_append(b, method->value, method->value_len) < 0 || buf_append(b, " ", 1) < 0 ||
+        buf_append(b, path->value, path->value_len) < 0 ||
+        buf_append(b, " HTTP/1.1\r\n", 11) < 0)
+        return -1;
+    if (authority && append_line(b, "host", 4, authority->value, authority->value_len) < 0)
+        return -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const HPackField *f = &fields[i];
+        if (f->name[0] == ':' || field_is(f, "content-length") || field_is(f, "cookie") ||
+            (authority && field_is(f, "host")))
+            continue;
+        if (append_line(b, f->name, f->name_len, f->value, f->value_len) < 0) return -1;
+    }
+
+    if (cookies > 0 && buf_append(b, "cookie: ", 8) < 0) return -1;
+    for (int i = 0, seen = 0; i < count; i++)
+    {
+        const HPackField *f = &fields[i];
+        if (!field_is(f, "cookie")) continue;
+        if ((seen++ > 0 && buf_append(b, "; ", 2) < 0) ||
+            buf_append(b, f->value, f->value_len) < 0)
+            return -1;
+    }
+    if (cookies > 0 && buf_append(b, "\r\n", 2) < 0) return -1;
+    return OK;
+}
+
+/**
+ * @brief   Hands a complete request to the application.
+ *
+ * The HTTP/1.1 form is run through parse_http_request(), so handlers see
+ * exactly what they would for an HTTP/1.1 client.
+ */
+static void dispatch_stream(H2Session *s, H2Stream *stream)
+{
+    stream->state = STREAM_HALF_CLOSED;
+
+    char length[48];
+    int length_len = stream->body.len > 0
+                         ? snprintf(length, sizeof(length), "content-length: %zu\r\n",
+                                    stream->body.len)
+                         : 0;
+    H2Buf *raw = &stream->head;
+    if (buf_append(raw, length, length_len) < 0 || buf_append(raw, "\r\n", 2) < 0 ||
+        buf_append(raw, stream->body.data ? stream->body.data : "", stream->body.len) < 0)
+    {
+        reset_stream(s, stream, H2_INTERNAL_ERROR);
+        return;
+    }
+    buf_free(&stream->body);
+
+    HTTPRequest *req = create_http_request();
+    HTTPResponse *response;
+    if (req && parse_http_request(raw->data, raw->len, req) == (int)raw->len)
+    {
+        response = s->cb.handle(s->cb.ctx, req, stream->id);
+    }
+    else
+    {
+        char response_buffer[] = "<h1>400 Bad Request</h1>";
+        response = response_builder(400, "Bad Request", response_buffer, sizeof(response_buffer),
+                                    "text/html");
+    }
+    if (req) free_http_request(req);
+    buf_free(raw);
+
+    if (response) answer_stream(s, stream, response);
+}
+
+/**
+ * @brief   Acts on a complete header block: a new request, or trailers.
+ *
+ * The block is decoded even when the stream is refused, since it still
+ * updates the HPACK table.
+ *
+ * @return  0, or the code of a connection error.
+ */
+static int on_header_block(H2Session *s, uint32_t id, uint8_t flags)
+{
+    HPackField fields[MAX_HEADER_FIELDS];
+    char *scratch = malloc(MAX_HEADER_BLOCK);
+    if (!scratch) return H2_INTERNAL_ERROR;
+    int count = hpack_decode(&s->decoder, (const uint8_t *)s->header_block.data,
+                             s->header_block.len, fields, MAX_HEADER_FIELDS, scratch,
+                             MAX_HEADER_BLOCK);
+    if (count < 0)
+    {
+        free(scratch);
+        return H2_COMPRESSION_ERROR;
+    }
+
+    int err          = H2_NO_ERROR;
+    H2Stream *stream = find_stream(s, id);
+    if (stream)
+    {
+        // Trailers: they end the request and are not passed on
+        if (stream->state != STREAM_OPEN)
+            reset_stream(s, stream, H2_STREAM_CLOSED);
+        else if (!(flags & FLAG_END_STREAM))
+            reset_stream(s, stream, H2_PROTOCOL_ERROR);
+        else
+            dispatch_stream(s, stream);
+    }
+    else if (id <= s->last_stream_id)
+    {
+        err = H2_STREAM_CLOSED;
+    }
+    else
+    {
+        s->last_stream_id = id;
+        if (s->stream_count >= H2_MAX_CONCURRENT_STREAMS)
+        {
+            send_rst_stream(s, id, H2_REFUSED_STREAM);
+        }
+        else if (!(stream = open_stream(s, id)))
+        {
+            err = H2_INTERNAL_ERROR;
+        }
+        else if (compose_request_head(stream, fields, count) < 0)
+        {
+            reset_stream(s, stream, H2_PROTOCOL_ERROR);
+        }
+        else if (flags & FLAG_END_STREAM)
+        {
+            dispatch_stream(s, stream);
+        }
+    }
+    free(scratch);
+    return err;
+}
+
+/**
+ * @brief   Drops the padding of a PADDED frame.
+ */
+static int strip_padding(uint8_t flags, const uint8_t **payload, size_t *len)
+{
+    if (!(flags & FLAG_PADDED)) return OK;
+    if (*len < 1 || (*payload)[0] >= *len) return -1;
+    *len -= 1 + (*payload)[0];
+    *payload += 1;
+    return OK;
+}
+
+static int on_headers(H2Session *s, uint8_t flags, uint32_t id, const uint8_t *payload,
+                      size_t len)
+{
+    if (id == 0 || !(id & 1)) return H2_PROTOCOL_ERROR;
+    if (strip_padding(flags, &payload, &len) < 0) return H2_PROTOCOL_ERROR;
+    if (flags & FLAG_PRIORITY)
+    {
+        if (len < 5) return H2_FRAME_SIZE_ERROR;
+        payload += 5;
+        len -= 5;
+    }
+
+    s->header_block.len = 0;
+    if (buf_append(&s->header_block, payload, len) < 0) return H2_INTERNAL_ERROR;
+    if (!(flags & FLAG_END_HEADERS))
+    {
+        s->continuation_stream = id;
+        s->continuation_flags  = flags;
+        return H2_NO_ERROR;
+    }
+    return on_header_block(s, id, flags);
+}
+
+static int on_continuation(H2Session *s, uint8_t flags, uint32_t id, const uint8_t *payload,
+                           size_t len)
+{
+    if (s->continuation_stream == 0 || id != s->continuation_stream) return H2_PROTOCOL_ERROR;
+    if (s->header_block.len + len > MAX_HEADER_BLOCK) return H2_ENHANCE_YOUR_CALM;
+    if (buf_append(&s->header_block, payload, len) < 0) return H2_INTERNAL_ERROR;
+    if (!(flags & FLAG_END_HEADERS)) return H2_NO_ERROR;
+
+    s->continuation_stream = 0;
+    return on_header_block(s, id, s->continuation_flags);
+}
+
+/**
+ * @brief   Collects request body bytes.
+ *
+ * The receive windows are replenished as soon as DATA arrives; the request
+ * size cap, not flow control, bounds what a stream may buffer.
+ */
+static int on_data(H2Session *s, uint8_t flags, uint32_t id, const uint8_t *payload, size_t len)
+{
+    if (id == 0) return H2_PROTOCOL_ERROR;
+    size_t frame_len = len;
+    if (strip_padding(flags, &payload, &len) < 0) return H2_PROTOCOL_ERROR;
+    if (frame_len > 0) send_window_update(s, 0, frame_len);
+
+    H2Stream *stream = find_stream(s, id);
+    if (!stream || stream->state != STREAM_OPEN)
+    {
+        if (id > s->last_stream_id) return H2_PROTOCOL_ERROR;
+        if (stream)
+            reset_stream(s, stream, H2_STREAM_CLOSED);
+        else
+            send_rst_stream(s, id, H2_STREAM_CLOSED);
+        return H2_NO_ERROR;
+    }
+
+    if (stream->head.len + stream->body.len + len > MAX_REQUEST_SIZE ||
+        buf_append(&stream->body, payload, len) < 0)
+    {
+        reset_stream(s, stream, H2_CANCEL);
+        return H2_NO_ERROR;
+    }
+    if (flags & FLAG_END_STREAM)
+        dispatch_stream(s, stream);
+    else if (frame_len > 0)
+        send_window_update(s, id, frame_len);
+    return H2_NO_ERROR;
+}
+
+/**
+ * @brief   Applies the peer's settings (a SETTINGS payload).
+ *
+ * @return  0, or the code of a connection error.
+ */
+static int apply_settings(H2Session *s, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i + 6 <= len; i += 6)
+    {
+        uint16_t id    = (uint16_t)(p[i] << 8 | p[i + 1]);
+        uint32_t value = get_u32(p + i + 2);
+        switch (id)
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            hpack_encoder_set_max_size(&s->encoder, value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1) return H2_PROTOCOL_ERROR;
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+            int64_t delta = (int64_t)value - s->peer_initial_window;
+            for (H2Stream *stream = s->streams; stream; stream = stream->next)
+            {
+                stream->send_window += delta;
+                if (stream->send_window > MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+            }
+            s->peer_initial_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_MAX_FRAME_SIZE || value > MAX_FRAME_SIZE_LIMIT)
+                return H2_PROTOCOL_ERROR;
+            s->peer_max_frame = value;
+            break;
+        default:
+            // Push is never used, and header list limits are advisory
+            break;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+static int on_settings(H2Session *s, uint8_t flags, uint32_t id, const uint8_t *payload,
+                       size_t len)
+{
+    if (id != 0) return H2_PROTOCOL_ERROR;
+    if (flags & FLAG_ACK) return len == 0 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR;
+    if (len % 6 != 0) return H2_FRAME_SIZE_ERROR;
+
+    int err = apply_settings(s, payload, len);
+    if (err) return err;
+    s->settings_received = true;
+    send_frame(s, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return H2_NO_ERROR;
+}
+
+static int on_window_update(H2Session *s, uint32_t id, const uint8_t *payload, size_t len)
+{
+    if (len != 4) return H2_FRAME_SIZE_ERROR;
+    uint32_t increment = get_u32(payload) & MAX_WINDOW;
+
+    if (id == 0)
+    {
+        if (increment == 0) return H2_PROTOCOL_ERROR;
+        s->send_window += increment;
+        return s->send_window > MAX_WINDOW ? H2_FLOW_CONTROL_ERROR : H2_NO_ERROR;
+    }
+
+    H2Stream *stream = find_stream(s, id);
+    if (!stream) return id > s->last_stream_id ? H2_PROTOCOL_ERROR : H2_NO_ERROR;
+    if (increment == 0)
+    {
+        reset_stream(s, stream, H2_PROTOCOL_ERROR);
+        return H2_NO_ERROR;
+    }
+    stream->send_window += increment;
+    if (stream->send_window > MAX_WINDOW) reset_stream(s, stream, H2_FLOW_CONTROL_ERROR);
+    return H2_NO_ERROR;
+}
+
+static int handle_frame(H2Session *s, uint8_t type, uint8_t flags, uint32_t id,
+                        const uint8_t *payload, size_t len)
+{
+    H2Stream *stream;
+    switch (type)
+    {
+    case FRAME_DATA:
+        return on_data(s, flags, id, payload, len);
+    case FRAME_HEADERS:
+        return on_headers(s, flags, id, payload, len);
+    case FRAME_CONTINUATION:
+        return on_continuation(s, flags, id, payload, len);
+    case FRAME_PRIORITY:
+        // Accepted and ignored: streams are served round-robin
+        if (id == 0) return H2_PROTOCOL_ERROR;
+        if (len != 5) send_rst_stream(s, id, H2_FRAME_SIZE_ERROR);
+        return H2_NO_ERROR;
+    case FRAME_RST_STREAM:
+        if (id == 0) return H2_PROTOCOL_ERROR;
+        if (len != 4) return H2_FRAME_SIZE_ERROR;
+        if (id > s->last_stream_id) return H2_PROTOCOL_ERROR;
+        if ((stream = find_stream(s, id))) close_stream(s, stream);
+        return H2_NO_ERROR;
+    case FRAME_SETTINGS:
+        return on_settings(s, flags, id, payload, len);
+    case FRAME_PUSH_PROMISE:
+        return H2_PROTOCOL_ERROR;
+    case FRAME_PING:
+        if (id != 0) return H2_PROTOCOL_ERROR;
+        if (len != 8) return H2_FRAME_SIZE_ERROR;
+        if (!(flags & FLAG_ACK)) send_frame(s, FRAME_PING, FLAG_ACK, 0, payload, len);
+        return H2_NO_ERROR;
+    case FRAME_GOAWAY:
+        if (id != 0) return H2_PROTOCOL_ERROR;
+        if (len < 8) return H2_FRAME_SIZE_ERROR;
+        s->goaway_received = true;
+        return H2_NO_ERROR;
+    case FRAME_WINDOW_UPDATE:
+        return on_window_update(s, id, payload, len);
+    default:
+        // Unknown frame types are ignored
+        return H2_NO_ERROR;
+    }
+}
+
+// ---------- SESSION ----------
+
+/**
+ * @brief   Starts a session and queues the server's SETTINGS.
+ */
+H2Session *h2_session_new(const H2Callbacks *callbacks)
+{
+    H2Session *s = calloc(1, sizeof(H2Session));
+    if (!s) return NULL;
+    s->cb                  = *callbacks;
+    s->send_window         = H2_DEFAULT_WINDOW;
+    s->peer_initial_window = H2_DEFAULT_WINDOW;
+    s->peer_max_frame      = H2_MAX_FRAME_SIZE;
+    hpack_decoder_init(&s->decoder, HPACK_DEFAULT_TABLE_SIZE);
+    hpack_encoder_init(&s->encoder, HPACK_DEFAULT_TABLE_SIZE);
+
+    uint8_t settings[6] = {0, SETTINGS_MAX_CONCURRENT_STREAMS};
+    put_u32(settings + 2, H2_MAX_CONCURRENT_STREAMS);
+    if (send_frame(s, FRAME_SETTINGS, 0, 0, settings, sizeof(settings)) < 0)
+    {
+        h2_session_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static int base64url_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-' || c == '+') return 62;
+    if (c == '_' || c == '/') return 63;
+    return -1;
+}
+
+/**
+ * @brief   Takes over an HTTP/1.1 request that asked to upgrade to h2c.
+ *
+ * settings is the HTTP2-Settings header (base64url SETTINGS payload),
+ * applied as if a SETTINGS frame had arrived; the 101 response stands in
+ * for its acknowledgement. The request becomes stream 1, half-closed, to
+ * be answered with h2_submit_response(). The client preface still follows.
+ *
+ * @return  OK, or -1 if the settings are malformed.
+ */
+int h2_session_upgrade(H2Session *s, const char *settings, size_t settings_len,
+                       const HTTPRequest *req)
+{
+    uint8_t payload[512];
+    size_t len    = 0;
+    uint32_t bits = 0;
+    int pending   = 0;
+    for (size_t i = 0; i < settings_len && settings[i] != '='; i++)
+    {
+        int v = base64url_value(settings[i]);
+        if (v < 0) return -1;
+        bits = bits << 6 | v;
+        pending += 6;
+        if (pending >= 8)
+        {
+            if (len == sizeof(payload)) return -1;
+            pending -= 8;
+            payload[len++] = (uint8_t)(bits >> pending);
+        }
+    }
+    if (len % 6 != 0 || apply_settings(s, payload, len) != H2_NO_ERROR) return -1;
+
+    H2Stream *stream = open_stream(s, 1);
+    if (!stream) return -1;
+    stream->state     = STREAM_HALF_CLOSED;
+    stream->is_head   = req->request_line.method_len == 4 &&
+                      memcmp(req->request_line.method, "HEAD", 4) == 0;
+    s->last_stream_id = 1;
+    return OK;
+}
+
+/**
+ * @brief   Processes the frames in data and queues whatever they call for.
+ *
+ * Only whole frames are consumed; the caller keeps the rest and passes it
+ * again with more bytes. Completed requests go to the handle callback
+ * along the way, and DATA for answered streams is queued at the end.
+ *
+ * @return  Bytes consumed, or -1 after a connection error (GOAWAY is
+ *          queued; the connection should close once it is sent).
+ */
+ssize_t h2_session_recv(H2Session *s, const char *data, size_t len)
+{
+    if (s->failed) return -1;
+
+    const uint8_t *p = (const uint8_t *)data;
+    size_t pos       = 0;
+    if (!s->preface_received)
+    {
+        if (memcmp(data, H2_PREFACE, len < H2_PREFACE_LEN ? len : H2_PREFACE_LEN) != 0)
+            return fail(s, H2_PROTOCOL_ERROR);
+        if (len < H2_PREFACE_LEN) return 0;
+        pos                 = H2_PREFACE_LEN;
+        s->preface_received = true;
+    }
+
+    while (len - pos >= H2_FRAME_HEADER_LEN)
+    {
+        size_t frame_len = (size_t)p[pos] << 16 | (size_t)p[pos + 1] << 8 | p[pos + 2];
+        uint8_t type     = p[pos + 3];
+        uint8_t flags    = p[pos + 4];
+        uint32_t id      = get_u32(p + pos + 5) & MAX_WINDOW;
+        if (frame_len > H2_MAX_FRAME_SIZE) return fail(s, H2_FRAME_SIZE_ERROR);
+        if (len - pos - H2_FRAME_HEADER_LEN < frame_len) break;
+
+        int err;
+        if (!s->settings_received && type != FRAME_SETTINGS)
+            err = H2_PROTOCOL_ERROR; // the client preface ends with SETTINGS
+        else if (s->continuation_stream && type != FRAME_CONTINUATION)
+            err = H2_PROTOCOL_ERROR;
+        else
+            err = handle_frame(s, type, flags, id, p + pos + H2_FRAME_HEADER_LEN, frame_len);
+        if (err) return fail(s, err);
+        pos += H2_FRAME_HEADER_LEN + frame_len;
+    }
+
+    flush_streams(s);
+    return pos;
+}
+
+/**
+ * @brief   Answers a stream whose handler returned NULL; takes ownership of response.
+ *
+ * The response is dropped if the stream was reset in the meantime.
+ */
+void h2_submit_response(H2Session *s, uint32_t stream_id, HTTPResponse *response)
+{
+    H2Stream *stream = s->failed ? NULL : find_stream(s, stream_id);
+    if (!stream || stream->state != STREAM_HALF_CLOSED || stream->response || !response)
+    {
+        httpresponse_free(response);
+        return;
+    }
+    answer_stream(s, stream, response);
+    flush_streams(s);
+}
+
+/**
+ * @brief   True once the connection should close: after a connection error,
+ *          or after the client's GOAWAY once every stream is answered.
+ */
+bool h2_session_finished(const H2Session *s)
+{
+    return s->failed || (s->goaway_received && s->stream_count == 0);
+}
+
+/**
+ * @brief   True while no stream is open, so closing the connection loses nothing.
+ */
+bool h2_session_idle(const H2Session *s)
+{
+    return s->stream_count == 0;
+}
+
+void h2_session_free(H2Session *s)
+{
+    if (!s) return;
+    while (s->streams)
+        close_stream(s, s->streams);
+    hpack_decoder_free(&s->decoder);
+    hpack_encoder_free(&s->encoder);
+    buf_free(&s->header_block);
+    free(s);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file    http2.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   HTTP/2 over cleartext (h2c) connection sessions.
+ *
+ * @details An H2Session is the protocol state of one HTTP/2 connection: it
+ *          parses frames from the bytes the connection read, keeps the HPACK
+ *          contexts and the per-stream state, and writes frames back through
+ *          callbacks, so it knows nothing about sockets or epoll.
+ *
+ *          Each stream's request is handed to the application as an ordinary
+ *          HTTPRequest once its END_STREAM arrives, and its HTTPResponse is
+ *          sent as HEADERS plus DATA frames within the peer's flow-control
+ *          windows. File-backed bodies stay zero-copy: frame headers go out
+ *          as bytes and the payload as file slices. Many streams share the
+ *          connection and their DATA frames are interleaved round-robin.
+ */
+
+#ifndef HTTP_HTTP2_H
+#define HTTP_HTTP2_H
+
+#include <stdint.h>
+#include "common.h"
+#include "request.h"
+#include "response.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_LEN 9
+#define H2_MAX_FRAME_SIZE 16384 // largest frame we accept (the protocol default)
+#define H2_MAX_CONCURRENT_STREAMS 100
+#define H2_DEFAULT_WINDOW 65535
+
+typedef struct H2Callbacks
+{
+    void *ctx;
+    // Queue bytes for the peer
+    int (*send)(void *ctx, const char *data, size_t len);
+    // Queue a slice of fd, sent after everything queued before it
+    int (*send_file)(void *ctx, int fd, off_t offset, size_t length);
+    // The session is done with fd; close it once its queued slices are out
+    void (*release_file)(void *ctx, int fd);
+    // Answer a request, or return NULL and call h2_submit_response() later
+    HTTPResponse *(*handle)(void *ctx, HTTPRequest *req, uint32_t stream_id);
+} H2Callbacks;
+
+typedef struct H2Session H2Session;
+
+H2Session *h2_session_new(const H2Callbacks *callbacks);
+int h2_session_upgrade(H2Session *s, const char *settings, size_t settings_len,
+                       const HTTPRequest *req);
+ssize_t h2_session_recv(H2Session *s, const char *data, size_t len);
+void h2_submit_response(H2Session *s, uint32_t stream_id, HTTPResponse *response);
+bool h2_session_finished(const H2Session *s);
+bool h2_session_idle(const H2Session *s);
+void h2_session_free(H2Session *s);
+
+#endif /* HTTP_HTTP2_H */
@@ -0,0 +1,174 @@
+/**
+ * @file    module.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Module table and per-phase hook dispatch.
+ *
+ */
+
+#include "module.h"
+
+extern const Module rewrite_module;
+extern const Module access_module;
+extern const Module echo_module;
+
+// Modules built in; within a phase their hooks run in this order
+static const Module *const modules[] = {
+    &rewrite_module,
+    &access_module,
+    &echo_module,
+};
+
+#define MODULE_COUNT (sizeof(modules) / sizeof(modules[0]))
+
+_Static_assert(MODULE_COUNT <= MAX_MODULES, "raise MAX_MODULES");
+
+// Hooks of each phase, gathered by modules_init()
+static HTTPResponse *(*rewrite_hooks[MAX_MODULES])(HTTPRequest *req);
+static HTTPResponse *(*access_hooks[MAX_MODULES])(const HTTPRequest *req,
+                                                  const struct sockaddr_storage *client);
+static void (*log_hooks[MAX_MODULES])(const AccessRecord *rec);
+static size_t rewrite_count;
+static size_t access_count;
+static size_t log_count;
+
+// ---------- CONFIGURATION ----------
+
+/**
+ * @brief   Offers a config key the core does not know to each module in turn.
+ *
+ * confs holds one settings pointer per module, in table order.
+ *
+ * @return  1 if a module took the key, 0 if none knows it, -1 if the module
+ *          it belongs to rejected the value.
+ */
+int modules_directive(void **confs, const char *key, const char *value)
+{
+    for (size_t i = 0; i < MODULE_COUNT; i++)
+    {
+        if (!modules[i]->directive) continue;
+        int taken = modules[i]->directive(&confs[i], key, value);
+        if (taken != 0) return taken;
+    }
+    return 0;
+}
+
+void modules_free_conf(void **confs)
+{
+    for (size_t i = 0; i < MODULE_COUNT; i++)
+    {
+        if (confs[i] && modules[i]->free_conf) modules[i]->free_conf(confs[i]);
+        confs[i] = NULL;
+    }
+}
+
+/**
+ * @brief   Finds the module a "content = <name>" location hands its requests to.
+ *
+ * @return  Its index in the module table, or -1 if no module of that name has
+ *          a content hook.
+ */
+int module_find_content(const char *name)
+{
+    for (size_t i = 0; i < MODULE_COUNT; i++)
+    {
+        if (modules[i]->content && strcmp(modules[i]->name, name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// ---------- STARTUP ----------
+
+/**
+ * @brief   Runs every module's init hook and gathers the phase hooks.
+ *
+ * @return  OK, or -1 if a module failed to initialize.
+ */
+int modules_init(void *const *confs)
+{
+    rewrite_count = 0;
+    access_count  = 0;
+    log_count     = 0;
+    for (size_t i = 0; i < MODULE_COUNT; i++)
+    {
+        const Module *m = modules[i];
+        if (m->init && m->init(confs[i]) < 0)
+        {
+            LOG(LOG_ERROR, "Module %s failed to initialize.", m->name);
+            return -1;
+        }
+        if (m->rewrite) rewrite_hooks[rewrite_count++] = m->rewrite;
+        if (m->access) access_hooks[access_count++] = m->access;
+        if (m->log) log_hooks[log_count++] = m->log;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Runs every module's init_worker hook on the calling event loop's thread.
+ *
+ * @return  OK, or -1 if a module failed.
+ */
+int modules_init_worker(int worker_id)
+{
+    for (size_t i = 0; i < MODULE_COUNT; i++)
+    {
+        if (modules[i]->init_worker && modules[i]->init_worker(worker_id) < 0)
+        {
+            LOG(LOG_ERROR, "Module %s failed to start on worker %d.", modules[i]->name,
+                worker_id);
+            return -1;
+        }
+    }
+    return OK;
+}
+
+// ---------- PHASES ----------
+
+/**
+ * @return  The response of the first rewrite hook that answers the request
+ *          itself (a redirect, say), or NULL to go on.
+ */
+HTTPResponse *modules_rewrite(HTTPRequest *req)
+{
+    for (size_t i = 0; i < rewrite_count; i++)
+    {
+        HTTPResponse *response = rewrite_hooks[i](req);
+        if (response) return response;
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Lets every access hook vet a request; client is NULL when unknown.
+ *
+ * @return  The refusal of the first hook that turns the request away, or NULL.
+ */
+HTTPResponse *modules_access(const HTTPRequest *req, const struct sockaddr_storage *client)
+{
+    for (size_t i = 0; i < access_count; i++)
+    {
+        HTTPResponse *response = access_hooks[i](req, client);
+        if (response) return response;
+    }
+    return NULL;
+}
+
+HTTPResponse *module_content(int module, HTTPRequest *req, const Location *route)
+{
+    return modules[module]->content(req, route);
+}
+
+/**
+ * @brief   True if some module wants the records of answered requests.
+ */
+bool modules_logging(void)
+{
+    return log_count > 0;
+}
+
+void modules_log(const AccessRecord *rec)
+{
+    for (size_t i = 0; i < log_count; i++)
+        log_hooks[i](rec);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file    module.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Request processing modules, registered at compile time.
+ *
+ * @details A module bundles optional hooks:
+ *          - directive:   takes top-level config keys the core does not know,
+ *                         building the module's settings
+ *          - init:        once at startup, with those settings
+ *          - init_worker: on each event loop's thread before it serves
+ *          - rewrite:     may change the request URI before routing
+ *          - access:      may refuse a request before its handler runs
+ *          - content:     answers requests of a location with "content = <module>"
+ *          - log:         sees the record of every answered request
+ *
+ *          The modules are listed in a static table in module.c. At startup
+ *          the hooks of each phase are gathered into an array of function
+ *          pointers, so a phase costs one call per module implementing it
+ *          and nothing for the others. Within a phase, modules run in table
+ *          order; the first rewrite or access hook returning a response
+ *          answers the request.
+ */
+
+#ifndef HTTP_MODULE_H
+#define HTTP_MODULE_H
+
+#include "common.h"
+#include "request.h"
+#include "response.h"
+#include "router.h"
+#include "utils/access_log.h"
+
+#define MAX_MODULES 16
+
+typedef struct Module
+{
+    const char *name;
+    // 1 if key is the module's and applied, 0 if not its key, -1 if its key
+    // with an invalid value; *conf starts NULL and is the module's to allocate
+    int (*directive)(void **conf, const char *key, const char *value);
+    void (*free_conf)(void *conf);
+    int (*init)(void *conf); // conf is NULL if no directive of the module was given
+    int (*init_worker)(int worker_id);
+    HTTPResponse *(*rewrite)(HTTPRequest *req);
+    HTTPResponse *(*access)(const HTTPRequest *req, const struct sockaddr_storage *client);
+    HTTPResponse *(*content)(HTTPRequest *req, const Location *route);
+    void (*log)(const AccessRecord *rec);
+} Module;
+
+int modules_directive(void **confs, const char *key, const char *value);
+void modules_free_conf(void **confs);
+int module_find_content(const char *name);
+
+int modules_init(void *const *confs);
+int modules_init_worker(int worker_id);
+
+HTTPResponse *modules_rewrite(HTTPRequest *req);
+HTTPResponse *modules_access(const HTTPRequest *req, const struct sockaddr_storage *client);
+HTTPResponse *module_content(int module, HTTPRequest *req, const Location *route);
+bool modules_logging(void);
+void modules_log(const AccessRecord *rec);
+
+#endif /* HTTP_MODULE_H */
@@ -12,7 +12,7 @@ int parse_request_line(HTTPRequest *req_t, const char *reqstr, size_t len)
 {
     if (!req_t || !reqstr)
     {
-        printf("Req parser is not working. %p %p\n", req_t, reqstr);
+        LOG(LOG_ERROR, "Request line parser called with NULL argument.");
         return -1;
     }
 
@@ -41,7 +41,8 @@ int parse_request_line(HTTPRequest *req_t, const char *reqstr, size_t len)
     req_t->request_line.protocol_len = crlf - ptr;
     ptr                              = crlf + 2;
 
-    LOG("DEBUG", "Request line parsed: %.*s", req_t->request_line.uri_len, req_t->request_line.uri);
+    LOG(LOG_DEBUG, "Request line parsed: %.*s", (int)req_t->request_line.uri_len,
+        req_t->request_line.uri);
 
     return ptr - reqstr;
 }
@@ -50,15 +51,19 @@ int parse_header(HTTPHeader *header, const char *line, size_t len)
 {
     if (!header || !line)
     {
-        printf("Header parser is not working. %p %p\n", header, line);
+        LOG(LOG_ERROR, "Header parser called with NULL argument.");
         return -1;
     }
     const char *ptr = line;
     const char *end = line + len;
 
-    // Find colon
+    // Find colon; a name with blanks could hide a framing header from us
     const char *colon = memchr(ptr, ':', end - ptr);
-    if (!colon) return -1;
+    if (!colon || colon == ptr) return -1;
+    for (const char *c = ptr; c < colon; c++)
+    {
+        if ((unsigned char)*c <= ' ' || *c == 0x7f) return -1;
+    }
     header->name     = (char *)ptr;
     header->name_len = colon - ptr;
     ptr              = colon + 1;
@@ -74,24 +79,60 @@ int parse_header(HTTPHeader *header, const char *line, size_t len)
     header->value_len = crlf - ptr;
     ptr               = crlf + 2;
 
-    LOG("DEBUG", "Header parsed: %.*s", header->name_len, header->name);
+    LOG(LOG_DEBUG, "Header parsed: %.*s", (int)header->name_len, header->name);
 
     return ptr - line;
 }
 
+/**
+ * @brief   Returns the value of the first header named name (case-insensitive).
+ *
+ * @return  Pointer into the request buffer (not NUL-terminated), or NULL.
+ */
+const HTTPHeader *find_header(const HTTPRequest *req, const char *name)
+{
+    size_t name_len = strlen(name);
+    for (int i = 0; i < req->header_count; i++)
+    {
+        if (req->headers[i].name_len == name_len &&
+            strncasecmp(req->headers[i].name, name, name_len) == 0)
+            return &req->headers[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Parses one complete HTTP request (line, headers and body) from data.
+ *
+ * Fields point into data, so the buffer must outlive the request. Only the
+ * first request is parsed; any pipelined bytes after it are left alone.
+ *
+ * The body is framed by Content-Length only. A request that also carries
+ * Transfer-Encoding, or more than one Content-Length, is malformed: a
+ * proxy in front could frame it differently and smuggle a request past
+ * us. Transfer-Encoding alone is not supported.
+ *
+ * @return  Bytes consumed by the request, 0 if data does not yet hold a
+ *          complete request, -1 if it is malformed, or PARSE_UNSUPPORTED
+ *          for a Transfer-Encoding body.
+ */
 int parse_http_request(const char *data, size_t len, HTTPRequest *req)
 {
     if (!req || !data)
     {
-        printf("Req parser is not working. %p %p\n", req, data);
+        LOG(LOG_ERROR, "Request parser called with NULL argument.");
         return -1;
     }
+
+    // Wait until the whole header block is buffered
+    const char *headers_end = memmem(data, len, "\r\n\r\n", 4);
+    if (!headers_end) return 0;
+
     const char *ptr = data;
-    const char *end = data + len;
+    const char *end = headers_end + 4;
     int consumed    = 0;
 
     consumed = parse_request_line(req, ptr, end - ptr);
-    printf("Consumed request_line: %d\n", consumed);
     if (consumed < 0) return -1;
     ptr += consumed;
 
@@ -100,45 +141,258 @@ int parse_http_request(const char *data, size_t len, HTTPRequest *req)
     {
         if (req->header_count >= MAX_HEADERS) return -1;
         consumed = parse_header(&req->headers[req->header_count], ptr, end - ptr);
-        if (consumed < 0) break;
+        if (consumed < 0) return -1;
         ptr += consumed;
         req->header_count++;
     }
+    ptr += 2; // blank line
+
+    LOG(LOG_DEBUG, "Consumed headers count: %d", req->header_count);
+
+    // Body, framed by Content-Length
+    size_t body_len            = 0;
+    const HTTPHeader *clheader = NULL;
+    bool transfer_encoding     = false;
+    for (int i = 0; i < req->header_count; i++)
+    {
+        const HTTPHeader *h = &req->headers[i];
+        if (h->name_len == 14 && strncasecmp(h->name, "Content-Length", 14) == 0)
+        {
+            if (clheader) return -1;
+            clheader = h;
+        }
+        else if (h->name_len == 17 && strncasecmp(h->name, "Transfer-Encoding", 17) == 0)
+        {
+            transfer_encoding = true;
+        }
+    }
+    if (transfer_encoding) return clheader ? -1 : PARSE_UNSUPPORTED;
+    if (clheader)
+    {
+        char digits[21];
+        if (clheader->value_len == 0 || clheader->value_len >= sizeof(digits)) return -1;
+        memcpy(digits, clheader->value, clheader->value_len);
+        digits[clheader->value_len] = '\0';
+
+        char *digits_end;
+        unsigned long long n = strtoull(digits, &digits_end, 10);
+        if (*digits_end != '\0' || !isdigit((unsigned char)digits[0])) return -1;
+        body_len = n;
+    }
+    if ((size_t)(data + len - ptr) < body_len) return 0;
+
+    req->body     = body_len ? (char *)ptr : NULL;
+    req->body_len = body_len;
+    ptr += body_len;
+
+    LOG(LOG_DEBUG, "HTTP request parsed.");
+
+    return ptr - data;
+}
+
+/**
+ * @brief   Parses an HTTP response status line ("HTTP/1.1 200 OK\r\n").
+ *
+ * @return  Bytes consumed including the CRLF, or -1 if malformed/incomplete.
+ */
+int parse_response_line(const char *data, size_t len, int *status_code, const char **reason,
+                        size_t *reason_len)
+{
+    const char *crlf = memmem(data, len, "\r\n", 2);
+    if (!crlf || len < 12 || memcmp(data, "HTTP/", 5) != 0) return -1;
+
+    const char *space = memchr(data, ' ', crlf - data);
+    if (!space || crlf - space < 4) return -1;
+    if (!isdigit((unsigned char)space[1]) || !isdigit((unsigned char)space[2]) ||
+        !isdigit((unsigned char)space[3]))
+        return -1;
+
+    *status_code = (space[1] - '0') * 100 + (space[2] - '0') * 10 + (space[3] - '0');
+
+    const char *phrase = space + 4;
+    if (phrase < crlf && *phrase == ' ') phrase++;
+    *reason     = phrase;
+    *reason_len = crlf - phrase;
+
+    return crlf + 2 - data;
+}
+
+/**
+ * @brief   Finds a field in a raw "Name: value\r\n" header block.
+ *
+ * @return  The value with surrounding blanks trimmed, or NULL.
+ */
+const char *find_raw_header(const char *headers, size_t len, const char *name, size_t *value_len)
+{
+    size_t name_len = strlen(name);
+    const char *p   = headers;
+    const char *end = headers + len;
+    while (p < end)
+    {
+        const char *eol  = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        if (eol && eol > p && eol[-1] == '\r') eol--;
+        if (!eol) eol = end;
+
+        if ((size_t)(eol - p) > name_len && p[name_len] == ':' &&
+            strncasecmp(p, name, name_len) == 0)
+        {
+            const char *v = p + name_len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t'))
+                v++;
+            const char *v_end = eol;
+            while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+                v_end--;
+            *value_len = v_end - v;
+            return v;
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief   True if a comma-separated list has the token (case-insensitive).
+ *
+ * A token followed by "=value" also counts; its value goes to *arg.
+ */
+bool list_has_token(const char *list, size_t len, const char *token, const char **arg)
+{
+    size_t token_len = strlen(token);
+    const char *p    = list;
+    const char *end  = list + len;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *item = p;
+        while (p < end && *p != ',')
+            p++;
+        size_t item_len = p - item;
+        while (item_len > 0 && (item[item_len - 1] == ' ' || item[item_len - 1] == '\t'))
+            item_len--;
+
+        if (item_len >= token_len && strncasecmp(item, token, token_len) == 0 &&
+            (item_len == token_len || item[token_len] == '='))
+        {
+            if (arg) *arg = item_len > token_len ? item + token_len + 1 : NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief   True if a header only concerns one connection and a proxy must
+ *          not pass it on.
+ *
+ * That is the fixed hop-by-hop list plus any field the message's
+ * Connection header names; connection may be NULL.
+ */
+bool is_hop_by_hop(const char *name, size_t len, const char *connection, size_t connection_len)
+{
+    static const char *names[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+        "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (len == strlen(names[i]) && strncasecmp(name, names[i], len) == 0) return true;
+    }
+
+    char token[64];
+    if (!connection || len == 0 || len >= sizeof(token)) return false;
+    memcpy(token, name, len);
+    token[len] = '\0';
+    return list_has_token(connection, connection_len, token, NULL);
+}
+
+/**
+ * @brief   True if a proxy forwards a request header as the client sent it.
+ *
+ * Besides hop-by-hop headers, Host, Content-Length and Expect stay behind:
+ * the proxy states its own for the backend connection, and the body goes
+ * along already read.
+ */
+bool is_forwarded_request_header(const char *name, size_t len, const char *connection,
+                                 size_t connection_len)
+{
+    if ((len == 4 && strncasecmp(name, "Host", 4) == 0) ||
+        (len == 14 && strncasecmp(name, "Content-Length", 14) == 0) ||
+        (len == 6 && strncasecmp(name, "Expect", 6) == 0))
+        return false;
+    return !is_hop_by_hop(name, len, connection, connection_len);
+}
+
+/**
+ * @brief   Adds the end-to-end fields of a raw header block to a response.
+ *
+ * Hop-by-hop fields are skipped, and so are Content-Type and
+ * Content-Length, which httpresponse_serialize() states from the response
+ * itself.
+ *
+ * @return  OK, or -1 if out of memory.
+ */
+int add_end_to_end_headers(HTTPResponse *res, const char *headers, size_t len)
+{
+    size_t connection_len;
+    const char *connection = find_raw_header(headers, len, "Connection", &connection_len);
+
+    const char *p   = headers;
+    const char *end = headers + len;
+    while (p < end)
+    {
+        const char *eol  = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        if (eol && eol > p && eol[-1] == '\r') eol--;
+        if (!eol) eol = end;
+
+        const char *colon = memchr(p, ':', eol - p);
+        size_t name_len   = colon ? (size_t)(colon - p) : 0;
+        if (name_len == 0 || is_hop_by_hop(p, name_len, connection, connection_len) ||
+            (name_len == 12 && strncasecmp(p, "Content-Type", 12) == 0) ||
+            (name_len == 14 && strncasecmp(p, "Content-Length", 14) == 0))
+        {
+            p = next;
+            continue;
+        }
+
+        const char *v = colon + 1;
+        while (v < eol && (*v == ' ' || *v == '\t'))
+            v++;
+        const char *v_end = eol;
+        while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+            v_end--;
+
+        char *name  = strndup(p, name_len);
+        char *value = strndup(v, v_end - v);
+        int ret     = name && value ? httpresponse_add_header(res, name, value) : -1;
+        free(name);
+        free(value);
+        if (ret < 0) return -1;
+        p = next;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Parses an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT").
+ *
+ * The obsolete RFC 850 and asctime() forms are not accepted.
+ *
+ * @return  Seconds since the epoch, or -1 if value is not a valid date.
+ */
+time_t parse_http_date(const char *value, size_t len)
+{
+    char buf[64];
+    if (len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, value, len);
+    buf[len] = '\0';
 
-    printf("Consumed headers count: %d\n", req->header_count);
-
-    // printf("ptr: %s\n", ptr);
-
-    // if (memcmp(ptr, "\r\n\r\n", 4) == 0)
-    // {
-    //     printf("No body present.");
-    //     req->body     = NULL;
-    //     req->body_len = 0;
-    //     return 0;
-    // }
-    // else if (ptr + 2 > end || memcmp(ptr, "\r\n", 2) != 0)
-    // {
-    //     printf("Invalid HTTP request.");
-    //     return -1;
-    // }
-    // ptr += 2;
-
-    // // Body
-    // req->body = (char *)ptr;
-    // for (int j = 0; j < req->header_count; j++)
-    // {
-    //     if (strncmp(req->headers[j].name, "Content-Length", req->headers[j].name_len) == 0)
-    //     {
-    //         req->body_len = atoi(req->headers[j].value);
-    //         break;
-    //     }
-    // }
-
-    // printf("Consumed body_len: %ld\n", req->body_len);
-
-    LOG("DEBUG", "HTTP request parsed.");
-
-    return 0;
+    struct tm tm = {0};
+    const char *end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') return -1;
+    return timegm(&tm);
 }
 
 void print_request(const HTTPRequest *req)
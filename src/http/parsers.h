@@ -9,8 +9,21 @@
 #include "request.h"
 #include "response.h"
 
+#define PARSE_UNSUPPORTED -2 // parse_http_request(): a body framed by Transfer-Encoding
+
 int parse_request_line(HTTPRequest *req_t, const char *reqstr, size_t len);
 int parse_header(HTTPHeader *header, const char *line, size_t len);
 int parse_http_request(const char *data, size_t len, HTTPRequest *req);
+const HTTPHeader *find_header(const HTTPRequest *req, const char *name);
+int parse_response_line(const char *data, size_t len, int *status_code, const char **reason,
+                        size_t *reason_len);
+const char *find_raw_header(const char *headers, size_t len, const char *name,
+                            size_t *value_len);
+bool list_has_token(const char *list, size_t len, const char *token, const char **arg);
+bool is_hop_by_hop(const char *name, size_t len, const char *connection, size_t connection_len);
+bool is_forwarded_request_header(const char *name, size_t len, const char *connection,
+                                 size_t connection_len);
+int add_end_to_end_headers(HTTPResponse *res, const char *headers, size_t len);
+time_t parse_http_date(const char *value, size_t len);
 void print_request(const HTTPRequest *req);
 const char *get_mime_type(const char *filepath);
\ No newline at end of file
@@ -0,0 +1,754 @@
+/**
+ * @file    proxy_cache.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Reverse-proxy response cache implementation.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "proxy_cache.h"
+#include "parsers.h"
+
+#define MEMORY_CACHE_BUCKETS 1024
+#define DISK_CACHE_MAGIC 0x32435043u // "CPC2"
+#define DISK_CACHE_WAYS 8            // slots per set; eviction is LRU within a set
+
+/* A response as stored in either tier; pointers refer to the tier's copy */
+typedef struct CachedRecord
+{
+    const char *key;
+    size_t key_len;
+    int status_code;
+    const char *reason_phrase;
+    size_t reason_len;
+    const char *content_type;
+    size_t content_type_len;
+    const char *headers; // end-to-end upstream headers, "Name: value\r\n" each
+    size_t headers_len;
+    const char *body;
+    size_t body_len;
+    time_t stored; // wall clock, for Age
+    time_t expires;
+} CachedRecord;
+
+/* Memory tier entry; key, phrase, type, headers and body follow the struct in one block */
+typedef struct MemoryEntry
+{
+    CachedRecord record;
+    uint64_t hash;
+    size_t cost; // bytes charged against memory_size
+    struct MemoryEntry *hash_next;
+    struct MemoryEntry *lru_prev; // towards most recently used
+    struct MemoryEntry *lru_next;
+} MemoryEntry;
+
+/* Disk tier layout: header, slot index, then one data cell per slot */
+typedef struct DiskHeader
+{
+    uint32_t magic;
+    uint32_t slot_size; // sizeof(DiskSlot), guards against layout changes
+    uint64_t slot_count;
+    uint64_t cell_size;
+    uint64_t clock; // LRU stamp source
+} DiskHeader;
+
+typedef struct DiskSlot
+{
+    uint64_t hash; // 0 for an empty slot
+    uint64_t last_used;
+    int64_t stored;
+    int64_t expires;
+    uint32_t key_len;
+    uint32_t body_len;
+    uint32_t headers_len;
+    uint16_t reason_len;
+    uint16_t content_type_len;
+    int32_t status_code;
+} DiskSlot;
+
+// One cache for the process, shared by every worker
+static struct
+{
+    pthread_mutex_t lock;
+    MemoryEntry *buckets[MEMORY_CACHE_BUCKETS];
+    MemoryEntry *lru_head; // most recently used
+    MemoryEntry *lru_tail;
+    size_t bytes;
+
+    int disk_fd;
+    char *disk_map;
+    size_t disk_map_size;
+    DiskHeader *disk_header;
+    DiskSlot *disk_slots;
+    char *disk_cells;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .disk_fd = -1};
+
+static const ProxyCacheOptions default_options = {
+    .enabled     = false,
+    .memory_size = DEFAULT_PROXY_CACHE_SIZE,
+    .disk_size   = DEFAULT_PROXY_CACHE_DISK_SIZE,
+    .disk_slots  = DEFAULT_PROXY_CACHE_DISK_SLOTS,
+};
+
+void proxy_cache_options_defaults(ProxyCacheOptions *opts)
+{
+    *opts = default_options;
+}
+
+/**
+ * @brief   Replaces the key headers with a comma-separated list of names.
+ *
+ * Only headers the proxy forwards can vary the response, so hop-by-hop
+ * ones, Host and the like are left out of the key.
+ *
+ * @return  OK, or -1 if the list names more than MAX_CACHE_KEY_HEADERS or
+ *          a header that is not forwarded (the others are kept).
+ */
+int proxy_cache_options_set_key_headers(ProxyCacheOptions *opts, const char *list)
+{
+    for (int i = 0; i < opts->key_header_count; i++)
+        free(opts->key_headers[i]);
+    opts->key_header_count = 0;
+
+    int ret       = OK;
+    const char *p = list;
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        size_t len = strcspn(p, " \t,");
+        if (len == 0) break;
+        if (!is_forwarded_request_header(p, len, NULL, 0))
+        {
+            ret = -1;
+            p += len;
+            continue;
+        }
+        if (opts->key_header_count == MAX_CACHE_KEY_HEADERS) return -1;
+        opts->key_headers[opts->key_header_count] = strndup(p, len);
+        if (!opts->key_headers[opts->key_header_count]) return -1;
+        opts->key_header_count++;
+        p += len;
+    }
+    return ret;
+}
+
+void proxy_cache_options_free(ProxyCacheOptions *opts)
+{
+    for (int i = 0; i < opts->key_header_count; i++)
+        free(opts->key_headers[i]);
+    opts->key_header_count = 0;
+    free(opts->disk_path);
+    opts->disk_path = NULL;
+}
+
+// ---------- CACHEABILITY ----------
+
+static bool is_cacheable_status(int status_code)
+{
+    switch (status_code)
+    {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief   Works out how long an upstream response may be served from the cache.
+ *
+ * s-maxage wins over max-age, which wins over Expires (relative to the
+ * upstream's Date when it sent one). There is no heuristic freshness: a
+ * response without an explicit lifetime is not stored.
+ *
+ * @return  The lifetime in seconds, or -1 if the response must not be stored.
+ */
+static long freshness_lifetime(const ProxyCacheOptions *opts, const char *headers, size_t len,
+                               time_t now)
+{
+    size_t value_len;
+    if (find_raw_header(headers, len, "Set-Cookie", &value_len)) return -1;
+
+    const char *vary = find_raw_header(headers, len, "Vary", &value_len);
+    if (vary)
+    {
+        // Every header the upstream varies on has to be part of the key
+        const char *p   = vary;
+        const char *end = vary + value_len;
+        while (p < end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+                p++;
+            const char *name = p;
+            while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+                p++;
+            if (p == name) break;
+
+            bool keyed = false;
+            for (int i = 0; !keyed && i < opts->key_header_count; i++)
+                keyed = strlen(opts->key_headers[i]) == (size_t)(p - name) &&
+                        strncasecmp(opts->key_headers[i], name, p - name) == 0;
+            if (!keyed) return -1; // includes "*"
+        }
+    }
+
+    const char *cc = find_raw_header(headers, len, "Cache-Control", &value_len);
+    if (cc)
+    {
+        if (list_has_token(cc, value_len, "no-store", NULL) ||
+            list_has_token(cc, value_len, "private", NULL) ||
+            list_has_token(cc, value_len, "no-cache", NULL))
+            return -1;
+
+        const char *arg;
+        if ((list_has_token(cc, value_len, "s-maxage", &arg) && arg) ||
+            (list_has_token(cc, value_len, "max-age", &arg) && arg))
+        {
+            long max_age = strtol(arg, NULL, 10);
+            return max_age > 0 ? max_age : -1;
+        }
+    }
+
+    const char *expires = find_raw_header(headers, len, "Expires", &value_len);
+    if (!expires) return -1;
+    time_t expires_at = parse_http_date(expires, value_len);
+    if (expires_at < 0) return -1; // invalid dates mean "already expired"
+
+    const char *date = find_raw_header(headers, len, "Date", &value_len);
+    time_t date_at   = date ? parse_http_date(date, value_len) : -1;
+    long lifetime    = (long)(expires_at - (date_at >= 0 ? date_at : now));
+    return lifetime > 0 ? lifetime : -1;
+}
+
+/**
+ * @brief   Decides whether a request may use the cache at all.
+ *
+ * Only GET and HEAD are cached. Requests carrying credentials, or asking
+ * to skip caches with no-cache/no-store, bypass it in both directions.
+ */
+static bool request_is_cacheable(const HTTPRequest *req)
+{
+    const char *method = req->request_line.method;
+    size_t method_len  = req->request_line.method_len;
+    if (!((method_len == 3 && memcmp(method, "GET", 3) == 0) ||
+          (method_len == 4 && memcmp(method, "HEAD", 4) == 0)))
+        return false;
+
+    if (find_header(req, "Authorization")) return false;
+    const HTTPHeader *cc = find_header(req, "Cache-Control");
+    if (cc && (list_has_token(cc->value, cc->value_len, "no-cache", NULL) ||
+               list_has_token(cc->value, cc->value_len, "no-store", NULL)))
+        return false;
+    const HTTPHeader *pragma = find_header(req, "Pragma");
+    if (pragma && list_has_token(pragma->value, pragma->value_len, "no-cache", NULL)) return false;
+    return true;
+}
+
+/**
+ * @brief   Builds the cache key: method, URI and each key header's value.
+ *
+ * Parts are separated by NUL bytes so no value can be confused with another.
+ * A key header the request's Connection names is not forwarded, so it
+ * counts as absent.
+ * The key is built whether or not the cache is enabled, since request
+ * coalescing uses it too.
+ *
+ * @return  Key length, or 0 if the request must bypass the cache or the key
+ *          does not fit in cap.
+ */
+size_t proxy_cache_key(const HTTPRequest *req, const ProxyCacheOptions *opts, char *key,
+                       size_t cap)
+{
+    if (!request_is_cacheable(req)) return 0;
+
+    size_t len = 0;
+#define APPEND(data, n)                                                                            \
+    do                                                                                             \
+    {                                                                                              \
+        if (len + (n) + 1 > cap) return 0;                                                         \
+        memcpy(key + len, (data), (n));                                                            \
+        len += (n);                                                                                \
+        key[len++] = '\0';                                                                         \
+    } while (0)
+
+    APPEND(req->request_line.method, req->request_line.method_len);
+    APPEND(req->request_line.uri, req->request_line.uri_len);
+    const HTTPHeader *connection = find_header(req, "Connection");
+    for (int i = 0; i < opts->key_header_count; i++)
+    {
+        const HTTPHeader *h = find_header(req, opts->key_headers[i]);
+        if (h && connection &&
+            list_has_token(connection->value, connection->value_len, opts->key_headers[i], NULL))
+            h = NULL;
+        if (h)
+            APPEND(h->value, h->value_len);
+        else
+            APPEND("", 0);
+    }
+#undef APPEND
+    return len;
+}
+
+static uint64_t key_hash(const char *key, size_t len)
+{
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ull;
+    return h | 1; // 0 marks an empty disk slot
+}
+
+static HTTPResponse *record_response(const CachedRecord *rec, time_t now)
+{
+    char phrase[64], content_type[128];
+    snprintf(phrase, sizeof(phrase), "%.*s", (int)rec->reason_len, rec->reason_phrase);
+    snprintf(content_type, sizeof(content_type), "%.*s", (int)rec->content_type_len,
+             rec->content_type);
+
+    HTTPResponse *response =
+        response_builder(rec->status_code, phrase, rec->body_len ? rec->body : "", rec->body_len,
+                         content_type);
+    if (response && add_end_to_end_headers(response, rec->headers, rec->headers_len) < 0)
+    {
+        httpresponse_free(response);
+        return NULL;
+    }
+    if (!response) return NULL;
+
+    char age[24];
+    snprintf(age, sizeof(age), "%ld", (long)(now > rec->stored ? now - rec->stored : 0));
+    httpresponse_add_header(response, "Age", age);
+    return response;
+}
+
+// ---------- MEMORY TIER ----------
+
+static void lru_unlink(MemoryEntry *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache.lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache.lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(MemoryEntry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head) cache.lru_head->lru_prev = e;
+    cache.lru_head = e;
+    if (!cache.lru_tail) cache.lru_tail = e;
+}
+
+static void memory_remove(MemoryEntry *e)
+{
+    MemoryEntry **slot = &cache.buckets[e->hash % MEMORY_CACHE_BUCKETS];
+    while (*slot != e)
+        slot = &(*slot)->hash_next;
+    *slot = e->hash_next;
+
+    lru_unlink(e);
+    cache.bytes -= e->cost;
+    free(e);
+}
+
+static MemoryEntry *memory_find(const char *key, size_t key_len, uint64_t hash)
+{
+    MemoryEntry *e = cache.buckets[hash % MEMORY_CACHE_BUCKETS];
+    for (; e; e = e->hash_next)
+    {
+        if (e->hash == hash && e->record.key_len == key_len &&
+            memcmp(e->record.key, key, key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Copies a record into the memory tier, evicting LRU entries to fit.
+ *
+ * Called with the lock held.
+ */
+static void memory_insert(const CachedRecord *rec, uint64_t hash, size_t limit)
+{
+    size_t cost = sizeof(MemoryEntry) + rec->key_len + rec->reason_len + rec->content_type_len +
+                  rec->headers_len + rec->body_len;
+    if (cost > limit) return;
+
+    MemoryEntry *old = memory_find(rec->key, rec->key_len, hash);
+    if (old) memory_remove(old);
+
+    MemoryEntry *e = malloc(cost);
+    if (!e) return;
+    char *p   = (char *)(e + 1);
+    e->record = *rec;
+
+    e->record.key = memcpy(p, rec->key, rec->key_len);
+    p += rec->key_len;
+    e->record.reason_phrase = memcpy(p, rec->reason_phrase, rec->reason_len);
+    p += rec->reason_len;
+    e->record.content_type = memcpy(p, rec->content_type, rec->content_type_len);
+    p += rec->content_type_len;
+    e->record.headers = memcpy(p, rec->headers, rec->headers_len);
+    p += rec->headers_len;
+    e->record.body = rec->body_len ? memcpy(p, rec->body, rec->body_len) : p;
+    e->hash        = hash;
+    e->cost        = cost;
+
+    while (cache.lru_tail && cache.bytes + cost > limit)
+        memory_remove(cache.lru_tail);
+
+    MemoryEntry **slot = &cache.buckets[hash % MEMORY_CACHE_BUCKETS];
+    e->hash_next       = *slot;
+    *slot              = e;
+    lru_push_front(e);
+    cache.bytes += cost;
+}
+
+// ---------- DISK TIER ----------
+
+static DiskSlot *disk_set(uint64_t hash)
+{
+    uint64_t sets = cache.disk_header->slot_count / DISK_CACHE_WAYS;
+    return &cache.disk_slots[(hash % sets) * DISK_CACHE_WAYS];
+}
+
+static char *disk_cell(const DiskSlot *slot)
+{
+    return cache.disk_cells + (size_t)(slot - cache.disk_slots) * cache.disk_header->cell_size;
+}
+
+static DiskSlot *disk_find(const char *key, size_t key_len, uint64_t hash)
+{
+    DiskSlot *set = disk_set(hash);
+    for (int i = 0; i < DISK_CACHE_WAYS; i++)
+    {
+        DiskSlot *slot = &set[i];
+        if (slot->hash == hash && slot->key_len == key_len &&
+            memcmp(disk_cell(slot), key, key_len) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static CachedRecord disk_record(const DiskSlot *slot)
+{
+    const char *cell    = disk_cell(slot);
+    const char *headers = cell + slot->key_len + slot->reason_len + slot->content_type_len;
+    CachedRecord rec    = {
+        .key              = cell,
+        .key_len          = slot->key_len,
+        .status_code      = slot->status_code,
+        .reason_phrase    = cell + slot->key_len,
+        .reason_len       = slot->reason_len,
+        .content_type     = cell + slot->key_len + slot->reason_len,
+        .content_type_len = slot->content_type_len,
+        .headers          = headers,
+        .headers_len      = slot->headers_len,
+        .body             = headers + slot->headers_len,
+        .body_len         = slot->body_len,
+        .stored           = slot->stored,
+        .expires          = slot->expires,
+    };
+    return rec;
+}
+
+/**
+ * @brief   Writes a record into its set, replacing the LRU (or an expired) slot.
+ *
+ * Records larger than one cell stay memory-only. Called with the lock held.
+ */
+static void disk_store(const CachedRecord *rec, uint64_t hash, time_t now)
+{
+    size_t size =
+        rec->key_len + rec->reason_len + rec->content_type_len + rec->headers_len + rec->body_len;
+    if (size > cache.disk_header->cell_size || rec->reason_len > UINT16_MAX ||
+        rec->content_type_len > UINT16_MAX)
+        return;
+
+    DiskSlot *victim = disk_find(rec->key, rec->key_len, hash);
+    DiskSlot *set    = disk_set(hash);
+    for (int i = 0; !victim && i < DISK_CACHE_WAYS; i++)
+    {
+        if (set[i].hash == 0 || set[i].expires <= now) victim = &set[i];
+    }
+    if (!victim)
+    {
+        victim = set;
+        for (int i = 1; i < DISK_CACHE_WAYS; i++)
+        {
+            if (set[i].last_used < victim->last_used) victim = &set[i];
+        }
+    }
+
+    // Invalidate first so a crash mid-copy leaves an empty slot, not a torn one
+    victim->hash = 0;
+    char *cell   = disk_cell(victim);
+    memcpy(cell, rec->key, rec->key_len);
+    cell += rec->key_len;
+    memcpy(cell, rec->reason_phrase, rec->reason_len);
+    cell += rec->reason_len;
+    memcpy(cell, rec->content_type, rec->content_type_len);
+    cell += rec->content_type_len;
+    memcpy(cell, rec->headers, rec->headers_len);
+    cell += rec->headers_len;
+    if (rec->body_len) memcpy(cell, rec->body, rec->body_len);
+
+    victim->last_used        = ++cache.disk_header->clock;
+    victim->stored           = rec->stored;
+    victim->expires          = rec->expires;
+    victim->key_len          = rec->key_len;
+    victim->body_len         = rec->body_len;
+    victim->headers_len      = rec->headers_len;
+    victim->reason_len       = rec->reason_len;
+    victim->content_type_len = rec->content_type_len;
+    victim->status_code      = rec->status_code;
+    victim->hash             = hash;
+}
+
+/**
+ * @brief   Maps the disk tier file, reusing its contents if the layout matches.
+ *
+ * @return  OK, or -1 if the file cannot be created or mapped.
+ */
+static int disk_open(const ProxyCacheOptions *opts)
+{
+    uint64_t slot_count = opts->disk_slots / DISK_CACHE_WAYS * DISK_CACHE_WAYS;
+    if (slot_count == 0) slot_count = DISK_CACHE_WAYS;
+    uint64_t cell_size = opts->disk_size / slot_count;
+    if (cell_size == 0) return -1;
+
+    long page          = sysconf(_SC_PAGESIZE);
+    size_t index_size  = sizeof(DiskHeader) + slot_count * sizeof(DiskSlot);
+    size_t cells_start = (index_size + page - 1) / page * page;
+    size_t map_size    = cells_start + slot_count * cell_size;
+
+    int fd = open(opts->disk_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+
+    DiskHeader existing = {0};
+    struct stat st;
+    bool reuse = fstat(fd, &st) == 0 && (size_t)st.st_size == map_size &&
+                 pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+                 existing.magic == DISK_CACHE_MAGIC && existing.slot_size == sizeof(DiskSlot) &&
+                 existing.slot_count == slot_count && existing.cell_size == cell_size;
+    if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, map_size) < 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    cache.disk_fd       = fd;
+    cache.disk_map      = map;
+    cache.disk_map_size = map_size;
+    cache.disk_header   = (DiskHeader *)map;
+    cache.disk_slots    = (DiskSlot *)(map + sizeof(DiskHeader));
+    cache.disk_cells    = map + cells_start;
+    if (!reuse)
+    {
+        cache.disk_header->slot_size  = sizeof(DiskSlot);
+        cache.disk_header->slot_count = slot_count;
+        cache.disk_header->cell_size  = cell_size;
+        cache.disk_header->magic      = DISK_CACHE_MAGIC;
+    }
+    LOG(LOG_INFO, "Proxy cache disk tier %s: %lu slots of %lu bytes%s.", opts->disk_path,
+        (unsigned long)slot_count, (unsigned long)cell_size, reuse ? ", reused" : "");
+    return OK;
+}
+
+// ---------- CACHE ----------
+
+/**
+ * @brief   Sets up the cache for a server; opens the disk tier if configured.
+ *
+ * A disk tier that cannot be opened is logged and skipped, leaving the
+ * memory tier in use.
+ */
+int proxy_cache_init(const ProxyCacheOptions *opts)
+{
+    if (!opts || !opts->enabled || !opts->disk_path) return OK;
+
+    pthread_mutex_lock(&cache.lock);
+    int ret = cache.disk_map ? OK : disk_open(opts);
+    pthread_mutex_unlock(&cache.lock);
+    if (ret < 0)
+        LOG(LOG_WARN, "Proxy cache disk tier %s unavailable: %s", opts->disk_path,
+            strerror(errno));
+    return ret;
+}
+
+/**
+ * @brief   Drops the memory tier and unmaps the disk tier (its file is kept).
+ */
+void proxy_cache_shutdown(void)
+{
+    pthread_mutex_lock(&cache.lock);
+    while (cache.lru_tail)
+        memory_remove(cache.lru_tail);
+    if (cache.disk_map)
+    {
+        munmap(cache.disk_map, cache.disk_map_size);
+        close(cache.disk_fd);
+        cache.disk_map    = NULL;
+        cache.disk_header = NULL;
+        cache.disk_fd     = -1;
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief   Answers a proxied request from the cache.
+ *
+ * Memory is checked first, then disk; a disk hit is copied into memory.
+ * Stale entries are dropped from both tiers.
+ *
+ * @return  A fresh response carrying Age and the HIT status, or NULL with
+ *          *status saying why the request has to go upstream.
+ */
+HTTPResponse *proxy_cache_lookup(const HTTPRequest *req, const ProxyCacheOptions *opts,
+                                 CacheStatus *status)
+{
+    *status = CACHE_OFF;
+    if (!opts || !opts->enabled) return NULL;
+
+    char key[INITIAL_BUFFER_SIZE];
+    size_t key_len = proxy_cache_key(req, opts, key, sizeof(key));
+    if (key_len == 0)
+    {
+        *status = CACHE_BYPASS;
+        return NULL;
+    }
+
+    uint64_t hash          = key_hash(key, key_len);
+    time_t now             = time(NULL);
+    HTTPResponse *response = NULL;
+    *status                = CACHE_MISS;
+
+    pthread_mutex_lock(&cache.lock);
+    MemoryEntry *e = memory_find(key, key_len, hash);
+    DiskSlot *slot = cache.disk_map ? disk_find(key, key_len, hash) : NULL;
+    if ((e && e->record.expires <= now) || (!e && slot && slot->expires <= now))
+    {
+        if (e) memory_remove(e);
+        if (slot) slot->hash = 0;
+        *status = CACHE_EXPIRED;
+    }
+    else if (e)
+    {
+        lru_unlink(e);
+        lru_push_front(e);
+        if (slot) slot->last_used = ++cache.disk_header->clock;
+        response = record_response(&e->record, now);
+    }
+    else if (slot)
+    {
+        slot->last_used  = ++cache.disk_header->clock;
+        CachedRecord rec = disk_record(slot);
+        memory_insert(&rec, hash, opts->memory_size);
+        response = record_response(&rec, now);
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    if (response)
+    {
+        *status = CACHE_HIT;
+        proxy_cache_set_status(response, CACHE_HIT);
+    }
+    return response;
+}
+
+/**
+ * @brief   Stores an upstream response under a key from proxy_cache_key().
+ *
+ * upstream_headers is the raw header block the backend sent; it decides
+ * the lifetime. Status, reason, Content-Type, headers and body are taken
+ * from the response relayed to the client, minus Age, which a hit
+ * restates. The key, not the request, is passed so a response can be
+ * stored after the client that asked for it is gone.
+ *
+ * @return  true if the response was cached.
+ */
+bool proxy_cache_store(const char *key, size_t key_len, const ProxyCacheOptions *opts,
+                       const char *upstream_headers, size_t headers_len,
+                       const HTTPResponse *response)
+{
+    // A HEAD response whose length describes a body it lacks cannot be replayed
+    if (!opts || !opts->enabled || !response || key_len == 0 ||
+        !is_cacheable_status(response->status_code) ||
+        response->content_length > (size_t)response->body_length)
+        return false;
+
+    time_t now    = time(NULL);
+    long lifetime = freshness_lifetime(opts, upstream_headers, headers_len, now);
+    if (lifetime < 0) return false;
+
+    size_t headers_size = 0;
+    for (int i = 0; i < response->header_count; i++)
+        headers_size += strlen(response->headers[i]) + 2;
+    char *headers = malloc(headers_size + 1);
+    if (!headers) return false;
+    size_t stored_len = 0;
+    for (int i = 0; i < response->header_count; i++)
+    {
+        const char *h = response->headers[i];
+        if (strncasecmp(h, "Age:", 4) == 0 ||
+            strncasecmp(h, CACHE_STATUS_HEADER ":", strlen(CACHE_STATUS_HEADER ":")) == 0)
+            continue;
+        stored_len += sprintf(headers + stored_len, "%s\r\n", h);
+    }
+
+    const char *content_type = response->content_type ? response->content_type : "";
+    CachedRecord rec = {
+        .key              = key,
+        .key_len          = key_len,
+        .status_code      = response->status_code,
+        .reason_phrase    = response->reason_phrase,
+        .reason_len       = strlen(response->reason_phrase),
+        .content_type     = content_type,
+        .content_type_len = strlen(content_type),
+        .headers          = headers,
+        .headers_len      = stored_len,
+        .body             = response->body,
+        .body_len         = response->body_length,
+        .stored           = now,
+        .expires          = now + lifetime,
+    };
+    uint64_t hash = key_hash(key, key_len);
+
+    pthread_mutex_lock(&cache.lock);
+    memory_insert(&rec, hash, opts->memory_size);
+    if (cache.disk_map) disk_store(&rec, hash, now);
+    pthread_mutex_unlock(&cache.lock);
+    free(headers);
+    return true;
+}
+
+/**
+ * @brief   Adds the X-Cache-Status header; nothing when the cache is off.
+ */
+void proxy_cache_set_status(HTTPResponse *response, CacheStatus status)
+{
+    static const char *const names[] = {
+        [CACHE_HIT] = "HIT", [CACHE_MISS] = "MISS", [CACHE_EXPIRED] = "EXPIRED",
+        [CACHE_BYPASS] = "BYPASS", [CACHE_COALESCED] = "COALESCED",
+    };
+    if (!response || status == CACHE_OFF) return;
+    httpresponse_add_header(response, CACHE_STATUS_HEADER, names[status]);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file    proxy_cache.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Reverse-proxy response cache with a memory tier and an mmap disk tier.
+ *
+ * @details Responses are keyed on method, URI and a configured set of request
+ *          headers, and are stored only when the upstream gives them an
+ *          explicit lifetime (s-maxage, max-age or Expires) and nothing in
+ *          Cache-Control, Vary or Set-Cookie forbids sharing them.
+ *
+ *          The memory tier is a byte-bounded LRU. The optional disk tier is a
+ *          file mapped with mmap(): a fixed-size index of set-associative
+ *          slots, each owning one fixed-size data cell, with LRU eviction
+ *          inside a set. Stores go to both tiers, disk hits are promoted to
+ *          memory, and the disk tier survives restarts.
+ */
+
+#ifndef HTTP_PROXY_CACHE_H
+#define HTTP_PROXY_CACHE_H
+
+#include "common.h"
+#include "request.h"
+#include "response.h"
+
+#define DEFAULT_PROXY_CACHE_SIZE (32 * 1024 * 1024)
+#define DEFAULT_PROXY_CACHE_DISK_SIZE (256 * 1024 * 1024)
+#define DEFAULT_PROXY_CACHE_DISK_SLOTS 16384
+#define MAX_CACHE_KEY_HEADERS 8
+
+#define CACHE_STATUS_HEADER "X-Cache-Status"
+
+typedef enum
+{
+    CACHE_OFF = 0,   // cache disabled, no status header
+    CACHE_HIT,
+    CACHE_MISS,
+    CACHE_EXPIRED,   // a stale entry was dropped; the response is fetched again
+    CACHE_BYPASS,    // the request may not be answered from or stored in the cache
+    CACHE_COALESCED, // answered with the response another request was already fetching
+} CacheStatus;
+
+typedef struct ProxyCacheOptions
+{
+    bool enabled;
+    size_t memory_size;                       // bytes kept in the memory tier
+    char *disk_path;                          // file backing the disk tier; NULL disables it
+    size_t disk_size;                         // bytes of data cells in the disk tier
+    size_t disk_slots;                        // index entries (and cells) in the disk tier
+    char *key_headers[MAX_CACHE_KEY_HEADERS]; // request headers that are part of the key
+    int key_header_count;
+    bool coalesce; // concurrent misses for one key share a single upstream request
+} ProxyCacheOptions;
+
+void proxy_cache_options_defaults(ProxyCacheOptions *opts);
+int proxy_cache_options_set_key_headers(ProxyCacheOptions *opts, const char *list);
+void proxy_cache_options_free(ProxyCacheOptions *opts);
+
+int proxy_cache_init(const ProxyCacheOptions *opts);
+void proxy_cache_shutdown(void);
+
+size_t proxy_cache_key(const HTTPRequest *req, const ProxyCacheOptions *opts, char *key,
+                       size_t cap);
+HTTPResponse *proxy_cache_lookup(const HTTPRequest *req, const ProxyCacheOptions *opts,
+                                 CacheStatus *status);
+bool proxy_cache_store(const char *key, size_t key_len, const ProxyCacheOptions *opts,
+                       const char *upstream_headers, size_t headers_len,
+                       const HTTPResponse *response);
+void proxy_cache_set_status(HTTPResponse *response, CacheStatus status);
+
+#endif /* HTTP_PROXY_CACHE_H */
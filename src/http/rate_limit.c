@@ -0,0 +1,225 @@
+/**
+ * @file    rate_limit.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Shared-memory client table for limit_req and limit_conn.
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "rate_limit.h"
+
+// ---------- OPTIONS ----------
+
+void rate_limit_options_defaults(RateLimitOptions *opts)
+{
+    opts->rate  = 0;
+    opts->burst = 0;
+    opts->conn  = 0;
+    opts->slots = DEFAULT_LIMIT_SLOTS;
+}
+
+/**
+ * @brief   Parses a request rate: "10", "10r/s" or "600r/m".
+ *
+ * @return  OK, or -1 if the value is malformed or negative.
+ */
+int rate_limit_options_set_rate(RateLimitOptions *opts, const char *value)
+{
+    char *end;
+    double rate = strtod(value, &end);
+    if (end == value || rate < 0) return -1;
+
+    if (strcmp(end, "r/m") == 0)
+        rate /= 60;
+    else if (*end != '\0' && strcmp(end, "r/s") != 0)
+        return -1;
+    opts->rate = rate;
+    return OK;
+}
+
+// ---------- TABLE ----------
+
+/**
+ * @brief   Maps the client table, or leaves it unmapped when both limits are off.
+ *
+ * The mapping is shared and anonymous: threads see it as ordinary memory and
+ * processes forked afterwards keep sharing it. One entry past the table is
+ * the overflow entry (see find_slot()).
+ *
+ * @return  OK, or -1 if the mapping fails.
+ */
+int rate_limiter_init(RateLimiter *rl, const RateLimitOptions *opts)
+{
+    memset(rl, 0, sizeof(*rl));
+    if (opts->rate <= 0 && opts->conn <= 0) return OK;
+
+    size_t slots = LIMIT_PROBES;
+    while (slots < opts->slots)
+        slots <<= 1;
+
+    void *map = mmap(NULL, (slots + 1) * sizeof(LimitSlot), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG(LOG_ERROR, "Failed to map the rate limit table: %s", strerror(errno));
+        return -1;
+    }
+
+    if (getrandom(&rl->seed, sizeof(rl->seed), GRND_NONBLOCK) != sizeof(rl->seed))
+        rl->seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+
+    rl->slots      = map;
+    rl->mask       = slots - 1;
+    rl->interval   = opts->rate > 0 ? (uint64_t)(1e9 / opts->rate) : 0;
+    rl->tolerance  = rl->interval * (opts->burst > 0 ? opts->burst : 0);
+    rl->conn_limit = opts->conn > 0 ? (uint32_t)opts->conn : 0;
+    return OK;
+}
+
+void rate_limiter_free(RateLimiter *rl)
+{
+    if (rl->slots) munmap(rl->slots, (rl->mask + 2) * sizeof(LimitSlot));
+    memset(rl, 0, sizeof(*rl));
+}
+
+/**
+ * @brief   Hashes a client address into a non-zero table key.
+ *
+ * IPv4-mapped IPv6 addresses hash like the IPv4 address; the port is left out.
+ * Other IPv6 clients are keyed by their /64 prefix, since a single host is
+ * usually handed a whole /64 and could otherwise pick a new address, and a
+ * fresh bucket, for every request.
+ */
+uint64_t rate_limit_key(const RateLimiter *rl, const struct sockaddr *addr)
+{
+    const uint8_t *bytes;
+    size_t len;
+    if (addr->sa_family == AF_INET6)
+    {
+        const struct in6_addr *in6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+        bool mapped                = IN6_IS_ADDR_V4MAPPED(in6);
+        bytes                      = in6->s6_addr + (mapped ? 12 : 0);
+        len                        = mapped ? 4 : 8;
+    }
+    else
+    {
+        bytes = (const uint8_t *)&((const struct sockaddr_in *)addr)->sin_addr;
+        len   = 4;
+    }
+
+    // FNV-1a over the address, then a splitmix64 finalizer to spread the bits
+    uint64_t h = 0xcbf29ce484222325ull ^ rl->seed;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+/* The entry past the table, shared by clients that find their window in use */
+static LimitSlot *overflow_slot(RateLimiter *rl)
+{
+    return &rl->slots[rl->mask + 1];
+}
+
+/**
+ * @brief   Finds the entry of a client, claiming one if it has none.
+ *
+ * Keys are never removed, so the search can stop at the first free entry.
+ * A window without free entries gives the client the first idle one: full
+ * bucket, no connection. If every entry in the window is in use, the
+ * client shares the overflow entry with every other client in that spot,
+ * so filling the table cannot switch the limits off.
+ *
+ * @return  The entry.
+ */
+static LimitSlot *find_slot(RateLimiter *rl, uint64_t key, uint64_t now)
+{
+    LimitSlot *idle = NULL;
+    for (size_t i = 0; i < LIMIT_PROBES; i++)
+    {
+        LimitSlot *slot = &rl->slots[(key + i) & rl->mask];
+        uint64_t found  = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (found == 0 &&
+            atomic_compare_exchange_strong_explicit(&slot->key, &found, key, memory_order_acq_rel,
+                                                    memory_order_acquire))
+            return slot;
+        if (found == key) return slot;
+
+        if (!idle && atomic_load_explicit(&slot->conns, memory_order_relaxed) == 0 &&
+            atomic_load_explicit(&slot->tat, memory_order_relaxed) <= now)
+            idle = slot;
+    }
+
+    if (idle)
+    {
+        uint64_t previous = atomic_load_explicit(&idle->key, memory_order_relaxed);
+        if (atomic_compare_exchange_strong_explicit(&idle->key, &previous, key,
+                                                    memory_order_acq_rel, memory_order_relaxed) ||
+            previous == key)
+            return idle;
+    }
+
+    static atomic_bool warned;
+    if (!atomic_exchange_explicit(&warned, true, memory_order_relaxed))
+        LOG(LOG_WARN, "Rate limit table is full, clients without room share one overflow entry; "
+                      "consider raising limit_zone_slots.");
+    return overflow_slot(rl);
+}
+
+/**
+ * @brief   Takes a token from the client's bucket for one request.
+ *
+ * @return  true if the request may proceed; false if it is over limit_req.
+ *          Always true when limit_req is off.
+ */
+bool rate_limit_request(RateLimiter *rl, uint64_t key, uint64_t now)
+{
+    if (rl->interval == 0) return true;
+    LimitSlot *slot = find_slot(rl, key, now);
+    uint64_t tat = atomic_load_explicit(&slot->tat, memory_order_relaxed);
+    while (1)
+    {
+        uint64_t from = tat > now ? tat : now;
+        if (from - now > rl->tolerance) return false;
+        if (atomic_compare_exchange_weak_explicit(&slot->tat, &tat, from + rl->interval,
+                                                  memory_order_relaxed, memory_order_relaxed))
+            return true;
+    }
+}
+
+/**
+ * @brief   Counts a new connection of a client against limit_conn.
+ *
+ * @return  The entry to pass to rate_limit_disconnect() when the connection
+ *          closes, -1 if it is not counted (limit off, or its entry was
+ *          just taken over), or RATE_LIMITED if the client has limit_conn
+ *          open already. Clients on the overflow entry share one count.
+ */
+int rate_limit_connect(RateLimiter *rl, uint64_t key, uint64_t now)
+{
+    if (rl->conn_limit == 0) return -1;
+    LimitSlot *slot = find_slot(rl, key, now);
+    uint32_t open   = atomic_fetch_add_explicit(&slot->conns, 1, memory_order_acq_rel);
+    if (open >= rl->conn_limit ||
+        (slot != overflow_slot(rl) &&
+         atomic_load_explicit(&slot->key, memory_order_acquire) != key)) // taken over meanwhile
+    {
+        atomic_fetch_sub_explicit(&slot->conns, 1, memory_order_release);
+        return open >= rl->conn_limit ? RATE_LIMITED : -1;
+    }
+    return (int)(slot - rl->slots);
+}
+
+void rate_limit_disconnect(RateLimiter *rl, int slot)
+{
+    if (slot >= 0 && rl->slots)
+        atomic_fetch_sub_explicit(&rl->slots[slot].conns, 1, memory_order_release);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file    rate_limit.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Per-client request rate and connection limits (limit_req, limit_conn).
+ *
+ * @details Clients are keyed by their address (IPv6 ones by their /64
+ *          prefix), hashed once at accept. Their state lives in a fixed-size
+ *          open-addressed table in a shared anonymous mapping, so every
+ *          worker thread, and any forked worker process, sees and updates
+ *          the same entries with atomic operations and no lock.
+ *
+ *          The request limit is a token bucket of burst + 1 tokens refilled
+ *          at rate per second. It is stored as the time the bucket will be
+ *          full again (the GCRA form of a token bucket), so one
+ *          compare-and-swap admits a request. The connection limit is a
+ *          counter per client.
+ *
+ *          Entries are never deleted: an entry with a full bucket and no open
+ *          connection holds no state and is taken over by the next new
+ *          client that needs room in its probe window. If the window is
+ *          taken entirely by active clients, the newcomer shares a single
+ *          overflow entry with every other client left without room, so a
+ *          flood of addresses is throttled as one client, not waved through.
+ */
+
+#ifndef HTTP_RATE_LIMIT_H
+#define HTTP_RATE_LIMIT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "common.h"
+
+#define DEFAULT_LIMIT_SLOTS 65536
+#define LIMIT_PROBES 16 // entries searched from a client's hash slot
+#define RATE_LIMITED -2 // rate_limit_connect(): over limit_conn
+
+typedef struct RateLimitOptions
+{
+    double rate;  // requests per second per client; 0 disables limit_req
+    int burst;    // requests a client may send ahead of rate
+    int conn;     // open connections per client; 0 disables limit_conn
+    size_t slots; // clients tracked at once, rounded up to a power of two
+} RateLimitOptions;
+
+typedef struct LimitSlot
+{
+    _Atomic uint64_t key;   // address hash, 0 for a free entry
+    _Atomic uint64_t tat;   // monotonic ns at which the bucket is full again
+    _Atomic uint32_t conns; // open connections
+} LimitSlot;
+
+typedef struct RateLimiter
+{
+    LimitSlot *slots; // shared mapping of mask + 2 entries, the last for overflow; NULL when off
+    size_t mask;
+    uint64_t seed;      // keeps clients from picking colliding addresses
+    uint64_t interval;  // ns per token
+    uint64_t tolerance; // ns the bucket may run ahead of now: burst tokens
+    uint32_t conn_limit;
+} RateLimiter;
+
+void rate_limit_options_defaults(RateLimitOptions *opts);
+int rate_limit_options_set_rate(RateLimitOptions *opts, const char *value);
+
+int rate_limiter_init(RateLimiter *rl, const RateLimitOptions *opts);
+void rate_limiter_free(RateLimiter *rl);
+
+uint64_t rate_limit_key(const RateLimiter *rl, const struct sockaddr *addr);
+bool rate_limit_request(RateLimiter *rl, uint64_t key, uint64_t now);
+int rate_limit_connect(RateLimiter *rl, uint64_t key, uint64_t now);
+void rate_limit_disconnect(RateLimiter *rl, int slot);
+
+#endif /* HTTP_RATE_LIMIT_H */
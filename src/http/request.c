@@ -25,13 +25,88 @@ HTTPRequest *create_http_request(void)
     req->body     = NULL;
     req->body_len = 0;
 
-    req->state = REQ_PARSE_LINE;
+    req->state       = REQ_PARSE_LINE;
+    req->storage     = NULL;
+    req->uri_storage = NULL;
 
     return req;
 }
 
+static char *copy_field(char **cursor, const char *src, size_t len)
+{
+    if (!src) return NULL;
+    char *dst = *cursor;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    *cursor += len + 1;
+    return dst;
+}
+
+/**
+ * @brief   Copies a parsed request so that it outlives the buffer it was parsed from.
+ *
+ * Parsed fields point into the connection's buffer; the copy owns one block
+ * holding all of them, NUL-terminated, and can be handed to another thread.
+ *
+ * @return  The copy, or NULL if out of memory.
+ */
+HTTPRequest *copy_http_request(const HTTPRequest *req)
+{
+    const HTTPRequestLine *line = &req->request_line;
+    size_t size                 = line->method_len + line->uri_len + line->protocol_len + 3;
+    for (int i = 0; i < req->header_count; i++)
+        size += req->headers[i].name_len + req->headers[i].value_len + 2;
+    size += req->body_len + 1;
+
+    HTTPRequest *copy = create_http_request();
+    if (!copy || !copy->headers || !(copy->storage = malloc(size)))
+    {
+        if (copy) free_http_request(copy);
+        return NULL;
+    }
+
+    char *cursor                = copy->storage;
+    copy->request_line          = *line;
+    copy->request_line.method   = copy_field(&cursor, line->method, line->method_len);
+    copy->request_line.uri      = copy_field(&cursor, line->uri, line->uri_len);
+    copy->request_line.protocol = copy_field(&cursor, line->protocol, line->protocol_len);
+    for (int i = 0; i < req->header_count; i++)
+    {
+        const HTTPHeader *h    = &req->headers[i];
+        copy->headers[i]       = *h;
+        copy->headers[i].name  = copy_field(&cursor, h->name, h->name_len);
+        copy->headers[i].value = copy_field(&cursor, h->value, h->value_len);
+    }
+    copy->header_count = req->header_count;
+    copy->body         = copy_field(&cursor, req->body, req->body_len);
+    copy->body_len     = req->body_len;
+    copy->state        = req->state;
+    return copy;
+}
+
+/**
+ * @brief   Points the request at a new URI, owned by the request; for a rewrite.
+ *
+ * @return  OK, or -1 if out of memory (the URI is then unchanged).
+ */
+int set_http_request_uri(HTTPRequest *req, const char *uri, size_t len)
+{
+    char *copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, uri, len);
+    copy[len] = '\0';
+
+    free(req->uri_storage);
+    req->uri_storage          = copy;
+    req->request_line.uri     = copy;
+    req->request_line.uri_len = len;
+    return OK;
+}
+
 void free_http_request(HTTPRequest *req)
 {
+    free(req->uri_storage);
+    free(req->storage);
     free(req->headers);
     free(req);
 }
\ No newline at end of file
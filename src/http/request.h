@@ -37,9 +37,13 @@ typedef struct HTTPRequest
     char *body;
     size_t body_len;
     HTTPRequestState state;
+    char *storage;     // bytes the fields point into when owned (see copy_http_request()), or NULL
+    char *uri_storage; // URI set by set_http_request_uri(), or NULL
 } HTTPRequest;
 
 HTTPRequest *create_http_request();
+HTTPRequest *copy_http_request(const HTTPRequest *req);
+int set_http_request_uri(HTTPRequest *req, const char *uri, size_t len);
 void free_http_request(HTTPRequest *req);
 
 #endif
\ No newline at end of file
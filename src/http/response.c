@@ -13,15 +13,19 @@ HTTPResponse *httpresponse_constructor()
     HTTPResponse *res = malloc(sizeof(HTTPResponse));
     if (!res) return NULL;
 
-    res->status_code    = 200;
-    res->version        = NULL;
-    res->reason_phrase  = NULL;
-    res->headers        = NULL;
-    res->body           = NULL;
-    res->content_type   = NULL;
-    res->header_count   = 0;
-    res->body_length    = 0;
-    res->content_length = 0;
+    res->status_code      = 200;
+    res->version          = NULL;
+    res->reason_phrase    = NULL;
+    res->headers          = NULL;
+    res->body             = NULL;
+    res->content_type     = NULL;
+    res->header_count     = 0;
+    res->body_length      = 0;
+    res->content_length   = 0;
+    res->file_fd          = -1;
+    res->file_ranges      = NULL;
+    res->file_range_count = 0;
+    res->file_trailer     = NULL;
 
     return res;
 }
@@ -41,6 +45,14 @@ void httpresponse_free(HTTPResponse *res)
 
     free(res->body);
     free(res->content_type);
+
+    if (res->file_fd >= 0) close(res->file_fd);
+    for (int i = 0; i < res->file_range_count; ++i)
+    {
+        free(res->file_ranges[i].prefix);
+    }
+    free(res->file_ranges);
+    free(res->file_trailer);
     free(res);
 }
 
@@ -64,21 +76,55 @@ int httpresponse_add_header(HTTPResponse *res, const char *key, const char *valu
     return OK;
 }
 
+/**
+ * @brief   Serializes status line, headers and body into one contiguous buffer.
+ *
+ * Content-Type and Content-Length are emitted from the response fields, so
+ * every response is framed and can be sent on a persistent connection
+ * (statuses that never carry a body get no Content-Length).
+ * The buffer is sized up front, so any number of headers fits.
+ *
+ * @return  Heap buffer (caller frees) of *out_len bytes, NUL-terminated, or NULL.
+ */
 char *httpresponse_serialize(HTTPResponse *res, size_t *out_len)
 {
     if (!res || !out_len) return NULL;
 
-    size_t capacity = INITIAL_RESPONSE_SIZE;
-    char *buffer    = malloc(capacity); // transferring ownership, caller frees the memory
+    const char *version = res->version ? res->version : "HTTP/1.1";
+    const char *phrase  = res->reason_phrase ? res->reason_phrase : "";
+    size_t body_length  = (res->body && res->body_length > 0) ? (size_t)res->body_length : 0;
+
+    // Status line + fixed headers + separator, then each custom header
+    size_t capacity = strlen(version) + strlen(phrase) + 16;
+    if (res->content_type) capacity += strlen(res->content_type) + 16;
+    capacity += 40; // "Content-Length: <20 digits>\r\n"
+    for (int i = 0; i < res->header_count; ++i)
+    {
+        capacity += strlen(res->headers[i]) + 2;
+    }
+    capacity += 2 + body_length + 1;
+
+    char *buffer = malloc(capacity); // transferring ownership, caller frees the memory
     if (!buffer) return NULL;
 
     size_t len = 0;
 
     // Status line
-    len += snprintf(buffer + len, capacity - len, "%s %d %s\r\n", res->version, res->status_code,
-                    res->reason_phrase);
+    len += snprintf(buffer + len, capacity - len, "%s %d %s\r\n", version, res->status_code,
+                    phrase);
 
     // Headers
+    if (res->content_type)
+    {
+        len += snprintf(buffer + len, capacity - len, "Content-Type: %s\r\n", res->content_type);
+    }
+    // 1xx, 204 and 304 responses never carry a body, so they get no framing either
+    bool bodiless = res->status_code < 200 || res->status_code == 204 || res->status_code == 304;
+    if (!bodiless)
+    {
+        len += snprintf(buffer + len, capacity - len, "Content-Length: %zu\r\n",
+                        res->content_length > 0 ? res->content_length : body_length);
+    }
     for (int i = 0; i < res->header_count; ++i)
     {
         len += snprintf(buffer + len, capacity - len, "%s\r\n", res->headers[i]);
@@ -88,22 +134,56 @@ char *httpresponse_serialize(HTTPResponse *res, size_t *out_len)
     len += snprintf(buffer + len, capacity - len, "\r\n");
 
     // Body
-    if (res->body && res->body_length > 0)
+    if (body_length > 0)
     {
-        if (len + res->body_length >= capacity)
-        {
-            buffer = realloc(buffer, len + res->body_length + 1);
-            if (!buffer) return NULL;
-        }
-        memcpy(buffer + len, res->body, res->body_length);
-        len += res->body_length;
-        buffer[len] = '\0';
+        memcpy(buffer + len, res->body, body_length);
+        len += body_length;
     }
+    buffer[len] = '\0';
 
     if (out_len) *out_len = len;
     return buffer;
 }
 
+/**
+ * @brief   Formats t as an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT").
+ *
+ * @return  Length written (29), or 0 if cap is too small.
+ */
+size_t format_http_date(time_t t, char *buf, size_t cap)
+{
+    struct tm tm;
+    if (!gmtime_r(&t, &tm)) return 0;
+    return strftime(buf, cap, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/**
+ * @brief   Appends a slice of res->file_fd to the body.
+ *
+ * The serializer only emits headers for these; the connection sends the
+ * slices with sendfile(), so content_length must account for them.
+ *
+ * @return  OK, or -1 on allocation failure.
+ */
+int httpresponse_add_file_range(HTTPResponse *res, off_t offset, size_t length, const char *prefix)
+{
+    if (!res) return -1;
+
+    ResponseFileRange *new_ranges =
+        realloc(res->file_ranges, sizeof(ResponseFileRange) * (res->file_range_count + 1));
+    if (!new_ranges) return -1;
+    res->file_ranges = new_ranges;
+
+    ResponseFileRange *range = &res->file_ranges[res->file_range_count];
+    range->offset            = offset;
+    range->length            = length;
+    range->prefix            = prefix ? strdup(prefix) : NULL;
+    if (prefix && !range->prefix) return -1;
+    res->file_range_count++;
+
+    return OK;
+}
+
 HTTPResponse *response_builder(int status_code, const char *phrase, const char *body,
                                size_t body_length, const char *content_type)
 {
@@ -128,4 +208,45 @@ HTTPResponse *response_builder(int status_code, const char *phrase, const char *
     response->content_type = strdup(content_type);
 
     return response;
-}
\ No newline at end of file
+}
+/**
+ * @brief   Copies an in-memory response: status, reason, body, Content-Type
+ *          and every header.
+ *
+ * File-backed bodies are not copied.
+ *
+ * @return  The copy (caller frees), or NULL.
+ */
+HTTPResponse *httpresponse_copy(const HTTPResponse *res)
+{
+    if (!res) return NULL;
+    HTTPResponse *copy =
+        response_builder(res->status_code, res->reason_phrase ? res->reason_phrase : "",
+                         res->body ? res->body : "", res->body_length,
+                         res->content_type ? res->content_type : "");
+    if (!copy) return NULL;
+
+    if (!res->content_type)
+    {
+        free(copy->content_type);
+        copy->content_type = NULL;
+    }
+    copy->content_length = res->content_length;
+    copy->headers        = malloc(sizeof(char *) * (res->header_count ? res->header_count : 1));
+    if (!copy->headers)
+    {
+        httpresponse_free(copy);
+        return NULL;
+    }
+    for (int i = 0; i < res->header_count; i++)
+    {
+        copy->headers[i] = strdup(res->headers[i]);
+        if (!copy->headers[i])
+        {
+            httpresponse_free(copy);
+            return NULL;
+        }
+        copy->header_count++;
+    }
+    return copy;
+}
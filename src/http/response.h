@@ -11,6 +11,14 @@
 
 #include "common.h"
 
+/* A slice of the response's file, sent with sendfile() after the headers */
+typedef struct ResponseFileRange
+{
+    off_t offset;
+    size_t length;
+    char *prefix; // bytes sent before the slice (multipart part headers), or NULL
+} ResponseFileRange;
+
 typedef struct
 {
     int status_code;
@@ -21,7 +29,11 @@ typedef struct
     char *content_type;
     int header_count;
     int body_length;
-    int content_length;
+    size_t content_length;          // overrides body_length in Content-Length when > 0
+    int file_fd;                    // file-backed body, or -1; closed by httpresponse_free()
+    ResponseFileRange *file_ranges; // slices of file_fd making up the body, in order
+    int file_range_count;
+    char *file_trailer;             // bytes sent after the last slice, or NULL
 } HTTPResponse;
 
 HTTPResponse *httpresponse_constructor();
@@ -29,8 +41,12 @@ void httpresponse_free(HTTPResponse *httpresponse_ptr);
 
 int httpresponse_add_header(HTTPResponse *res, const char *key, const char *value);
 char *httpresponse_serialize(HTTPResponse *res, size_t *out_len);
+size_t format_http_date(time_t t, char *buf, size_t cap);
+int httpresponse_add_file_range(HTTPResponse *res, off_t offset, size_t length,
+                                const char *prefix);
 
 HTTPResponse *response_builder(int status_code, const char *phrase, const char *body,
                                size_t body_length, const char *content_type);
+HTTPResponse *httpresponse_copy(const HTTPResponse *res);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,308 @@
+/**
+ * @file    router.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Location parsing and the radix trie routing requests to them.
+ *
+ */
+
+#include "router.h"
+#include "module.h"
+#include "utils/config.h"
+
+// ---------- LOCATIONS ----------
+
+/**
+ * @brief   Starts a location from its section header, after the "location"
+ *          keyword: "/prefix", or "= /path" for an exact match.
+ *
+ * @return  OK, or -1 if the path is missing or does not start with '/'.
+ */
+int location_init(Location *loc, const char *spec)
+{
+    memset(loc, 0, sizeof(*loc));
+    loc->group = -1;
+
+    while (isspace((unsigned char)*spec))
+        spec++;
+    if (*spec == '=')
+    {
+        loc->match = MATCH_EXACT;
+        spec++;
+        while (isspace((unsigned char)*spec))
+            spec++;
+    }
+
+    size_t len = strcspn(spec, " \t");
+    if (len == 0 || spec[0] != '/' || spec[len] != '\0') return -1;
+    loc->path = strdup(spec);
+    return loc->path ? OK : -1;
+}
+
+static int replace_string(char **field, const char *value)
+{
+    free(*field);
+    *field = *value ? strdup(value) : NULL;
+    return (*value && !*field) ? -1 : OK;
+}
+
+/**
+ * @brief   Applies one key of a location section.
+ *
+ * - static       (directory the URI path resolves under; empty for the working directory)
+ * - proxy        (upstream group name; empty for the top-level backends)
+ * - return       ("<status> [text]"; for 301, 302, 303, 307 and 308 the text
+ *                is the redirect target)
+ * - content_type (of a return body, default text/plain)
+ * - content      (name of a module whose content hook answers the requests)
+ * - strip_prefix (on/off, drop the location path before resolving or forwarding)
+ * - coroutine    (on/off, run the handler as blocking code on a coroutine)
+ *
+ * @return  OK, or -1 if the key is unknown or the value invalid.
+ */
+int location_set(Location *loc, const char *key, const char *value)
+{
+    if (strcmp(key, "static") == 0)
+    {
+        loc->handler = ROUTE_STATIC;
+        return replace_string(&loc->root, value);
+    }
+    if (strcmp(key, "proxy") == 0)
+    {
+        loc->handler = ROUTE_PROXY;
+        return replace_string(&loc->upstream, value);
+    }
+    if (strcmp(key, "return") == 0)
+    {
+        char *end;
+        long status = strtol(value, &end, 10);
+        if (end == value || status < 100 || status > 599 || (*end && !isspace((unsigned char)*end)))
+            return -1;
+        while (isspace((unsigned char)*end))
+            end++;
+        loc->handler = ROUTE_RETURN;
+        loc->status  = (int)status;
+        return replace_string(&loc->body, end);
+    }
+    if (strcmp(key, "content_type") == 0) return replace_string(&loc->content_type, value);
+    if (strcmp(key, "content") == 0)
+    {
+        int module = module_find_content(value);
+        if (module < 0) return -1;
+        loc->handler = ROUTE_MODULE;
+        loc->module  = module;
+        return OK;
+    }
+    if (strcmp(key, "strip_prefix") == 0)
+    {
+        loc->strip_prefix = parse_bool(value);
+        return OK;
+    }
+    if (strcmp(key, "coroutine") == 0)
+    {
+        loc->coroutine = parse_bool(value);
+        return OK;
+    }
+    return -1;
+}
+
+void location_free(Location *loc)
+{
+    free(loc->path);
+    free(loc->root);
+    free(loc->upstream);
+    free(loc->body);
+    free(loc->content_type);
+    memset(loc, 0, sizeof(*loc));
+}
+
+static char *copy_string(const char *str, bool *failed)
+{
+    if (!str) return NULL;
+    char *copy = strdup(str);
+    if (!copy) *failed = true;
+    return copy;
+}
+
+// ---------- TRIE ----------
+
+/**
+ * @brief   Prepares a router with only the root node.
+ *
+ * @return  OK, or -1 on allocation failure.
+ */
+int router_init(Router *router)
+{
+    memset(router, 0, sizeof(*router));
+    router->nodes = malloc(16 * sizeof(RouteNode));
+    if (!router->nodes) return -1;
+    router->node_cap   = 16;
+    router->node_count = 1;
+    router->nodes[0]   = (RouteNode){"", 0, -1, -1, -1, -1};
+    return OK;
+}
+
+static int32_t new_node(Router *router, const char *label, size_t len)
+{
+    if (router->node_count == router->node_cap)
+    {
+        RouteNode *grown = realloc(router->nodes, router->node_cap * 2 * sizeof(RouteNode));
+        if (!grown) return -1;
+        router->nodes = grown;
+        router->node_cap *= 2;
+    }
+    router->nodes[router->node_count] = (RouteNode){label, len, -1, -1, -1, -1};
+    return (int32_t)router->node_count++;
+}
+
+/**
+ * @brief   Finds or creates the node at the end of path.
+ *
+ * Children are kept sorted by the first byte of their label. An edge that
+ * only partly matches is split, so every location path ends on a node.
+ *
+ * @return  The node index, or -1 on allocation failure.
+ */
+static int32_t insert_path(Router *router, const char *path, size_t len)
+{
+    int32_t node = 0;
+    size_t pos   = 0;
+    while (pos < len)
+    {
+        unsigned char c = path[pos];
+        int32_t prev    = -1;
+        int32_t child   = router->nodes[node].child;
+        while (child >= 0 && (unsigned char)router->nodes[child].label[0] < c)
+        {
+            prev  = child;
+            child = router->nodes[child].sibling;
+        }
+
+        int32_t next;
+        if (child < 0 || (unsigned char)router->nodes[child].label[0] != c)
+        {
+            // No edge starts with c: the rest of the path becomes a new leaf
+            if ((next = new_node(router, path + pos, len - pos)) < 0) return -1;
+            router->nodes[next].sibling = child;
+            pos                         = len;
+        }
+        else
+        {
+            RouteNode *edge = &router->nodes[child];
+            size_t common   = 0;
+            while (common < edge->label_len && pos + common < len &&
+                   edge->label[common] == path[pos + common])
+                common++;
+            pos += common;
+            if (common == edge->label_len)
+            {
+                node = child;
+                continue;
+            }
+
+            // Split the edge: the shared part leads to a new node above the old one
+            if ((next = new_node(router, router->nodes[child].label, common)) < 0) return -1;
+            edge                        = &router->nodes[child];
+            router->nodes[next].sibling = edge->sibling;
+            router->nodes[next].child   = child;
+            edge->sibling               = -1;
+            edge->label += common;
+            edge->label_len -= common;
+        }
+
+        if (prev < 0)
+            router->nodes[node].child = next;
+        else
+            router->nodes[prev].sibling = next;
+        node = next;
+    }
+    return node;
+}
+
+/**
+ * @brief   Adds a copy of a location to the trie.
+ *
+ * @return  OK, or -1 if the location has no handler or path, the same path
+ *          and match type is already routed, or on allocation failure.
+ */
+int router_add(Router *router, const Location *loc)
+{
+    if (loc->handler == ROUTE_NONE || !loc->path || loc->path[0] != '/') return -1;
+
+    Location *grown =
+        realloc(router->locations, (router->location_count + 1) * sizeof(Location));
+    if (!grown) return -1;
+    router->locations = grown;
+
+    bool failed       = false;
+    Location copy     = *loc;
+    copy.path         = copy_string(loc->path, &failed);
+    copy.root         = copy_string(loc->root, &failed);
+    copy.upstream     = copy_string(loc->upstream, &failed);
+    copy.body         = copy_string(loc->body, &failed);
+    copy.content_type = copy_string(loc->content_type, &failed);
+
+    int32_t node = failed ? -1 : insert_path(router, copy.path, strlen(copy.path));
+    if (node < 0)
+    {
+        location_free(&copy);
+        return -1;
+    }
+
+    RouteNode *n  = &router->nodes[node];
+    int32_t *slot = loc->match == MATCH_EXACT ? &n->exact : &n->prefix;
+    if (*slot >= 0)
+    {
+        location_free(&copy);
+        return -1;
+    }
+    *slot                                       = (int32_t)router->location_count;
+    router->locations[router->location_count++] = copy;
+    return OK;
+}
+
+/**
+ * @brief   Finds the location for a request path (without its query string).
+ *
+ * The walk follows the path down the trie, remembering the deepest prefix
+ * location that ends at a segment boundary; an exact location at the very
+ * end of the path takes precedence.
+ *
+ * @return  The location, or NULL if none matches.
+ */
+const Location *router_match(const Router *router, const char *path, size_t len)
+{
+    if (router->node_count == 0) return NULL;
+
+    const RouteNode *nodes = router->nodes;
+    int32_t best           = -1;
+    int32_t node           = 0;
+    size_t pos             = 0;
+    while (1)
+    {
+        const RouteNode *n = &nodes[node];
+        if (pos == len && n->exact >= 0) return &router->locations[n->exact];
+        if (n->prefix >= 0 && (pos == len || path[pos] == '/' || (pos > 0 && path[pos - 1] == '/')))
+            best = n->prefix;
+        if (pos == len) break;
+
+        int32_t child = n->child;
+        while (child >= 0 && (unsigned char)nodes[child].label[0] < (unsigned char)path[pos])
+            child = nodes[child].sibling;
+        if (child < 0 || len - pos < nodes[child].label_len ||
+            memcmp(nodes[child].label, path + pos, nodes[child].label_len) != 0)
+            break;
+        pos += nodes[child].label_len;
+        node = child;
+    }
+    return best >= 0 ? &router->locations[best] : NULL;
+}
+
+void router_free(Router *router)
+{
+    for (size_t i = 0; i < router->location_count; i++)
+        location_free(&router->locations[i]);
+    free(router->locations);
+    free(router->nodes);
+    memset(router, 0, sizeof(*router));
+}
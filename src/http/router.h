@@ -0,0 +1,88 @@
+/**
+ * @file    router.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Location routing: request paths to handlers through a radix trie.
+ *
+ * @details Locations come from "[location /prefix]" and "[location = /path]"
+ *          config sections. At startup they are compiled into a radix trie
+ *          whose edges carry path fragments, so a lookup walks the request
+ *          path once, however many locations there are.
+ *
+ *          An exact location only matches its own path and wins over any
+ *          prefix. A prefix location matches its path and everything below
+ *          it at a segment boundary: "/static" matches "/static" and
+ *          "/static/app.css" but not "/staticfoo". The longest matching
+ *          prefix wins.
+ */
+
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define MAX_LOCATIONS 64
+
+typedef enum
+{
+    MATCH_PREFIX,
+    MATCH_EXACT,
+} LocationMatch;
+
+typedef enum
+{
+    ROUTE_NONE,
+    ROUTE_STATIC, // files below root
+    ROUTE_PROXY,  // an upstream group
+    ROUTE_RETURN, // a fixed response
+    ROUTE_STATS,  // internal metrics (stats_uri)
+    ROUTE_MODULE, // the content hook of a module
+} RouteHandler;
+
+typedef struct Location
+{
+    char *path;
+    LocationMatch match;
+    RouteHandler handler;
+    bool strip_prefix;  // drop path from the URI before resolving or forwarding it
+    bool coroutine;     // run the handler on a coroutine of the event loop
+    char *root;         // ROUTE_STATIC: directory URIs resolve under; NULL for the working dir
+    char *upstream;     // ROUTE_PROXY: upstream group name; NULL for the top-level backends
+    int group;          // ROUTE_PROXY: index of the upstream group, -1 for the top-level backends
+    int status;         // ROUTE_RETURN
+    char *body;         // ROUTE_RETURN: body text, or the Location of a redirect
+    char *content_type; // ROUTE_RETURN: NULL for text/plain
+    int module;         // ROUTE_MODULE: index of the module in the module table
+} Location;
+
+/* A trie node; the edge leading to it carries label */
+typedef struct RouteNode
+{
+    const char *label; // points into a location path owned by the router
+    size_t label_len;
+    int32_t child;   // first child, -1 if none
+    int32_t sibling; // next child of the same parent, -1 if none
+    int32_t exact;   // location matching exactly the path up to here, -1 if none
+    int32_t prefix;  // prefix location ending here, -1 if none
+} RouteNode;
+
+typedef struct Router
+{
+    Location *locations; // copies, owned
+    size_t location_count;
+    RouteNode *nodes; // nodes[0] is the root, with an empty label
+    size_t node_count;
+    size_t node_cap;
+} Router;
+
+int location_init(Location *loc, const char *spec);
+int location_set(Location *loc, const char *key, const char *value);
+void location_free(Location *loc);
+
+int router_init(Router *router);
+int router_add(Router *router, const Location *loc);
+const Location *router_match(const Router *router, const char *path, size_t len);
+void router_free(Router *router);
+
+#endif /* HTTP_ROUTER_H */
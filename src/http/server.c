@@ -6,340 +6,3037 @@
  *
  */
 
+#include <poll.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+
 #include "server.h"
 
-int launch(HTTPServer *self)
+// Settings consulted by request_handler(), which only receives the request
+static const Config *server_config = NULL;
+
+// Locations of server_config compiled for lookup; see build_router()
+static Router server_router;
+
+// Registered with epoll for the listen sockets; see EventKind
+static const EventKind listener_kind     = EVENT_LISTENER;
+static const EventKind tls_listener_kind = EVENT_TLS_LISTENER;
+static const EventKind io_done_kind      = EVENT_IO_DONE;
+
+/* Answer to a client over limit_req or limit_conn, sent as is and followed by a close */
+static const char too_many_requests[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                                        "Content-Type: text/html\r\n"
+                                        "Content-Length: 30\r\n"
+                                        "Retry-After: 1\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n"
+                                        "<h1>429 Too Many Requests</h1>";
+
+/* Answer to requests shed under overload; built once, see build_unavailable() */
+static char service_unavailable[256];
+static size_t service_unavailable_len;
+
+/* A request waiting on a fetch: an HTTP/1.1 connection, or one HTTP/2 stream */
+typedef struct FetchWaiter
+{
+    Connection *conn;     // NULL once the connection closed
+    uint32_t stream_id;   // 0 for HTTP/1.1
+    AccessRecord *access; // HTTP/2 only: the stream's access log record, or NULL
+} FetchWaiter;
+
+/*
+ * A nonblocking upstream request and the requests waiting for its
+ * response. With proxy_coalesce on, later cache-eligible requests for the
+ * same key join the fetch already in flight instead of opening their own
+ * backend connection (collapsed forwarding); waiters[0] is the request
+ * that started it.
+ */
+typedef struct ProxyFetch
+{
+    EventKind kind; // EVENT_UPSTREAM
+    Upstream upstream;
+    UpstreamAddress address; // for a retry after a stale keep-alive connection
+    uint32_t watching; // epoll events currently registered
+    int backend;       // index for metrics
+    uint64_t start;
+    CacheStatus cache_status; // of the request that started the fetch
+    char *key;                // cache key; NULL when the response cannot be shared
+    size_t key_len;
+    bool shared;   // other requests may join
+    bool splicing; // relaying the body with splice(); see relay_body()
+    int pipe[2];   // splicing: body bytes on their way from the backend to the client
+    size_t in_pipe;
+    FetchWaiter *waiters;
+    size_t waiter_count;
+    size_t waiter_cap;
+    struct ProxyFetch *next;
+} ProxyFetch;
+
+static const Location *route_request(const HTTPRequest *request_ptr);
+static HTTPResponse *handle_route(HTTPServer *self, HTTPRequest *request_ptr,
+                                  const Location *route);
+static HTTPResponse *start_proxy(HTTPServer *self, Connection *conn, HTTPRequest *request_ptr,
+                                 const Location *route, uint32_t stream_id);
+static void handle_fetch_event(HTTPServer *self, ProxyFetch *fetch, uint32_t events);
+static void remove_waiters(HTTPServer *self, Connection *conn);
+static void free_fetch(HTTPServer *self, ProxyFetch *fetch);
+static void relay_body(HTTPServer *self, ProxyFetch *fetch);
+static void start_tunnel(HTTPServer *self, ProxyFetch *fetch);
+static bool starts_with_h2_preface(const Connection *conn, bool *partial);
+static int start_h2(Connection *conn);
+static void process_h2(Connection *conn);
+static bool wants_h2c_upgrade(const Connection *conn);
+static void upgrade_to_h2(Connection *conn, size_t consumed);
+static int continue_handshake(HTTPServer *self, Connection *conn);
+static void log_response(Connection *conn, const HTTPRequest *req, int status,
+                         uint64_t queued_from);
+static void complete_access(Connection *conn, bool closing);
+static HTTPResponse *dispatch_request(HTTPServer *self, Connection *conn, HTTPRequest *req,
+                                      uint32_t stream_id, bool *deferred);
+static void forget_handler_jobs(HTTPServer *self, Connection *conn);
+static void finish_file_jobs(HTTPServer *self);
+static void relay_tunnel(HTTPServer *self, struct Tunnel *tunnel);
+static void free_tunnel(HTTPServer *self, struct Tunnel *tunnel);
+
+/**
+ * @brief   Drains a listen queue with accept4(), up to accept_batch clients.
+ *
+ * Accepted sockets come back already nonblocking and close-on-exec, so no
+ * fcntl() round trips are needed. If the batch cap is hit the listen socket
+ * stays readable and the next epoll_wait() resumes where this call stopped.
+ * Clients of the TLS listener start in CONN_HANDSHAKE. A client already
+ * holding limit_conn connections is turned away before it takes a slot:
+ * plaintext clients get the canned 429, TLS clients are simply closed.
+ *
+ * @return  Number of connections accepted.
+ */
+static int accept_connections(HTTPServer *self, SocketServer *listener)
 {
     char s[INET6_ADDRSTRLEN];
+    int accepted = 0;
 
-    if (bind(self->server->socket, (struct sockaddr *)&self->server->address,
-             sizeof(self->server->address)) < 0)
+    int soft_limit = self->config->overload_connections;
+    while (accepted < listener->options.accept_batch)
     {
-        return SOCKET_BIND_ERROR;
+        // Past the soft limit the rest wait in the backlog; update_admission() pauses the listener
+        if (soft_limit > 0 && self->active_count >= (size_t)soft_limit) break;
+
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_fd = accept4(listener->socket, (struct sockaddr *)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG(LOG_ERROR, "Failed to accept a new connection: %s", strerror(errno));
+            }
+            break;
+        }
+        accepted++;
+
+        uint64_t client_key = rate_limit_key(&self->limiter, (struct sockaddr *)&client_addr);
+        int limit_slot      = rate_limit_connect(&self->limiter, client_key, monotonic_ns());
+        if (limit_slot == RATE_LIMITED)
+        {
+            metric_add(&metrics_local()->limited_connections, 1);
+            if (listener != self->tls_server)
+                send(client_fd, too_many_requests, sizeof(too_many_requests) - 1,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(client_fd);
+            continue;
+        }
+
+        // Find a free connection slot, starting from the last one freed or taken
+        Connection *conn = NULL;
+        for (size_t j = 0; j < self->connection_slots; j++)
+        {
+            size_t slot = (self->free_hint + j) % self->connection_slots;
+            if (self->connections[slot].socket <= 0)
+            {
+                conn            = &self->connections[slot];
+                self->free_hint = slot + 1;
+                break;
+            }
+        }
+        if (!conn || self->active_count >= self->connection_slots)
+        {
+            LOG(LOG_ERROR, "No free connection slots available.");
+            metric_add(&metrics_local()->shed_connections, 1);
+            if (listener != self->tls_server)
+                send(client_fd, service_unavailable, service_unavailable_len,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            rate_limit_disconnect(&self->limiter, limit_slot);
+            close(client_fd);
+            continue;
+        }
+
+        if (init_connection(conn, client_fd, self->epoll_fd) < 0)
+        {
+            LOG(LOG_ERROR, "Failed to initialize a connection.");
+            rate_limit_disconnect(&self->limiter, limit_slot);
+            close(client_fd);
+            continue;
+        }
+        conn->server      = self;
+        conn->client_addr = client_addr;
+        conn->client_key  = client_key;
+        conn->limit_slot  = limit_slot;
+        conn->accepted_at = monotonic_ns();
+        if (listener == self->tls_server)
+        {
+            conn->tls = tls_accept(self->tls, client_fd);
+            if (!conn->tls)
+            {
+                LOG(LOG_ERROR, "Failed to start TLS for client FD %d.", client_fd);
+                rate_limit_disconnect(&self->limiter, limit_slot);
+                free(conn->buffer);
+                close(client_fd);
+                conn->socket = 0;
+                continue;
+            }
+            conn->state = CONN_HANDSHAKE;
+        }
+        self->active_count++;
+        metric_add(&metrics_local()->connections_accepted, 1);
+        metric_add(&metrics_local()->connections_active, 1);
+
+        // Add to epoll
+        struct epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1)
+        {
+            LOG(LOG_ERROR, "Failed to add client socket to epoll event loop.");
+            rate_limit_disconnect(&self->limiter, limit_slot);
+            free(conn->buffer);
+            tls_free(conn->tls);
+            conn->tls = NULL;
+            close(client_fd);
+            conn->socket = 0;
+            self->active_count--;
+            metric_sub(&metrics_local()->connections_active, 1);
+            continue;
+        }
+
+        inet_ntop(client_addr.ss_family, get_in_addr((struct sockaddr *)&client_addr), s,
+                  sizeof(s));
+        LOG(LOG_INFO, "Connected: %s:%d, FD: %d", s,
+            ntohs(((struct sockaddr_in *)&client_addr)->sin_port), client_fd);
+    }
+
+    return accepted;
+}
+
+/**
+ * @brief   Unregisters, closes and frees a client connection slot.
+ */
+static void close_connection(HTTPServer *self, Connection *conn)
+{
+    int client_fd = conn->socket;
+    LOG(LOG_DEBUG, "Connection is closing for client FD %d", client_fd);
+
+    ProxyFetch *splicing = conn->fetch && conn->fetch->splicing ? conn->fetch : NULL;
+    if (conn->fetch || conn->h2) remove_waiters(self, conn);
+    if (conn->handler_job || conn->h2) forget_handler_jobs(self, conn);
+    if (splicing) free_fetch(self, splicing); // the rest of the body has nowhere to go
+    if (conn->tunnel) free_tunnel(self, conn->tunnel);
+    complete_access(conn, true);
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
+    tls_shutdown(conn->tls);
+    close(client_fd);
+    rate_limit_disconnect(&self->limiter, conn->limit_slot);
+    free_connection(conn, client_fd, self->epoll_fd);
+    self->free_hint = conn - self->connections;
+    self->active_count--;
+    metric_sub(&metrics_local()->connections_active, 1);
+}
+
+/**
+ * @brief   Switches the epoll interest of a connection between reading and writing.
+ *
+ * While a response is only partially sent the connection waits for EPOLLOUT
+ * and stops reading, which keeps a pipelining client from growing the output
+ * buffer without bound.
+ */
+static int watch_connection(HTTPServer *self, Connection *conn, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events   = events;
+    ev.data.ptr = conn;
+    return epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, conn->socket, &ev);
+}
+
+static bool output_pending(const Connection *conn)
+{
+    return conn->segment_head < conn->segment_count;
+}
+
+/**
+ * @brief   True while an HTTP/1.1 request is answered off the loop: by an
+ *          upstream fetch, the I/O pool or a coroutine.
+ */
+static bool awaiting_response(const Connection *conn)
+{
+    return conn->fetch || conn->handler_job;
+}
+
+static OutputSegment *push_segment(Connection *conn)
+{
+    if (conn->segment_count == conn->segment_cap)
+    {
+        size_t new_cap = conn->segment_cap ? conn->segment_cap * 2 : 8;
+        OutputSegment *new_segments = realloc(conn->segments, new_cap * sizeof(OutputSegment));
+        if (!new_segments) return NULL;
+        conn->segments    = new_segments;
+        conn->segment_cap = new_cap;
     }
-    if ((listen(self->server->socket, self->server->queue)) < 0)
+    if (!output_pending(conn)) conn->send_start = monotonic_ns();
+    return &conn->segments[conn->segment_count++];
+}
+
+/**
+ * @brief   Appends serialized response bytes to the connection's output.
+ */
+static int queue_output(Connection *conn, const char *data, size_t len)
+{
+    if (len == 0) return OK;
+    if (conn->out_len + len > conn->out_size)
     {
-        return SOCKET_LISTEN_ERROR;
+        size_t new_size = conn->out_size ? conn->out_size : INITIAL_RESPONSE_SIZE;
+        while (new_size < conn->out_len + len)
+            new_size *= 2;
+        char *new_buf = realloc(conn->out_buf, new_size);
+        if (!new_buf) return -1;
+        conn->out_buf  = new_buf;
+        conn->out_size = new_size;
     }
 
-    // Initialize epoll
-    self->epoll_fd = epoll_create1(0);
-    if (self->epoll_fd == -1)
+    // Bytes that directly follow the previous span extend it
+    OutputSegment *last = output_pending(conn) ? &conn->segments[conn->segment_count - 1] : NULL;
+    if (last && last->fd < 0 && (size_t)last->offset + last->length == conn->out_len)
     {
-        LOG("ERROR", "Failed to initialize epoll instance.");
-        exit(1);
+        last->length += len;
+    }
+    else
+    {
+        OutputSegment *seg = push_segment(conn);
+        if (!seg) return -1;
+        seg->fd       = -1;
+        seg->close_fd = false;
+        seg->offset   = conn->out_len;
+        seg->length   = len;
     }
 
-    // Initialize connections
-    self->connections = calloc(MAX_CONNECTIONS, sizeof(Connection));
-    if (!self->connections)
+    memcpy(conn->out_buf + conn->out_len, data, len);
+    conn->out_len += len;
+    conn->out_total += len;
+    return OK;
+}
+
+/**
+ * @brief   Queues a slice of an open file, sent later with sendfile().
+ *
+ * With close_fd the connection takes ownership of fd and closes it after the
+ * slice is sent, or when the connection is torn down.
+ */
+static int queue_file(Connection *conn, int fd, off_t offset, size_t length, bool close_fd)
+{
+    if (length == 0)
     {
-        LOG("ERROR", "Failed to allocate memory for connections.");
-        close(self->epoll_fd);
-        return -1;
+        if (close_fd) close(fd);
+        return OK;
     }
-    self->active_count = 0;
 
-    // Add server socket to epoll
-    struct epoll_event ev, events[MAX_EPOLL_EVENTS];
-    ev.events  = EPOLLIN;
-    ev.data.fd = self->server->socket;
-    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->server->socket, &ev) == -1)
+    OutputSegment *seg = push_segment(conn);
+    if (!seg)
     {
-        close(self->epoll_fd);
-        close(self->server->socket);
-        LOG("ERROR", "Failed to add server socket to epoll event loop.");
+        if (close_fd) close(fd);
         return -1;
     }
+    seg->fd       = fd;
+    seg->close_fd = close_fd;
+    seg->offset   = offset;
+    seg->length   = length;
+    conn->out_total += length;
+    return OK;
+}
+
+/**
+ * @brief   Gives fd to the connection: it is closed after its last queued slice.
+ */
+static void release_file(Connection *conn, int fd)
+{
+    for (size_t i = conn->segment_count; i > conn->segment_head; i--)
+    {
+        if (conn->segments[i - 1].fd == fd)
+        {
+            conn->segments[i - 1].close_fd = true;
+            return;
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief   Releases queued output, closing files whose slices were not sent.
+ */
+static void discard_output(Connection *conn)
+{
+    for (size_t i = conn->segment_head; i < conn->segment_count; i++)
+    {
+        if (conn->segments[i].close_fd) close(conn->segments[i].fd);
+    }
+    conn->segment_head  = 0;
+    conn->segment_count = 0;
+    conn->out_len       = 0;
+}
+
+/**
+ * @brief   Sends as much queued output as the socket accepts.
+ *
+ * Buffered bytes go out with send(), flagged MSG_MORE when more output
+ * follows so headers share packets with the body; file slices go out with
+ * sendfile() straight from the page cache.
+ *
+ * @return  0 when everything was sent, 1 if output is still pending (EAGAIN),
+ *          -1 on a socket error.
+ */
+static int flush_output(Connection *conn)
+{
+    if (!output_pending(conn))
+    {
+        // Nothing was sent, so there is no send phase to time
+        if (conn->access_count) complete_access(conn, false);
+        return 0;
+    }
+
+    while (output_pending(conn))
+    {
+        OutputSegment *seg = &conn->segments[conn->segment_head];
+        bool more          = conn->segment_head + 1 < conn->segment_count;
+
+        ssize_t bytes_sent;
+        if (seg->fd < 0)
+        {
+            const char *data = conn->out_buf + seg->offset;
+            bytes_sent       = conn->tls ? tls_send(conn->tls, data, seg->length)
+                                         : send(conn->socket, data, seg->length,
+                                                MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if (bytes_sent > 0) seg->offset += bytes_sent;
+        }
+        else
+        {
+            // With kTLS this is still sendfile(); see tls_sendfile()
+            bytes_sent = conn->tls ? tls_sendfile(conn->tls, seg->fd, &seg->offset, seg->length)
+                                   : sendfile(conn->socket, seg->fd, &seg->offset, seg->length);
+            if (bytes_sent == 0)
+            {
+                // The file shrank after Content-Length went out; framing is lost
+                LOG(LOG_ERROR, "File truncated while sending to client FD %d.", conn->socket);
+                return -1;
+            }
+        }
+
+        if (bytes_sent < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (conn->access_count) complete_access(conn, false);
+                return 1;
+            }
+            LOG(errno == EPIPE || errno == ECONNRESET ? LOG_DEBUG : LOG_ERROR,
+                "Sending to client FD %d failed: %s", conn->socket, strerror(errno));
+            return -1;
+        }
+
+        seg->length -= bytes_sent;
+        conn->sent_total += bytes_sent;
+        metric_add(&metrics_local()->bytes_out, bytes_sent);
+        if (seg->length == 0)
+        {
+            if (seg->close_fd) close(seg->fd);
+            conn->segment_head++;
+        }
+    }
+
+    LOG(LOG_DEBUG, "Sent queued output to client FD %d.", conn->socket);
+    metrics_record_phase(PHASE_SEND, conn->send_start);
+    conn->send_start    = 0;
+    conn->segment_head  = 0;
+    conn->segment_count = 0;
+    conn->out_len       = 0;
+    if (conn->access_count) complete_access(conn, false);
+    return 0;
+}
 
-    LOG("INFO", "Waiting for connections on port %d", self->server->port);
+/**
+ * @brief   Reads everything available on the socket into the request buffer.
+ *
+ * @return  1 if the socket is drained (EAGAIN), 0 on EOF, -1 on error.
+ */
+static int read_from_client(Connection *conn)
+{
+    int client_fd = conn->socket;
 
     while (1)
     {
-        int n_ready = epoll_wait(self->epoll_fd, events, MAX_EPOLL_EVENTS, 60);
-        if (n_ready == -1)
+        // Keep one byte spare so the buffer can always be NUL-terminated
+        if (conn->buffer_len + 1 >= conn->buffer_size)
         {
-            LOG("ERROR", "Failed to wait for epoll events.");
-            continue;
+            if (conn->buffer_size >= MAX_REQUEST_SIZE) return 1;
+            size_t new_size  = conn->buffer_size * 2;
+            char *new_buffer = realloc(conn->buffer, new_size);
+            if (!new_buffer)
+            {
+                LOG(LOG_ERROR, "Failed to reallocate buffer for FD %d", client_fd);
+                return -1;
+            }
+            conn->buffer      = new_buffer;
+            conn->buffer_size = new_size;
+            LOG(LOG_DEBUG, "Buffer size increased to %zu", new_size);
         }
 
-        for (int i = 0; i < n_ready; i++)
+        char *dst          = conn->buffer + conn->buffer_len;
+        size_t room        = conn->buffer_size - conn->buffer_len - 1;
+        ssize_t bytes_read = conn->tls ? tls_recv(conn->tls, dst, room)
+                                       : recv(client_fd, dst, room, 0);
+        if (bytes_read < 0)
         {
-            if (events[i].data.fd == self->server->socket)
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
-                // Accept a new connection
-                struct sockaddr_in client_addr;
-                socklen_t client_len = sizeof(client_addr);
+                // No more data for now. Socket is still open
+                LOG(LOG_DEBUG, "EAGAIN || EWOULDBLOCK - No more data for now.");
+                return 1;
+            }
+            // A peer resetting the connection or garbling TLS is routine, not a server error
+            LOG(errno == ECONNRESET || errno == EPROTO ? LOG_DEBUG : LOG_ERROR,
+                "recv() on FD %d failed: %s", client_fd, strerror(errno));
+            return -1;
+        }
+        if (bytes_read == 0)
+        {
+            LOG(LOG_INFO, "Client FD %d intentionally closed connection (EOF)", client_fd);
+            return 0;
+        }
 
-                int client_fd =
-                    accept(self->server->socket, (struct sockaddr *)&client_addr, &client_len);
-                if (client_fd == -1)
-                {
-                    LOG("ERROR", "Failed to accept a new connection.");
-                    continue;
-                }
+        if (conn->trace[ACCESS_FIRST_BYTE] == 0) conn->trace[ACCESS_FIRST_BYTE] = monotonic_ns();
+        conn->buffer_len += bytes_read;
+        conn->buffer[conn->buffer_len] = '\0';
+        metric_add(&metrics_local()->bytes_in, bytes_read);
+        LOG(LOG_DEBUG, "Read %zd bytes from socket FD %d", bytes_read, client_fd);
+    }
+}
+
+static bool is_head_request(const HTTPRequest *req)
+{
+    const HTTPRequestLine *line = &req->request_line;
+    return line->method_len == 4 && memcmp(line->method, "HEAD", 4) == 0;
+}
+
+static bool is_http10(const HTTPRequest *req)
+{
+    const HTTPRequestLine *line = &req->request_line;
+    return line->protocol_len == 8 && strncmp(line->protocol, "HTTP/1.0", 8) == 0;
+}
+
+/**
+ * @brief   Returns true if the client lets the connection stay open.
+ *
+ * HTTP/1.1 connections persist unless the client sends "Connection: close";
+ * HTTP/1.0 ones only if it sends "Connection: keep-alive".
+ */
+static bool request_wants_keep_alive(const HTTPRequest *req)
+{
+    const HTTPHeader *h = find_header(req, "Connection");
+    if (is_http10(req)) return h && list_has_token(h->value, h->value_len, "keep-alive", NULL);
+    return !h || !list_has_token(h->value, h->value_len, "close", NULL);
+}
+
+/**
+ * @brief   Tells the client whether the connection stays open after response.
+ *
+ * An HTTP/1.0 client needs "Connection: keep-alive" to know it may reuse
+ * the connection; HTTP/1.1 clients assume it. Keep-Alive advertises the
+ * idle timeout and the requests left, so clients can retire the connection
+ * before the server closes it under them.
+ */
+static void add_connection_headers(const Connection *conn, const HTTPRequest *req,
+                                   HTTPResponse *response)
+{
+    if (!conn->keep_alive)
+    {
+        httpresponse_add_header(response, "Connection", "close");
+        return;
+    }
+    if (is_http10(req)) httpresponse_add_header(response, "Connection", "keep-alive");
+
+    const Config *cfg = conn->server->config;
+    char value[48];
+    int len = 0;
+    if (cfg->keepalive_timeout > 0)
+        len = snprintf(value, sizeof(value), "timeout=%d", cfg->keepalive_timeout);
+    if (cfg->keepalive_requests > 0)
+        len += snprintf(value + len, sizeof(value) - len, "%smax=%d", len ? ", " : "",
+                        cfg->keepalive_requests - conn->requests_handled - 1);
+    if (len > 0) httpresponse_add_header(response, "Keep-Alive", value);
+}
+
+/**
+ * @brief   Serializes a response into the connection's output and frees it.
+ *
+ * A file-backed body is queued as file slices; the file descriptor moves to
+ * the connection, which closes it after the last slice. The answer to a
+ * HEAD request keeps the Content-Length a GET would get and drops the body
+ * and the slices, so pipelined responses behind it stay framed.
+ */
+static int queue_response(Connection *conn, HTTPResponse *response, bool head)
+{
+    metrics_count_status(response->status_code);
+    if (head)
+    {
+        if (response->content_length == 0 && response->body && response->body_length > 0)
+            response->content_length = response->body_length;
+        response->body_length = 0;
+    }
+
+    size_t response_len;
+    char *response_str = httpresponse_serialize(response, &response_len);
+    if (!response_str)
+    {
+        LOG(LOG_ERROR, "Failed to serialize HTTP response.");
+        httpresponse_free(response);
+        return -1;
+    }
+
+    int ret = queue_output(conn, response_str, response_len);
+    free(response_str);
+
+    if (ret == OK && !head && response->file_fd >= 0 && response->file_range_count > 0)
+    {
+        int fd            = response->file_fd;
+        response->file_fd = -1;
+        for (int i = 0; i < response->file_range_count; i++)
+        {
+            ResponseFileRange *range = &response->file_ranges[i];
+            bool last                = i == response->file_range_count - 1;
+            if (ret == OK && range->prefix)
+                ret = queue_output(conn, range->prefix, strlen(range->prefix));
+            if (ret == OK)
+                ret = queue_file(conn, fd, range->offset, range->length, last);
+            else if (last)
+                close(fd);
+        }
+        if (ret == OK && response->file_trailer)
+            ret = queue_output(conn, response->file_trailer, strlen(response->file_trailer));
+    }
+
+    httpresponse_free(response);
+    return ret;
+}
+
+/**
+ * @brief   Queues the response to curr_request and drops it from the buffer.
+ *
+ * consumed is the number of buffer bytes the request took; any pipelined
+ * bytes behind it move to the front.
+ */
+static void finish_request(Connection *conn, HTTPResponse *response, size_t consumed)
+{
+    int max_requests = conn->server->config->keepalive_requests;
+    conn->keep_alive = request_wants_keep_alive(conn->curr_request) &&
+                       (max_requests <= 0 || conn->requests_handled + 1 < max_requests);
+    if (response) add_connection_headers(conn, conn->curr_request, response);
+    uint64_t queued_from = conn->out_total;
+    int status           = response ? response->status_code : 0;
+    if (!response || queue_response(conn, response, is_head_request(conn->curr_request)) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to handle HTTP request (no response generated).");
+        conn->keep_alive = false;
+    }
+    log_response(conn, conn->curr_request, status, queued_from);
+    conn->requests_handled++;
+
+    free_http_request(conn->curr_request);
+    conn->curr_request = NULL;
+    conn->buffer_len -= consumed;
+    memmove(conn->buffer, conn->buffer + consumed, conn->buffer_len);
+    conn->buffer[conn->buffer_len] = '\0';
+
+    // The next request is timed afresh; one pipelined behind has already arrived
+    memset(conn->trace, 0, sizeof(conn->trace));
+    if (conn->buffer_len > 0) conn->trace[ACCESS_FIRST_BYTE] = monotonic_ns();
+
+    if (!conn->keep_alive)
+    {
+        LOG(LOG_DEBUG, "Connection is not keep-alive for client FD %d, closing connection...",
+            conn->socket);
+        conn->state = CONN_CLOSING;
+    }
+}
+
+/**
+ * @brief   Answers a request with a canned response and closes: 429 over
+ *          limit_req, 503 when shedding load.
+ *
+ * The request is left unparsed; whatever else the client pipelined is
+ * dropped with the connection.
+ */
+static void reject_request(Connection *conn, int status, const char *response, size_t len)
+{
+    metrics_count_status(status);
+    uint64_t queued_from = conn->out_total;
+    if (queue_output(conn, response, len) < 0)
+        LOG(LOG_ERROR, "Failed to queue %d for client FD %d.", status, conn->socket);
+    log_response(conn, NULL, status, queued_from);
+    conn->keep_alive = false;
+    conn->state      = CONN_CLOSING;
+}
+
+/**
+ * @brief   Handles every complete request in the connection buffer.
+ *
+ * Pipelined requests are answered in order and their responses batched into
+ * one output buffer. Stops at an incomplete request, after a request that
+ * ends the connection, or at a request answered off the loop (a proxied
+ * request waiting on upstream, a static file read by the I/O pool): the
+ * connection stops reading until that completes, so the requests behind it
+ * keep their order.
+ */
+static void process_requests(HTTPServer *self, Connection *conn)
+{
+    bool partial_preface;
+    if (!conn->h2 && starts_with_h2_preface(conn, &partial_preface) && start_h2(conn) < 0)
+        conn->state = CONN_CLOSING;
+    if (conn->h2)
+    {
+        if (conn->state != CONN_CLOSING) process_h2(conn);
+        return;
+    }
+    if (partial_preface) return; // wait for the rest of the preface
+
+    while (conn->buffer_len > 0 && conn->state != CONN_CLOSING && !awaiting_response(conn))
+    {
+        if (conn->curr_request == NULL)
+        {
+            // Load shedding and limit_req act before a byte of the request is parsed
+            if (self->shedding)
+            {
+                metric_add(&metrics_local()->shed_requests, 1);
+                reject_request(conn, 503, service_unavailable, service_unavailable_len);
+                break;
+            }
+            if (!rate_limit_request(&self->limiter, conn->client_key, monotonic_ns()))
+            {
+                metric_add(&metrics_local()->limited_requests, 1);
+                reject_request(conn, 429, too_many_requests, sizeof(too_many_requests) - 1);
+                break;
+            }
+            conn->curr_request = create_http_request();
+        }
+        conn->state = CONN_PROCESSING;
+
+        uint64_t parse_start = monotonic_ns();
+        int consumed = parse_http_request(conn->buffer, conn->buffer_len, conn->curr_request);
+        if (consumed == 0)
+        {
+            if (conn->buffer_len + 1 < MAX_REQUEST_SIZE) break; // wait for the rest
+
+            LOG(LOG_ERROR, "Request on FD %d exceeds %d bytes.", conn->socket, MAX_REQUEST_SIZE);
+            consumed = -1;
+        }
+        metrics_record_phase(PHASE_PARSE, parse_start);
+
+        if (consumed < 0)
+        {
+            // Where a body of unknown framing ends is unknowable, so the connection goes too
+            bool unsupported = consumed == PARSE_UNSUPPORTED;
+            LOG(LOG_ERROR, unsupported ? "Refused a request with a Transfer-Encoding body."
+                                       : "Failed to parse HTTP request.");
+            metric_add(&metrics_local()->parse_errors, 1);
+            conn->curr_request->state = REQ_HANDLE_ERROR;
+
+            int status         = unsupported ? 501 : 400;
+            const char *phrase = unsupported ? "Not Implemented" : "Bad Request";
+            char response_buffer[48];
+            snprintf(response_buffer, sizeof(response_buffer), "<h1>%d %s</h1>", status, phrase);
+            HTTPResponse *response = response_builder(status, phrase, response_buffer,
+                                                      strlen(response_buffer) + 1, "text/html");
+            if (response)
+            {
+                uint64_t queued_from = conn->out_total;
+                httpresponse_add_header(response, "Connection", "close");
+                queue_response(conn, response, false);
+                log_response(conn, NULL, status, queued_from);
+            }
+            conn->keep_alive = false;
+            conn->state      = CONN_CLOSING;
+            break;
+        }
+        conn->curr_request->state  = REQ_PARSE_DONE;
+        conn->trace[ACCESS_PARSED] = monotonic_ns();
+        LOG(LOG_DEBUG, "Successfully parsed HTTP request.");
+
+        if (wants_h2c_upgrade(conn))
+        {
+            upgrade_to_h2(conn, consumed);
+            if (conn->state == CONN_CLOSING) break;
+            conn->state = CONN_ESTABLISHED;
+            process_h2(conn);
+            return;
+        }
+
+        metric_add(&metrics_local()->requests, 1);
+        uint64_t handle_start = monotonic_ns();
+        bool deferred;
+        HTTPResponse *response = dispatch_request(self, conn, conn->curr_request, 0, &deferred);
+        metrics_record_phase(PHASE_HANDLE, handle_start);
+        conn->trace[ACCESS_HANDLER] = handle_start;
+
+        if (awaiting_response(conn))
+        {
+            // complete_fetch() or finish_handler_job() picks up from here
+            conn->request_size = consumed;
+            conn->state        = conn->fetch ? CONN_WAITING_UPSTREAM : CONN_WAITING_HANDLER;
+            if (!conn->write_blocked) watch_connection(self, conn, 0);
+            return;
+        }
+        finish_request(conn, response, consumed);
+    }
+
+    if (conn->state == CONN_PROCESSING) conn->state = CONN_ESTABLISHED;
+}
+
+/**
+ * @brief   Sends queued output and moves the connection on once it drains.
+ *
+ * Closes the connection if sending fails, or once everything is sent and
+ * the connection is ending.
+ */
+static void drive_output(HTTPServer *self, Connection *conn)
+{
+    while (1)
+    {
+        int flushed = flush_output(conn);
+        if (flushed < 0)
+        {
+            close_connection(self, conn);
+            return;
+        }
+        if (flushed > 0)
+        {
+            if (!conn->write_blocked)
+            {
+                conn->write_blocked = true;
+                watch_connection(self, conn, EPOLLOUT);
+            }
+            if (conn->state != CONN_CLOSING && !awaiting_response(conn))
+                conn->state = CONN_SENDING_RESPONSE;
+            return;
+        }
+
+        if (conn->fetch && conn->fetch->splicing)
+        {
+            // Headers are out; the body follows straight from the backend
+            relay_body(self, conn->fetch);
+            return;
+        }
+        if (awaiting_response(conn))
+        {
+            // Nothing more to send before the response arrives; stay quiet until then
+            if (conn->write_blocked)
+            {
+                conn->write_blocked = false;
+                watch_connection(self, conn, 0);
+            }
+            return;
+        }
+        if (conn->state == CONN_CLOSING || conn->state == CONN_ERROR)
+        {
+            close_connection(self, conn);
+            return;
+        }
+        if (conn->write_blocked)
+        {
+            // Output drained: resume reading and answer requests that queued up meanwhile
+            conn->write_blocked = false;
+            conn->state         = CONN_ESTABLISHED;
+            watch_connection(self, conn, EPOLLIN);
+            process_requests(self, conn);
+            if (output_pending(conn) || conn->state == CONN_CLOSING) continue;
+        }
+        return;
+    }
+}
+
+/**
+ * @brief   Drives one client connection after an epoll event.
+ */
+static void handle_connection_event(HTTPServer *self, Connection *conn, uint32_t events)
+{
+    conn->last_active = time(NULL);
+
+    if (conn->tunnel)
+    {
+        relay_tunnel(self, conn->tunnel);
+        return;
+    }
+
+    if (conn->state == CONN_HANDSHAKE)
+    {
+        if (continue_handshake(self, conn) < 0)
+        {
+            close_connection(self, conn);
+            return;
+        }
+        if (conn->state == CONN_HANDSHAKE) return;
+        // The first request may have arrived with the handshake and already be decrypted
+        events = EPOLLIN;
+    }
+
+    // A connection waiting on a response does not read; see process_requests()
+    if ((events & EPOLLIN) && !awaiting_response(conn))
+    {
+        int status = read_from_client(conn);
+        if (status < 0)
+        {
+            close_connection(self, conn);
+            return;
+        }
+        if (status == 0)
+        {
+            // Answer whatever complete requests arrived before the EOF, then close
+            process_requests(self, conn);
+            conn->keep_alive = false;
+            conn->state      = CONN_CLOSING;
+        }
+        else
+        {
+            process_requests(self, conn);
+        }
+    }
+    else if (events & (EPOLLERR | EPOLLHUP))
+    {
+        close_connection(self, conn);
+        return;
+    }
+
+    drive_output(self, conn);
+}
+
+/**
+ * @brief   Closes client connections idle for longer than keepalive_timeout,
+ *          and tunnels that passed no bytes for tunnel_timeout.
+ *
+ * Only connections with nothing in flight count as idle: no request waiting
+ * on upstream or the disk, no output left to send and, on HTTP/2, no open
+ * stream. A partially received request does not keep its connection alive
+ * either.
+ *
+ * Under overload, keep-alive connections waiting for their next request are
+ * closed whatever their age: they hold a slot and buffers while doing
+ * nothing, and are the cheapest clients to turn away. Tunnels are left
+ * alone: they carry sessions that cannot be resumed on a new connection.
+ */
+static void close_idle_connections(HTTPServer *self, time_t now, bool overloaded)
+{
+    int timeout        = self->config->keepalive_timeout;
+    int tunnel_timeout = self->config->tunnel_timeout;
+    if (timeout <= 0 && tunnel_timeout <= 0 && !overloaded) return;
+
+    for (size_t j = 0; j < self->connection_slots; j++)
+    {
+        Connection *conn = &self->connections[j];
+        if (conn->socket <= 0) continue;
+        if (conn->tunnel)
+        {
+            if (tunnel_timeout <= 0 || now - conn->last_active <= tunnel_timeout) continue;
+            LOG(LOG_DEBUG, "Closing idle tunnel of client FD %d.", conn->socket);
+            close_connection(self, conn);
+            continue;
+        }
+        if (awaiting_response(conn) || output_pending(conn) ||
+            (conn->h2 && !h2_session_idle(conn->h2)))
+            continue;
+
+        bool expired = timeout > 0 && now - conn->last_active > timeout;
+        bool between_requests =
+            conn->h2 || (conn->requests_handled > 0 && conn->buffer_len == 0);
+        if (!expired && !(overloaded && between_requests)) continue;
+
+        LOG(LOG_DEBUG, "Closing idle connection on FD %d.", conn->socket);
+        if (!expired) metric_add(&metrics_local()->shed_connections, 1);
+        close_connection(self, conn);
+    }
+}
+
+/**
+ * @brief   Current resident set size of the process, or 0 if unknown.
+ */
+static size_t resident_memory(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void watch_listeners(HTTPServer *self, bool watch)
+{
+    struct epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = (void *)&listener_kind;
+    epoll_ctl(self->epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, self->server->socket, &ev);
+    if (self->tls_server)
+    {
+        ev.data.ptr = (void *)&tls_listener_kind;
+        epoll_ctl(self->epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, self->tls_server->socket,
+                  &ev);
+    }
+}
+
+/**
+ * @brief   Decides after each event batch what the loop admits.
+ *
+ * Loop lag past overload_latency_ms or memory past overload_memory makes the
+ * loop shed new requests with a 503. Either of those, or overload_connections
+ * open connections, takes the listeners out of epoll: new clients wait in the
+ * kernel backlog instead of being accepted only to be closed, and idle
+ * keep-alive connections are closed to make room. Accepting resumes once the
+ * loop is no longer shedding and connections have dropped to 7/8 of the limit.
+ */
+static void update_admission(HTTPServer *self)
+{
+    const Config *cfg = self->config;
+    uint64_t max_lag  = (uint64_t)cfg->overload_latency_ms * 1000000;
+    bool lagging      = max_lag > 0 && self->loop_lag > max_lag;
+    bool bloated      = cfg->overload_memory > 0 && self->resident_bytes > cfg->overload_memory;
+    size_t max_conns  = cfg->overload_connections > 0 ? (size_t)cfg->overload_connections : 0;
+    self->shedding    = lagging || bloated;
+
+    if (!self->accept_paused && (self->shedding || (max_conns && self->active_count >= max_conns)))
+    {
+        LOG(LOG_WARN, "Worker %d stops accepting: %zu connections, loop lag %lu us, %zu bytes.",
+            self->worker_id, self->active_count, (unsigned long)(self->loop_lag / 1000),
+            self->resident_bytes);
+        watch_listeners(self, false);
+        self->accept_paused = true;
+        metric_add(&metrics_local()->accept_pauses, 1);
+        close_idle_connections(self, time(NULL), true);
+    }
+    else if (self->accept_paused && !self->shedding &&
+             (!max_conns || self->active_count < max_conns - max_conns / 8))
+    {
+        LOG(LOG_INFO, "Worker %d accepts connections again.", self->worker_id);
+        watch_listeners(self, true);
+        self->accept_paused = false;
+    }
+}
+
+static int start_listening(SocketServer *listener)
+{
+    if (bind(listener->socket, (struct sockaddr *)&listener->address,
+             sizeof(listener->address)) < 0)
+    {
+        return SOCKET_BIND_ERROR;
+    }
+    if ((listen(listener->socket, listener->queue)) < 0)
+    {
+        return SOCKET_LISTEN_ERROR;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Runs one event loop until httpserver_stop().
+ *
+ * The loop pins its thread first, so the connection table it allocates
+ * lands on its own NUMA node.
+ */
+static int run_loop(HTTPServer *self)
+{
+    if (self->cpu >= 0) pin_thread_to_cpu(self->cpu);
+    if (modules_init_worker(self->worker_id) < 0) return -1;
+
+    // Initialize epoll
+    self->epoll_fd = epoll_create1(0);
+    if (self->epoll_fd == -1)
+    {
+        LOG(LOG_ERROR, "Failed to initialize epoll instance.");
+        exit(1);
+    }
+
+    // Initialize connections and the idle backend connections they share. The table is
+    // mapped, not touched: pages of slots never used cost no memory.
+    self->connection_slots = self->config->max_connections > 0
+                                 ? (size_t)self->config->max_connections
+                                 : DEFAULT_MAX_CONNECTIONS;
+    self->connections = node_alloc(self->connection_slots * sizeof(Connection), self->cpu);
+    if (!self->connections ||
+        upstream_pool_init(&self->upstream_pool, self->config->upstream_keepalive,
+                           self->config->upstream_keepalive_timeout) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to allocate memory for connections.");
+        node_free(self->connections, self->connection_slots * sizeof(Connection));
+        self->connections = NULL;
+        close(self->epoll_fd);
+        return -1;
+    }
+    self->active_count      = 0;
+    self->free_hint         = 0;
+    self->spare_pipes.count = 0;
+
+    // Add server socket to epoll
+    struct epoll_event ev, events[MAX_EPOLL_EVENTS];
+    ev.events   = EPOLLIN;
+    ev.data.ptr = (void *)&listener_kind;
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->server->socket, &ev) == -1)
+    {
+        close(self->epoll_fd);
+        close(self->server->socket);
+        LOG(LOG_ERROR, "Failed to add server socket to epoll event loop.");
+        return -1;
+    }
+    if (self->tls_server)
+    {
+        ev.data.ptr = (void *)&tls_listener_kind;
+        if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->tls_server->socket, &ev) == -1)
+        {
+            close(self->epoll_fd);
+            LOG(LOG_ERROR, "Failed to add TLS server socket to epoll event loop.");
+            return -1;
+        }
+    }
+
+    // Coroutines register their sockets with this loop's epoll instance
+    self->handler_jobs = NULL;
+    co_scheduler_init(&self->coroutines, self->epoll_fd, EVENT_COROUTINE);
+
+    // File reads finished by the I/O pool come back through an eventfd
+    if (self->io_pool)
+    {
+        ev.data.ptr = (void *)&io_done_kind;
+        if (io_completions_init(&self->io_done) < 0 ||
+            epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->io_done.fd, &ev) == -1)
+        {
+            LOG(LOG_WARN, "Worker %d reads static files on its event loop.", self->worker_id);
+            io_completions_free(&self->io_done);
+            self->io_pool = NULL;
+        }
+    }
+
+    metrics_register_worker();
+    if (self->cpu >= 0)
+        LOG(LOG_INFO, "Worker %d waiting for connections on port %d, CPU %d", self->worker_id,
+            self->server->port, self->cpu);
+    else
+        LOG(LOG_INFO, "Worker %d waiting for connections on port %d", self->worker_id,
+            self->server->port);
+    if (self->tls_server && self->worker_id == 0)
+        LOG(LOG_INFO, "Waiting for TLS connections on port %d", self->tls_server->port);
+
+    time_t last_sweep    = time(NULL);
+    self->loop_lag       = 0;
+    self->resident_bytes = self->config->overload_memory > 0 ? resident_memory() : 0;
+    self->shedding       = false;
+    self->accept_paused  = false;
+    while (atomic_load_explicit(&self->running, memory_order_relaxed))
+    {
+        int timeout = co_next_timeout(&self->coroutines, 60);
+        int n_ready = epoll_wait(self->epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+        if (n_ready == -1)
+        {
+            if (errno != EINTR) LOG(LOG_ERROR, "Failed to wait for epoll events.");
+            continue;
+        }
+        uint64_t batch_start = monotonic_ns();
+
+        for (int i = 0; i < n_ready; i++)
+        {
+            switch (*(const EventKind *)events[i].data.ptr)
+            {
+            case EVENT_LISTENER:
+                accept_connections(self, self->server);
+                break;
+            case EVENT_TLS_LISTENER:
+                accept_connections(self, self->tls_server);
+                break;
+            case EVENT_CLIENT:
+            {
+                // Skip events for a connection an earlier event in this batch closed
+                Connection *conn = events[i].data.ptr;
+                if (conn->socket > 0) handle_connection_event(self, conn, events[i].events);
+                break;
+            }
+            case EVENT_UPSTREAM:
+                handle_fetch_event(self, events[i].data.ptr, events[i].events);
+                break;
+            case EVENT_IO_DONE:
+                finish_file_jobs(self);
+                break;
+            case EVENT_COROUTINE:
+                co_handle_event(events[i].data.ptr, events[i].events);
+                break;
+            case EVENT_TUNNEL:
+            {
+                // A tunnel's backend socket; the connection may have closed earlier in this batch
+                Connection *conn = (Connection *)((char *)events[i].data.ptr -
+                                                  offsetof(Connection, tunnel_kind));
+                if (conn->tunnel) relay_tunnel(self, conn->tunnel);
+                break;
+            }
+            }
+        }
+        // Coroutines spawned by this batch start here, along with those whose deadline passed
+        co_run_due(&self->coroutines);
+
+        // Idle connections are looked for once a second, not on every wakeup
+        time_t now = time(NULL);
+        if (now != last_sweep)
+        {
+            close_idle_connections(self, now, self->accept_paused);
+            if (self->config->overload_memory > 0) self->resident_bytes = resident_memory();
+            last_sweep = now;
+        }
+
+        // Moving average over 8 batches; idle wakeups pull it back down
+        uint64_t batch_time = monotonic_ns() - batch_start;
+        self->loop_lag      = self->loop_lag - self->loop_lag / 8 + batch_time / 8;
+        if (n_ready > 0) metrics_record_phase(PHASE_LOOP, batch_start);
+        update_admission(self);
+    }
+
+    for (size_t j = 0; j < self->connection_slots; j++)
+    {
+        if (self->connections[j].socket > 0) close_connection(self, &self->connections[j]);
+    }
+    for (size_t i = 0; i < self->spare_pipes.count; i++)
+    {
+        close(self->spare_pipes.fds[i][0]);
+        close(self->spare_pipes.fds[i][1]);
+    }
+    while (self->fetches)
+        free_fetch(self, self->fetches);
+    // Coroutine handlers see their pending I/O fail and end
+    co_scheduler_cancel(&self->coroutines);
+    // Reads still on the pool complete into io_done; they are only freed from here
+    while (self->handler_jobs)
+    {
+        struct pollfd pfd = {.fd = self->io_done.fd, .events = POLLIN};
+        poll(&pfd, 1, 100);
+        finish_file_jobs(self);
+    }
+    if (self->io_pool) io_completions_free(&self->io_done);
+    co_scheduler_free(&self->coroutines);
+    upstream_pool_free(&self->upstream_pool);
+    node_free(self->connections, self->connection_slots * sizeof(Connection));
+    self->connections = NULL;
+
+    close(self->epoll_fd);
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    HTTPServer *self = arg;
+    if (run_loop(self) < 0) LOG(LOG_ERROR, "Worker %d failed to start.", self->worker_id);
+    return NULL;
+}
+
+/**
+ * @brief   Points each worker's listeners at the CPU it is pinned to.
+ *
+ * Connections then stay on the CPU whose RX queue received them, from the
+ * interrupt through accept to the response.
+ */
+static void steer_listeners(HTTPServer *self)
+{
+    int cpus[MAX_WORKERS];
+    int count = 0;
+    for (int i = 0; i <= self->worker_count && count < MAX_WORKERS; i++)
+    {
+        HTTPServer *worker = i == 0 ? self : &self->workers[i - 1];
+        cpus[count++]      = worker->cpu;
+        prefer_incoming_cpu(worker->server->socket, worker->cpu);
+        if (worker->tls_server) prefer_incoming_cpu(worker->tls_server->socket, worker->cpu);
+    }
+    steer_reuseport_group(self->server->socket, cpus, count);
+    if (self->tls_server) steer_reuseport_group(self->tls_server->socket, cpus, count);
+}
+
+/**
+ * @brief   Runs the server: worker 0 on the calling thread and every other
+ *          worker on a thread of its own. Returns once all of them stopped.
+ */
+int launch(HTTPServer *self)
+{
+    // Listeners join their SO_REUSEPORT group in worker order, which the CPU selector relies on
+    int status = start_listening(self->server);
+    if (status == OK && self->tls_server) status = start_listening(self->tls_server);
+    for (int i = 0; status == OK && i < self->worker_count; i++)
+    {
+        status = start_listening(self->workers[i].server);
+        if (status == OK && self->workers[i].tls_server)
+            status = start_listening(self->workers[i].tls_server);
+    }
+    if (status != OK) return status;
+    if (self->worker_count > 0 && self->cpu >= 0) steer_listeners(self);
+
+    int started = 0;
+    for (; started < self->worker_count; started++)
+    {
+        HTTPServer *worker = &self->workers[started];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+        {
+            LOG(LOG_ERROR, "Failed to start worker %d.", worker->worker_id);
+            status = -1;
+            break;
+        }
+    }
+
+    if (status == OK) status = run_loop(self);
+    httpserver_stop(self);
+    for (int i = 0; i < started; i++)
+        pthread_join(self->workers[i].thread, NULL);
+    return status;
+}
+
+/**
+ * @brief   Asks a running launch() to return; safe to call from another thread.
+ *
+ * Every worker loop notices within one epoll_wait() timeout.
+ */
+void httpserver_stop(HTTPServer *self)
+{
+    atomic_store_explicit(&self->running, false, memory_order_relaxed);
+    for (int i = 0; i < self->worker_count; i++)
+        atomic_store_explicit(&self->workers[i].running, false, memory_order_relaxed);
+}
+
+/**
+ * @brief   Serves aggregated metrics; JSON when asked via "?json" or an Accept header.
+ */
+static HTTPResponse *stats_handler(HTTPRequest *request_ptr)
+{
+    bool json = memmem(request_ptr->request_line.uri, request_ptr->request_line.uri_len, "json",
+                       4) != NULL;
+    for (int i = 0; !json && i < request_ptr->header_count; i++)
+    {
+        HTTPHeader *h = &request_ptr->headers[i];
+        json = h->name_len == 6 && strncasecmp(h->name, "Accept", 6) == 0 &&
+               memmem(h->value, h->value_len, "application/json", 16) != NULL;
+    }
+
+    size_t len;
+    char *body = metrics_render(json, &len);
+    if (!body)
+    {
+        char response_buffer[] = "<h1>500 Internal Server Error</h1>";
+        return response_builder(500, "Internal Server Error", response_buffer,
+                                sizeof(response_buffer), "text/html");
+    }
+
+    HTTPResponse *response = response_builder(200, "OK", body, len,
+                                              json ? "application/json" : "text/plain");
+    free(body);
+    if (response) httpresponse_add_header(response, "Cache-Control", "no-store");
+    return response;
+}
+
+/**
+ * @brief   Picks the next backend of an upstream group round-robin.
+ *
+ * Group -1 is the top-level backend list, which precedes every upstream
+ * section's entries; with no top-level backend it falls back to
+ * localhost:8002.
+ *
+ * @return  Backend index (for metrics and the keep-alive pool), or -1 if the
+ *          entry is malformed.
+ */
+static int select_backend(int group, UpstreamAddress *addr)
+{
+    static _Thread_local unsigned int next_backend[MAX_UPSTREAM_GROUPS + 1];
+
+    int first = 0;
+    int count = 0;
+    if (server_config && group >= 0)
+    {
+        first = server_config->upstreams[group].first;
+        count = server_config->upstreams[group].count;
+    }
+    else if (server_config)
+    {
+        count = server_config->upstream_count > 0 ? server_config->upstreams[0].first
+                                                  : (int)server_config->backend_count;
+    }
+    if (count == 0) return upstream_parse_address("localhost:8002", addr);
+
+    int index = first + next_backend[group + 1]++ % count;
+    if (upstream_parse_address(server_config->backends[index], addr) < 0) return -1;
+    return index;
+}
+
+static HTTPResponse *bad_gateway(void)
+{
+    char response_buffer[] = "<h1>502 Bad Gateway</h1>";
+    return response_builder(502, "Bad Gateway", response_buffer, sizeof(response_buffer),
+                            "text/html");
+}
+
+/**
+ * @brief   Builds the request sent upstream for a proxy location, body included.
+ *
+ * The client's end-to-end headers go along; hop-by-hop ones stay behind,
+ * and Host names the backend (Unix socket backends get "localhost"). For
+ * an upgrade, Upgrade and Connection go along too, since the handshake
+ * lives in them. With strip_prefix the location path is removed from the
+ * URI. Otherwise, unless keep_alive is set, the backend is asked to close
+ * the connection after responding.
+ *
+ * @return  A heap buffer of *len bytes, or NULL.
+ */
+static char *build_upstream_request(const HTTPRequest *req, const Location *route,
+                                    const UpstreamAddress *addr, bool keep_alive, bool upgrade,
+                                    size_t *len)
+{
+    size_t strip      = route->strip_prefix ? strlen(route->path) : 0;
+    const char *path  = req->request_line.uri + strip;
+    size_t path_len   = req->request_line.uri_len - strip;
+    const char *slash = path_len > 0 && path[0] == '/' ? "" : "/";
+    const char *host  = addr->is_unix ? "localhost" : addr->host;
+
+    const HTTPHeader *connection = find_header(req, "Connection");
+    const char *listed           = connection ? connection->value : NULL;
+    size_t listed_len            = connection ? connection->value_len : 0;
+
+    size_t size = req->request_line.method_len + path_len + strlen(host) + 96 + req->body_len;
+    for (int i = 0; i < req->header_count; i++)
+        size += req->headers[i].name_len + req->headers[i].value_len + 4;
+    char *request = malloc(size);
+    if (!request) return NULL;
+
+    size_t n = snprintf(request, size, "%.*s %s%.*s HTTP/1.1\r\nHost: %s\r\n",
+                        (int)req->request_line.method_len, req->request_line.method, slash,
+                        (int)path_len, path, host);
+    for (int i = 0; i < req->header_count; i++)
+    {
+        const HTTPHeader *h = &req->headers[i];
+        bool handshake =
+            upgrade && ((h->name_len == 7 && strncasecmp(h->name, "Upgrade", 7) == 0) ||
+                        (h->name_len == 10 && strncasecmp(h->name, "Connection", 10) == 0));
+        if (!handshake && !is_forwarded_request_header(h->name, h->name_len, listed, listed_len))
+            continue;
+        n += snprintf(request + n, size - n, "%.*s: %.*s\r\n", (int)h->name_len, h->name,
+                      (int)h->value_len, h->value);
+    }
+    // The body is forwarded as parsed, so its framing is restated
+    if (!upgrade || req->body_len > 0)
+        n += snprintf(request + n, size - n, "Content-Length: %zu\r\n", req->body_len);
+    if (!upgrade && !keep_alive) n += snprintf(request + n, size - n, "Connection: close\r\n");
+    n += snprintf(request + n, size - n, "\r\n");
+    if (req->body_len > 0) memcpy(request + n, req->body, req->body_len);
+    *len = n + req->body_len;
+    return request;
+}
+
+/**
+ * @brief   Turns a complete upstream response into the response relayed to the client.
+ *
+ * Status, reason and every end-to-end header are relayed; hop-by-hop
+ * ones are dropped and the framing is restated for the client. The body
+ * is everything after the headers. proxy_response must be NUL-terminated.
+ * The header block (after the status line) is reported for cache
+ * freshness checks.
+ *
+ * @return  The response, or NULL if the upstream response is malformed.
+ */
+static HTTPResponse *relay_response(const char *proxy_response, size_t response_len,
+                                    const char **headers, size_t *headers_len)
+{
+    int status_code = 0;
+    const char *reason;
+    size_t reason_len;
+    int line_len =
+        parse_response_line(proxy_response, response_len, &status_code, &reason, &reason_len);
+    const char *body = memmem(proxy_response, response_len, "\r\n\r\n", 4);
+    if (line_len < 0 || !body) return NULL;
+    body += 4;
+    *headers     = proxy_response + line_len;
+    *headers_len = body - *headers;
+
+    LOG(LOG_DEBUG, "Received %zu bytes response from backend.", response_len);
+
+    char phrase[64];
+    snprintf(phrase, sizeof(phrase), "%.*s", (int)reason_len, reason);
+
+    char content_type[128] = "application/octet-stream";
+    const char *ct         = strcasestr(proxy_response, "\r\nContent-Type:");
+    if (ct && ct < body)
+    {
+        ct += strlen("\r\nContent-Type:");
+        while (*ct == ' ')
+            ct++;
+        size_t ct_len = strcspn(ct, "\r\n");
+        snprintf(content_type, sizeof(content_type), "%.*s", (int)ct_len, ct);
+    }
+
+    size_t body_len        = response_len - (body - proxy_response);
+    HTTPResponse *response = response_builder(status_code, phrase, body, body_len, content_type);
+    if (response && add_end_to_end_headers(response, *headers, *headers_len) < 0)
+    {
+        httpresponse_free(response);
+        return NULL;
+    }
+
+    // The answer to HEAD states the length of a body it does not carry
+    size_t length_len;
+    const char *length = find_raw_header(*headers, *headers_len, "Content-Length", &length_len);
+    if (response && body_len == 0 && length) response->content_length = strtoull(length, NULL, 10);
+    return response;
+}
+
+/**
+ * @brief   Forwards a request to a backend of its location's upstream group
+ *          and relays the response.
+ *
+ * Written as blocking code around the same Upstream exchange start_proxy()
+ * drives, so chunked and keep-alive responses are framed alike: each wait
+ * on the backend socket is a co_wait(). On an event loop (self set) the
+ * backend connection comes from and goes back to the loop's keep-alive
+ * pool, and a pooled connection the backend had closed is replaced once.
+ * Cacheable responses are stored in the proxy cache; cache_status (from
+ * the lookup already made) is reported in X-Cache-Status. The event loop
+ * uses start_proxy() instead, unless the location has "coroutine = on":
+ * then this runs on a coroutine and its waits yield to the loop rather
+ * than block it. Such requests are not coalesced.
+ */
+static HTTPResponse *proxy_handler(HTTPServer *self, HTTPRequest *request_ptr,
+                                   const Location *route, CacheStatus cache_status)
+{
+    UpstreamAddress addr;
+    int backend = select_backend(route->group, &addr);
+    if (backend < 0)
+    {
+        LOG(LOG_ERROR, "Malformed backend address in config.");
+        return bad_gateway();
+    }
+
+    UpstreamPool *pool = self && self->upstream_pool.capacity > 0 ? &self->upstream_pool : NULL;
+    size_t proxy_request_len;
+    char *proxy_request = build_upstream_request(request_ptr, route, &addr, pool != NULL, false,
+                                                 &proxy_request_len);
+    if (!proxy_request)
+    {
+        LOG(LOG_ERROR, "Failed to build proxy request.");
+        char response_buffer[] = "<h1>Internal Server Error</h1>";
+        return response_builder(500, "Internal Server Error", response_buffer,
+                                sizeof(response_buffer), "text/html");
+    }
+
+    uint64_t upstream_start_ns = monotonic_ns();
+    int pooled_fd              = pool ? upstream_pool_get(pool, backend) : -1;
+    if (pooled_fd >= 0) metric_add(&metrics_local()->upstream_reused, 1);
+
+    Upstream upstream;
+    uint32_t wanted = 0;
+    if (upstream_start(&upstream, &addr, pooled_fd, proxy_request, proxy_request_len) == OK)
+        wanted = upstream_step(&upstream, 0);
+    while (wanted != 0 || (upstream.state == UPSTREAM_FAILED && upstream.retryable))
+    {
+        if (wanted == 0)
+        {
+            if (upstream_retry(&upstream, &addr) < 0) break;
+            wanted = upstream_step(&upstream, 0);
+            continue;
+        }
+        if (co_wait(upstream.fd, wanted) < 0)
+        {
+            LOG(LOG_ERROR, "Waiting on backend FD %d failed: %s", upstream.fd, strerror(errno));
+            upstream.state = UPSTREAM_FAILED;
+            break;
+        }
+        wanted = upstream_step(&upstream, wanted);
+    }
+
+    const char *headers;
+    size_t headers_len;
+    HTTPResponse *response =
+        upstream.state == UPSTREAM_DONE
+            ? relay_response(upstream.response, upstream.response_len, &headers, &headers_len)
+            : NULL;
+    if (!response)
+    {
+        LOG(LOG_ERROR, "Failed to read a valid response from backend.");
+        metrics_record_upstream(backend, upstream_start_ns, true);
+        upstream_release(&upstream);
+        return bad_gateway();
+    }
+    metrics_record_upstream(backend, upstream_start_ns, false);
+
+    if (cache_status == CACHE_MISS || cache_status == CACHE_EXPIRED)
+    {
+        char key[INITIAL_BUFFER_SIZE];
+        size_t key_len = proxy_cache_key(request_ptr, &server_config->proxy_cache, key,
+                                         sizeof(key));
+        proxy_cache_store(key, key_len, &server_config->proxy_cache, headers, headers_len,
+                          response);
+    }
+    proxy_cache_set_status(response, cache_status);
+
+    if (pool && upstream.reusable) upstream_pool_put(pool, backend, upstream_detach(&upstream));
+    upstream_release(&upstream);
+    return response;
+}
+
+// ---------- ACCESS LOG ----------
+
+/**
+ * @brief   Time from the accept of conn to a monotonic stamp, for an AccessRecord.
+ *
+ * A request that joined a fetch already in flight can find its backend
+ * connected before its own connection was accepted; that counts as 0.
+ */
+static uint64_t since_accept(const Connection *conn, uint64_t stamp)
+{
+    if (stamp == 0) return ACCESS_UNSET;
+    return stamp > conn->accepted_at ? stamp - conn->accepted_at : 0;
+}
+
+/**
+ * @brief   True if answered requests get an access record: for the access
+ *          log, or for the log hook of a module.
+ */
+static bool recording_access(void)
+{
+    return access_log_on || modules_logging();
+}
+
+static void copy_field(char *dst, size_t cap, const char *src, size_t len)
+{
+    if (!src) return;
+    if (len >= cap) len = cap - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/**
+ * @brief   Fills the parts of an access record known when a request is answered.
+ *
+ * req is NULL for requests turned away before they were parsed. The phases
+ * come from the connection's trace.
+ */
+static void fill_access(AccessRecord *rec, const Connection *conn, const HTTPRequest *req)
+{
+    memset(rec, 0, offsetof(AccessRecord, uri));
+    rec->worker = conn->server->worker_id;
+    rec->family = conn->client_addr.ss_family;
+    if (rec->family == AF_INET || rec->family == AF_INET6)
+        memcpy(rec->addr, get_in_addr((struct sockaddr *)&conn->client_addr),
+               rec->family == AF_INET ? 4 : 16);
+    for (int i = 0; i < ACCESS_PHASES; i++)
+        rec->phases[i] = since_accept(conn, conn->trace[i]);
+
+    if (!req) return;
+    const HTTPRequestLine *line = &req->request_line;
+    if (line->uri)
+    {
+        rec->uri_len = line->uri_len < ACCESS_URI_MAX ? line->uri_len : ACCESS_URI_MAX;
+        memcpy(rec->uri, line->uri, rec->uri_len);
+    }
+    copy_field(rec->method, sizeof(rec->method), line->method, line->method_len);
+    // HTTP/2 requests reach the handlers rewritten as HTTP/1.1
+    if (conn->h2)
+        copy_field(rec->protocol, sizeof(rec->protocol), "HTTP/2.0", 8);
+    else
+        copy_field(rec->protocol, sizeof(rec->protocol), line->protocol, line->protocol_len);
+}
+
+static void write_access(AccessRecord *rec)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec->time_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    if (access_log_on) access_log_write(rec);
+    modules_log(rec);
+}
+
+/**
+ * @brief   Notes an HTTP/1.1 response that was just queued.
+ *
+ * Its record waits on the connection until the output up to its last byte
+ * has gone to the socket; see complete_access(). queued_from is out_total
+ * before the response was queued.
+ */
+static void log_response(Connection *conn, const HTTPRequest *req, int status,
+                         uint64_t queued_from)
+{
+    if (!recording_access()) return;
+    if (conn->access_count == conn->access_cap)
+    {
+        size_t cap           = conn->access_cap ? conn->access_cap * 2 : 2;
+        PendingAccess *grown = realloc(conn->access, cap * sizeof(*grown));
+        if (!grown) return;
+        conn->access     = grown;
+        conn->access_cap = cap;
+    }
+    PendingAccess *pending = &conn->access[conn->access_count++];
+    fill_access(&pending->record, conn, req);
+    pending->record.status = status;
+    pending->out_start     = queued_from;
+    pending->out_end       = conn->out_total;
+}
+
+/**
+ * @brief   Writes the records of responses that are through, in order.
+ *
+ * When the connection is closing every record goes out, with the bytes
+ * that made it and no last byte for a response cut short.
+ */
+static void complete_access(Connection *conn, bool closing)
+{
+    size_t done = 0;
+    while (done < conn->access_count && (closing || conn->access[done].out_end <= conn->sent_total))
+        done++;
+    if (done == 0) return;
+
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < done; i++)
+    {
+        PendingAccess *pending = &conn->access[i];
+        bool sent              = pending->out_end <= conn->sent_total;
+        uint64_t sent_end      = sent ? pending->out_end : conn->sent_total;
+        pending->record.bytes_sent =
+            sent_end > pending->out_start ? sent_end - pending->out_start : 0;
+        pending->record.phases[ACCESS_LAST_BYTE] = sent ? since_accept(conn, now) : ACCESS_UNSET;
+        write_access(&pending->record);
+    }
+    conn->access_count -= done;
+    memmove(conn->access, conn->access + done, conn->access_count * sizeof(*conn->access));
+}
+
+/**
+ * @brief   Logs an HTTP/2 stream once its response is handed to the session.
+ *
+ * The frames of all streams share the connection's output, so a stream is
+ * not followed to the socket: its last byte is when the response was
+ * submitted and its bytes are the body's. upstream is the fetch that
+ * answered it, or NULL.
+ */
+static void log_stream(const Connection *conn, AccessRecord *rec, const Upstream *upstream,
+                       const HTTPResponse *response)
+{
+    if (upstream)
+    {
+        rec->phases[ACCESS_UPSTREAM_CONNECT]    = since_accept(conn, upstream->connected_at);
+        rec->phases[ACCESS_UPSTREAM_FIRST_BYTE] = since_accept(conn, upstream->first_byte_at);
+    }
+    if (response)
+    {
+        rec->status     = response->status_code;
+        rec->bytes_sent = response->content_length > 0 ? response->content_length
+                                                       : (uint64_t)response->body_length;
+    }
+    rec->phases[ACCESS_LAST_BYTE] = since_accept(conn, monotonic_ns());
+    write_access(rec);
+}
+
+/**
+ * @brief   Copies the backend phases of a fetch into an HTTP/1.1 connection's trace.
+ */
+static void trace_upstream(Connection *conn, const Upstream *upstream)
+{
+    conn->trace[ACCESS_UPSTREAM_CONNECT]    = upstream->connected_at;
+    conn->trace[ACCESS_UPSTREAM_FIRST_BYTE] = upstream->first_byte_at;
+}
+
+// ---------- UPSTREAM FETCHES ----------
+
+
+/**
+ * @brief   Adds a request to a fetch's waiters.
+ *
+ * An HTTP/1.1 connection (stream_id 0) stops reading until the fetch
+ * completes; an HTTP/2 connection carries on with its other streams, so
+ * the access record of a stream travels with its waiter.
+ */
+static int add_waiter(ProxyFetch *fetch, Connection *conn, uint32_t stream_id,
+                      const HTTPRequest *req)
+{
+    if (fetch->waiter_count == fetch->waiter_cap)
+    {
+        size_t cap         = fetch->waiter_cap ? fetch->waiter_cap * 2 : 4;
+        FetchWaiter *grown = realloc(fetch->waiters, cap * sizeof(*grown));
+        if (!grown) return -1;
+        fetch->waiters    = grown;
+        fetch->waiter_cap = cap;
+    }
+    FetchWaiter waiter = {conn, stream_id, NULL};
+    if (recording_access() && stream_id != 0 && (waiter.access = malloc(sizeof(AccessRecord))))
+        fill_access(waiter.access, conn, req);
+    fetch->waiters[fetch->waiter_count++] = waiter;
+    if (stream_id == 0) conn->fetch = fetch;
+    return OK;
+}
+
+/**
+ * @brief   Forgets every request of a closing connection; the fetches carry on.
+ */
+static void remove_waiters(HTTPServer *self, Connection *conn)
+{
+    for (ProxyFetch *fetch = self->fetches; fetch; fetch = fetch->next)
+    {
+        for (size_t i = 0; i < fetch->waiter_count; i++)
+        {
+            if (fetch->waiters[i].conn == conn) fetch->waiters[i].conn = NULL;
+        }
+    }
+    conn->fetch = NULL;
+}
+
+static ProxyFetch *find_shared_fetch(HTTPServer *self, const char *key, size_t key_len)
+{
+    for (ProxyFetch *fetch = self->fetches; fetch; fetch = fetch->next)
+    {
+        if (fetch->shared && fetch->key_len == key_len && memcmp(fetch->key, key, key_len) == 0)
+            return fetch;
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Unlinks a fetch from the loop and frees it.
+ *
+ * Its backend connection goes back to the keep-alive pool if the response
+ * completed and the backend keeps the connection open; otherwise it is closed.
+ */
+static void free_fetch(HTTPServer *self, ProxyFetch *fetch)
+{
+    ProxyFetch **link = &self->fetches;
+    while (*link != fetch)
+        link = &(*link)->next;
+    *link = fetch->next;
+
+    Upstream *upstream = &fetch->upstream;
+    if (upstream->fd >= 0) epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, upstream->fd, NULL);
+    if (upstream->fd >= 0 && upstream->state == UPSTREAM_DONE && upstream->reusable)
+        upstream_pool_put(&self->upstream_pool, fetch->backend, upstream_detach(upstream));
+    upstream_release(upstream);
+    if (fetch->splicing)
+    {
+        close(fetch->pipe[0]);
+        close(fetch->pipe[1]);
+    }
+    for (size_t i = 0; i < fetch->waiter_count; i++)
+        free(fetch->waiters[i].access);
+    free(fetch->key);
+    free(fetch->waiters);
+    free(fetch);
+}
+
+/**
+ * @brief   Links a prepared fetch into the loop and starts its exchange;
+ *          takes ownership of request.
+ *
+ * pooled_fd is an idle keep-alive connection to the backend, or -1.
+ *
+ * @return  OK, or -1 with the fetch freed.
+ */
+static int launch_fetch(HTTPServer *self, ProxyFetch *fetch, int pooled_fd, char *request,
+                        size_t len)
+{
+    fetch->kind     = EVENT_UPSTREAM;
+    fetch->start    = monotonic_ns();
+    fetch->watching = EPOLLOUT;
+    fetch->next     = self->fetches;
+    self->fetches   = fetch;
+
+    struct epoll_event ev;
+    ev.events   = EPOLLOUT;
+    ev.data.ptr = fetch;
+    if (upstream_start(&fetch->upstream, &fetch->address, pooled_fd, request, len) < 0 ||
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fetch->upstream.fd, &ev) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to connect to backend.");
+        metrics_record_upstream(fetch->backend, fetch->start, true);
+        if (fetch->upstream.fd >= 0) close(fetch->upstream.fd);
+        fetch->upstream.fd = -1;
+        free_fetch(self, fetch);
+        return -1;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Answers a request for a proxy location without blocking.
+ *
+ * Cache hits and errors are answered at once. Otherwise the request (on
+ * HTTP/2, its stream) joins a shared fetch for the same key, or starts a
+ * new one, and NULL is returned: the response is queued when the fetch
+ * completes.
+ */
+static HTTPResponse *start_proxy(HTTPServer *self, Connection *conn, HTTPRequest *request_ptr,
+                                 const Location *route, uint32_t stream_id)
+{
+    const ProxyCacheOptions *cache_opts = server_config ? &server_config->proxy_cache : NULL;
+
+    CacheStatus cache_status;
+    HTTPResponse *cached = proxy_cache_lookup(request_ptr, cache_opts, &cache_status);
+    if (cached) return cached;
+
+    bool coalesce  = cache_opts && cache_opts->coalesce;
+    size_t key_len = 0;
+    char key[INITIAL_BUFFER_SIZE];
+    if (cache_opts && (cache_opts->enabled || coalesce))
+        key_len = proxy_cache_key(request_ptr, cache_opts, key, sizeof(key));
+
+    if (coalesce && key_len > 0)
+    {
+        ProxyFetch *fetch = find_shared_fetch(self, key, key_len);
+        if (fetch && add_waiter(fetch, conn, stream_id, request_ptr) == OK)
+        {
+            metric_add(&metrics_local()->upstream_coalesced, 1);
+            return NULL;
+        }
+    }
+
+    ProxyFetch *fetch = calloc(1, sizeof(ProxyFetch));
+    if (!fetch)
+    {
+        LOG(LOG_ERROR, "Out of memory starting a proxy fetch.");
+        char response_buffer[] = "<h1>Internal Server Error</h1>";
+        return response_builder(500, "Internal Server Error", response_buffer,
+                                sizeof(response_buffer), "text/html");
+    }
+    int backend = select_backend(route->group, &fetch->address);
+    if (backend < 0)
+    {
+        LOG(LOG_ERROR, "Malformed backend address in config.");
+        free(fetch);
+        return bad_gateway();
+    }
+
+    bool keep_alive = self->upstream_pool.capacity > 0;
+    size_t proxy_request_len;
+    char *proxy_request = build_upstream_request(request_ptr, route, &fetch->address, keep_alive,
+                                                 false, &proxy_request_len);
+    if (key_len > 0) fetch->key = malloc(key_len);
+    if (!proxy_request || (key_len > 0 && !fetch->key) ||
+        add_waiter(fetch, conn, stream_id, request_ptr) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to build proxy request.");
+        free(fetch->key);
+        free(fetch->waiters);
+        free(fetch);
+        free(proxy_request);
+        conn->fetch            = NULL;
+        char response_buffer[] = "<h1>Internal Server Error</h1>";
+        return response_builder(500, "Internal Server Error", response_buffer,
+                                sizeof(response_buffer), "text/html");
+    }
+    fetch->backend      = backend;
+    fetch->cache_status = cache_status;
+    fetch->key_len      = key_len;
+    fetch->shared       = coalesce && key_len > 0;
+    if (key_len > 0) memcpy(fetch->key, key, key_len);
+
+    int pooled_fd = upstream_pool_get(&self->upstream_pool, backend);
+    if (pooled_fd >= 0) metric_add(&metrics_local()->upstream_reused, 1);
+    if (launch_fetch(self, fetch, pooled_fd, proxy_request, proxy_request_len) < 0)
+    {
+        conn->fetch = NULL;
+        return bad_gateway();
+    }
+
+    // A body that only this HTTP/1.1 client will see may skip userspace
+    if (stream_id == 0 && !conn->tls && key_len == 0)
+        fetch->upstream.splice_min = self->config->upstream_splice_min;
+    return NULL;
+}
+
+/**
+ * @brief   Relays a finished fetch to every request still waiting on it.
+ *
+ * Each waiter gets its own copy of the response. On HTTP/1.1 it is queued
+ * in request order and the connection goes on with any requests pipelined
+ * behind; on HTTP/2 it answers the waiting stream.
+ */
+static void complete_fetch(HTTPServer *self, ProxyFetch *fetch)
+{
+    Upstream *upstream = &fetch->upstream;
+    const char *headers;
+    size_t headers_len;
+    HTTPResponse *response =
+        upstream->state == UPSTREAM_DONE
+            ? relay_response(upstream->response, upstream->response_len, &headers, &headers_len)
+            : NULL;
+    metrics_record_upstream(fetch->backend, fetch->start, response == NULL);
+    if (response)
+        proxy_cache_store(fetch->key, fetch->key_len, &server_config->proxy_cache, headers,
+                          headers_len, response);
+    else
+        LOG(LOG_ERROR, "Failed to read a valid response from backend.");
+
+    // No one may join once the response is being handed out
+    fetch->shared = false;
+    for (size_t i = 0; i < fetch->waiter_count; i++)
+    {
+        Connection *conn = fetch->waiters[i].conn;
+        if (!conn) continue;
+
+        HTTPResponse *copy = response ? httpresponse_copy(response) : bad_gateway();
+        if (response) proxy_cache_set_status(copy, i == 0 ? fetch->cache_status : CACHE_COALESCED);
+
+        if (fetch->waiters[i].stream_id != 0)
+        {
+            if (copy) metrics_count_status(copy->status_code);
+            if (fetch->waiters[i].access)
+                log_stream(conn, fetch->waiters[i].access, upstream, copy);
+            h2_submit_response(conn->h2, fetch->waiters[i].stream_id, copy);
+            drive_output(self, conn);
+            continue;
+        }
+        conn->fetch = NULL;
+        if (conn->state == CONN_WAITING_UPSTREAM) conn->state = CONN_ESTABLISHED;
+        trace_upstream(conn, upstream);
+        finish_request(conn, copy, conn->request_size);
+        if (!conn->write_blocked) watch_connection(self, conn, EPOLLIN);
+        process_requests(self, conn);
+        drive_output(self, conn);
+    }
+
+    httpresponse_free(response);
+    free_fetch(self, fetch);
+}
+
+/**
+ * @brief   Sets the epoll events to wait for on a socket; *watching holds
+ *          those registered so far.
+ *
+ * With none the socket leaves epoll altogether, so a peer hanging up while
+ * the other side is the one being waited on does not wake the loop over
+ * and over.
+ */
+static void watch_socket(HTTPServer *self, int fd, void *ptr, uint32_t *watching,
+                         uint32_t events)
+{
+    if (events == *watching) return;
+
+    struct epoll_event ev;
+    ev.events   = events;
+    ev.data.ptr = ptr;
+    int op      = *watching == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    epoll_ctl(self->epoll_fd, op, fd, &ev);
+    *watching = events;
+}
+
+/**
+ * @brief   Sets the epoll events a fetch waits for on its backend socket.
+ */
+static void watch_backend(HTTPServer *self, ProxyFetch *fetch, uint32_t events)
+{
+    watch_socket(self, fetch->upstream.fd, fetch, &fetch->watching, events);
+}
+
+/**
+ * @brief   Answers the waiting request with the header block of a large
+ *          response, leaving its body to relay_body().
+ *
+ * The headers, and whatever part of the body came with them, are relayed
+ * like any response and the request is finished. The connection keeps its
+ * fetch until the body is through, so pipelined requests wait behind it as
+ * they do behind any proxied request.
+ */
+static void start_splice(HTTPServer *self, ProxyFetch *fetch)
+{
+    Upstream *upstream = &fetch->upstream;
+    Connection *conn   = fetch->waiters[0].conn;
+    if (!conn)
+    {
+        free_fetch(self, fetch);
+        return;
+    }
+    if (pipe2(fetch->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        LOG(LOG_WARN, "Failed to create a pipe, relaying the body through userspace: %s",
+            strerror(errno));
+        upstream->splice_min = 0;
+        upstream->state      = UPSTREAM_RECEIVING;
+        watch_backend(self, fetch, EPOLLIN);
+        return;
+    }
+    fetch->splicing = true;
+
+    const char *headers;
+    size_t headers_len;
+    HTTPResponse *response =
+        relay_response(upstream->response, upstream->response_len, &headers, &headers_len);
+    if (!response)
+    {
+        upstream->state = UPSTREAM_FAILED;
+        complete_fetch(self, fetch);
+        return;
+    }
+    response->content_length = upstream->body_length;
+    proxy_cache_set_status(response, fetch->cache_status);
+
+    // Nothing is read from the backend until the headers are sent
+    watch_backend(self, fetch, 0);
+    trace_upstream(conn, upstream);
+    finish_request(conn, response, conn->request_size);
+
+    // The rest of the body counts as queued, so the record waits for it
+    conn->out_total += upstream->body_left;
+    if (conn->access_count) conn->access[conn->access_count - 1].out_end = conn->out_total;
+    drive_output(self, conn);
+}
+
+/**
+ * @brief   Moves a spliced body on: backend socket, pipe, client socket.
+ *
+ * Bytes never pass through userspace. While the pipe holds any, they go to
+ * the client, and the loop waits for EPOLLOUT on it when its socket is
+ * full; once the pipe is empty it is refilled from the backend, and the
+ * loop waits for EPOLLIN there when nothing has arrived. When the body is
+ * through the backend connection goes back to the pool and the client
+ * connection carries on with the requests behind.
+ */
+static void relay_body(HTTPServer *self, ProxyFetch *fetch)
+{
+    Upstream *upstream = &fetch->upstream;
+    Connection *conn   = fetch->waiters[0].conn;
+
+    while (fetch->in_pipe > 0 || upstream->state == UPSTREAM_SPLICING)
+    {
+        if (fetch->in_pipe > 0)
+        {
+            unsigned int more = upstream->state == UPSTREAM_SPLICING ? SPLICE_F_MORE : 0;
+            ssize_t n         = splice(fetch->pipe[0], NULL, conn->socket, NULL, fetch->in_pipe,
+                                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK | more);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                watch_backend(self, fetch, 0);
+                if (!conn->write_blocked)
+                {
+                    conn->write_blocked = true;
+                    watch_connection(self, conn, EPOLLOUT);
+                }
+                return;
+            }
+            if (n <= 0)
+            {
+                LOG(errno == EPIPE || errno == ECONNRESET ? LOG_DEBUG : LOG_ERROR,
+                    "Splicing to client FD %d failed: %s", conn->socket, strerror(errno));
+                close_connection(self, conn);
+                return;
+            }
+            fetch->in_pipe -= n;
+            conn->sent_total += n;
+            metric_add(&metrics_local()->bytes_out, n);
+            metric_add(&metrics_local()->upstream_spliced, n);
+            continue;
+        }
+
+        // As much as the pipe takes
+        ssize_t n = upstream_splice(upstream, fetch->pipe[1], upstream->body_left);
+        if (n > 0)
+        {
+            fetch->in_pipe += n;
+            continue;
+        }
+        if (upstream->state == UPSTREAM_FAILED)
+        {
+            // The headers are out, so the client can only be cut off
+            metrics_record_upstream(fetch->backend, fetch->start, true);
+            close_connection(self, conn);
+            return;
+        }
+        if (conn->write_blocked)
+        {
+            conn->write_blocked = false;
+            watch_connection(self, conn, 0);
+        }
+        watch_backend(self, fetch, EPOLLIN);
+        return;
+    }
+
+    metrics_record_upstream(fetch->backend, fetch->start, false);
+    if (conn->access_count) complete_access(conn, false);
+    conn->fetch         = NULL;
+    conn->write_blocked = false;
+    free_fetch(self, fetch);
+    if (conn->state == CONN_WAITING_UPSTREAM) conn->state = CONN_ESTABLISHED;
+    watch_connection(self, conn, EPOLLIN);
+    process_requests(self, conn);
+    drive_output(self, conn);
+}
+
+/**
+ * @brief   Drives a fetch after an epoll event on its backend socket.
+ *
+ * A pooled connection the backend had already closed is replaced by a
+ * fresh one and the request sent again, once. A large body stops the
+ * exchange after its headers and is spliced through instead; a backend
+ * agreeing to an upgrade turns the connection into a tunnel.
+ */
+static void handle_fetch_event(HTTPServer *self, ProxyFetch *fetch, uint32_t events)
+{
+    Upstream *upstream = &fetch->upstream;
+    if (fetch->splicing)
+    {
+        relay_body(self, fetch);
+        return;
+    }
+
+    uint32_t wanted = upstream_step(upstream, events);
+    if (wanted == 0 && upstream->state == UPSTREAM_FAILED && upstream->retryable)
+    {
+        struct epoll_event ev;
+        ev.events   = EPOLLOUT;
+        ev.data.ptr = fetch;
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, upstream->fd, NULL);
+        if (upstream_retry(upstream, &fetch->address) == OK &&
+            epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, upstream->fd, &ev) == 0)
+        {
+            fetch->watching = EPOLLOUT;
+            return;
+        }
+        if (upstream->fd >= 0) close(upstream->fd);
+        upstream->fd = -1;
+    }
+    if (wanted == 0 && upstream->state == UPSTREAM_SPLICING)
+    {
+        start_splice(self, fetch);
+        return;
+    }
+    if (wanted == 0 && upstream->state == UPSTREAM_UPGRADED)
+    {
+        start_tunnel(self, fetch);
+        return;
+    }
+    if (wanted == 0)
+    {
+        complete_fetch(self, fetch);
+        return;
+    }
+    watch_backend(self, fetch, wanted);
+}
+
+// ---------- TUNNELS ----------
+
+/*
+ * Bytes on their way through a tunnel, from one socket to the other. They
+ * wait in a pipe borrowed from the loop between splice() calls or, when the
+ * client speaks TLS, in a heap buffer. Either goes back as soon as it is
+ * empty, so an idle flow holds no memory and no descriptors.
+ */
+typedef struct TunnelFlow
+{
+    int pipe[2]; // borrowed while bytes sit in it, else -1
+    size_t in_pipe;
+    char *buf; // bytes passing through userspace, or NULL
+    size_t buf_head;
+    size_t buf_len;
+    bool eof;  // the source sent its last byte
+    bool shut; // and the destination was told so, once the flow drained
+} TunnelFlow;
+
+/*
+ * A client connection relaying bytes to and from a backend after the
+ * backend accepted an upgrade (WebSocket, say), or after CONNECT. The
+ * connection's request buffer is gone by then; this is all it holds.
+ */
+typedef struct Tunnel
+{
+    Connection *conn;
+    int fd;                   // backend socket
+    uint32_t watching;        // epoll events registered for fd; 0 when out of epoll
+    uint32_t client_watching; // the same for the client socket
+    TunnelFlow up;            // client to backend
+    TunnelFlow down;          // backend to client
+} Tunnel;
+
+/**
+ * @brief   True for an HTTP/1.1 request to switch protocols: an Upgrade
+ *          header that Connection names.
+ */
+static bool wants_upgrade(const HTTPRequest *req)
+{
+    if (is_http10(req)) return false;
+    const HTTPHeader *upgrade    = find_header(req, "Upgrade");
+    const HTTPHeader *connection = find_header(req, "Connection");
+    return upgrade && upgrade->value_len > 0 && connection &&
+           list_has_token(connection->value, connection->value_len, "upgrade", NULL);
+}
+
+static bool is_connect(const HTTPRequest *req)
+{
+    const HTTPRequestLine *line = &req->request_line;
+    return line->method_len == 7 && memcmp(line->method, "CONNECT", 7) == 0;
+}
+
+/**
+ * @brief   Finds the backend a CONNECT names: its target must be spelled as
+ *          one of the configured backend entries, so CONNECT cannot reach
+ *          anything the proxy locations could not.
+ *
+ * @return  Backend index, or -1 if the target is not a configured backend.
+ */
+static int find_connect_backend(const HTTPRequest *req, UpstreamAddress *addr)
+{
+    const HTTPRequestLine *line = &req->request_line;
+    for (size_t i = 0; server_config && i < server_config->backend_count; i++)
+    {
+        const char *backend = server_config->backends[i];
+        if (strlen(backend) == line->uri_len && memcmp(backend, line->uri, line->uri_len) == 0)
+            return upstream_parse_address(backend, addr) == OK ? (int)i : -1;
+    }
+    return -1;
+}
+
+/**
+ * @brief   Starts the backend side of a tunnel: an upgrade request to a
+ *          proxy location's upstream, or a CONNECT to the backend it names.
+ *
+ * As with start_proxy(), the request waits on a fetch and NULL is
+ * returned. If the backend agrees (a 101, or for CONNECT a connection),
+ * start_tunnel() takes over; any other response is relayed like that of a
+ * proxied request and the connection goes on as HTTP/1.1. Never pooled,
+ * cached or coalesced: the backend connection becomes the tunnel's.
+ */
+static HTTPResponse *open_tunnel(HTTPServer *self, Connection *conn, HTTPRequest *req,
+                                 const Location *route)
+{
+    ProxyFetch *fetch = calloc(1, sizeof(ProxyFetch));
+    if (!fetch) return bad_gateway();
+
+    int backend = route ? select_backend(route->group, &fetch->address)
+                        : find_connect_backend(req, &fetch->address);
+    if (backend < 0)
+    {
+        free(fetch);
+        if (route)
+        {
+            LOG(LOG_ERROR, "Malformed backend address in config.");
+            return bad_gateway();
+        }
+        char response_buffer[] = "<h1>403 Forbidden</h1>";
+        return response_builder(403, "Forbidden", response_buffer, sizeof(response_buffer),
+                                "text/html");
+    }
+
+    size_t request_len = 0;
+    char *request =
+        route ? build_upstream_request(req, route, &fetch->address, false, true, &request_len)
+              : NULL;
+    fetch->backend      = backend;
+    fetch->cache_status = CACHE_BYPASS;
+    if ((route && !request) || add_waiter(fetch, conn, 0, req) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to build proxy request.");
+        free(fetch->waiters);
+        free(fetch);
+        free(request);
+        conn->fetch            = NULL;
+        char response_buffer[] = "<h1>Internal Server Error</h1>";
+        return response_builder(500, "Internal Server Error", response_buffer,
+                                sizeof(response_buffer), "text/html");
+    }
+    if (launch_fetch(self, fetch, -1, request, request_len) < 0)
+    {
+        conn->fetch = NULL;
+        return bad_gateway();
+    }
+    fetch->upstream.upgrade = true;
+    return NULL;
+}
+
+/**
+ * @brief   Takes an empty pipe for a flow: a spare one of the loop, or a new one.
+ */
+static int borrow_pipe(HTTPServer *self, TunnelFlow *flow)
+{
+    if (flow->pipe[0] >= 0) return OK;
+
+    PipePool *spares = &self->spare_pipes;
+    if (spares->count > 0)
+    {
+        spares->count--;
+        flow->pipe[0] = spares->fds[spares->count][0];
+        flow->pipe[1] = spares->fds[spares->count][1];
+        return OK;
+    }
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to create a tunnel pipe: %s", strerror(errno));
+        return -1;
+    }
+    flow->pipe[0] = fds[0];
+    flow->pipe[1] = fds[1];
+    return OK;
+}
+
+/**
+ * @brief   Gives up a flow's pipe and buffer.
+ *
+ * An empty pipe goes back to the loop's spares while there is room; one
+ * still holding bytes (the tunnel is closing) is closed with them.
+ */
+static void release_flow(HTTPServer *self, TunnelFlow *flow)
+{
+    free(flow->buf);
+    flow->buf      = NULL;
+    flow->buf_head = 0;
+    flow->buf_len  = 0;
+    if (flow->pipe[0] < 0) return;
+
+    PipePool *spares = &self->spare_pipes;
+    if (flow->in_pipe == 0 && spares->count < TUNNEL_SPARE_PIPES)
+    {
+        spares->fds[spares->count][0] = flow->pipe[0];
+        spares->fds[spares->count][1] = flow->pipe[1];
+        spares->count++;
+    }
+    else
+    {
+        close(flow->pipe[0]);
+        close(flow->pipe[1]);
+    }
+    flow->pipe[0] = -1;
+    flow->pipe[1] = -1;
+    flow->in_pipe = 0;
+}
+
+static bool flow_pending(const TunnelFlow *flow)
+{
+    return flow->in_pipe > 0 || flow->buf_head < flow->buf_len;
+}
+
+/**
+ * @brief   Moves one flow's bytes until its source is drained, its
+ *          destination full, or TUNNEL_BURST bytes went through.
+ *
+ * Between plaintext sockets the bytes go socket to pipe to socket with
+ * splice() and never enter userspace. A TLS client's bytes must be
+ * decrypted or encrypted, so they pass through a buffer; its reads are not
+ * capped, as TLS may hold decrypted bytes that epoll cannot report. Once
+ * the source has sent its last byte and the flow drained, the write side
+ * of the destination is shut down so the far end sees the half-close.
+ *
+ * @return  OK, or -1 if either socket failed.
+ */
+static int pump_flow(HTTPServer *self, Tunnel *tunnel, TunnelFlow *flow, bool to_backend)
+{
+    Connection *conn       = tunnel->conn;
+    int src                = to_backend ? conn->socket : tunnel->fd;
+    int dst                = to_backend ? tunnel->fd : conn->socket;
+    TLSConnection *src_tls = to_backend ? conn->tls : NULL;
+    TLSConnection *dst_tls = to_backend ? NULL : conn->tls;
+    size_t moved           = 0;
+
+    while (moved < TUNNEL_BURST || src_tls)
+    {
+        ssize_t n;
+        if (flow->buf_head < flow->buf_len)
+        {
+            const char *data = flow->buf + flow->buf_head;
+            size_t len       = flow->buf_len - flow->buf_head;
+            n = dst_tls ? tls_send(dst_tls, data, len) : send(dst, data, len, MSG_NOSIGNAL);
+            if (n > 0) flow->buf_head += n;
+        }
+        else if (flow->in_pipe > 0)
+        {
+            n = splice(flow->pipe[0], NULL, dst, NULL, flow->in_pipe,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) flow->in_pipe -= n;
+        }
+        else
+        {
+            release_flow(self, flow);
+            if (flow->eof)
+            {
+                // TLS has no half-close; relay_tunnel() ends the tunnel instead
+                if (!flow->shut && !dst_tls) shutdown(dst, SHUT_WR);
+                flow->shut = true;
+                return OK;
+            }
+
+            if (src_tls || dst_tls)
+            {
+                if (!(flow->buf = malloc(TUNNEL_BUFFER))) return -1;
+                n = src_tls ? tls_recv(src_tls, flow->buf, TUNNEL_BUFFER)
+                            : recv(src, flow->buf, TUNNEL_BUFFER, 0);
+                if (n > 0) flow->buf_len = n;
+            }
+            else
+            {
+                if (borrow_pipe(self, flow) < 0) return -1;
+                n = splice(src, NULL, flow->pipe[1], NULL, TUNNEL_BURST,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) flow->in_pipe = n;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                release_flow(self, flow);
+                return OK;
+            }
+            if (n < 0)
+            {
+                LOG(errno == ECONNRESET || errno == EPROTO ? LOG_DEBUG : LOG_ERROR,
+                    "Reading tunnel of client FD %d failed: %s", conn->socket, strerror(errno));
+                return -1;
+            }
+            if (n == 0) flow->eof = true;
+            moved += n;
+            metric_add(&metrics_local()->tunnel_bytes, n);
+            if (to_backend) metric_add(&metrics_local()->bytes_in, n);
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return OK;
+        if (n <= 0)
+        {
+            LOG(errno == EPIPE || errno == ECONNRESET ? LOG_DEBUG : LOG_ERROR,
+                "Writing tunnel of client FD %d failed: %s", conn->socket, strerror(errno));
+            return -1;
+        }
+        if (!to_backend) metric_add(&metrics_local()->bytes_out, n);
+    }
+    return OK;
+}
+
+/**
+ * @brief   Moves a tunnel's bytes both ways after an event on either of its
+ *          sockets, then waits for what each socket has to do next.
+ *
+ * Output the connection queued before the tunnel (the 101, say) goes out
+ * ahead of anything from the backend. The tunnel, and the connection with
+ * it, ends when both flows have shut down, when a socket fails, or for a
+ * TLS client once the backend is done.
+ */
+static void relay_tunnel(HTTPServer *self, Tunnel *tunnel)
+{
+    Connection *conn  = tunnel->conn;
+    conn->last_active = time(NULL);
+
+    int flushed = output_pending(conn) ? flush_output(conn) : 0;
+    if (flushed == 0 && conn->out_buf)
+    {
+        // The response is out; an idle tunnel keeps no output buffers
+        free(conn->out_buf);
+        free(conn->segments);
+        conn->out_buf     = NULL;
+        conn->out_size    = 0;
+        conn->segments    = NULL;
+        conn->segment_cap = 0;
+    }
+    if (flushed < 0 || pump_flow(self, tunnel, &tunnel->up, true) < 0 ||
+        (flushed == 0 && pump_flow(self, tunnel, &tunnel->down, false) < 0) ||
+        (tunnel->up.shut && tunnel->down.shut) || (conn->tls && tunnel->down.shut))
+    {
+        close_connection(self, conn);
+        return;
+    }
+
+    // Each side reads only while the other has taken everything it read before
+    bool up_busy            = flow_pending(&tunnel->up);
+    bool down_busy          = flushed > 0 || flow_pending(&tunnel->down);
+    bool client_reads       = !up_busy && !tunnel->up.eof;
+    bool backend_reads      = !down_busy && !tunnel->down.eof;
+    uint32_t client_events  = (client_reads ? EPOLLIN : 0) | (down_busy ? EPOLLOUT : 0);
+    uint32_t backend_events = (backend_reads ? EPOLLIN : 0) | (up_busy ? EPOLLOUT : 0);
+    watch_socket(self, conn->socket, conn, &tunnel->client_watching, client_events);
+    watch_socket(self, tunnel->fd, &conn->tunnel_kind, &tunnel->watching, backend_events);
+}
+
+/**
+ * @brief   Turns the connection waiting on an upgraded fetch into a tunnel.
+ *
+ * The client gets the backend's 101 as sent, or "200 Connection
+ * Established" for CONNECT, then whatever the backend sent behind it;
+ * bytes the client sent behind its request go to the backend first. The
+ * request buffer is freed, and the output buffers once the response is
+ * out, leaving the tunnel the only memory an idle one holds.
+ */
+static void start_tunnel(HTTPServer *self, ProxyFetch *fetch)
+{
+    static const char established[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+    Upstream *upstream = &fetch->upstream;
+    Connection *conn   = fetch->waiters[0].conn;
+    if (!conn)
+    {
+        free_fetch(self, fetch);
+        return;
+    }
+
+    bool connect     = upstream->request_len == 0;
+    size_t early_len = conn->buffer_len - conn->request_size;
+    Tunnel *tunnel   = calloc(1, sizeof(Tunnel));
+    char *early      = early_len > 0 ? malloc(early_len) : NULL;
+    if (!tunnel || (early_len > 0 && !early))
+    {
+        free(tunnel);
+        upstream->state = UPSTREAM_FAILED;
+        complete_fetch(self, fetch);
+        return;
+    }
+    if (early_len > 0) memcpy(early, conn->buffer + conn->request_size, early_len);
+    tunnel->conn    = conn;
+    tunnel->up      = (TunnelFlow){.pipe = {-1, -1}, .buf = early, .buf_len = early_len};
+    tunnel->down    = (TunnelFlow){.pipe = {-1, -1}};
+    metrics_record_upstream(fetch->backend, fetch->start, false);
+    metrics_count_status(connect ? 200 : 101);
+    trace_upstream(conn, upstream);
+
+    uint64_t queued_from = conn->out_total;
+    int queued = connect ? queue_output(conn, established, sizeof(established) - 1)
+                         : queue_output(conn, upstream->response, upstream->body_start);
+    log_response(conn, conn->curr_request, connect ? 200 : 101, queued_from);
+    if (queued == OK && !connect)
+        queued = queue_output(conn, upstream->response + upstream->body_start,
+                              upstream->response_len - upstream->body_start);
+
+    // The backend socket moves from the fetch to the tunnel
+    watch_backend(self, fetch, 0);
+    tunnel->fd  = upstream_detach(upstream);
+    conn->fetch = NULL;
+    free_fetch(self, fetch);
+
+    conn->requests_handled++;
+    conn->keep_alive = false;
+    free_http_request(conn->curr_request);
+    free(conn->buffer);
+    conn->curr_request  = NULL;
+    conn->buffer        = NULL;
+    conn->buffer_size   = 0;
+    conn->buffer_len    = 0;
+    conn->request_size  = 0;
+    conn->write_blocked = false;
+    conn->state         = CONN_TUNNEL;
+    conn->tunnel        = tunnel;
+    conn->tunnel_kind   = EVENT_TUNNEL;
+    metric_add(&metrics_local()->tunnels_opened, 1);
+    metric_add(&metrics_local()->tunnels_active, 1);
+
+    // From here on relay_tunnel() registers the client socket for what the tunnel needs
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    if (queued < 0)
+    {
+        LOG(LOG_ERROR, "Failed to queue the tunnel response for client FD %d.", conn->socket);
+        close_connection(self, conn);
+        return;
+    }
+    LOG(LOG_DEBUG, "Client FD %d tunnels to backend FD %d.", conn->socket, tunnel->fd);
+    relay_tunnel(self, tunnel);
+}
+
+/**
+ * @brief   Closes a tunnel's backend socket and frees it; for close_connection().
+ */
+static void free_tunnel(HTTPServer *self, Tunnel *tunnel)
+{
+    Connection *conn = tunnel->conn;
+    watch_socket(self, tunnel->fd, &conn->tunnel_kind, &tunnel->watching, 0);
+    close(tunnel->fd);
+    release_flow(self, &tunnel->up);
+    release_flow(self, &tunnel->down);
+    free(tunnel);
+    conn->tunnel = NULL;
+    metric_sub(&metrics_local()->tunnels_active, 1);
+}
+
+// ---------- HANDLERS OFF THE LOOP ----------
+
+/*
+ * A request whose handler runs somewhere it may block without blocking the
+ * event loop: static_handler() on an I/O pool thread, so the open, fstat
+ * and reads (or a compression cache miss) wait there, or the handler of a
+ * "coroutine = on" location on a coroutine, whose socket waits yield to
+ * the loop. Either works on a copy of the request; the loop then answers
+ * with the response, unless the client went away.
+ */
+typedef struct HandlerJob
+{
+    IOTask task;             // first, so the task is the job; unused on a coroutine
+    HTTPServer *server;      // loop the job answers on
+    Connection *conn;        // NULL once the connection closed
+    uint32_t stream_id;      // 0 for HTTP/1.1
+    HTTPRequest *request;    // copy owned by the job
+    const Location *route;   // location that matched
+    HTTPResponse *response;  // set by the pool thread or the coroutine
+    AccessRecord *access;    // HTTP/2 only: the stream's access log record, or NULL
+    struct HandlerJob *next; // in the loop's handler_jobs
+} HandlerJob;
+
+/**
+ * @brief   Builds the response of a static file HandlerJob on a pool thread.
+ *
+ * The head of a file-backed body is read ahead into the page cache here,
+ * so the loop's first sendfile() calls find it there rather than on disk.
+ */
+static void run_file_job(IOTask *task)
+{
+    HandlerJob *job           = (HandlerJob *)task;
+    const Location *route     = job->route;
+    const StaticOptions *opts = server_config ? &server_config->static_options : NULL;
+    size_t strip_len          = route->strip_prefix ? strlen(route->path) : 0;
+    job->response             = static_handler(job->request, opts, route->root, strip_len);
+
+    HTTPResponse *response = job->response;
+    size_t budget          = FILE_READAHEAD;
+    for (int i = 0; response && i < response->file_range_count && budget > 0; i++)
+    {
+        const ResponseFileRange *range = &response->file_ranges[i];
+        size_t length                  = range->length < budget ? range->length : budget;
+        readahead(response->file_fd, range->offset, length);
+        budget -= length;
+    }
+}
+
+static HandlerJob *new_handler_job(HTTPServer *self, Connection *conn, const HTTPRequest *req,
+                                   const Location *route, uint32_t stream_id)
+{
+    HandlerJob *job = calloc(1, sizeof(HandlerJob));
+    if (!job || !(job->request = copy_http_request(req)))
+    {
+        free(job);
+        return NULL;
+    }
+    job->server    = self;
+    job->conn      = conn;
+    job->stream_id = stream_id;
+    job->route     = route;
+    if (recording_access() && stream_id != 0 && (job->access = malloc(sizeof(AccessRecord))))
+        fill_access(job->access, conn, req);
+    return job;
+}
+
+static void free_handler_job(HandlerJob *job)
+{
+    free_http_request(job->request);
+    httpresponse_free(job->response);
+    free(job->access);
+    free(job);
+}
+
+/**
+ * @brief   Records a job that was handed off, so the loop can answer it.
+ *
+ * An HTTP/1.1 connection (stream_id 0) stops reading until the job
+ * completes, as it does for a proxied request; an HTTP/2 connection
+ * carries on with its other streams.
+ */
+static void track_handler_job(HTTPServer *self, HandlerJob *job)
+{
+    job->next          = self->handler_jobs;
+    self->handler_jobs = job;
+    if (job->stream_id == 0) job->conn->handler_job = job;
+}
+
+/**
+ * @brief   Hands a request for a static location to the I/O pool.
+ *
+ * @return  OK, or -1 if there is no pool or the request could not be
+ *          queued: the caller then serves the file itself.
+ */
+static int offload_static(HTTPServer *self, Connection *conn, const HTTPRequest *req,
+                          const Location *route, uint32_t stream_id)
+{
+    if (!self->io_pool) return -1;
+
+    HandlerJob *job = new_handler_job(self, conn, req, route, stream_id);
+    if (!job) return -1;
+    job->task.run  = run_file_job;
+    job->task.done = &self->io_done;
+    if (io_pool_submit(self->io_pool, &job->task) < 0)
+    {
+        free_handler_job(job);
+        return -1;
+    }
+    track_handler_job(self, job);
+    metric_add(&metrics_local()->static_offloaded, 1);
+    return OK;
+}
+
+/**
+ * @brief   Forgets every handler job of a closing connection; the jobs run
+ *          to the end and their responses are dropped.
+ */
+static void forget_handler_jobs(HTTPServer *self, Connection *conn)
+{
+    for (HandlerJob *job = self->handler_jobs; job; job = job->next)
+    {
+        if (job->conn == conn) job->conn = NULL;
+    }
+    conn->handler_job = NULL;
+}
+
+/**
+ * @brief   Answers the request of a handler job that has finished.
+ *
+ * Like complete_fetch(): on HTTP/1.1 the response is queued in request
+ * order and the connection goes on with the requests pipelined behind; on
+ * HTTP/2 it answers the waiting stream.
+ */
+static void finish_handler_job(HTTPServer *self, HandlerJob *job)
+{
+    HandlerJob **link = &self->handler_jobs;
+    while (*link != job)
+        link = &(*link)->next;
+    *link = job->next;
+
+    Connection *conn       = job->conn;
+    HTTPResponse *response = job->response;
+    job->response          = NULL;
+    if (!conn)
+    {
+        httpresponse_free(response);
+        free_handler_job(job);
+        return;
+    }
+
+    if (job->stream_id != 0)
+    {
+        if (!response)
+        {
+            LOG(LOG_ERROR, "Failed to handle HTTP/2 request (no response generated).");
+            char response_buffer[] = "<h1>500 Internal Server Error</h1>";
+            response = response_builder(500, "Internal Server Error", response_buffer,
+                                        sizeof(response_buffer), "text/html");
+        }
+        if (response) metrics_count_status(response->status_code);
+        if (job->access) log_stream(conn, job->access, NULL, response);
+        h2_submit_response(conn->h2, job->stream_id, response);
+        drive_output(self, conn);
+        free_handler_job(job);
+        return;
+    }
+
+    conn->handler_job = NULL;
+    if (conn->state == CONN_WAITING_HANDLER) conn->state = CONN_ESTABLISHED;
+    finish_request(conn, response, conn->request_size);
+    if (!conn->write_blocked) watch_connection(self, conn, EPOLLIN);
+    process_requests(self, conn);
+    drive_output(self, conn);
+    free_handler_job(job);
+}
+
+/**
+ * @brief   Answers every file read completed since the loop last looked.
+ */
+static void finish_file_jobs(HTTPServer *self)
+{
+    IOTask *task = io_completions_take(&self->io_done);
+    while (task)
+    {
+        IOTask *next = task->next;
+        finish_handler_job(self, (HandlerJob *)task);
+        task = next;
+    }
+}
+
+static void run_handler(void *arg)
+{
+    HandlerJob *job = arg;
+    job->response   = handle_route(job->server, job->request, job->route);
+}
+
+/**
+ * @brief   Coroutine done callback: answers the request once its handler returned.
+ */
+static void handler_done(void *arg)
+{
+    HandlerJob *job = arg;
+    finish_handler_job(job->server, job);
+}
+
+/**
+ * @brief   Runs the handler of a request on a coroutine of the loop.
+ *
+ * The handler is the same blocking code request_handler() runs; the
+ * co_*() calls it makes (proxy_handler()'s backend I/O) yield to the loop
+ * while they wait.
+ *
+ * @return  OK, or -1 if no coroutine could be created: the caller then
+ *          answers the request as usual.
+ */
+static int spawn_handler(HTTPServer *self, Connection *conn, const HTTPRequest *req,
+                         const Location *route, uint32_t stream_id)
+{
+    HandlerJob *job = new_handler_job(self, conn, req, route, stream_id);
+    if (!job) return -1;
+    if (co_spawn(&self->coroutines, run_handler, handler_done, job) < 0)
+    {
+        free_handler_job(job);
+        return -1;
+    }
+    track_handler_job(self, job);
+    return OK;
+}
 
-                // Find free connection slot from connections pool
-                Connection *conn = NULL;
-                for (size_t j = 0; j < MAX_CONNECTIONS; j++)
-                {
-                    if (self->connections[j].socket == 0)
-                    {
-                        conn = &self->connections[j];
-                        break;
-                    }
-                }
-                if (!conn || self->active_count >= MAX_CONNECTIONS)
-                {
-                    LOG("ERROR", "No free connection slots available.");
-                    close(client_fd);
-                    continue;
-                }
+/**
+ * @brief   Runs the module phases of a request, then its location's handler,
+ *          or hands the request off.
+ *
+ * A rewrite or access hook of a module can answer the request outright.
+ * Otherwise coroutine locations go to a coroutine, proxy locations to an
+ * upstream fetch and static locations to the I/O pool when there is one;
+ * anything else, or a hand-off that fails, runs handle_route() on the loop.
+ * An HTTP/1.1 upgrade to a proxy location, or CONNECT with proxy_connect
+ * on, opens a tunnel instead.
+ *
+ * @return  The response, or NULL with *deferred set while the request is
+ *          answered off the loop. start_proxy() and open_tunnel() can also
+ *          answer at once.
+ */
+static HTTPResponse *dispatch_request(HTTPServer *self, Connection *conn, HTTPRequest *req,
+                                      uint32_t stream_id, bool *deferred)
+{
+    *deferred              = false;
+    HTTPResponse *response = modules_rewrite(req);
+    if (!response) response = modules_access(req, &conn->client_addr);
+    if (response) return response;
+
+    *deferred = true;
+    if (stream_id == 0 && is_connect(req) && server_config && server_config->proxy_connect)
+        return open_tunnel(self, conn, req, NULL);
+
+    const Location *route = route_request(req);
+    if (stream_id == 0 && route && route->handler == ROUTE_PROXY && wants_upgrade(req))
+        return open_tunnel(self, conn, req, route);
+    if (route && route->coroutine && spawn_handler(self, conn, req, route, stream_id) == OK)
+        return NULL;
+    if (route && route->handler == ROUTE_PROXY)
+        return start_proxy(self, conn, req, route, stream_id);
+    if (route && route->handler == ROUTE_STATIC &&
+        offload_static(self, conn, req, route, stream_id) == OK)
+        return NULL;
+
+    *deferred = false;
+    return handle_route(self, req, route);
+}
 
-                // ---------------------
+// ---------- ROUTING ----------
 
-                if (init_connection(conn, client_fd, self->epoll_fd) < 0)
-                {
-                    LOG("ERROR", "Failed to initialize a connection.");
-                    close(client_fd);
-                    continue;
-                }
-                self->active_count++;
-                // --------------------
+static const char *status_phrase(int status)
+{
+    static const struct
+    {
+        int status;
+        const char *phrase;
+    } phrases[] = {
+        {200, "OK"},
+        {201, "Created"},
+        {204, "No Content"},
+        {301, "Moved Permanently"},
+        {302, "Found"},
+        {303, "See Other"},
+        {307, "Temporary Redirect"},
+        {308, "Permanent Redirect"},
+        {400, "Bad Request"},
+        {401, "Unauthorized"},
+        {403, "Forbidden"},
+        {404, "Not Found"},
+        {405, "Method Not Allowed"},
+        {410, "Gone"},
+        {429, "Too Many Requests"},
+        {500, "Internal Server Error"},
+        {502, "Bad Gateway"},
+        {503, "Service Unavailable"},
+    };
+    for (size_t i = 0; i < sizeof(phrases) / sizeof(phrases[0]); i++)
+    {
+        if (phrases[i].status == status) return phrases[i].phrase;
+    }
+    return status < 400 ? "OK" : "Error";
+}
 
-                // Set socket nonblocking
-                int flags = fcntl(client_fd, F_GETFL, 0);
-                if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK))
-                {
-                    LOG("ERROR", "Failed to set socket nonblocking.");
-                    free(conn->buffer);
-                    close(client_fd);
-                    conn->socket = 0;
-                    self->active_count--;
-                    continue;
-                }
+/**
+ * @brief   Answers a return location with its fixed status and body, or a
+ *          redirect to the URL given as its body.
+ */
+static HTTPResponse *return_handler(const Location *route)
+{
+    int status = route->status;
+    bool redirect =
+        status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+    const char *body = !redirect && route->body ? route->body : "";
 
-                // Add to epoll
-                ev.events   = EPOLLIN;
-                ev.data.ptr = conn;
-                if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1)
-                {
-                    LOG("ERROR", "Failed to add client socket to epoll event loop.");
-                    free(conn->buffer);
-                    close(client_fd);
-                    conn->socket = 0;
-                    self->active_count--;
-                    continue;
-                }
+    HTTPResponse *response =
+        response_builder(status, status_phrase(status), body, strlen(body),
+                         route->content_type ? route->content_type : "text/plain");
+    if (response && redirect && route->body)
+        httpresponse_add_header(response, "Location", route->body);
+    return response;
+}
 
-                inet_ntop(AF_INET, &client_addr.sin_addr, s, sizeof(s));
-                LOG("INFO", "Connected: %s:%d, FD: %d", s, ntohs(client_addr.sin_port), client_fd);
-            }
-            else
-            {
-                // Handle client data
-                Connection *conn = (Connection *)events[i].data.ptr;
-                int client_fd    = conn->socket;
+static HTTPResponse *not_found(const HTTPRequest *request_ptr)
+{
+    LOG(LOG_DEBUG, "Request to unknown URI: %.*s", (int)request_ptr->request_line.uri_len,
+        request_ptr->request_line.uri);
+    char response_buffer[] = "<h1>404 Not Found</h1>";
+    return response_builder(404, "Not Found", response_buffer, sizeof(response_buffer),
+                            "text/html");
+}
 
-                // ---------------------------------
-                while (1)
-                {
-                    int bytes_read = recv(client_fd, conn->buffer + conn->buffer_len,
-                                          conn->buffer_size - conn->buffer_len, 0);
-
-                    printf("recv(%d, conn->buffer + %ld, %ld, 0);\n", client_fd, conn->buffer_len,
-                           conn->buffer_size - conn->buffer_len);
-                    printf("Buffer: %s\n", conn->buffer);
-
-                    conn->buffer[conn->buffer_len + bytes_read] = '\0';
-                    if (bytes_read < 0)
-                    {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK)
-                        {
-                            // No more data for now. Socket is still open
-                            LOG("DEBUG", "EAGAIN || EWOULDBLOCK - No more data for now.");
-                            break;
-                        }
-                        else
-                        {
-                            // Couldn't read data from client, error
-                            // TODO: set timeout
-                            LOG("ERROR", "Failed to read data from client using recv().");
-                            conn->state = CONN_ERROR;
-                            break;
-                        }
-                    }
-                    else if (bytes_read == 0)
-                    {
-                        // Client intentionally closed the connection
-                        LOG("INFO", "Client FD %d intentionally closed connection (EOF)",
-                            client_fd);
-                        conn->state = CONN_CLOSING;
-
-                        if (conn->buffer_len > 0)
-                        {
-                            // If we read something to buffer, continue processing
-                            LOG("DEBUG", "Client sent partial request and disconnected.");
-                            break;
-                        }
-                        else
-                        {
-                            // Otherwise, Client just connected, and disconnected without sending
-                            // anything - close connection
-                            LOG("DEBUG", "Client disconnected without sending anything.");
-                            conn->state = CONN_CLOSING;
-                            // free_connection(conn, client_fd, self->epoll_fd);
-                            // self->active_count--;
-                            break;
-                        }
-                        break;
-                    }
-                    else
-                    {
-                        // Successfully read some data
-                        conn->buffer_len += bytes_read;
-                        LOG("DEBUG", "Read %d bytes from socket FD %d", bytes_read, client_fd);
-
-                        // Check if we need to grow buffer
-                        if (conn->buffer_len >= conn->buffer_size)
-                        {
-                            size_t new_size  = conn->buffer_size * 2;
-                            char *new_buffer = realloc(conn->buffer, new_size);
-                            if (!new_buffer)
-                            {
-                                LOG("ERROR", "Failed to reallocate buffer for FD %d", client_fd);
-                                conn->state = CONN_ERROR;
-                                break;
-                            }
-                            conn->buffer      = new_buffer;
-                            conn->buffer_size = new_size;
-                            LOG("DEBUG", "Buffer size increased to %ld", new_size);
-                        }
-                    }
-                }
+/**
+ * @brief   Finds the location for a request; the query string is not part of the match.
+ */
+static const Location *route_request(const HTTPRequest *request_ptr)
+{
+    const char *uri = request_ptr->request_line.uri;
+    size_t len      = request_ptr->request_line.uri_len;
+    if (!uri) return NULL;
+    const char *query = memchr(uri, '?', len);
+    if (query) len = query - uri;
+    return router_match(&server_router, uri, len);
+}
 
-                if (conn->state != CONN_CLOSING && conn->state != CONN_ERROR)
-                {
-                    // Initialize HTTPRequest for current request
-                    if (conn->curr_request == NULL)
-                    {
-                        conn->curr_request = create_http_request();
-                    }
-                    conn->state = CONN_PROCESSING;
-                    printf("New request initialized, connection state - PROCESSING.\n");
-
-                    // Parse request if data available
-                    if (conn->curr_request->state != REQ_PARSE_DONE)
-                    {
-                        int consumed =
-                            parse_http_request(conn->buffer, conn->buffer_len, conn->curr_request);
-                        printf("Is request parsed: %d\n", consumed);
-                        if (consumed < 0)
-                        {
-                            LOG("ERROR", "Failed to parse HTTP request.");
-                            conn->curr_request->state = REQ_HANDLE_ERROR;
-                        }
-                        else
-                        {
-                            LOG("DEBUG", "Successfully parsed HTTP request.");
-                            conn->curr_request->state = REQ_PARSE_DONE;
-                        }
-                    }
-                    // Handle request if fully parsed
-                    if (conn->curr_request->state == REQ_PARSE_DONE)
-                    {
-                        printf("Request state: PARSE_DONE\n");
-                        LOG("DEBUG", "Fully parsed HTTP request below:");
-                        // print_request(&conn->request);
-
-                        HTTPResponse *response = request_handler(conn->curr_request);
-                        if (!response)
-                        {
-                            LOG("ERROR", "Failed to handle HTTP request (no response generated).");
-                            conn->curr_request->state = REQ_HANDLE_ERROR;
-                        }
-                        else
-                        {
-                            size_t response_len;
-                            char *response_str = httpresponse_serialize(response, &response_len);
-                            httpresponse_free(response);
-                            if (!response_str)
-                            {
-                                LOG("ERROR", "Failed to serialize HTTP response.");
-                                conn->curr_request->state = REQ_HANDLE_ERROR;
-                            }
-                            else
-                            {
-                                // Send response
-                                conn->state       = CONN_SENDING_RESPONSE;
-                                size_t total_sent = 0;
-                                while (total_sent < response_len)
-                                {
-                                    int bytes_sent = send(client_fd, response_str + total_sent,
-                                                          response_len - total_sent, 0);
-                                    if (bytes_sent <= 0)
-                                    {
-                                        LOG("ERROR",
-                                            "Error while sending response to client socket.");
-                                        break;
-                                    }
-                                    total_sent += bytes_sent;
-                                }
-
-                                LOG("DEBUG", "Sent %ld bytes response to client FD %d.", total_sent,
-                                    client_fd);
-                            }
-                            // LOG("DEBUG", "Response string: %s", response_str);
-                            free(response_str);
-                        }
-                    }
-
-                    // Check for keep-alive
-                    int keep_alive = 0;
-                    for (int j = 0; j < conn->curr_request->header_count; j++)
-                    {
-                        if (strncmp(conn->curr_request->headers[j].name, "Connection",
-                                    conn->curr_request->headers[j].name_len) == 0 &&
-                            strncmp(conn->curr_request->headers[j].value, "keep-alive",
-                                    conn->curr_request->headers[j].value_len) == 0)
-                        {
-                            keep_alive = 1;
-                            break;
-                        }
-                    }
-
-                    if (keep_alive)
-                    {
-                        // Reset for next request
-                        reset_connection(conn);
-                        LOG("DEBUG", "Connection is keep-alive for client FD %d", client_fd);
-                    }
-                    else
-                    {
-                        // Close connection
-                        LOG("DEBUG",
-                            "Connection is not keep-alive for client FD %d, closing connection...",
-                            client_fd);
-                        conn->state = CONN_CLOSING;
-                    }
-                }
+/**
+ * @brief   Runs the handler of a request's location (NULL answers 404).
+ *
+ * self is the event loop the request came in on, or NULL. Proxy locations
+ * go through the blocking proxy_handler() here; the event loop runs this
+ * on a coroutine for them, or sends them to start_proxy().
+ */
+static HTTPResponse *handle_route(HTTPServer *self, HTTPRequest *request_ptr,
+                                  const Location *route)
+{
+    if (!route) return not_found(request_ptr);
 
-                if (conn->state == CONN_CLOSING || conn->state == CONN_ERROR)
-                {
-                    LOG("DEBUG", "Connection is closing for client FD %d", client_fd);
-                    if (conn->curr_request != NULL) free_http_request(conn->curr_request);
-                    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
-                    close(client_fd);
-                    free_connection(conn, client_fd, self->epoll_fd);
-                    self->active_count--;
-                }
-            }
-        }
-        // ---------------------------------
+    switch (route->handler)
+    {
+    case ROUTE_STATS:
+        return stats_handler(request_ptr);
+    case ROUTE_MODULE:
+        return module_content(route->module, request_ptr, route);
+    case ROUTE_RETURN:
+        return return_handler(route);
+    case ROUTE_STATIC:
+        return static_handler(request_ptr, server_config ? &server_config->static_options : NULL,
+                              route->root, route->strip_prefix ? strlen(route->path) : 0);
+    case ROUTE_PROXY:
+    {
+        // Hits never reach the blocking upstream round trip
+        CacheStatus cache_status;
+        HTTPResponse *cached = proxy_cache_lookup(
+            request_ptr, server_config ? &server_config->proxy_cache : NULL, &cache_status);
+        if (cached) return cached;
+        return proxy_handler(self, request_ptr, route, cache_status);
+    }
+    default:
+        return not_found(request_ptr);
     }
-
-    close(self->epoll_fd);
-    return 0;
 }
 
 HTTPResponse *request_handler(HTTPRequest *request_ptr)
@@ -347,172 +3044,302 @@ HTTPResponse *request_handler(HTTPRequest *request_ptr)
     if (request_ptr == NULL) return NULL;
     if (request_ptr->request_line.uri == NULL) return NULL;
 
-    if (request_ptr->request_line.uri_len > 0)
+    HTTPResponse *response = modules_rewrite(request_ptr);
+    if (!response) response = modules_access(request_ptr, NULL);
+    if (response) return response;
+    return handle_route(NULL, request_ptr, route_request(request_ptr));
+}
+
+/**
+ * @brief   Compiles the configured locations, and the stats_uri, into server_router.
+ *
+ * Without any location section the historical routes apply: /static serves
+ * files from the working directory and /api goes to the top-level backends
+ * with the prefix stripped.
+ *
+ * @return  OK, or -1 if a location is invalid or repeats a path.
+ */
+static int build_router(const Config *cfg)
+{
+    router_free(&server_router);
+    if (router_init(&server_router) < 0) return -1;
+
+    Location defaults[] = {
+        {.path = "/static", .match = MATCH_PREFIX, .handler = ROUTE_STATIC, .group = -1},
+        {.path         = "/api",
+         .match        = MATCH_PREFIX,
+         .handler      = ROUTE_PROXY,
+         .group        = -1,
+         .strip_prefix = true},
+    };
+    Location stats = {
+        .path = cfg->stats_uri, .match = MATCH_EXACT, .handler = ROUTE_STATS, .group = -1};
+
+    if (cfg->stats_uri && router_add(&server_router, &stats) < 0)
+    {
+        LOG(LOG_ERROR, "Cannot route stats_uri %s.", cfg->stats_uri);
+        return -1;
+    }
+    for (size_t i = 0; i < cfg->location_count; i++)
     {
-        if (strncmp(request_ptr->request_line.uri, "/static", 7) == 0)
+        if (router_add(&server_router, &cfg->locations[i]) < 0)
         {
-            char filepath[PATH_MAX];
-            char *base_dir = realpath(BASE_DIR, NULL);
-            if (!base_dir)
-            {
-                LOG("ERROR", "Failed to resolve base directory.");
-                char response_buffer[] = "<h1>500 Internal Server Error</h1>";
-                return response_builder(500, "Internal Server Error", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
-            int snprintf_ret = snprintf(filepath, sizeof(filepath), "%s%.*s", base_dir,
-                                        (int)request_ptr->request_line.uri_len,
-                                        request_ptr->request_line.uri);
-            free(base_dir);
-            if (snprintf_ret < 0)
-            {
-                LOG("ERROR", "Failed to build filepath.");
-                char response_buffer[] = "<h1>404 Not Found</h1>";
-                HTTPResponse *response = response_builder(404, "Not Found", response_buffer,
-                                                          sizeof(response_buffer), "text/html");
-                return response;
-            }
-
-            int fd = open(filepath, O_RDONLY);
-            if (fd == -1)
-            {
-                LOG("ERROR", "Failed to open file.");
-                char response_buffer[] = "<h1>404 Not Found</h1>";
-                HTTPResponse *response = response_builder(404, "Not Found", response_buffer,
-                                                          sizeof(response_buffer), "text/html");
-                return response;
-            }
+            LOG(LOG_ERROR, "Cannot route location %s: invalid or already defined.",
+                cfg->locations[i].path);
+            return -1;
+        }
+    }
+    for (size_t i = 0; cfg->location_count == 0 && i < sizeof(defaults) / sizeof(*defaults); i++)
+    {
+        if (router_add(&server_router, &defaults[i]) < 0) return -1;
+    }
+    return OK;
+}
 
-            // Get file size
-            struct stat st;
-            fstat(fd, &st);
-            size_t filesize = st.st_size;
+// ---------- HTTP/2 ----------
 
-            char *buffer = calloc(1, filesize);
+static bool http2_enabled(void)
+{
+    return !server_config || server_config->http2;
+}
 
-            if (!buffer)
-            {
-                LOG("ERROR", "Failed to allocate buffer.");
-                close(fd);
-                char response_buffer[] = "<h1>Internal Server Error</h1>";
-                return response_builder(500, "Internal Server Error", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
+static int h2_send(void *ctx, const char *data, size_t len)
+{
+    return queue_output(ctx, data, len);
+}
 
-            size_t total_read = 0;
-            while (total_read < filesize)
-            {
-                size_t bytes = read(fd, buffer + total_read, filesize - total_read);
-                if (bytes <= 0)
-                {
-                    LOG("ERROR", "Failed to read file.");
-                    free(buffer);
-                    char response_buffer[] = "<h1>Internal Server Error</h1>";
-                    return response_builder(500, "Internal Server Error", response_buffer,
-                                            sizeof(response_buffer), "text/html");
-                }
-                total_read += bytes;
-            }
+static int h2_send_file(void *ctx, int fd, off_t offset, size_t length)
+{
+    return queue_file(ctx, fd, offset, length, false);
+}
 
-            LOG("DEBUG", "Read %zu bytes\nActual filesize: %zu", total_read, filesize);
+static void h2_release_file(void *ctx, int fd)
+{
+    release_file(ctx, fd);
+}
 
-            if (total_read != filesize)
-            {
-                LOG("ERROR", "Failed to read file.");
-                free(buffer);
-                char response_buffer[] = "<h1>Internal Server Error</h1>";
-                return response_builder(500, "Internal Server Error", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
+/**
+ * @brief   Answers an HTTP/2 stream refused by load shedding or limit_req.
+ *
+ * Only the stream is refused; the connection and its other streams go on.
+ */
+static HTTPResponse *refuse_stream(int status, int retry_after)
+{
+    metrics_count_status(status);
+    char body[64], seconds[16];
+    int body_len = snprintf(body, sizeof(body), "<h1>%d %s</h1>", status, status_phrase(status));
+    HTTPResponse *response =
+        response_builder(status, status_phrase(status), body, body_len, "text/html");
+    snprintf(seconds, sizeof(seconds), "%d", retry_after);
+    if (response) httpresponse_add_header(response, "Retry-After", seconds);
+    return response;
+}
 
-            HTTPResponse *response =
-                response_builder(200, "OK", buffer, filesize, get_mime_type(filepath));
+/**
+ * @brief   Answers one HTTP/2 stream, like process_requests() does a request.
+ *
+ * @return  The response, or NULL while an upstream fetch, the I/O pool or
+ *          a coroutine answers the stream; complete_fetch() or
+ *          finish_handler_job() submits it then.
+ */
+static HTTPResponse *answer_stream(Connection *conn, HTTPRequest *req, uint32_t stream_id)
+{
+    if (conn->server->shedding)
+    {
+        metric_add(&metrics_local()->shed_requests, 1);
+        return refuse_stream(503, conn->server->config->overload_retry_after);
+    }
+    if (!rate_limit_request(&conn->server->limiter, conn->client_key, monotonic_ns()))
+    {
+        metric_add(&metrics_local()->limited_requests, 1);
+        return refuse_stream(429, 1);
+    }
+    metric_add(&metrics_local()->requests, 1);
 
-            close(fd);
-            return response;
-        }
-        else if (strncmp(request_ptr->request_line.uri, "/api", 4) == 0)
-        {
-            // TODO: Reverse proxy
-            char *api_path = request_ptr->request_line.uri + strlen("/api");
-            if (*api_path == '\0') api_path = "/";
+    uint64_t handle_start = monotonic_ns();
+    bool deferred;
+    HTTPResponse *response = dispatch_request(conn->server, conn, req, stream_id, &deferred);
+    metrics_record_phase(PHASE_HANDLE, handle_start);
 
-            char proxy_request[INITIAL_BUFFER_SIZE];
-            int proxy_request_len =
-                snprintf(proxy_request, sizeof(proxy_request),
-                         "%s %s HTTP/1.1\r\n"
-                         "Host: localhost\r\n"
-                         "Content-Length: %zu\r\n"
-                         "Connection: close\r\n"
-                         "\r\n",
-                         request_ptr->request_line.method, api_path, request_ptr->body_len);
+    if (!response && !deferred)
+    {
+        LOG(LOG_ERROR, "Failed to handle HTTP/2 request (no response generated).");
+        char response_buffer[] = "<h1>500 Internal Server Error</h1>";
+        response = response_builder(500, "Internal Server Error", response_buffer,
+                                    sizeof(response_buffer), "text/html");
+    }
+    if (response) metrics_count_status(response->status_code);
+    return response;
+}
 
-            if (proxy_request_len < 0)
-            {
-                LOG("ERROR", "Failed to build proxy request.");
-                char response_buffer[] = "<h1>Internal Server Error</h1>";
-                return response_builder(500, "Internal Server Error", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
+/**
+ * @brief   Session callback for a complete stream: answers and logs it.
+ *
+ * The frames of a stream are read along with those of the others, so its
+ * timing starts at the handler.
+ */
+static HTTPResponse *h2_handle(void *ctx, HTTPRequest *req, uint32_t stream_id)
+{
+    Connection *conn = ctx;
+    memset(conn->trace, 0, sizeof(conn->trace));
+    conn->trace[ACCESS_HANDLER] = monotonic_ns();
 
-            // Then, append the request body to the proxy_request string
-            strncat(proxy_request, request_ptr->body, request_ptr->body_len);
+    HTTPResponse *response = answer_stream(conn, req, stream_id);
+    if (response && recording_access())
+    {
+        AccessRecord rec;
+        fill_access(&rec, conn, req);
+        log_stream(conn, &rec, NULL, response);
+    }
+    return response;
+}
 
-            int backend_fd = connect_to_backend("localhost", "8002");
-            if (backend_fd == -1)
-            {
-                LOG("ERROR", "Failed to connect to backend.");
-                char response_buffer[] = "<h1>502 Bad Gateway</h1>";
-                return response_builder(502, "Bad Gateway", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
+static int start_h2(Connection *conn)
+{
+    H2Callbacks callbacks = {conn, h2_send, h2_send_file, h2_release_file, h2_handle};
+    conn->h2              = h2_session_new(&callbacks);
+    return conn->h2 ? OK : -1;
+}
 
-            send(backend_fd, proxy_request, proxy_request_len, 0);
+/**
+ * @brief   True for a first request asking to switch to h2c (RFC 7540 section 3.2).
+ *
+ * Requests with a body stay on HTTP/1.1, and TLS clients pick h2 with ALPN
+ * instead.
+ */
+static bool wants_h2c_upgrade(const Connection *conn)
+{
+    const HTTPRequest *req = conn->curr_request;
+    if (!http2_enabled() || conn->tls || conn->requests_handled > 0 || req->body_len > 0)
+        return false;
+    const HTTPHeader *upgrade = find_header(req, "Upgrade");
+    return upgrade && list_has_token(upgrade->value, upgrade->value_len, "h2c", NULL) &&
+           find_header(req, "HTTP2-Settings");
+}
 
-            // Receive response from backend
-            char proxy_response[INITIAL_BUFFER_SIZE];
-            int proxy_response_len = recv(backend_fd, proxy_response, sizeof(proxy_response), 0);
+/**
+ * @brief   Answers 101 and continues the connection as HTTP/2.
+ *
+ * curr_request becomes stream 1 and is answered over HTTP/2; whatever
+ * follows it in the buffer is the client preface.
+ */
+static void upgrade_to_h2(Connection *conn, size_t consumed)
+{
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Upgrade: h2c\r\n\r\n";
+    HTTPRequest *req           = conn->curr_request;
+    const HTTPHeader *settings = find_header(req, "HTTP2-Settings");
+
+    metrics_count_status(101);
+    if (queue_output(conn, switching, sizeof(switching) - 1) < 0 || start_h2(conn) < 0 ||
+        h2_session_upgrade(conn->h2, settings->value, settings->value_len, req) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to upgrade client FD %d to HTTP/2.", conn->socket);
+        conn->state = CONN_CLOSING;
+    }
+    else
+    {
+        HTTPResponse *response = h2_handle(conn, req, 1);
+        if (response) h2_submit_response(conn->h2, 1, response);
+    }
+    conn->requests_handled++;
 
-            if (proxy_response_len < 0)
-            {
-                LOG("ERROR", "Failed to read from backend.");
-                char response_buffer[] = "<h1>502 Bad Gateway</h1>";
-                return response_builder(502, "Bad Gateway", response_buffer,
-                                        sizeof(response_buffer), "text/html");
-            }
+    free_http_request(conn->curr_request);
+    conn->curr_request = NULL;
+    conn->buffer_len -= consumed;
+    memmove(conn->buffer, conn->buffer + consumed, conn->buffer_len);
+    conn->buffer[conn->buffer_len] = '\0';
+}
 
-            proxy_response[proxy_response_len] = '\0';
-            close(backend_fd);
+/**
+ * @brief   Feeds buffered bytes to the connection's HTTP/2 session.
+ *
+ * A connection error or the end of the session closes the connection once
+ * the queued frames (GOAWAY included) are sent.
+ */
+static void process_h2(Connection *conn)
+{
+    ssize_t consumed = h2_session_recv(conn->h2, conn->buffer, conn->buffer_len);
+    if (consumed > 0)
+    {
+        conn->buffer_len -= consumed;
+        memmove(conn->buffer, conn->buffer + consumed, conn->buffer_len);
+        conn->buffer[conn->buffer_len] = '\0';
+    }
+    if (consumed < 0 || h2_session_finished(conn->h2))
+    {
+        conn->keep_alive = false;
+        conn->state      = CONN_CLOSING;
+    }
+}
 
-            LOG("DEBUG", "Received %d bytes response from backend.", proxy_response_len);
+/**
+ * @brief   True once the buffer holds the HTTP/2 client preface (prior knowledge).
+ *
+ * *partial is set while the buffer holds only the start of it.
+ */
+static bool starts_with_h2_preface(const Connection *conn, bool *partial)
+{
+    size_t n = conn->buffer_len < H2_PREFACE_LEN ? conn->buffer_len : H2_PREFACE_LEN;
+    *partial = false;
+    if (conn->requests_handled > 0 || !http2_enabled() || n == 0 ||
+        memcmp(conn->buffer, H2_PREFACE, n) != 0)
+        return false;
+    *partial = n < H2_PREFACE_LEN;
+    return !*partial;
+}
 
-            // TODO: parse response headers, here we directly return body
-            char *body = strstr(proxy_response, "\r\n\r\n");
-            if (!body)
-                body = proxy_response;
-            else
-                body += 4;
+// ---------- TLS ----------
 
-            HTTPResponse *response =
-                response_builder(200, "OK", body, proxy_request_len, "text/html");
-            return response;
-        }
-        else
+/**
+ * @brief   Advances a TLS handshake, watching whichever direction it waits on.
+ *
+ * Once it completes the connection moves to CONN_ESTABLISHED and reads
+ * requests like a plaintext one. A client that negotiated h2 with ALPN
+ * starts with the HTTP/2 preface, which process_requests() recognizes.
+ *
+ * @return  OK when complete or still in progress, -1 if the handshake failed.
+ */
+static int continue_handshake(HTTPServer *self, Connection *conn)
+{
+    uint32_t events = 0;
+    int done        = tls_handshake(conn->tls, &events);
+    if (done < 0)
+    {
+        LOG(LOG_DEBUG, "TLS handshake with client FD %d failed.", conn->socket);
+        return -1;
+    }
+    if (done == 0)
+    {
+        bool want_write = events == EPOLLOUT;
+        if (want_write != conn->write_blocked)
         {
-            LOG("DEBUG", "Request to unknown URI by proxy backend: %s",
-                request_ptr->request_line.uri);
-            char response_buffer[] = "<h1>404 Not Found</h1>";
-            HTTPResponse *response = response_builder(404, "Not Found", response_buffer,
-                                                      sizeof(response_buffer), "text/html");
-            return response;
+            conn->write_blocked = want_write;
+            watch_connection(self, conn, events);
         }
+        return OK;
     }
 
-    LOG("DEBUG", "Request to unknown URI: %s", request_ptr->request_line.uri);
-    char response_buffer[] = "<h1>404 Not Found</h1>";
-    HTTPResponse *response =
-        response_builder(404, "Not Found", response_buffer, sizeof(response_buffer), "text/html");
-    return response;
+    if (conn->write_blocked)
+    {
+        conn->write_blocked = false;
+        watch_connection(self, conn, EPOLLIN);
+    }
+    conn->state = CONN_ESTABLISHED;
+
+    WorkerMetrics *metrics = metrics_local();
+    bool resumed           = tls_session_reused(conn->tls);
+    bool ktls              = tls_ktls_send(conn->tls);
+    metric_add(&metrics->tls_handshakes, 1);
+    if (resumed) metric_add(&metrics->tls_resumed, 1);
+    if (ktls) metric_add(&metrics->tls_ktls, 1);
+
+    size_t alpn_len;
+    const char *alpn = tls_alpn(conn->tls, &alpn_len);
+    LOG(LOG_DEBUG, "TLS established with client FD %d (alpn %.*s, resumed %d, ktls %d)",
+        conn->socket, alpn ? (int)alpn_len : 4, alpn ? alpn : "none", resumed, ktls);
+    return OK;
 }
 
 // ---------- UTILS ----------
@@ -521,6 +3348,7 @@ int init_connection(Connection *conn, int client_fd, int epoll_fd)
 {
     if (!conn || client_fd < 0 || epoll_fd < 0) return -1;
 
+    conn->kind   = EVENT_CLIENT;
     conn->socket = client_fd;
     conn->buffer = (char *)calloc(INITIAL_BUFFER_SIZE, sizeof(char));
     if (!conn->buffer) return -1;
@@ -532,6 +3360,30 @@ int init_connection(Connection *conn, int client_fd, int epoll_fd)
     conn->requests_handled = 0;
     conn->state            = CONN_ESTABLISHED;
     conn->last_active      = time(NULL);
+    conn->out_buf          = NULL;
+    conn->out_size         = 0;
+    conn->out_len          = 0;
+    conn->segments         = NULL;
+    conn->segment_cap      = 0;
+    conn->segment_count    = 0;
+    conn->segment_head     = 0;
+    conn->send_start       = 0;
+    conn->write_blocked    = false;
+    conn->fetch            = NULL;
+    conn->handler_job      = NULL;
+    conn->request_size     = 0;
+    conn->h2               = NULL;
+    conn->tunnel           = NULL;
+    conn->tls              = NULL;
+    conn->client_key       = 0;
+    conn->limit_slot       = -1;
+    conn->accepted_at      = 0;
+    conn->out_total        = 0;
+    conn->sent_total       = 0;
+    conn->access           = NULL;
+    conn->access_count     = 0;
+    conn->access_cap       = 0;
+    memset(conn->trace, 0, sizeof(conn->trace));
 
     return 0;
 }
@@ -548,16 +3400,35 @@ int free_connection(Connection *conn, int client_fd, int epoll_fd)
         free(conn->buffer);
         conn->buffer = NULL;
     }
-
-    conn->buffer_size = 0;
-    conn->buffer_len  = 0;
+    if (conn->curr_request)
+    {
+        free_http_request(conn->curr_request);
+        conn->curr_request = NULL;
+    }
+    discard_output(conn);
+    h2_session_free(conn->h2); // after discard_output(), so released files are closed at once
+    conn->h2 = NULL;
+    tls_free(conn->tls);
+    conn->tls = NULL;
+    free(conn->out_buf);
+    free(conn->segments);
+    free(conn->access);
+    conn->out_buf  = NULL;
+    conn->segments = NULL;
+    conn->access   = NULL;
+
+    conn->buffer_size  = 0;
+    conn->buffer_len   = 0;
+    conn->out_size     = 0;
+    conn->segment_cap  = 0;
+    conn->access_count = 0;
+    conn->access_cap   = 0;
 
     return OK;
 }
 
 int reset_connection(Connection *conn)
 {
-    memset(conn->buffer, 0, conn->buffer_size);
     conn->buffer_len = 0;
     conn->state      = CONN_ESTABLISHED;
 
@@ -572,54 +3443,192 @@ int reset_connection(Connection *conn)
 
 int connect_to_backend(const char *host, const char *port)
 {
-    struct addrinfo hints, *res;
-    memset(&hints, 0, sizeof(hints));
+    UpstreamAddress addr = {.is_unix = false};
+    if (snprintf(addr.host, sizeof(addr.host), "%s", host) >= (int)sizeof(addr.host)) return -1;
+    snprintf(addr.port, sizeof(addr.port), "%s", port);
 
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    int sock = upstream_connect(&addr, false);
+    if (sock < 0) LOG(LOG_ERROR, "Failed to connect to proxy backend.");
+    return sock;
+}
 
-    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (sock < 0)
+void *get_in_addr(struct sockaddr *sa)
+{
+    if (sa->sa_family == AF_INET)
     {
-        LOG("ERROR", "Failed to create socket while connecting to proxy backend.");
-        freeaddrinfo(res);
-        return -1;
+        return &(((struct sockaddr_in *)sa)->sin_addr);
     }
 
-    if (connect(sock, res->ai_addr, res->ai_addrlen) != 0)
+    return &(((struct sockaddr_in6 *)sa)->sin6_addr);
+}
+
+/**
+ * @brief   Builds the 503 sent when shedding, with the configured Retry-After.
+ */
+static void build_unavailable(const Config *cfg)
+{
+    static const char body[] = "<h1>503 Service Unavailable</h1>";
+    int retry_after = cfg->overload_retry_after > 0 ? cfg->overload_retry_after : 1;
+    int len         = snprintf(service_unavailable, sizeof(service_unavailable),
+                               "HTTP/1.1 503 Service Unavailable\r\n"
+                               "Content-Type: text/html\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Retry-After: %d\r\n"
+                               "Connection: close\r\n"
+                               "\r\n"
+                               "%s",
+                               sizeof(body) - 1, retry_after, body);
+    service_unavailable_len = (size_t)len;
+}
+
+/**
+ * @brief   Starts the threads all workers hand static file I/O to.
+ *
+ * @return  The pool, or NULL if threads is 0 or none could be started;
+ *          the loops then read files themselves.
+ */
+static IOPool *start_io_pool(int threads)
+{
+    if (threads <= 0) return NULL;
+    IOPool *pool = malloc(sizeof(IOPool));
+    if (!pool || io_pool_start(pool, threads) < 0)
     {
-        LOG("ERROR", "Failed to connect to proxy backend.");
-        freeaddrinfo(res);
-        return -1;
+        LOG(LOG_WARN, "Failed to start the I/O pool, reading static files on the event loops.");
+        free(pool);
+        return NULL;
     }
-
-    freeaddrinfo(res);
-    return sock;
+    return pool;
 }
 
-void *get_in_addr(struct sockaddr *sa)
+/**
+ * @brief   Adds workers 1..count-1 to a server: copies sharing everything
+ *          but their listeners and per-loop state.
+ */
+static void add_workers(HTTPServer *self, int count, const SocketOptions *options)
 {
-    if (sa->sa_family == AF_INET)
+    self->workers = calloc(count - 1, sizeof(HTTPServer));
+    if (!self->workers)
     {
-        return &(((struct sockaddr_in *)sa)->sin_addr);
+        LOG(LOG_ERROR, "Failed to allocate workers, running a single one.");
+        return;
     }
 
-    return &(((struct sockaddr_in6 *)sa)->sin6_addr);
+    for (int i = 1; i < count; i++)
+    {
+        HTTPServer *worker = &self->workers[i - 1];
+        int port           = self->server->port;
+        *worker            = *self;
+        worker->server     = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_ANY, port, options);
+        worker->tls_server = NULL;
+        if (self->tls_server)
+            worker->tls_server = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_ANY,
+                                                    self->tls_server->port, options);
+        worker->worker_id    = i;
+        worker->cpu          = worker_cpu(&self->config->workers, i);
+        worker->workers      = NULL;
+        worker->worker_count = 0;
+        atomic_init(&worker->running, true);
+    }
+    self->worker_count = count - 1;
+}
+
+/**
+ * @brief   Raises the open file limit toward what the workers may hold.
+ *
+ * A tunnel holds a backend socket beside its client's, and the loops keep
+ * spare pipes, so each worker can need twice max_connections descriptors
+ * and more. Only the soft limit moves; a hard limit below the need is
+ * reported and left to the operator.
+ */
+static void raise_file_limit(const Config *cfg, int workers)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return;
+
+    rlim_t wanted = (rlim_t)workers * (cfg->max_connections * 2 + TUNNEL_SPARE_PIPES * 2) + 64;
+    if (limit.rlim_cur >= wanted) return;
+
+    limit.rlim_cur = limit.rlim_max == RLIM_INFINITY || limit.rlim_max >= wanted ? wanted
+                                                                                  : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < wanted)
+        LOG(LOG_WARN, "Open file limit %llu is below the %llu that %d workers may need.",
+            (unsigned long long)limit.rlim_cur, (unsigned long long)wanted, workers);
 }
 
-HTTPServer *httpserver_constructor(int port, char *static_dir, char **proxy_backends,
-                                   int backend_count)
+/**
+ * @brief   Creates the HTTP server described by cfg.
+ *
+ * The Config is borrowed: it must outlive the server, which keeps pointing
+ * at its backend list and handler settings.
+ */
+HTTPServer *httpserver_constructor(const Config *cfg)
 {
+    if (build_router(cfg) < 0 || modules_init(cfg->modules) < 0)
+    {
+        router_free(&server_router);
+        return NULL;
+    }
+
+    RateLimiter limiter;
+    if (rate_limiter_init(&limiter, &cfg->limits) < 0)
+    {
+        router_free(&server_router);
+        return NULL;
+    }
+
+    TLSContext *tls = NULL;
+    if (cfg->tls.port > 0 && !(tls = tls_context_new(&cfg->tls, cfg->http2)))
+    {
+        rate_limiter_free(&limiter);
+        router_free(&server_router);
+        return NULL;
+    }
+
+    if (access_log_open(&cfg->access_log) < 0)
+    {
+        tls_context_free(tls);
+        rate_limiter_free(&limiter);
+        router_free(&server_router);
+        return NULL;
+    }
+
     HTTPServer *httpserver_ptr = (HTTPServer *)malloc(sizeof(HTTPServer));
 
-    SocketServer *SockServer   = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_ANY, port, 10);
-    httpserver_ptr->server     = SockServer;
-    httpserver_ptr->static_dir = strdup(static_dir);
-    httpserver_ptr->proxy_backends = proxy_backends;
-    httpserver_ptr->backend_count  = backend_count;
+    // Every worker listens on the port itself; the kernel spreads connections over them
+    int workers                  = worker_count(&cfg->workers);
+    SocketOptions socket_options = cfg->socket_options;
+    if (workers > 1) socket_options.reuseport = true;
+    raise_file_limit(cfg, workers);
+
+    SocketServer *SockServer =
+        server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_ANY, cfg->port, &socket_options);
+    httpserver_ptr->server         = SockServer;
+    httpserver_ptr->tls            = tls;
+    httpserver_ptr->tls_server     = NULL;
+    httpserver_ptr->config         = cfg;
+    httpserver_ptr->static_dir     = strdup(cfg->static_dir ? cfg->static_dir : BASE_DIR);
+    httpserver_ptr->proxy_backends = cfg->backends;
+    httpserver_ptr->backend_count  = cfg->backend_count;
     httpserver_ptr->launch         = launch;
+    httpserver_ptr->fetches        = NULL;
+    httpserver_ptr->io_pool        = start_io_pool(cfg->static_io_threads);
+    httpserver_ptr->io_done.fd     = -1;
+    httpserver_ptr->handler_jobs   = NULL;
+    httpserver_ptr->limiter        = limiter;
+    httpserver_ptr->worker_id      = 0;
+    httpserver_ptr->cpu            = worker_cpu(&cfg->workers, 0);
+    httpserver_ptr->workers        = NULL;
+    httpserver_ptr->worker_count   = 0;
+    atomic_init(&httpserver_ptr->running, true);
+    if (tls)
+        httpserver_ptr->tls_server = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_ANY,
+                                                        cfg->tls.port, &socket_options);
+    if (workers > 1) add_workers(httpserver_ptr, workers, &socket_options);
+
+    server_config = cfg;
+    build_unavailable(cfg);
+    metrics_set_backends(cfg->backends, cfg->backend_count);
+    proxy_cache_init(&cfg->proxy_cache);
 
     return httpserver_ptr;
 }
@@ -630,7 +3639,24 @@ void httpserver_destructor(HTTPServer *httpserver_ptr)
     {
         server_destructor(httpserver_ptr->server);
     }
+    if (httpserver_ptr->tls_server != NULL)
+    {
+        server_destructor(httpserver_ptr->tls_server);
+    }
+    for (int i = 0; i < httpserver_ptr->worker_count; i++)
+    {
+        server_destructor(httpserver_ptr->workers[i].server);
+        server_destructor(httpserver_ptr->workers[i].tls_server);
+    }
+    free(httpserver_ptr->workers);
+    tls_context_free(httpserver_ptr->tls);
+    if (httpserver_ptr->io_pool) io_pool_stop(httpserver_ptr->io_pool);
+    free(httpserver_ptr->io_pool);
+    static_cache_clear();
+    proxy_cache_shutdown();
+    access_log_close();
+    router_free(&server_router);
+    rate_limiter_free(&httpserver_ptr->limiter);
     free(httpserver_ptr->static_dir);
-    free(httpserver_ptr->proxy_backends);
     free(httpserver_ptr);
 }
\ No newline at end of file
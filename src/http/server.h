@@ -9,22 +9,112 @@
 #ifndef HTTPSERVER_H
 #define HTTPSERVER_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include "sock/server.h"
+#include "sock/tls.h"
 #include "parsers.h"
 #include "common.h"
 #include "request.h"
+#include "http2.h"
+#include "proxy_cache.h"
+#include "static_files.h"
+#include "upstream.h"
+#include "router.h"
+#include "module.h"
+#include "rate_limit.h"
+#include "utils/config.h"
+#include "utils/metrics.h"
+#include "utils/access_log.h"
+#include "utils/io_pool.h"
+#include "utils/coroutine.h"
+
+/*
+ * What an epoll registration points at. Every object registered with epoll
+ * starts with its EventKind, so the loop can tell them apart from data.ptr.
+ */
+typedef enum
+{
+    EVENT_LISTENER,
+    EVENT_TLS_LISTENER,
+    EVENT_CLIENT,
+    EVENT_UPSTREAM,
+    EVENT_IO_DONE,
+    EVENT_COROUTINE,
+    EVENT_TUNNEL,
+} EventKind;
+
+#define TUNNEL_SPARE_PIPES 64         // empty pipes a loop keeps for its tunnels
+#define TUNNEL_BUFFER (16 * 1024)     // bytes of a TLS client's tunnel read at a time
+#define TUNNEL_BURST (256 * 1024)     // bytes one way of a tunnel moves before others get a turn
+
+struct ProxyFetch;
+struct HandlerJob;
+struct Tunnel;
+
+/* Empty pipes lent to tunnels while bytes are in flight, so idle tunnels hold none */
+typedef struct PipePool
+{
+    int fds[TUNNEL_SPARE_PIPES][2];
+    size_t count;
+} PipePool;
+
+/* One piece of queued output: bytes of out_buf, or a slice of a file */
+typedef struct OutputSegment
+{
+    int fd;        // -1 for out_buf bytes, else the file sent with sendfile()
+    bool close_fd; // close fd once the slice is sent
+    off_t offset;  // into out_buf or the file; advances as bytes go out
+    size_t length; // bytes left to send
+} OutputSegment;
+
+/* An access log record waiting for the last byte of its response to be sent */
+typedef struct PendingAccess
+{
+    uint64_t out_start; // out_total before the response was queued
+    uint64_t out_end;   // out_total once it was
+    AccessRecord record;
+} PendingAccess;
 
 typedef struct Connection
 {
-    int socket;                // client socket
-    char *buffer;              // dynamic buffer for request
-    size_t buffer_size;        // allocated size for buffer
-    size_t buffer_len;         // current data length of buffer
-    ConnectionState state;     // connection state
-    time_t last_active;        // last active time
-    HTTPRequest *curr_request; // current request
-    int requests_handled;      // number of requests handled so far
-    bool keep_alive;           // keep-alive?
+    EventKind kind;                      // EVENT_CLIENT
+    int socket;                          // client socket
+    char *buffer;                        // dynamic buffer for request
+    size_t buffer_size;                  // allocated size for buffer
+    size_t buffer_len;                   // current data length of buffer
+    ConnectionState state;               // connection state
+    time_t last_active;                  // last active time
+    HTTPRequest *curr_request;           // current request
+    int requests_handled;                // number of requests handled so far
+    bool keep_alive;                     // keep-alive?
+    char *out_buf;                       // serialized response bytes not yet sent
+    size_t out_size;                     // allocated size for out_buf
+    size_t out_len;                      // bytes queued in out_buf
+    OutputSegment *segments;             // output in send order: out_buf spans and file slices
+    size_t segment_cap;                  // allocated entries in segments
+    size_t segment_count;                // entries queued
+    size_t segment_head;                 // first entry not yet fully sent
+    uint64_t send_start;                 // when output went from empty to non-empty
+    bool write_blocked;                  // waiting for EPOLLOUT
+    struct ProxyFetch *fetch;            // upstream fetch curr_request waits on, or NULL
+    struct HandlerJob *handler_job;      // pool read or coroutine curr_request waits on, or NULL
+    size_t request_size;                 // buffer bytes taken by curr_request while it waits
+    H2Session *h2;                       // HTTP/2 session once the connection speaks h2c, or NULL
+    struct Tunnel *tunnel;               // relay of a CONN_TUNNEL connection, or NULL
+    EventKind tunnel_kind;               // EVENT_TUNNEL; registered for the tunnel's backend socket
+    struct HTTPServer *server;           // event loop owning the connection
+    TLSConnection *tls;                  // TLS session for a TLS listener's client, or NULL
+    struct sockaddr_storage client_addr; // peer address captured at accept
+    uint64_t client_key;                 // rate limit key of client_addr
+    int limit_slot;                      // limit_conn entry counting the connection, or -1
+    uint64_t accepted_at;                // monotonic time of accept
+    uint64_t trace[ACCESS_PHASES];       // monotonic phase times of curr_request, 0 if not yet
+    uint64_t out_total;                  // bytes ever queued for the client
+    uint64_t sent_total;                 // bytes of them sent
+    PendingAccess *access;               // access log records of responses not fully sent
+    size_t access_count;
+    size_t access_cap;
 } Connection;
 
 int init_connection(Connection *conn, int client_fd, int epoll_fd);
@@ -34,9 +124,32 @@ int reset_connection(Connection *conn);
 typedef struct HTTPServer
 {
     SocketServer *server;
+    SocketServer *tls_server; // TLS listener, or NULL
+    TLSContext *tls;          // certificate and session state of tls_server
+    const Config *config;
     Connection *connections;
+    size_t connection_slots; // entries in connections: the config's max_connections
+    size_t free_hint;        // where the search for a free connection slot starts
     size_t active_count;
     int epoll_fd;
+    atomic_bool running;
+    struct ProxyFetch *fetches;      // upstream fetches in flight on this loop
+    IOPool *io_pool;                 // static file I/O threads shared by all loops, or NULL
+    IOCompletions io_done;           // file reads of this loop the pool has finished
+    struct HandlerJob *handler_jobs; // pool reads and coroutine handlers in flight on this loop
+    CoScheduler coroutines;          // handlers of "coroutine = on" locations
+    UpstreamPool upstream_pool;      // idle keep-alive backend connections of this loop
+    PipePool spare_pipes;            // lent to tunnels of this loop
+    RateLimiter limiter;             // limit_req and limit_conn state shared by all loops
+    int worker_id;                   // 0 for the loop launch() runs on the calling thread
+    int cpu;                         // CPU the loop is pinned to, or -1
+    struct HTTPServer *workers;      // workers 1.. of a multi-worker server; copies sharing config
+    int worker_count;                // entries in workers
+    pthread_t thread;                // thread running this loop, for workers 1..
+    uint64_t loop_lag;               // moving average of the time an event batch takes, ns
+    size_t resident_bytes;           // process RSS at the last idle sweep
+    bool shedding;                   // answering new requests with 503
+    bool accept_paused;              // listeners out of epoll until load drops
 
     char *static_dir;
     char **proxy_backends;
@@ -47,9 +160,10 @@ typedef struct HTTPServer
 
 HTTPResponse *request_handler(HTTPRequest *request_ptr);
 int connect_to_backend(const char *host, const char *port);
+void *get_in_addr(struct sockaddr *sa);
 
-HTTPServer *httpserver_constructor(int port, char *static_dir, char **proxy_backends,
-                                   int backend_count);
+HTTPServer *httpserver_constructor(const Config *cfg);
+void httpserver_stop(HTTPServer *self);
 void httpserver_destructor(HTTPServer *httpserver_ptr);
 
 #endif
@@ -0,0 +1,945 @@
+/**
+ * @file    static_files.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Static file handler and compressed-variant cache implementation.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <zlib.h>
+#ifdef CSERVE_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "static_files.h"
+#include "parsers.h"
+
+#define COMPRESSION_CACHE_BUCKETS 1024
+
+typedef struct CacheEntry
+{
+    char *path;
+    int encoding;
+    dev_t dev; // identity of the file the variant was built from
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *data; // NULL when compressing did not make the file smaller
+    size_t len;
+    size_t cost; // bytes charged against compression_cache_size
+    uint64_t hash;
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev; // towards most recently used
+    struct CacheEntry *lru_next;
+} CacheEntry;
+
+// One cache for the process, shared by every worker
+static struct
+{
+    pthread_mutex_t lock;
+    CacheEntry *buckets[COMPRESSION_CACHE_BUCKETS];
+    CacheEntry *lru_head; // most recently used
+    CacheEntry *lru_tail;
+    size_t bytes;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static const StaticOptions default_options = {
+    .compression            = true,
+    .compression_cache_size = DEFAULT_COMPRESSION_CACHE_SIZE,
+    .compression_min_length = DEFAULT_COMPRESSION_MIN_LENGTH,
+    .compression_max_length = DEFAULT_COMPRESSION_MAX_LENGTH,
+    .gzip_level             = DEFAULT_GZIP_LEVEL,
+    .brotli_quality         = DEFAULT_BROTLI_QUALITY,
+};
+
+void static_options_defaults(StaticOptions *opts)
+{
+    *opts = default_options;
+}
+
+/**
+ * @brief   Adds a "<prefix> <seconds>" Cache-Control rule.
+ *
+ * A rule for a prefix that is already configured replaces it.
+ *
+ * @return  OK, or -1 if the spec is malformed or the table is full.
+ */
+int static_options_add_cache_rule(StaticOptions *opts, const char *spec)
+{
+    char prefix[256];
+    long max_age;
+    if (sscanf(spec, "%255s %ld", prefix, &max_age) != 2 || prefix[0] != '/' || max_age < 0)
+        return -1;
+
+    for (int i = 0; i < opts->cache_rule_count; i++)
+    {
+        if (strcmp(opts->cache_rules[i].prefix, prefix) == 0)
+        {
+            opts->cache_rules[i].max_age = max_age;
+            return OK;
+        }
+    }
+    if (opts->cache_rule_count == MAX_CACHE_RULES) return -1;
+
+    CacheRule *rule = &opts->cache_rules[opts->cache_rule_count];
+    rule->prefix    = strdup(prefix);
+    if (!rule->prefix) return -1;
+    rule->max_age = max_age;
+    opts->cache_rule_count++;
+    return OK;
+}
+
+void static_options_free(StaticOptions *opts)
+{
+    for (int i = 0; i < opts->cache_rule_count; i++)
+        free(opts->cache_rules[i].prefix);
+    opts->cache_rule_count = 0;
+}
+
+// ---------- CONTENT NEGOTIATION ----------
+
+/**
+ * @brief   Parses an Accept-Encoding value into a mask of ContentEncoding bits.
+ *
+ * Codings with q=0 are refused; "*" accepts every coding not listed
+ * explicitly. Unknown codings are ignored.
+ */
+int parse_accept_encoding(const char *value, size_t len)
+{
+    int accepted = 0, refused = 0;
+    bool wildcard = false;
+
+    const char *ptr = value;
+    const char *end = value + len;
+    while (ptr < end)
+    {
+        const char *comma = memchr(ptr, ',', end - ptr);
+        const char *next  = comma ? comma : end;
+
+        while (ptr < next && (*ptr == ' ' || *ptr == '\t'))
+            ptr++;
+        const char *token = ptr;
+        while (ptr < next && *ptr != ';' && *ptr != ' ' && *ptr != '\t')
+            ptr++;
+        size_t token_len = ptr - token;
+
+        // A q-value of zero ("q=0", "q=0.0", ...) means "not acceptable"
+        bool zero_q       = false;
+        const char *param = memchr(ptr, ';', next - ptr);
+        if (param)
+        {
+            const char *q = memmem(param, next - param, "q=", 2);
+            if (q)
+            {
+                zero_q = true;
+                for (q += 2; q < next && *q != ' ' && *q != ';'; q++)
+                {
+                    if (*q >= '1' && *q <= '9') zero_q = false;
+                }
+            }
+        }
+
+        int coding = 0;
+        if (token_len == 4 && strncasecmp(token, "gzip", 4) == 0)
+            coding = ENCODING_GZIP;
+        else if (token_len == 2 && strncasecmp(token, "br", 2) == 0)
+            coding = ENCODING_BROTLI;
+        else if (token_len == 1 && *token == '*')
+            wildcard = !zero_q;
+
+        if (coding && zero_q)
+            refused |= coding;
+        else if (coding)
+            accepted |= coding;
+        ptr = comma ? comma + 1 : end;
+    }
+
+    if (wildcard) accepted |= (ENCODING_GZIP | ENCODING_BROTLI) & ~refused;
+
+    return accepted & ~refused;
+}
+
+static bool is_compressible(const char *mime)
+{
+    return strncmp(mime, "text/", 5) == 0 || strcmp(mime, "application/javascript") == 0 ||
+           strcmp(mime, "application/json") == 0 || strcmp(mime, "image/svg+xml") == 0;
+}
+
+static const char *encoding_name(int encoding)
+{
+    return encoding == ENCODING_BROTLI ? "br" : "gzip";
+}
+
+// ---------- COMPRESSION ----------
+
+static char *compress_gzip(const char *in, size_t len, int level, size_t *out_len)
+{
+    z_stream zs = {0};
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+
+    size_t cap = deflateBound(&zs, len);
+    char *out  = malloc(cap);
+    if (!out)
+    {
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    zs.next_in   = (Bytef *)in;
+    zs.avail_in  = len;
+    zs.next_out  = (Bytef *)out;
+    zs.avail_out = cap;
+    int ret      = deflate(&zs, Z_FINISH);
+    *out_len     = zs.total_out;
+    deflateEnd(&zs);
+
+    if (ret != Z_STREAM_END)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static char *compress_brotli(const char *in, size_t len, int quality, size_t *out_len)
+{
+#ifdef CSERVE_HAVE_BROTLI
+    size_t cap = BrotliEncoderMaxCompressedSize(len);
+    char *out  = cap ? malloc(cap) : NULL;
+    if (!out) return NULL;
+
+    *out_len = cap;
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                               (const uint8_t *)in, out_len, (uint8_t *)out))
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+#else
+    (void)in, (void)len, (void)quality, (void)out_len;
+    return NULL;
+#endif
+}
+
+// ---------- COMPRESSED VARIANT CACHE ----------
+
+static uint64_t cache_hash(const char *path, int encoding)
+{
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (const char *p = path; *p; p++)
+        h = (h ^ (unsigned char)*p) * 1099511628211ull;
+    return (h ^ encoding) * 1099511628211ull;
+}
+
+static bool entry_matches(const CacheEntry *e, const struct stat *st)
+{
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size &&
+           e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void lru_unlink(CacheEntry *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache.lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache.lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(CacheEntry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head) cache.lru_head->lru_prev = e;
+    cache.lru_head = e;
+    if (!cache.lru_tail) cache.lru_tail = e;
+}
+
+static void cache_remove(CacheEntry *e)
+{
+    CacheEntry **slot = &cache.buckets[e->hash % COMPRESSION_CACHE_BUCKETS];
+    while (*slot != e)
+        slot = &(*slot)->hash_next;
+    *slot = e->hash_next;
+
+    lru_unlink(e);
+    cache.bytes -= e->cost;
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+static CacheEntry *cache_find(const char *path, int encoding, uint64_t hash)
+{
+    CacheEntry *e = cache.buckets[hash % COMPRESSION_CACHE_BUCKETS];
+    for (; e; e = e->hash_next)
+    {
+        if (e->hash == hash && e->encoding == encoding && strcmp(e->path, path) == 0) return e;
+    }
+    return NULL;
+}
+
+/**
+ * @brief   Copies a cached variant of path that is still current for st.
+ *
+ * @return  1 and a heap copy in *out on a hit, 0 if the file is cached as
+ *          not worth compressing, -1 on a miss or a stale entry.
+ */
+static int cache_lookup(const char *path, int encoding, const struct stat *st, char **out,
+                        size_t *out_len)
+{
+    uint64_t hash = cache_hash(path, encoding);
+    int ret       = -1;
+
+    pthread_mutex_lock(&cache.lock);
+    CacheEntry *e = cache_find(path, encoding, hash);
+    if (e && !entry_matches(e, st))
+    {
+        cache_remove(e);
+        e = NULL;
+    }
+    if (e)
+    {
+        lru_unlink(e);
+        lru_push_front(e);
+        ret = 0;
+        if (e->data && (*out = malloc(e->len)))
+        {
+            memcpy(*out, e->data, e->len);
+            *out_len = e->len;
+            ret      = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return ret;
+}
+
+/**
+ * @brief   Stores a variant, evicting least recently used ones to stay under limit.
+ *
+ * data is copied; NULL records that compression did not pay off.
+ */
+static void cache_insert(const char *path, int encoding, const struct stat *st, const char *data,
+                         size_t len, size_t limit)
+{
+    size_t cost = sizeof(CacheEntry) + strlen(path) + 1 + (data ? len : 0);
+    if (cost > limit) return;
+
+    CacheEntry *e = calloc(1, sizeof(CacheEntry));
+    if (!e) return;
+    e->path = strdup(path);
+    e->data = data ? malloc(len) : NULL;
+    if (!e->path || (data && !e->data))
+    {
+        free(e->path);
+        free(e->data);
+        free(e);
+        return;
+    }
+    if (data) memcpy(e->data, data, len);
+    e->encoding = encoding;
+    e->dev      = st->st_dev;
+    e->ino      = st->st_ino;
+    e->size     = st->st_size;
+    e->mtime    = st->st_mtim;
+    e->len      = len;
+    e->cost     = cost;
+    e->hash     = cache_hash(path, encoding);
+
+    pthread_mutex_lock(&cache.lock);
+
+    // Another worker may have compressed the same file meanwhile
+    CacheEntry *old = cache_find(path, encoding, e->hash);
+    if (old) cache_remove(old);
+
+    while (cache.lru_tail && cache.bytes + cost > limit)
+        cache_remove(cache.lru_tail);
+
+    CacheEntry **slot = &cache.buckets[e->hash % COMPRESSION_CACHE_BUCKETS];
+    e->hash_next      = *slot;
+    *slot             = e;
+    lru_push_front(e);
+    cache.bytes += cost;
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * @brief   Drops every cached compressed variant.
+ */
+void static_cache_clear(void)
+{
+    pthread_mutex_lock(&cache.lock);
+    while (cache.lru_tail)
+        cache_remove(cache.lru_tail);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// ---------- BYTE RANGES ----------
+
+static bool parse_offset(const char *p, const char *end, off_t *out)
+{
+    if (p == end) return false;
+    off_t value = 0;
+    for (; p < end; p++)
+    {
+        if (*p < '0' || *p > '9') return false;
+        if (value > (INT64_MAX - 9) / 10) return false;
+        value = value * 10 + (*p - '0');
+    }
+    *out = value;
+    return true;
+}
+
+/**
+ * @brief   Parses a "bytes=" Range value against a representation of size bytes.
+ *
+ * Specs ("a-b", "a-", "-n") that start past the end are dropped, ends are
+ * clamped to the last byte, and ranges are kept in request order.
+ *
+ * @return  Number of satisfiable ranges written to ranges, 0 if none are
+ *          satisfiable (416), or -1 if the header is malformed or asks for
+ *          more than max ranges, in which case it is ignored.
+ */
+int parse_range(const char *value, size_t len, off_t size, ByteRange *ranges, int max)
+{
+    if (len < 6 || strncasecmp(value, "bytes=", 6) != 0) return -1;
+
+    const char *ptr = value + 6;
+    const char *end = value + len;
+    int count = 0, specs = 0;
+    while (ptr < end)
+    {
+        const char *comma = memchr(ptr, ',', end - ptr);
+        const char *next  = comma ? comma : end;
+
+        const char *spec_start = ptr, *spec_end = next;
+        while (spec_start < spec_end && (*spec_start == ' ' || *spec_start == '\t'))
+            spec_start++;
+        while (spec_end > spec_start && (spec_end[-1] == ' ' || spec_end[-1] == '\t'))
+            spec_end--;
+        ptr = comma ? comma + 1 : end;
+        if (spec_start == spec_end) continue; // tolerate empty list elements
+
+        if (++specs > max) return -1;
+        const char *dash = memchr(spec_start, '-', spec_end - spec_start);
+        if (!dash) return -1;
+
+        off_t first, last;
+        if (dash == spec_start)
+        {
+            // Suffix range: the final n bytes
+            if (!parse_offset(dash + 1, spec_end, &last)) return -1;
+            if (last == 0 || size == 0) continue;
+            first = last < size ? size - last : 0;
+            last  = size - 1;
+        }
+        else
+        {
+            if (!parse_offset(spec_start, dash, &first)) return -1;
+            if (dash + 1 == spec_end)
+                last = size - 1;
+            else if (!parse_offset(dash + 1, spec_end, &last) || last < first)
+                return -1;
+            if (first >= size) continue;
+            if (last >= size) last = size - 1;
+        }
+
+        ranges[count].offset = first;
+        ranges[count].length = last - first + 1;
+        count++;
+    }
+
+    return specs ? count : -1;
+}
+
+// ---------- VALIDATORS ----------
+
+/**
+ * @brief   Formats the strong ETag of a file as it is served.
+ *
+ * Built from inode, size and mtime, so any change to the file changes it.
+ * Encoded variants are different representations and get a suffix.
+ */
+static void format_etag(const struct stat *st, int encoding, char *buf, size_t cap)
+{
+    snprintf(buf, cap, "\"%lx-%llx-%lx.%lx%s\"", (unsigned long)st->st_ino,
+             (unsigned long long)st->st_size, (unsigned long)st->st_mtim.tv_sec,
+             (unsigned long)st->st_mtim.tv_nsec,
+             encoding == ENCODING_BROTLI ? "-br" : encoding == ENCODING_GZIP ? "-gz" : "");
+}
+
+/**
+ * @brief   Checks an If-None-Match list against an ETag.
+ *
+ * Uses the weak comparison required for If-None-Match: a "W/" prefix is
+ * ignored on either side. "*" matches any current representation.
+ */
+static bool etag_list_matches(const char *value, size_t len, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p   = value;
+    const char *end = value + len;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end) break;
+        if (*p == '*') return true;
+        if (end - p > 2 && p[0] == 'W' && p[1] == '/') p += 2;
+        if (*p != '"') return false;
+
+        const char *close = memchr(p + 1, '"', end - p - 1);
+        if (!close) return false;
+        if ((size_t)(close + 1 - p) == etag_len && memcmp(p, etag, etag_len) == 0) return true;
+        p = close + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief   True if a conditional GET/HEAD can be answered with 304.
+ *
+ * If-None-Match takes precedence; If-Modified-Since is only consulted
+ * without it.
+ */
+static bool not_modified(const HTTPRequest *req, const char *etag, const struct stat *st)
+{
+    const HTTPHeader *inm = find_header(req, "If-None-Match");
+    if (inm) return etag_list_matches(inm->value, inm->value_len, etag);
+
+    const HTTPHeader *ims = find_header(req, "If-Modified-Since");
+    if (!ims) return false;
+    time_t date = parse_http_date(ims->value, ims->value_len);
+    return date >= 0 && st->st_mtim.tv_sec <= date;
+}
+
+/**
+ * @brief   True if an If-Range validator still describes the file.
+ *
+ * An entity tag must match strongly (weak tags never do); an HTTP-date must
+ * equal the file's mtime.
+ */
+static bool if_range_matches(const HTTPHeader *if_range, const struct stat *st, const char *etag)
+{
+    if (if_range->value_len > 0 && if_range->value[0] == '"')
+        return if_range->value_len == strlen(etag) &&
+               memcmp(if_range->value, etag, if_range->value_len) == 0;
+    if (if_range->value_len > 1 && if_range->value[0] == 'W' && if_range->value[1] == '/')
+        return false;
+
+    time_t date = parse_http_date(if_range->value, if_range->value_len);
+    return date >= 0 && date == st->st_mtim.tv_sec;
+}
+
+/**
+ * @brief   Finds the max-age of the longest cache rule covering a path.
+ *
+ * A prefix covers the path itself and everything below it, so /img
+ * applies to /img/a.png but not to /imgs.png.
+ *
+ * @return  The max-age in seconds, or -1 if no rule applies.
+ */
+static long cache_max_age(const StaticOptions *opts, const char *path, size_t len)
+{
+    long max_age    = -1;
+    size_t best_len = 0;
+    for (int i = 0; i < opts->cache_rule_count; i++)
+    {
+        const CacheRule *rule = &opts->cache_rules[i];
+        size_t prefix_len     = strlen(rule->prefix);
+        if (prefix_len > len || memcmp(path, rule->prefix, prefix_len) != 0) continue;
+        if (prefix_len < len && rule->prefix[prefix_len - 1] != '/' && path[prefix_len] != '/')
+            continue;
+        if (max_age < 0 || prefix_len > best_len)
+        {
+            max_age  = rule->max_age;
+            best_len = prefix_len;
+        }
+    }
+    return max_age;
+}
+
+// ---------- HANDLER ----------
+
+static HTTPResponse *error_response(int status_code, const char *phrase)
+{
+    char body[64];
+    int len = snprintf(body, sizeof(body), "<h1>%d %s</h1>", status_code, phrase);
+    return response_builder(status_code, phrase, body, len, "text/html");
+}
+
+static HTTPResponse *new_response(int status_code, const char *phrase, const char *mime)
+{
+    HTTPResponse *response = httpresponse_constructor();
+    if (!response) return NULL;
+    response->status_code   = status_code;
+    response->version       = strdup("HTTP/1.1");
+    response->reason_phrase = strdup(phrase);
+    response->content_type  = strdup(mime);
+    return response;
+}
+
+static char *read_file(int fd, size_t size)
+{
+    char *buffer = malloc(size ? size : 1);
+    if (!buffer) return NULL;
+
+    size_t total_read = 0;
+    while (total_read < size)
+    {
+        ssize_t bytes = pread(fd, buffer + total_read, size - total_read, total_read);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0)
+        {
+            free(buffer);
+            return NULL;
+        }
+        total_read += bytes;
+    }
+    return buffer;
+}
+
+/**
+ * @brief   Opens <filepath><suffix> if it is a regular file.
+ *
+ * @return  The open descriptor with *st filled in, or -1.
+ */
+static int open_sidecar(const char *filepath, const char *suffix, struct stat *st)
+{
+    char sidecar[PATH_MAX + 8];
+    if (snprintf(sidecar, sizeof(sidecar), "%s%s", filepath, suffix) >= (int)sizeof(sidecar))
+        return -1;
+
+    int fd = open(sidecar, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, st) < 0 || !S_ISREG(st->st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief   True if the path has a ".." segment that could climb out of the root.
+ */
+static bool has_dot_dot_segment(const char *path, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        if (path[i] == '.' && path[i + 1] == '.' && (i == 0 || path[i - 1] == '/') &&
+            (i + 2 == len || path[i + 2] == '/'))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief   Builds a multipart/byteranges body out of file slices.
+ *
+ * Part headers ride along as slice prefixes, so the file data itself is
+ * still sent with sendfile().
+ */
+static int add_multipart_ranges(HTTPResponse *response, const ByteRange *ranges, int count,
+                                off_t size, const char *mime)
+{
+    static atomic_uint_fast64_t boundary_counter = 0;
+    char boundary[24];
+    snprintf(boundary, sizeof(boundary), "%020lu",
+             (unsigned long)atomic_fetch_add(&boundary_counter, 1) + 1);
+
+    char content_type[64];
+    snprintf(content_type, sizeof(content_type), "multipart/byteranges; boundary=%s", boundary);
+    free(response->content_type);
+    response->content_type = strdup(content_type);
+
+    size_t total = 0;
+    char prefix[256];
+    for (int i = 0; i < count; i++)
+    {
+        int len = snprintf(prefix, sizeof(prefix),
+                           "%s--%s\r\nContent-Type: %s\r\n"
+                           "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                           i ? "\r\n" : "", boundary, mime, (long long)ranges[i].offset,
+                           (long long)(ranges[i].offset + ranges[i].length - 1), (long long)size);
+        if (httpresponse_add_file_range(response, ranges[i].offset, ranges[i].length, prefix) < 0)
+            return -1;
+        total += len + ranges[i].length;
+    }
+
+    if (asprintf(&response->file_trailer, "\r\n--%s--\r\n", boundary) < 0)
+    {
+        response->file_trailer = NULL;
+        return -1;
+    }
+    response->content_length = total + strlen(response->file_trailer);
+    return OK;
+}
+
+/**
+ * @brief   Responds with (part of) an open file, sent later with sendfile().
+ *
+ * Honors Range and If-Range. Takes ownership of fd.
+ */
+static HTTPResponse *file_response(const HTTPRequest *req, int fd, const struct stat *st,
+                                   const char *mime, const char *etag)
+{
+    off_t size = st->st_size;
+
+    // Range only applies to GET; If-Range falls back to the full file when stale
+    bool is_get =
+        req->request_line.method_len == 3 && memcmp(req->request_line.method, "GET", 3) == 0;
+    const HTTPHeader *range   = find_header(req, "Range");
+    const HTTPHeader *ifrange = find_header(req, "If-Range");
+
+    ByteRange ranges[MAX_RANGES];
+    int range_count = -1;
+    if (range && is_get && (!ifrange || if_range_matches(ifrange, st, etag)))
+        range_count = parse_range(range->value, range->value_len, size, ranges, MAX_RANGES);
+
+    HTTPResponse *response;
+    if (range_count == 0)
+    {
+        close(fd);
+        response = error_response(416, "Range Not Satisfiable");
+        char content_range[48];
+        snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)size);
+        if (response) httpresponse_add_header(response, "Content-Range", content_range);
+        return response;
+    }
+
+    response = range_count > 0 ? new_response(206, "Partial Content", mime)
+                               : new_response(200, "OK", mime);
+    if (!response)
+    {
+        close(fd);
+        return NULL;
+    }
+    response->file_fd = fd;
+    httpresponse_add_header(response, "Accept-Ranges", "bytes");
+
+    int ret;
+    if (range_count == 1)
+    {
+        char content_range[80];
+        snprintf(content_range, sizeof(content_range), "bytes %lld-%lld/%lld",
+                 (long long)ranges[0].offset, (long long)(ranges[0].offset + ranges[0].length - 1),
+                 (long long)size);
+        httpresponse_add_header(response, "Content-Range", content_range);
+        response->content_length = ranges[0].length;
+        ret = httpresponse_add_file_range(response, ranges[0].offset, ranges[0].length, NULL);
+    }
+    else if (range_count > 1)
+    {
+        ret = add_multipart_ranges(response, ranges, range_count, size, mime);
+    }
+    else
+    {
+        response->content_length = size;
+        ret = httpresponse_add_file_range(response, 0, size, NULL);
+    }
+
+    if (ret < 0)
+    {
+        httpresponse_free(response);
+        return error_response(500, "Internal Server Error");
+    }
+    return response;
+}
+
+/**
+ * @brief   Serves a file for a static location.
+ *
+ * The URI path, less its first strip_len bytes, resolves under root (the
+ * working directory when NULL). Cache-Control rules still match the full
+ * URI path.
+ *
+ * Encoding preference is br, then gzip: a matching sidecar wins, then a
+ * cached or freshly compressed variant, then the file as it is. Files and
+ * sidecars are sent with sendfile() and support byte ranges; compressed
+ * variants come from memory and are always sent whole. Responses for files
+ * that have a compressed form carry "Vary: Accept-Encoding".
+ *
+ * The ETag and Last-Modified describe the representation being served, and
+ * a GET or HEAD whose If-None-Match/If-Modified-Since still matches gets a
+ * 304 without a body. Cache-Control comes from the configured prefix rules.
+ */
+HTTPResponse *static_handler(const HTTPRequest *req, const StaticOptions *opts, const char *root,
+                             size_t strip_len)
+{
+    if (!opts) opts = &default_options;
+
+    const char *uri   = req->request_line.uri;
+    size_t uri_len    = req->request_line.uri_len;
+    const char *query = memchr(uri, '?', uri_len);
+    if (query) uri_len = query - uri;
+    if (has_dot_dot_segment(uri, uri_len)) return error_response(404, "Not Found");
+
+    // Without a root, paths resolve against the working directory, like BASE_DIR
+    const char *path = uri + (strip_len < uri_len ? strip_len : uri_len);
+    size_t path_len  = uri_len - (path - uri);
+    char filepath[PATH_MAX];
+    if (snprintf(filepath, sizeof(filepath), "%s%s%.*s", root ? root : ".",
+                 path_len > 0 && path[0] == '/' ? "" : "/", (int)path_len,
+                 path) >= (int)sizeof(filepath))
+        return error_response(404, "Not Found");
+
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG(LOG_DEBUG, "Failed to open %s: %s", filepath, strerror(errno));
+        return error_response(404, "Not Found");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return error_response(404, "Not Found");
+    }
+
+    const char *mime = get_mime_type(filepath);
+    int accepted     = 0;
+    for (int i = 0; i < req->header_count; i++)
+    {
+        const HTTPHeader *h = &req->headers[i];
+        if (h->name_len == 15 && strncasecmp(h->name, "Accept-Encoding", 15) == 0)
+            accepted |= parse_accept_encoding(h->value, h->value_len);
+    }
+
+    bool vary     = false;
+    int encoding  = ENCODING_IDENTITY;
+    char *body    = NULL;
+    size_t length = 0;
+
+    // Precompressed sidecars, gzip_static style
+    static const struct
+    {
+        int encoding;
+        const char *suffix;
+    } sidecars[] = {{ENCODING_BROTLI, ".br"}, {ENCODING_GZIP, ".gz"}};
+    for (size_t i = 0; i < sizeof(sidecars) / sizeof(sidecars[0]); i++)
+    {
+        struct stat sidecar_st;
+        int sidecar_fd = open_sidecar(filepath, sidecars[i].suffix, &sidecar_st);
+        if (sidecar_fd < 0) continue;
+
+        vary = true;
+        if (encoding == ENCODING_IDENTITY && (accepted & sidecars[i].encoding))
+        {
+            // Serve the sidecar in place of the file
+            close(fd);
+            fd       = sidecar_fd;
+            st       = sidecar_st;
+            encoding = sidecars[i].encoding;
+        }
+        else
+        {
+            close(sidecar_fd);
+        }
+    }
+
+    // On-the-fly compression, cached per path and encoding. Compressing reads
+    // the whole file, so large ones go out as they are with sendfile(). HEAD
+    // only reports a variant already cached and never compresses
+    bool is_head =
+        req->request_line.method_len == 4 && memcmp(req->request_line.method, "HEAD", 4) == 0;
+    if (encoding == ENCODING_IDENTITY && opts->compression && is_compressible(mime) &&
+        (size_t)st.st_size >= opts->compression_min_length &&
+        (opts->compression_max_length == 0 || (size_t)st.st_size <= opts->compression_max_length))
+    {
+        vary = true;
+#ifdef CSERVE_HAVE_BROTLI
+        int candidate = (accepted & ENCODING_BROTLI) ? ENCODING_BROTLI : accepted & ENCODING_GZIP;
+#else
+        int candidate = accepted & ENCODING_GZIP;
+#endif
+        if (candidate)
+        {
+            int hit = cache_lookup(filepath, candidate, &st, &body, &length);
+            if (hit < 0 && !is_head)
+            {
+                char *plain = read_file(fd, st.st_size);
+                if (!plain)
+                {
+                    close(fd);
+                    return error_response(500, "Internal Server Error");
+                }
+
+                body = candidate == ENCODING_BROTLI
+                           ? compress_brotli(plain, st.st_size, opts->brotli_quality, &length)
+                           : compress_gzip(plain, st.st_size, opts->gzip_level, &length);
+                free(plain);
+                if (body && length >= (size_t)st.st_size)
+                {
+                    // Not worth compressing; remembered so it is not tried again
+                    free(body);
+                    body = NULL;
+                }
+                cache_insert(filepath, candidate, &st, body, length,
+                             opts->compression_cache_size);
+            }
+            if (body) encoding = candidate;
+        }
+    }
+
+    char etag[80];
+    format_etag(&st, encoding, etag, sizeof(etag));
+    bool is_get_or_head =
+        is_head ||
+        (req->request_line.method_len == 3 && memcmp(req->request_line.method, "GET", 3) == 0);
+
+    HTTPResponse *response;
+    if (is_get_or_head && not_modified(req, etag, &st))
+    {
+        close(fd);
+        free(body);
+        response = new_response(304, "Not Modified", mime);
+        if (!response) return NULL;
+        free(response->content_type);
+        response->content_type = NULL;
+    }
+    else if (body)
+    {
+        close(fd);
+        response = new_response(200, "OK", mime);
+        if (!response)
+        {
+            free(body);
+            return NULL;
+        }
+        response->body        = body;
+        response->body_length = length;
+    }
+    else
+    {
+        response = file_response(req, fd, &st, mime, etag);
+        if (!response) return NULL;
+    }
+
+    if (response->status_code >= 400) return response;
+    char last_modified[40];
+    format_http_date(st.st_mtim.tv_sec, last_modified, sizeof(last_modified));
+    httpresponse_add_header(response, "ETag", etag);
+    httpresponse_add_header(response, "Last-Modified", last_modified);
+
+    long max_age = cache_max_age(opts, uri, uri_len);
+    if (max_age >= 0)
+    {
+        char cache_control[32];
+        snprintf(cache_control, sizeof(cache_control), "max-age=%ld", max_age);
+        httpresponse_add_header(response, "Cache-Control", cache_control);
+    }
+
+    if (encoding != ENCODING_IDENTITY)
+        httpresponse_add_header(response, "Content-Encoding", encoding_name(encoding));
+    if (vary) httpresponse_add_header(response, "Vary", "Accept-Encoding");
+    return response;
+}
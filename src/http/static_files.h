@@ -0,0 +1,76 @@
+/**
+ * @file    static_files.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Static file handler with precompressed and cached compressed variants.
+ *
+ * @details For a client that accepts br or gzip, a sidecar file (<file>.br,
+ *          <file>.gz) is served when present. Otherwise compressible types
+ *          are compressed once and kept in a byte-bounded LRU cache, keyed by
+ *          path and encoding and invalidated when the file's inode, size or
+ *          mtime changes.
+ *
+ *          Uncompressed files and sidecars are sent with sendfile() and
+ *          support single and multipart byte ranges. Every response carries
+ *          a strong ETag and Last-Modified, and conditional requests that
+ *          still match get a body-less 304.
+ */
+
+#ifndef HTTP_STATIC_FILES_H
+#define HTTP_STATIC_FILES_H
+
+#include "common.h"
+#include "request.h"
+#include "response.h"
+
+#define DEFAULT_COMPRESSION_CACHE_SIZE (16 * 1024 * 1024)
+#define DEFAULT_COMPRESSION_MIN_LENGTH 256
+#define DEFAULT_COMPRESSION_MAX_LENGTH (4 * 1024 * 1024)
+#define DEFAULT_GZIP_LEVEL 6
+#define DEFAULT_BROTLI_QUALITY 6
+#define MAX_RANGES 16 // more ranges than this in one request are ignored
+#define MAX_CACHE_RULES 32
+
+typedef enum
+{
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP     = 1 << 0,
+    ENCODING_BROTLI   = 1 << 1,
+} ContentEncoding;
+
+typedef struct ByteRange
+{
+    off_t offset;
+    size_t length;
+} ByteRange;
+
+/* "Cache-Control: max-age" for paths under a prefix; the longest prefix wins */
+typedef struct CacheRule
+{
+    char *prefix;
+    long max_age; // seconds
+} CacheRule;
+
+typedef struct StaticOptions
+{
+    bool compression;              // compress compressible types on the fly
+    size_t compression_cache_size; // bytes of compressed variants kept in memory
+    size_t compression_min_length; // smaller files are sent as they are
+    size_t compression_max_length; // so are larger ones, with sendfile(); 0 for no limit
+    int gzip_level;                // zlib level, 1-9
+    int brotli_quality;            // brotli quality, 0-11
+    CacheRule cache_rules[MAX_CACHE_RULES];
+    int cache_rule_count;
+} StaticOptions;
+
+void static_options_defaults(StaticOptions *opts);
+int static_options_add_cache_rule(StaticOptions *opts, const char *spec);
+void static_options_free(StaticOptions *opts);
+
+int parse_accept_encoding(const char *value, size_t len);
+int parse_range(const char *value, size_t len, off_t size, ByteRange *ranges, int max);
+HTTPResponse *static_handler(const HTTPRequest *req, const StaticOptions *opts, const char *root,
+                             size_t strip_len);
+void static_cache_clear(void);
+
+#endif /* HTTP_STATIC_FILES_H */
@@ -0,0 +1,573 @@
+/**
+ * @file    upstream.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Nonblocking proxy backend exchange implementation.
+ *
+ */
+
+#include <stdint.h>
+
+#include "upstream.h"
+#include "parsers.h"
+#include "utils/coroutine.h"
+#include "utils/metrics.h"
+
+// ---------- ADDRESSES ----------
+
+/**
+ * @brief   Parses a backend entry: "unix:/path/to.sock", or "host[:port]" (port 80).
+ *
+ * @return  OK, or -1 if the entry is malformed or the socket path too long.
+ */
+int upstream_parse_address(const char *backend, UpstreamAddress *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+
+    size_t prefix_len = strlen(UPSTREAM_UNIX_PREFIX);
+    if (strncmp(backend, UPSTREAM_UNIX_PREFIX, prefix_len) == 0)
+    {
+        const char *path = backend + prefix_len;
+        size_t path_len  = strlen(path);
+        if (path_len == 0 || path_len >= sizeof(((struct sockaddr_un *)0)->sun_path)) return -1;
+        addr->is_unix = true;
+        memcpy(addr->host, path, path_len + 1);
+        return OK;
+    }
+
+    const char *colon = strrchr(backend, ':');
+    size_t host_len   = colon ? (size_t)(colon - backend) : strlen(backend);
+    if (host_len == 0 || host_len >= sizeof(addr->host)) return -1;
+
+    memcpy(addr->host, backend, host_len);
+    addr->host[host_len] = '\0';
+    snprintf(addr->port, sizeof(addr->port), "%s", colon ? colon + 1 : "80");
+    return OK;
+}
+
+/**
+ * @brief   Opens a socket and connects it to addr.
+ *
+ * A nonblocking TCP connect may still be in progress on return. AF_UNIX
+ * connects complete at once; a full listen queue fails them with EAGAIN.
+ * A blocking connect made on a coroutine yields to the loop while it waits.
+ *
+ * @return  The socket, or -1.
+ */
+int upstream_connect(const UpstreamAddress *addr, bool nonblocking)
+{
+    int flags = SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+    int (*connect_to)(int, const struct sockaddr *, socklen_t) = nonblocking ? connect
+                                                                             : co_connect;
+
+    if (addr->is_unix)
+    {
+        struct sockaddr_un sun = {.sun_family = AF_UNIX};
+        memcpy(sun.sun_path, addr->host, strlen(addr->host) + 1);
+
+        int sock = socket(AF_UNIX, SOCK_STREAM | flags, 0);
+        if (sock >= 0 && connect_to(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+        return sock;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(addr->host, addr->port, &hints, &res) != 0) return -1;
+
+    int sock = socket(res->ai_family, res->ai_socktype | flags, res->ai_protocol);
+    if (sock >= 0 && connect_to(sock, res->ai_addr, res->ai_addrlen) != 0 &&
+        !(nonblocking && errno == EINPROGRESS))
+    {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+// ---------- EXCHANGE ----------
+
+static bool is_idempotent(const char *request, size_t len)
+{
+    static const char *const methods[] = {"GET ", "HEAD ", "PUT ", "DELETE ", "OPTIONS ",
+                                          "TRACE "};
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+    {
+        size_t n = strlen(methods[i]);
+        if (len >= n && memcmp(request, methods[i], n) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief   Starts an exchange; takes ownership of request.
+ *
+ * pooled_fd is an idle keep-alive connection to the backend, or -1 to
+ * connect to addr.
+ *
+ * @return  OK with u->fd ready to be watched for EPOLLOUT, or -1.
+ */
+int upstream_start(Upstream *u, const UpstreamAddress *addr, int pooled_fd, char *request,
+                   size_t len)
+{
+    memset(u, 0, sizeof(*u));
+    u->request     = request;
+    u->request_len = len;
+    u->idempotent  = is_idempotent(request, len);
+    u->head        = len >= 5 && memcmp(request, "HEAD ", 5) == 0;
+    u->reused      = pooled_fd >= 0;
+    u->state       = u->reused ? UPSTREAM_SENDING : UPSTREAM_CONNECTING;
+    u->fd          = u->reused ? pooled_fd : upstream_connect(addr, true);
+    if (u->fd < 0)
+    {
+        u->state = UPSTREAM_FAILED;
+        return -1;
+    }
+    if (u->reused) u->connected_at = monotonic_ns();
+    return OK;
+}
+
+static uint32_t fail(Upstream *u, const char *what)
+{
+    LOG(u->retryable ? LOG_DEBUG : LOG_ERROR, "Upstream %s on FD %d failed: %s", what, u->fd,
+        strerror(errno));
+    u->state = UPSTREAM_FAILED;
+    return 0;
+}
+
+/**
+ * @brief   Decodes the chunks that arrived since the last call, in place.
+ *
+ * The decoded body grows from body_start while chunk_scan walks the raw
+ * bytes ahead of it. Trailer fields are dropped.
+ *
+ * @return  1 once the last chunk is in, 0 while more is needed, -1 if malformed.
+ */
+static int decode_chunks(Upstream *u)
+{
+    char *buf = u->response;
+    while (1)
+    {
+        size_t scan     = u->chunk_scan;
+        const char *eol = memmem(buf + scan, u->response_len - scan, "\r\n", 2);
+        if (!eol) return 0;
+        size_t line_end = eol - buf;
+
+        // Chunk size in hex; extensions after ';' are ignored
+        size_t size = 0;
+        size_t i    = scan;
+        for (; i < line_end && isxdigit((unsigned char)buf[i]); i++)
+        {
+            if (size > (SIZE_MAX >> 4)) return -1;
+            int c = tolower((unsigned char)buf[i]);
+            size  = size * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+        }
+        if (i == scan || (i < line_end && buf[i] != ';' && buf[i] != ' ' && buf[i] != '\t'))
+            return -1;
+
+        size_t data  = line_end + 2;
+        size_t avail = u->response_len - data;
+        if (size == 0)
+        {
+            const char *end;
+            if (avail >= 2 && memcmp(buf + data, "\r\n", 2) == 0)
+                end = buf + data + 2;
+            else if ((end = memmem(buf + data, avail, "\r\n\r\n", 4)))
+                end += 4;
+            else
+                return 0;
+            // Anything after the message was never asked for; do not reuse the connection
+            if ((size_t)(end - buf) < u->response_len) u->reusable = false;
+            u->response_len      = u->chunk_decoded;
+            buf[u->response_len] = '\0';
+            return 1;
+        }
+        if (avail < 2 || size > avail - 2) return 0;
+        if (memcmp(buf + data + size, "\r\n", 2) != 0) return -1;
+
+        memmove(buf + u->chunk_decoded, buf + data, size);
+        u->chunk_decoded += size;
+        u->chunk_scan = data + size + 2;
+    }
+}
+
+/**
+ * @brief   Works out the framing from the header block, then whether the
+ *          whole response has arrived.
+ *
+ * Interim 1xx responses are dropped, except a 101 answering an upgrade
+ * request: it ends the exchange, and whatever follows its header block is
+ * already the new protocol. HEAD, 204 and 304 responses have no body;
+ * otherwise chunked coding wins over Content-Length, and with neither the
+ * body runs to EOF and the connection cannot be reused.
+ *
+ * @return  2 for a 101 to an upgrade request, 1 when the response is
+ *          complete, 0 while more is needed, -1 if malformed.
+ */
+static int response_complete(Upstream *u)
+{
+    while (u->body_start == 0)
+    {
+        const char *end = memmem(u->response, u->response_len, "\r\n\r\n", 4);
+        if (!end) return 0;
+        size_t header_end = end + 4 - u->response;
+
+        int status;
+        const char *reason;
+        size_t reason_len;
+        int line_len =
+            parse_response_line(u->response, u->response_len, &status, &reason, &reason_len);
+        if (line_len < 0) return -1;
+        if (status == 101 && u->upgrade)
+        {
+            u->body_start = header_end;
+            u->reusable   = false;
+            return 2;
+        }
+        if (status < 200)
+        {
+            u->response_len -= header_end;
+            memmove(u->response, u->response + header_end, u->response_len + 1);
+            continue;
+        }
+
+        const char *headers = u->response + line_len;
+        size_t headers_len  = header_end - line_len;
+        bool http10         = memcmp(u->response, "HTTP/1.0", 8) == 0;
+        size_t value_len;
+        const char *value = find_raw_header(headers, headers_len, "Connection", &value_len);
+        u->reusable       = value ? !list_has_token(value, value_len, "close", NULL) &&
+                                  (!http10 || list_has_token(value, value_len, "keep-alive", NULL))
+                                  : !http10;
+
+        u->body_start  = header_end;
+        u->body_length = -1;
+        if (u->head || status == 204 || status == 304)
+        {
+            u->body_length = 0;
+        }
+        else if ((value = find_raw_header(headers, headers_len, "Transfer-Encoding",
+                                          &value_len)) &&
+                 list_has_token(value, value_len, "chunked", NULL))
+        {
+            u->chunked       = true;
+            u->chunk_scan    = header_end;
+            u->chunk_decoded = header_end;
+        }
+        else if ((value = find_raw_header(headers, headers_len, "Content-Length", &value_len)))
+        {
+            size_t length = 0;
+            for (size_t i = 0; i < value_len; i++)
+            {
+                if (!isdigit((unsigned char)value[i]) || length > (SIZE_MAX / 2 - 9) / 10)
+                    return -1;
+                length = length * 10 + (value[i] - '0');
+            }
+            if (value_len == 0) return -1;
+            u->body_length = length;
+        }
+        if (u->body_length < 0 && !u->chunked) u->reusable = false;
+    }
+
+    if (u->chunked) return decode_chunks(u);
+    if (u->body_length < 0) return 0; // until EOF
+
+    size_t received = u->response_len - u->body_start;
+    if (received < (size_t)u->body_length) return 0;
+    if (received > (size_t)u->body_length)
+    {
+        u->reusable                  = false;
+        u->response_len              = u->body_start + u->body_length;
+        u->response[u->response_len] = '\0';
+    }
+    return 1;
+}
+
+/**
+ * @brief   Handles EOF from the backend.
+ *
+ * It ends a body without framing. On a reused connection with nothing
+ * received it means the backend had closed the idle connection, and an
+ * idempotent request can be sent again.
+ */
+static uint32_t finish_at_eof(Upstream *u)
+{
+    if (u->body_start > 0 && u->body_length < 0 && !u->chunked)
+    {
+        u->state = UPSTREAM_DONE;
+        return 0;
+    }
+    u->retryable = u->reused && u->response_len == 0 && u->idempotent;
+    errno        = ECONNRESET;
+    return fail(u, u->response_len ? "receive (truncated response)" : "receive");
+}
+
+/**
+ * @brief   Advances the exchange as far as the socket allows.
+ *
+ * @return  The epoll events to wait for next, or 0 once the state is
+ *          UPSTREAM_SPLICING, UPSTREAM_UPGRADED, UPSTREAM_DONE or
+ *          UPSTREAM_FAILED.
+ */
+uint32_t upstream_step(Upstream *u, uint32_t events)
+{
+    if (u->state == UPSTREAM_CONNECTING)
+    {
+        int err       = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            if (err) errno = err;
+            return fail(u, "connect");
+        }
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return EPOLLOUT;
+        u->state        = UPSTREAM_SENDING;
+        u->connected_at = monotonic_ns();
+    }
+
+    while (u->state == UPSTREAM_SENDING)
+    {
+        if (u->request_sent == u->request_len)
+        {
+            // A CONNECT tunnel has no request; the backend is the far end itself
+            u->state = u->upgrade && u->request_len == 0 ? UPSTREAM_UPGRADED : UPSTREAM_RECEIVING;
+            break;
+        }
+        ssize_t n = send(u->fd, u->request + u->request_sent, u->request_len - u->request_sent,
+                         MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return EPOLLOUT;
+            // A pooled connection the backend closed; nothing was processed
+            u->retryable = u->reused;
+            return fail(u, "send");
+        }
+        u->request_sent += n;
+    }
+
+    while (u->state == UPSTREAM_RECEIVING)
+    {
+        if (u->response_len + 1 >= u->response_size)
+        {
+            size_t size = u->response_size ? u->response_size * 2 : INITIAL_BUFFER_SIZE;
+            char *grown = realloc(u->response, size);
+            if (!grown) return fail(u, "receive buffer allocation");
+            u->response      = grown;
+            u->response_size = size;
+        }
+
+        ssize_t n = recv(u->fd, u->response + u->response_len,
+                         u->response_size - u->response_len - 1, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return EPOLLIN;
+            u->retryable = u->reused && u->response_len == 0 && u->idempotent;
+            return fail(u, "recv");
+        }
+        if (n == 0) return finish_at_eof(u);
+
+        if (u->response_len == 0) u->first_byte_at = monotonic_ns();
+        u->response_len += n;
+        u->response[u->response_len] = '\0';
+
+        int complete = response_complete(u);
+        if (complete < 0)
+        {
+            errno = EPROTO;
+            return fail(u, "response framing");
+        }
+        if (complete)
+        {
+            u->state = complete == 2 ? UPSTREAM_UPGRADED : UPSTREAM_DONE;
+        }
+        else if (u->splice_min > 0 && u->body_start > 0 && !u->chunked &&
+                 u->body_length >= (ssize_t)u->splice_min)
+        {
+            // Leave the rest of a large body on the socket for upstream_splice()
+            u->body_left = u->body_length - (u->response_len - u->body_start);
+            u->state     = UPSTREAM_SPLICING;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   Moves up to len body bytes from the backend socket into a pipe.
+ *
+ * For UPSTREAM_SPLICING: the bytes go from the socket buffer to the pipe
+ * without a copy through userspace. The state becomes UPSTREAM_DONE once
+ * the whole body has been moved.
+ *
+ * @return  Bytes moved (0 if none are left), or -1: with errno EAGAIN when
+ *          the socket is drained or the pipe full, otherwise the exchange
+ *          failed (UPSTREAM_FAILED), e.g. the backend closed mid-body.
+ */
+ssize_t upstream_splice(Upstream *u, int pipe_fd, size_t len)
+{
+    if (len > u->body_left) len = u->body_left;
+    if (len == 0) return 0;
+
+    while (1)
+    {
+        ssize_t n = splice(u->fd, NULL, pipe_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return -1;
+        if (n <= 0)
+        {
+            if (n == 0) errno = ECONNRESET;
+            fail(u, n == 0 ? "receive (truncated body)" : "splice");
+            return -1;
+        }
+
+        u->body_left -= n;
+        if (u->body_left == 0) u->state = UPSTREAM_DONE;
+        return n;
+    }
+}
+
+/**
+ * @brief   Sends the request again on a fresh connection after a stale
+ *          pooled one failed (u->retryable).
+ *
+ * The caller removes the old socket from epoll first.
+ *
+ * @return  OK with u->fd ready to be watched for EPOLLOUT, or -1.
+ */
+int upstream_retry(Upstream *u, const UpstreamAddress *addr)
+{
+    char *request     = u->request;
+    size_t len        = u->request_len;
+    size_t splice_min = u->splice_min;
+    bool upgrade      = u->upgrade;
+    u->request        = NULL;
+    upstream_release(u);
+    int ret       = upstream_start(u, addr, -1, request, len);
+    u->splice_min = splice_min;
+    u->upgrade    = upgrade;
+    return ret;
+}
+
+/**
+ * @brief   Takes the socket away from a finished exchange, for the keep-alive pool.
+ *
+ * @return  The socket; upstream_release() will no longer close it.
+ */
+int upstream_detach(Upstream *u)
+{
+    int fd = u->fd;
+    u->fd  = -1;
+    return fd;
+}
+
+/**
+ * @brief   Closes the backend socket and frees both buffers.
+ *
+ * The caller removes the socket from epoll first.
+ */
+void upstream_release(Upstream *u)
+{
+    if (u->fd >= 0) close(u->fd);
+    free(u->request);
+    free(u->response);
+    u->fd       = -1;
+    u->request  = NULL;
+    u->response = NULL;
+}
+
+// ---------- KEEP-ALIVE POOL ----------
+
+/**
+ * @brief   Prepares an empty pool keeping up to capacity idle connections
+ *          per backend for timeout seconds.
+ *
+ * @return  OK, or -1 on allocation failure.
+ */
+int upstream_pool_init(UpstreamPool *pool, int capacity, int timeout)
+{
+    memset(pool, 0, sizeof(*pool));
+    if (capacity <= 0) return OK;
+
+    pool->idle = calloc((size_t)capacity * MAX_BACKENDS, sizeof(UpstreamIdle));
+    if (!pool->idle) return -1;
+    pool->capacity = capacity;
+    pool->timeout  = timeout;
+    return OK;
+}
+
+/**
+ * @brief   Takes the most recently used idle connection to backend.
+ *
+ * Idle connections are not watched by epoll, so a peek tells whether the
+ * backend closed one meanwhile; such connections, and those idle for longer
+ * than the timeout, are closed and skipped.
+ *
+ * @return  A connected socket, or -1 if none is available.
+ */
+int upstream_pool_get(UpstreamPool *pool, int backend)
+{
+    if (pool->capacity == 0 || backend < 0 || backend >= MAX_BACKENDS) return -1;
+
+    UpstreamIdle *slots = pool->idle + (size_t)backend * pool->capacity;
+    time_t now          = time(NULL);
+    while (pool->counts[backend] > 0)
+    {
+        UpstreamIdle idle = slots[--pool->counts[backend]];
+        if (pool->timeout > 0 && now - idle.since >= pool->timeout)
+        {
+            // Older entries sit below this one and have expired as well
+            close(idle.fd);
+            while (pool->counts[backend] > 0)
+                close(slots[--pool->counts[backend]].fd);
+            break;
+        }
+
+        char byte;
+        ssize_t n = recv(idle.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return idle.fd;
+        close(idle.fd);
+    }
+    return -1;
+}
+
+/**
+ * @brief   Keeps a connection whose response completed for the next request
+ *          to backend, closing the oldest idle one if the pool is full.
+ */
+void upstream_pool_put(UpstreamPool *pool, int backend, int fd)
+{
+    if (pool->capacity == 0 || backend < 0 || backend >= MAX_BACKENDS)
+    {
+        close(fd);
+        return;
+    }
+
+    UpstreamIdle *slots = pool->idle + (size_t)backend * pool->capacity;
+    if (pool->counts[backend] == pool->capacity)
+    {
+        close(slots[0].fd);
+        memmove(slots, slots + 1, (pool->capacity - 1) * sizeof(*slots));
+        pool->counts[backend]--;
+    }
+    slots[pool->counts[backend]++] = (UpstreamIdle){fd, time(NULL)};
+}
+
+void upstream_pool_free(UpstreamPool *pool)
+{
+    for (int b = 0; pool->idle && b < MAX_BACKENDS; b++)
+    {
+        UpstreamIdle *slots = pool->idle + (size_t)b * pool->capacity;
+        for (int i = 0; i < pool->counts[b]; i++)
+            close(slots[i].fd);
+    }
+    free(pool->idle);
+    memset(pool, 0, sizeof(*pool));
+}
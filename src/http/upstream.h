@@ -0,0 +1,129 @@
+/**
+ * @file    upstream.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Nonblocking exchange with a proxy backend, driven by epoll events.
+ *
+ * @details An Upstream owns one backend socket and walks it through connect,
+ *          send and receive without ever blocking: the event loop calls
+ *          upstream_step() whenever the socket is ready and waits for the
+ *          events it returns.
+ *
+ *          Backends are TCP "host:port" or "unix:/path/to.sock" addresses.
+ *          The response is complete once its Content-Length or chunked body
+ *          has arrived (or at EOF when it has neither), after which the
+ *          connection can go back to an UpstreamPool and carry the next
+ *          request to the same backend.
+ *
+ *          A large Content-Length body need not pass through userspace at
+ *          all: with splice_min set, the exchange stops after the header
+ *          block (UPSTREAM_SPLICING) and upstream_splice() moves the rest of
+ *          the body from the socket into a pipe, for the caller to splice on
+ *          to the client.
+ *
+ *          With upgrade set, a 101 Switching Protocols response ends the
+ *          exchange at its header block (UPSTREAM_UPGRADED): the socket then
+ *          belongs to whatever protocol the client asked for. An upgrade
+ *          exchange with no request, for CONNECT, ends as soon as the
+ *          connection is made.
+ */
+
+#ifndef HTTP_UPSTREAM_H
+#define HTTP_UPSTREAM_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/un.h>
+#include "common.h"
+
+#define UPSTREAM_UNIX_PREFIX "unix:"
+#define DEFAULT_UPSTREAM_KEEPALIVE 16
+#define DEFAULT_UPSTREAM_KEEPALIVE_TIMEOUT 60
+#define DEFAULT_UPSTREAM_SPLICE_MIN (64 * 1024)
+#define MAX_UPSTREAM_GROUPS 16
+
+typedef enum
+{
+    UPSTREAM_CONNECTING,
+    UPSTREAM_SENDING,
+    UPSTREAM_RECEIVING,
+    UPSTREAM_SPLICING, // header block in; body_left bytes wait on the socket
+    UPSTREAM_UPGRADED, // 101 in, or connected for CONNECT; the socket carries a tunnel now
+    UPSTREAM_DONE,
+    UPSTREAM_FAILED,
+} UpstreamState;
+
+typedef struct UpstreamAddress
+{
+    bool is_unix;
+    char host[NI_MAXHOST]; // TCP host, or the socket path of a unix: backend
+    char port[NI_MAXSERV]; // TCP port; empty for unix: backends
+} UpstreamAddress;
+
+/* A named "[upstream name]" set of backends, balanced round-robin */
+typedef struct UpstreamGroup
+{
+    char *name;
+    int first; // index of its first entry in the configured backend list
+    int count;
+} UpstreamGroup;
+
+typedef struct Upstream
+{
+    int fd;
+    UpstreamState state;
+    bool reused;     // fd came from the keep-alive pool
+    bool retryable;  // failed on a reused fd before any response; safe to send again
+    bool idempotent; // the request method may be repeated
+    bool head;       // HEAD request: the response has no body whatever its headers say
+    bool reusable;   // at UPSTREAM_DONE: the backend keeps the connection open
+    bool upgrade;    // a 101 response ends the exchange; see UPSTREAM_UPGRADED
+    char *request;   // request bytes, owned
+    size_t request_len;
+    size_t request_sent;
+    char *response; // response bytes received so far, NUL-terminated; de-chunked when done
+    size_t response_len;
+    size_t response_size;
+    size_t body_start;   // offset of the body; 0 until the header block is complete
+    ssize_t body_length; // expected body bytes, -1 when the body ends at EOF
+    bool chunked;
+    size_t chunk_scan;      // chunked: next raw byte to decode
+    size_t chunk_decoded;   // chunked: end of the decoded body
+    size_t splice_min;      // bodies of this Content-Length or more are spliced; 0 never
+    size_t body_left;       // UPSTREAM_SPLICING: body bytes not yet moved off the socket
+    uint64_t connected_at;  // monotonic ns the connection was ready to send; 0 until then
+    uint64_t first_byte_at; // monotonic ns the first response byte arrived; 0 until then
+} Upstream;
+
+/* Idle backend connections kept by one event loop, per backend */
+typedef struct UpstreamIdle
+{
+    int fd;
+    time_t since;
+} UpstreamIdle;
+
+typedef struct UpstreamPool
+{
+    int capacity; // idle connections kept per backend; 0 disables reuse
+    int timeout;  // seconds an idle connection is kept
+    int counts[MAX_BACKENDS];
+    UpstreamIdle *idle; // capacity slots per backend, oldest first
+} UpstreamPool;
+
+int upstream_parse_address(const char *backend, UpstreamAddress *addr);
+int upstream_connect(const UpstreamAddress *addr, bool nonblocking);
+
+int upstream_start(Upstream *u, const UpstreamAddress *addr, int pooled_fd, char *request,
+                   size_t len);
+uint32_t upstream_step(Upstream *u, uint32_t events);
+ssize_t upstream_splice(Upstream *u, int pipe_fd, size_t len);
+int upstream_retry(Upstream *u, const UpstreamAddress *addr);
+int upstream_detach(Upstream *u);
+void upstream_release(Upstream *u);
+
+int upstream_pool_init(UpstreamPool *pool, int capacity, int timeout);
+int upstream_pool_get(UpstreamPool *pool, int backend);
+void upstream_pool_put(UpstreamPool *pool, int backend, int fd);
+void upstream_pool_free(UpstreamPool *pool);
+
+#endif /* HTTP_UPSTREAM_H */
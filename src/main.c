@@ -23,25 +23,30 @@ int main(void)
     signal(SIGSEGV, handle_signal);
     signal(SIGPIPE, SIG_IGN);
 
+    if (logger_init() < 0)
+    {
+        fprintf(stderr, "Failed to start logger thread, logging synchronously.\n");
+    }
+
     Config *cfg = parse_config("cserver.ini");
     if (!cfg)
     {
-        LOG("ERROR", "Failed to parse config file.");
+        LOG(LOG_ERROR, "Failed to parse config file.");
         return EXIT_FAILURE;
     }
+    logger_set_level(cfg->log_level);
 
-    httpserver_ptr =
-        httpserver_constructor(cfg->port, cfg->static_dir, cfg->backends, cfg->backend_count);
+    httpserver_ptr = httpserver_constructor(cfg);
     if (!httpserver_ptr)
     {
-        LOG("ERROR", "Failed to create HTTPServer instance.");
+        LOG(LOG_ERROR, "Failed to create HTTPServer instance.");
         return EXIT_FAILURE;
     }
 
     int is_launched = httpserver_ptr->launch(httpserver_ptr);
     if (is_launched < 0)
     {
-        LOG("ERROR", "HTTPServer launch function faced an error, with code %d.", is_launched);
+        LOG(LOG_ERROR, "HTTPServer launch function faced an error, with code %d.", is_launched);
         httpserver_destructor(httpserver_ptr);
         return EXIT_FAILURE;
     }
@@ -71,6 +76,13 @@ void handle_signal(int sig)
         fprintf(stderr, "\n\03[33m[!] Signal %d received. Cleaning up...\033[0m\n", sig);
     }
 
+    // Worker threads may be inside the server: let launch() stop and join them, main() cleans up
+    if (httpserver_ptr && sig != SIGSEGV)
+    {
+        httpserver_stop(httpserver_ptr);
+        return;
+    }
+
     if (httpserver_ptr)
     {
         httpserver_destructor(httpserver_ptr);
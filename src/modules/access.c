@@ -0,0 +1,156 @@
+/**
+ * @file    access.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Access module: allows or denies clients by address.
+ *
+ * @details "allow = <address>[/<prefix>]" and "deny = <address>[/<prefix>]",
+ *          IPv4 or IPv6, or "all". The rules are checked in file order and
+ *          the first one matching the client decides; a client no rule
+ *          matches is allowed. Denied requests get 403.
+ */
+
+#include "http/module.h"
+
+#define MAX_ACCESS_RULES 64
+
+typedef struct AccessRule
+{
+    bool allow;
+    bool all;       // matches every client
+    uint8_t family; // AF_INET or AF_INET6
+    uint8_t addr[16];
+    int prefix; // leading bits of addr that must match
+} AccessRule;
+
+typedef struct AccessConf
+{
+    AccessRule rules[MAX_ACCESS_RULES];
+    size_t count;
+} AccessConf;
+
+static const AccessConf *access_rules = NULL;
+
+/**
+ * @brief   Parses "all", an address, or an address with a prefix length.
+ *
+ * @return  OK, or -1 if malformed.
+ */
+static int parse_rule(AccessRule *rule, const char *value)
+{
+    if (strcmp(value, "all") == 0)
+    {
+        rule->all = true;
+        return OK;
+    }
+
+    char addr[INET6_ADDRSTRLEN];
+    const char *slash = strchr(value, '/');
+    size_t addr_len   = slash ? (size_t)(slash - value) : strlen(value);
+    if (addr_len >= sizeof(addr)) return -1;
+    memcpy(addr, value, addr_len);
+    addr[addr_len] = '\0';
+
+    if (inet_pton(AF_INET, addr, rule->addr) == 1)
+        rule->family = AF_INET;
+    else if (inet_pton(AF_INET6, addr, rule->addr) == 1)
+        rule->family = AF_INET6;
+    else
+        return -1;
+
+    int max_prefix = rule->family == AF_INET ? 32 : 128;
+    rule->prefix   = max_prefix;
+    if (slash)
+    {
+        char *end;
+        long prefix = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end || prefix < 0 || prefix > max_prefix) return -1;
+        rule->prefix = (int)prefix;
+    }
+    return OK;
+}
+
+static int access_directive(void **conf, const char *key, const char *value)
+{
+    bool allow = strcmp(key, "allow") == 0;
+    if (!allow && strcmp(key, "deny") != 0) return 0;
+
+    AccessRule rule = {.allow = allow};
+    if (parse_rule(&rule, value) < 0) return -1;
+
+    if (!*conf && !(*conf = calloc(1, sizeof(AccessConf)))) return -1;
+    AccessConf *c = *conf;
+    if (c->count == MAX_ACCESS_RULES) return -1;
+    c->rules[c->count++] = rule;
+    return 1;
+}
+
+static void access_free_conf(void *conf)
+{
+    free(conf);
+}
+
+static int access_init(void *conf)
+{
+    access_rules = conf;
+    return OK;
+}
+
+static bool rule_matches(const AccessRule *rule, int family, const uint8_t *addr)
+{
+    if (rule->all) return true;
+    if (rule->family != family) return false;
+
+    int whole = rule->prefix / 8, bits = rule->prefix % 8;
+    if (memcmp(rule->addr, addr, whole) != 0) return false;
+    if (bits == 0) return true;
+    uint8_t mask = (uint8_t)(0xFF << (8 - bits));
+    return (rule->addr[whole] & mask) == (addr[whole] & mask);
+}
+
+static HTTPResponse *check_access(const HTTPRequest *req, const struct sockaddr_storage *client)
+{
+    (void)req;
+    if (!access_rules || !client) return NULL;
+
+    const uint8_t *addr;
+    int family = client->ss_family;
+    if (family == AF_INET)
+    {
+        addr = (const uint8_t *)&((const struct sockaddr_in *)client)->sin_addr;
+    }
+    else if (family == AF_INET6)
+    {
+        // An IPv4 client of a dual-stack listener is matched as IPv4
+        const struct in6_addr *v6 = &((const struct sockaddr_in6 *)client)->sin6_addr;
+        addr                      = v6->s6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(v6))
+        {
+            family = AF_INET;
+            addr += 12;
+        }
+    }
+    else
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < access_rules->count; i++)
+    {
+        const AccessRule *rule = &access_rules->rules[i];
+        if (!rule_matches(rule, family, addr)) continue;
+        if (rule->allow) return NULL;
+
+        char body[] = "<h1>403 Forbidden</h1>";
+        return response_builder(403, "Forbidden", body, strlen(body), "text/html");
+    }
+    return NULL;
+}
+
+const Module access_module = {
+    .name      = "access",
+    .directive = access_directive,
+    .free_conf = access_free_conf,
+    .init      = access_init,
+    .access    = check_access,
+};
@@ -0,0 +1,58 @@
+/**
+ * @file    echo.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Echo module: answers with the request as the server received it.
+ *
+ * @details A location with "content = echo" replies 200 text/plain with the
+ *          request line, the headers and the body, which shows what a client
+ *          or a rewrite rule actually sent.
+ */
+
+#include "http/module.h"
+
+static void append(char *buf, size_t cap, size_t *len, const char *data, size_t data_len)
+{
+    if (!data || *len >= cap) return;
+    if (data_len > cap - *len) data_len = cap - *len;
+    memcpy(buf + *len, data, data_len);
+    *len += data_len;
+}
+
+static HTTPResponse *echo_request(HTTPRequest *req, const Location *route)
+{
+    (void)route;
+    const HTTPRequestLine *line = &req->request_line;
+    size_t cap = line->method_len + line->uri_len + line->protocol_len + 4 + req->body_len;
+    for (int i = 0; i < req->header_count; i++)
+        cap += req->headers[i].name_len + req->headers[i].value_len + 3;
+
+    char *body = malloc(cap);
+    if (!body) return NULL;
+    size_t len = 0;
+    append(body, cap, &len, line->method, line->method_len);
+    append(body, cap, &len, " ", 1);
+    append(body, cap, &len, line->uri, line->uri_len);
+    append(body, cap, &len, " ", 1);
+    append(body, cap, &len, line->protocol, line->protocol_len);
+    append(body, cap, &len, "\n", 1);
+    for (int i = 0; i < req->header_count; i++)
+    {
+        const HTTPHeader *h = &req->headers[i];
+        append(body, cap, &len, h->name, h->name_len);
+        append(body, cap, &len, ": ", 2);
+        append(body, cap, &len, h->value, h->value_len);
+        append(body, cap, &len, "\n", 1);
+    }
+    append(body, cap, &len, "\n", 1);
+    append(body, cap, &len, req->body, req->body_len);
+
+    HTTPResponse *response = response_builder(200, "OK", body, len, "text/plain");
+    free(body);
+    return response;
+}
+
+const Module echo_module = {
+    .name    = "echo",
+    .content = echo_request,
+};
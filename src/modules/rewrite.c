@@ -0,0 +1,122 @@
+/**
+ * @file    rewrite.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Rewrite module: replaces URI prefixes before routing.
+ *
+ * @details "rewrite = <from> <to> [permanent]" turns a URI starting with
+ *          <from> into one starting with <to>, query included. The rewritten
+ *          request is routed, proxied and logged with its new URI; with
+ *          "permanent" the client is sent a 301 to it instead. The key can
+ *          be repeated; the first matching rule applies.
+ */
+
+#include "http/module.h"
+
+#define MAX_REWRITES 32
+
+typedef struct RewriteRule
+{
+    char *from;
+    char *to;
+    size_t from_len;
+    size_t to_len;
+    bool permanent; // redirect rather than rewrite internally
+} RewriteRule;
+
+typedef struct RewriteConf
+{
+    RewriteRule rules[MAX_REWRITES];
+    size_t count;
+} RewriteConf;
+
+static const RewriteConf *rewrites = NULL;
+
+static int rewrite_directive(void **conf, const char *key, const char *value)
+{
+    if (strcmp(key, "rewrite") != 0) return 0;
+
+    char from[256], to[256], flag[16] = "";
+    int fields = sscanf(value, "%255s %255s %15s", from, to, flag);
+    if (fields < 2 || from[0] != '/' || (fields == 3 && strcmp(flag, "permanent") != 0))
+        return -1;
+
+    if (!*conf && !(*conf = calloc(1, sizeof(RewriteConf)))) return -1;
+    RewriteConf *c = *conf;
+    if (c->count == MAX_REWRITES) return -1;
+
+    RewriteRule *rule = &c->rules[c->count];
+    rule->from        = strdup(from);
+    rule->to          = strdup(to);
+    if (!rule->from || !rule->to)
+    {
+        free(rule->from);
+        free(rule->to);
+        return -1;
+    }
+    rule->from_len  = strlen(from);
+    rule->to_len    = strlen(to);
+    rule->permanent = fields == 3;
+    c->count++;
+    return 1;
+}
+
+static void rewrite_free_conf(void *conf)
+{
+    RewriteConf *c = conf;
+    for (size_t i = 0; i < c->count; i++)
+    {
+        free(c->rules[i].from);
+        free(c->rules[i].to);
+    }
+    free(c);
+}
+
+static int rewrite_init(void *conf)
+{
+    rewrites = conf;
+    return OK;
+}
+
+static HTTPResponse *rewrite_request(HTTPRequest *req)
+{
+    const char *uri = req->request_line.uri;
+    size_t uri_len  = req->request_line.uri_len;
+    if (!rewrites || !uri) return NULL;
+
+    for (size_t i = 0; i < rewrites->count; i++)
+    {
+        const RewriteRule *rule = &rewrites->rules[i];
+        if (uri_len < rule->from_len || memcmp(uri, rule->from, rule->from_len) != 0) continue;
+
+        size_t rest_len = uri_len - rule->from_len;
+        size_t len      = rule->to_len + rest_len;
+        char *target    = malloc(len + 1);
+        if (!target) return NULL;
+        memcpy(target, rule->to, rule->to_len);
+        memcpy(target + rule->to_len, uri + rule->from_len, rest_len);
+        target[len] = '\0';
+
+        HTTPResponse *response = NULL;
+        if (rule->permanent)
+        {
+            response = response_builder(301, "Moved Permanently", "", 0, "text/plain");
+            if (response) httpresponse_add_header(response, "Location", target);
+        }
+        else if (set_http_request_uri(req, target, len) < 0)
+        {
+            LOG(LOG_ERROR, "Failed to rewrite %.*s.", (int)uri_len, uri);
+        }
+        free(target);
+        return response;
+    }
+    return NULL;
+}
+
+const Module rewrite_module = {
+    .name      = "rewrite",
+    .directive = rewrite_directive,
+    .free_conf = rewrite_free_conf,
+    .init      = rewrite_init,
+    .rewrite   = rewrite_request,
+};
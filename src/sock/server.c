@@ -10,8 +10,29 @@
 
 #include "server.h"
 
+void socket_options_defaults(SocketOptions *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->backlog      = DEFAULT_LISTEN_BACKLOG;
+    options->accept_batch = DEFAULT_ACCEPT_BATCH;
+}
+
+/**
+ * @brief   Applies a single integer socket option, logging on failure.
+ *
+ * Tuning options are best effort: a kernel that lacks TCP_FASTOPEN or caps
+ * SO_RCVBUF should not prevent the server from starting.
+ */
+static void apply_socket_option(int socket, int level, int name, int value, const char *label)
+{
+    if (setsockopt(socket, level, name, &value, sizeof(value)) < 0)
+    {
+        LOG(LOG_ERROR, "setsockopt(%s=%d) failed: %s", label, value, strerror(errno));
+    }
+}
+
 SocketServer *server_constructor(int domain, int service, int protocol, uint32_t interface,
-                                 int port, int queue)
+                                 int port, const SocketOptions *options)
 {
     SocketServer *server_ptr = (SocketServer *)malloc(sizeof(SocketServer));
     server_ptr->domain       = domain;
@@ -19,13 +40,22 @@ SocketServer *server_constructor(int domain, int service, int protocol, uint32_t
     server_ptr->protocol     = protocol;
     server_ptr->port         = port;
     server_ptr->interface    = interface;
-    server_ptr->queue        = queue;
+
+    if (options)
+        server_ptr->options = *options;
+    else
+        socket_options_defaults(&server_ptr->options);
+    if (server_ptr->options.backlog <= 0) server_ptr->options.backlog = DEFAULT_LISTEN_BACKLOG;
+    if (server_ptr->options.accept_batch <= 0)
+        server_ptr->options.accept_batch = DEFAULT_ACCEPT_BATCH;
+    server_ptr->queue = server_ptr->options.backlog;
 
     server_ptr->address.sin_family      = domain;
     server_ptr->address.sin_port        = htons(port);
     server_ptr->address.sin_addr.s_addr = htonl(interface);
 
-    server_ptr->socket = socket(domain, service, protocol);
+    // Nonblocking so the accept loop can drain the queue until EAGAIN
+    server_ptr->socket = socket(domain, service | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
 
     if (server_ptr->socket < 0)
     {
@@ -41,6 +71,30 @@ SocketServer *server_constructor(int domain, int service, int protocol, uint32_t
         exit(1);
     }
 
+    if (server_ptr->options.reuseport &&
+        setsockopt(server_ptr->socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt(SO_REUSEPORT) failed");
+        close(server_ptr->socket);
+        exit(1);
+    }
+
+    // Buffer sizes must be set before listen() to take part in window scaling;
+    // accepted sockets inherit them, as well as TCP_NODELAY.
+    const SocketOptions *o = &server_ptr->options;
+    if (o->rcvbuf > 0)
+        apply_socket_option(server_ptr->socket, SOL_SOCKET, SO_RCVBUF, o->rcvbuf, "SO_RCVBUF");
+    if (o->sndbuf > 0)
+        apply_socket_option(server_ptr->socket, SOL_SOCKET, SO_SNDBUF, o->sndbuf, "SO_SNDBUF");
+    if (o->nodelay)
+        apply_socket_option(server_ptr->socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (o->defer_accept > 0)
+        apply_socket_option(server_ptr->socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, o->defer_accept,
+                            "TCP_DEFER_ACCEPT");
+    if (o->fastopen > 0)
+        apply_socket_option(server_ptr->socket, IPPROTO_TCP, TCP_FASTOPEN, o->fastopen,
+                            "TCP_FASTOPEN");
+
     return server_ptr;
 }
 
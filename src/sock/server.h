@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "common.h"
 
 typedef enum
@@ -23,6 +24,24 @@ typedef enum
     UDP
 } TransportType;
 
+/**
+ * @brief   Listen-socket tuning applied by server_constructor().
+ *
+ * Zero means "leave the kernel default" for every field except backlog and
+ * accept_batch, which fall back to DEFAULT_LISTEN_BACKLOG / DEFAULT_ACCEPT_BATCH.
+ */
+typedef struct SocketOptions
+{
+    int backlog;      // listen() queue length
+    int accept_batch; // max accept4() calls per listen-socket event
+    int defer_accept; // TCP_DEFER_ACCEPT timeout in seconds
+    int fastopen;     // TCP_FASTOPEN queue length
+    bool nodelay;     // TCP_NODELAY (inherited by accepted sockets)
+    int rcvbuf;       // SO_RCVBUF in bytes
+    int sndbuf;       // SO_SNDBUF in bytes
+    bool reuseport;   // SO_REUSEPORT, so every worker can listen on the port
+} SocketOptions;
+
 typedef struct Server
 {
     int domain;
@@ -34,11 +53,13 @@ typedef struct Server
     TransportType transport;
     struct sockaddr_in address;
     int socket;
+    SocketOptions options;
 
     // void (*launch)(struct Server *self);
 } SocketServer;
 
+void socket_options_defaults(SocketOptions *options);
 SocketServer *server_constructor(int domain, int service, int protocol, uint32_t interface,
-                                 int port, int queue);
+                                 int port, const SocketOptions *options);
 void server_destructor(SocketServer *server);
 #endif /* SERVER_H */
\ No newline at end of file
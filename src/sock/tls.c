@@ -0,0 +1,429 @@
+/**
+ * @file    tls.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Nonblocking TLS termination on top of OpenSSL, with kTLS offload.
+ */
+
+#include <sys/epoll.h>
+#ifdef CSERVE_HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#include "tls.h"
+
+#define TLS_FILE_CHUNK 16384 // one full TLS record
+
+static const TLSOptions default_options = {
+    .session_cache_size = DEFAULT_TLS_SESSION_CACHE_SIZE,
+    .session_timeout    = DEFAULT_TLS_SESSION_TIMEOUT,
+    .session_tickets    = true,
+    .ktls               = true,
+};
+
+void tls_options_defaults(TLSOptions *opts)
+{
+    *opts = default_options;
+}
+
+void tls_options_free(TLSOptions *opts)
+{
+    free(opts->certificate);
+    free(opts->certificate_key);
+    opts->certificate     = NULL;
+    opts->certificate_key = NULL;
+}
+
+#ifdef CSERVE_HAVE_OPENSSL
+
+struct TLSContext
+{
+    SSL_CTX *ssl_ctx;
+    bool http2; // offer h2 in ALPN
+};
+
+struct TLSConnection
+{
+    SSL *ssl;
+    bool ktls_send; // the kernel encrypts what is written to the socket
+    bool failed;    // a fatal error occurred; no close_notify may be sent
+};
+
+static void log_ssl_errors(int level, const char *what)
+{
+    unsigned long err;
+    char message[256];
+    while ((err = ERR_get_error()) != 0)
+    {
+        ERR_error_string_n(err, message, sizeof(message));
+        LOG(level, "%s: %s", what, message);
+    }
+}
+
+/**
+ * @brief   Picks the application protocol: h2 when enabled, else http/1.1.
+ *
+ * A client offering neither proceeds without ALPN and is served HTTP/1.1.
+ */
+static int select_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *arg)
+{
+    static const unsigned char with_h2[] = "\x02h2\x08http/1.1";
+    static const unsigned char http1[]   = "\x08http/1.1";
+    const TLSContext *ctx                = arg;
+    (void)ssl;
+
+    const unsigned char *supported = ctx->http2 ? with_h2 : http1;
+    unsigned int supported_len     = ctx->http2 ? sizeof(with_h2) - 1 : sizeof(http1) - 1;
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, outlen, supported, supported_len, in, inlen) !=
+        OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * @brief   Builds the shared TLS state of a listener from opts.
+ *
+ * Resumption works both ways: by session ID against a server-side cache of
+ * session_cache_size entries, and from tickets the client holds, whose keys
+ * OpenSSL generates per context. TLS 1.2 is the oldest version accepted.
+ *
+ * @return  The context, or NULL if the certificate or key cannot be loaded.
+ */
+TLSContext *tls_context_new(const TLSOptions *opts, bool http2)
+{
+    if (!opts->certificate || !opts->certificate_key)
+    {
+        LOG(LOG_ERROR, "TLS needs both tls_certificate and tls_certificate_key.");
+        return NULL;
+    }
+
+    TLSContext *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) return NULL;
+    ctx->http2   = http2;
+    ctx->ssl_ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx->ssl_ctx)
+    {
+        log_ssl_errors(LOG_ERROR, "SSL_CTX_new");
+        free(ctx);
+        return NULL;
+    }
+    SSL_CTX *c = ctx->ssl_ctx;
+
+    uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE |
+                       SSL_OP_NO_COMPRESSION | SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if (opts->ktls) options |= SSL_OP_ENABLE_KTLS;
+    if (!opts->session_tickets) options |= SSL_OP_NO_TICKET;
+    SSL_CTX_set_options(c, options);
+    SSL_CTX_set_min_proto_version(c, TLS1_2_VERSION);
+    // Partial writes and a movable buffer match how flush_output() retries;
+    // idle keep-alive connections give their record buffers back
+    SSL_CTX_set_mode(c, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(c, opts->certificate) != 1 ||
+        SSL_CTX_use_PrivateKey_file(c, opts->certificate_key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(c) != 1)
+    {
+        log_ssl_errors(LOG_ERROR, "Loading the TLS certificate");
+        tls_context_free(ctx);
+        return NULL;
+    }
+
+    static const unsigned char session_context[] = "cserve";
+    SSL_CTX_set_session_id_context(c, session_context, sizeof(session_context) - 1);
+    if (opts->session_cache_size > 0)
+    {
+        SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(c, (long)opts->session_cache_size);
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_OFF);
+        if (!opts->session_tickets) SSL_CTX_set_num_tickets(c, 0);
+    }
+    if (opts->session_timeout > 0) SSL_CTX_set_timeout(c, opts->session_timeout);
+    SSL_CTX_set_alpn_select_cb(c, select_alpn, ctx);
+
+    return ctx;
+}
+
+void tls_context_free(TLSContext *ctx)
+{
+    if (!ctx) return;
+    SSL_CTX_free(ctx->ssl_ctx);
+    free(ctx);
+}
+
+/**
+ * @brief   Starts server-side TLS on an accepted socket; the handshake is
+ *          driven by tls_handshake().
+ *
+ * @return  The connection state, or NULL on allocation failure.
+ */
+TLSConnection *tls_accept(TLSContext *ctx, int fd)
+{
+    TLSConnection *tls = calloc(1, sizeof(*tls));
+    if (!tls) return NULL;
+
+    tls->ssl = SSL_new(ctx->ssl_ctx);
+    if (!tls->ssl || SSL_set_fd(tls->ssl, fd) != 1)
+    {
+        log_ssl_errors(LOG_ERROR, "SSL_new");
+        SSL_free(tls->ssl);
+        free(tls);
+        return NULL;
+    }
+    SSL_set_accept_state(tls->ssl);
+    return tls;
+}
+
+/**
+ * @brief   Turns the result of a failed SSL call into the errno conventions
+ *          of recv() and send().
+ *
+ * @return  0 when the peer closed the TLS session, otherwise -1 with errno
+ *          EAGAIN if the call has to be retried once the socket is ready.
+ */
+static ssize_t ssl_failure(TLSConnection *tls, int ret)
+{
+    int saved_errno = errno;
+    switch (SSL_get_error(tls->ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        tls->failed = true;
+        ERR_clear_error();
+        errno = saved_errno ? saved_errno : ECONNRESET;
+        return -1;
+    default:
+        tls->failed = true;
+        log_ssl_errors(LOG_DEBUG, "TLS");
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+/**
+ * @brief   Advances the handshake as far as the socket allows.
+ *
+ * @return  1 once it is complete, 0 while it waits for the socket (events
+ *          is set to the epoll interest to wait for), -1 if it failed.
+ */
+int tls_handshake(TLSConnection *tls, uint32_t *events)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(tls->ssl);
+    if (ret == 1)
+    {
+        tls->ktls_send = BIO_get_ktls_send(SSL_get_wbio(tls->ssl));
+        return 1;
+    }
+
+    int err = SSL_get_error(tls->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        *events = err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT;
+        return 0;
+    }
+    tls->failed = true;
+    log_ssl_errors(LOG_DEBUG, "TLS handshake");
+    return -1;
+}
+
+/**
+ * @brief   recv() through TLS.
+ *
+ * @return  Bytes read, 0 at the end of the session, -1 with errno set.
+ */
+ssize_t tls_recv(TLSConnection *tls, char *buf, size_t len)
+{
+    size_t n;
+    ERR_clear_error();
+    if (SSL_read_ex(tls->ssl, buf, len, &n) == 1) return n;
+    return ssl_failure(tls, 0);
+}
+
+/**
+ * @brief   send() through TLS; may send less than len.
+ *
+ * After an EAGAIN the same bytes must be offered again, though they may
+ * have moved in memory.
+ *
+ * @return  Bytes sent, or -1 with errno set.
+ */
+ssize_t tls_send(TLSConnection *tls, const char *data, size_t len)
+{
+    size_t n;
+    ERR_clear_error();
+    if (SSL_write_ex(tls->ssl, data, len, &n) == 1) return n;
+    if (ssl_failure(tls, 0) == 0)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    return -1;
+}
+
+/**
+ * @brief   sendfile() through TLS, advancing *offset like sendfile() does.
+ *
+ * With kTLS the kernel encrypts the file pages as they go out. Otherwise up
+ * to one record is read from the file and encrypted here.
+ *
+ * @return  Bytes sent, 0 if the file ended early, or -1 with errno set.
+ */
+ssize_t tls_sendfile(TLSConnection *tls, int fd, off_t *offset, size_t length)
+{
+    if (tls->ktls_send)
+    {
+        ERR_clear_error();
+        ossl_ssize_t sent = SSL_sendfile(tls->ssl, fd, *offset, length, 0);
+        if (sent < 0) return ssl_failure(tls, (int)sent);
+        *offset += sent;
+        return sent;
+    }
+
+    char chunk[TLS_FILE_CHUNK];
+    ssize_t got = pread(fd, chunk, length < sizeof(chunk) ? length : sizeof(chunk), *offset);
+    if (got <= 0) return got;
+    ssize_t sent = tls_send(tls, chunk, got);
+    if (sent > 0) *offset += sent;
+    return sent;
+}
+
+/**
+ * @brief   Sends close_notify if the session is healthy; best effort, never blocks.
+ */
+void tls_shutdown(TLSConnection *tls)
+{
+    if (!tls || tls->failed || !SSL_is_init_finished(tls->ssl)) return;
+    ERR_clear_error();
+    SSL_shutdown(tls->ssl);
+    ERR_clear_error();
+}
+
+void tls_free(TLSConnection *tls)
+{
+    if (!tls) return;
+    SSL_free(tls->ssl);
+    free(tls);
+}
+
+bool tls_ktls_send(const TLSConnection *tls)
+{
+    return tls->ktls_send;
+}
+
+bool tls_session_reused(const TLSConnection *tls)
+{
+    return SSL_session_reused(tls->ssl);
+}
+
+/**
+ * @brief   The protocol chosen with ALPN, not NUL-terminated; NULL if none was.
+ */
+const char *tls_alpn(const TLSConnection *tls, size_t *len)
+{
+    const unsigned char *protocol;
+    unsigned int protocol_len;
+    SSL_get0_alpn_selected(tls->ssl, &protocol, &protocol_len);
+    *len = protocol_len;
+    return protocol_len ? (const char *)protocol : NULL;
+}
+
+#else /* !CSERVE_HAVE_OPENSSL */
+
+TLSContext *tls_context_new(const TLSOptions *opts, bool http2)
+{
+    (void)opts;
+    (void)http2;
+    LOG(LOG_ERROR, "TLS is not available: cserve was built without OpenSSL.");
+    return NULL;
+}
+
+void tls_context_free(TLSContext *ctx)
+{
+    (void)ctx;
+}
+
+TLSConnection *tls_accept(TLSContext *ctx, int fd)
+{
+    (void)ctx;
+    (void)fd;
+    return NULL;
+}
+
+int tls_handshake(TLSConnection *tls, uint32_t *events)
+{
+    (void)tls;
+    (void)events;
+    return -1;
+}
+
+ssize_t tls_recv(TLSConnection *tls, char *buf, size_t len)
+{
+    (void)tls;
+    (void)buf;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t tls_send(TLSConnection *tls, const char *data, size_t len)
+{
+    (void)tls;
+    (void)data;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t tls_sendfile(TLSConnection *tls, int fd, off_t *offset, size_t length)
+{
+    (void)tls;
+    (void)fd;
+    (void)offset;
+    (void)length;
+    errno = ENOTSUP;
+    return -1;
+}
+
+void tls_shutdown(TLSConnection *tls)
+{
+    (void)tls;
+}
+
+void tls_free(TLSConnection *tls)
+{
+    (void)tls;
+}
+
+bool tls_ktls_send(const TLSConnection *tls)
+{
+    (void)tls;
+    return false;
+}
+
+bool tls_session_reused(const TLSConnection *tls)
+{
+    (void)tls;
+    return false;
+}
+
+const char *tls_alpn(const TLSConnection *tls, size_t *len)
+{
+    (void)tls;
+    *len = 0;
+    return NULL;
+}
+
+#endif /* CSERVE_HAVE_OPENSSL */
@@ -0,0 +1,63 @@
+/**
+ * @file    tls.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   TLS termination for client connections (OpenSSL).
+ *
+ * @details A TLSContext holds the certificate, the session cache and ticket
+ *          keys shared by every connection of a listener; a TLSConnection is
+ *          the per-socket state. All calls are nonblocking: the handshake is
+ *          resumed from the event loop, and reads and writes that would block
+ *          fail with errno EAGAIN like their plaintext counterparts.
+ *
+ *          When the kernel accepts the negotiated cipher, record encryption is
+ *          handed to it (kTLS) after the handshake, so file bodies still go out
+ *          with sendfile(). Otherwise tls_sendfile() reads the file and encrypts
+ *          it in user space.
+ *
+ *          Without OpenSSL at build time tls_context_new() fails and TLS
+ *          listeners cannot be configured.
+ */
+
+#ifndef SOCK_TLS_H
+#define SOCK_TLS_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define DEFAULT_TLS_SESSION_CACHE_SIZE 20480
+#define DEFAULT_TLS_SESSION_TIMEOUT 300
+
+typedef struct TLSOptions
+{
+    int port;                  // TLS listener port; 0 disables TLS
+    char *certificate;         // PEM certificate chain
+    char *certificate_key;     // PEM private key
+    size_t session_cache_size; // sessions kept for resumption by ID; 0 disables the cache
+    long session_timeout;      // seconds a session can be resumed
+    bool session_tickets;      // resume from client-held tickets (RFC 5077, TLS 1.3 PSK)
+    bool ktls;                 // hand record encryption to the kernel when it can
+} TLSOptions;
+
+typedef struct TLSContext TLSContext;
+typedef struct TLSConnection TLSConnection;
+
+void tls_options_defaults(TLSOptions *opts);
+void tls_options_free(TLSOptions *opts);
+
+TLSContext *tls_context_new(const TLSOptions *opts, bool http2);
+void tls_context_free(TLSContext *ctx);
+
+TLSConnection *tls_accept(TLSContext *ctx, int fd);
+int tls_handshake(TLSConnection *tls, uint32_t *events);
+ssize_t tls_recv(TLSConnection *tls, char *buf, size_t len);
+ssize_t tls_send(TLSConnection *tls, const char *data, size_t len);
+ssize_t tls_sendfile(TLSConnection *tls, int fd, off_t *offset, size_t length);
+void tls_shutdown(TLSConnection *tls);
+void tls_free(TLSConnection *tls);
+
+bool tls_ktls_send(const TLSConnection *tls);
+bool tls_session_reused(const TLSConnection *tls);
+const char *tls_alpn(const TLSConnection *tls, size_t *len);
+
+#endif /* SOCK_TLS_H */
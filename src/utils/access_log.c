@@ -0,0 +1,643 @@
+/**
+ * @file    access_log.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Access log formats and background writer.
+ *
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "access_log.h"
+#include "utils/metrics.h"
+#include "utils/thread_ring.h"
+
+bool access_log_on = false;
+
+static ThreadRings rings   = THREAD_RINGS_INIT(AccessRecord, ACCESS_RING_CAPACITY);
+static atomic_bool running = false;
+static pthread_t writer_thread;
+static int log_fd = -1;
+static bool log_binary;
+static AccessLogFormat log_format;
+static char *out_buf; // rendered records not yet written
+static size_t out_len;
+
+static _Thread_local ThreadRing *local_ring = NULL;
+
+// ---------- OPTIONS ----------
+
+void access_log_options_defaults(AccessLogOptions *opts)
+{
+    opts->path   = NULL;
+    opts->format = NULL;
+    opts->binary = false;
+}
+
+void access_log_options_free(AccessLogOptions *opts)
+{
+    free(opts->path);
+    free(opts->format);
+    access_log_options_defaults(opts);
+}
+
+// ---------- TEXT FORMAT ----------
+
+static const struct
+{
+    const char *name;
+    AccessVar var;
+    AccessPhase phase;
+} variables[] = {
+    {"remote_addr", ACCESS_VAR_REMOTE_ADDR, 0},
+    {"time_local", ACCESS_VAR_TIME_LOCAL, 0},
+    {"time_iso8601", ACCESS_VAR_TIME_ISO8601, 0},
+    {"msec", ACCESS_VAR_MSEC, 0},
+    {"request", ACCESS_VAR_REQUEST, 0},
+    {"method", ACCESS_VAR_METHOD, 0},
+    {"uri", ACCESS_VAR_URI, 0},
+    {"protocol", ACCESS_VAR_PROTOCOL, 0},
+    {"status", ACCESS_VAR_STATUS, 0},
+    {"bytes_sent", ACCESS_VAR_BYTES_SENT, 0},
+    {"worker", ACCESS_VAR_WORKER, 0},
+    {"request_time_us", ACCESS_VAR_REQUEST_TIME_US, 0},
+    {"first_byte_us", ACCESS_VAR_PHASE, ACCESS_FIRST_BYTE},
+    {"parsed_us", ACCESS_VAR_PHASE, ACCESS_PARSED},
+    {"handler_us", ACCESS_VAR_PHASE, ACCESS_HANDLER},
+    {"upstream_connect_us", ACCESS_VAR_PHASE, ACCESS_UPSTREAM_CONNECT},
+    {"upstream_first_byte_us", ACCESS_VAR_PHASE, ACCESS_UPSTREAM_FIRST_BYTE},
+    {"last_byte_us", ACCESS_VAR_PHASE, ACCESS_LAST_BYTE},
+};
+
+static bool is_name_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || c == '_';
+}
+
+static bool is_name_char(char c)
+{
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+/**
+ * @brief   Compiles a log line template.
+ *
+ * $name is replaced by a request field: remote_addr, time_local,
+ * time_iso8601, msec, request ("GET /uri HTTP/1.1"), method, uri, protocol,
+ * status, bytes_sent and worker. The timing variables are microseconds:
+ * request_time_us from first byte to last byte, and first_byte_us,
+ * parsed_us, handler_us, upstream_connect_us, upstream_first_byte_us and
+ * last_byte_us since the connection was accepted. Anything else, a '$'
+ * not followed by a name included, is copied as is.
+ *
+ * @return  OK, or -1 for an unknown variable or a template with too many parts.
+ */
+int access_log_format_compile(AccessLogFormat *fmt, const char *spec)
+{
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->spec = strdup(spec);
+    if (!fmt->spec) return -1;
+
+    const char *p = fmt->spec;
+    while (*p)
+    {
+        if (fmt->token_count == ACCESS_FORMAT_MAX_TOKENS)
+        {
+            LOG(LOG_ERROR, "Access log format has more than %d parts.", ACCESS_FORMAT_MAX_TOKENS);
+            access_log_format_free(fmt);
+            return -1;
+        }
+        AccessToken *token = &fmt->tokens[fmt->token_count++];
+
+        if (*p == '$' && is_name_start(p[1]))
+        {
+            const char *name = ++p;
+            while (is_name_char(*p))
+                p++;
+            size_t len = p - name;
+
+            size_t i = 0;
+            for (; i < sizeof(variables) / sizeof(variables[0]); i++)
+            {
+                if (strlen(variables[i].name) == len && memcmp(variables[i].name, name, len) == 0)
+                    break;
+            }
+            if (i == sizeof(variables) / sizeof(variables[0]))
+            {
+                LOG(LOG_ERROR, "Unknown access log variable $%.*s.", (int)len, name);
+                access_log_format_free(fmt);
+                return -1;
+            }
+            token->var   = variables[i].var;
+            token->phase = variables[i].phase;
+            continue;
+        }
+
+        token->var  = ACCESS_VAR_LITERAL;
+        token->text = p++;
+        while (*p && !(*p == '$' && is_name_start(p[1])))
+            p++;
+        token->len = p - token->text;
+    }
+    return OK;
+}
+
+void access_log_format_free(AccessLogFormat *fmt)
+{
+    free(fmt->spec);
+    memset(fmt, 0, sizeof(*fmt));
+}
+
+static size_t put_text(char *out, size_t cap, size_t len, const char *text, size_t text_len)
+{
+    if (len >= cap) return len;
+    if (text_len > cap - len) text_len = cap - len;
+    memcpy(out + len, text, text_len);
+    return len + text_len;
+}
+
+/**
+ * @brief   Copies request bytes with '"', '\\', control bytes and bytes from
+ *          0x7f up written as \xHH, as nginx does, so a client cannot forge
+ *          fields or terminal escapes in the log.
+ */
+static size_t put_escaped(char *out, size_t cap, size_t len, const char *text, size_t text_len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < text_len && len < cap; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+        {
+            out[len++] = (char)c;
+            continue;
+        }
+        if (cap - len < 4) break; // no half escapes
+        out[len++] = '\\';
+        out[len++] = 'x';
+        out[len++] = hex[c >> 4];
+        out[len++] = hex[c & 0xf];
+    }
+    return len;
+}
+
+static size_t put_field(char *out, size_t cap, size_t len, const char *text)
+{
+    return *text ? put_escaped(out, cap, len, text, strlen(text)) : put_text(out, cap, len, "-", 1);
+}
+
+static size_t put_number(char *out, size_t cap, size_t len, uint64_t value)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%lu", (unsigned long)value);
+    return put_text(out, cap, len, num, n);
+}
+
+static size_t put_time(char *out, size_t cap, size_t len, uint64_t time_us, const char *format)
+{
+    time_t seconds = time_us / 1000000;
+    struct tm tm;
+    char stamp[64];
+    size_t n = localtime_r(&seconds, &tm) ? strftime(stamp, sizeof(stamp), format, &tm) : 0;
+    return put_text(out, cap, len, stamp, n);
+}
+
+/**
+ * @brief   Renders one record as a text line, newline included.
+ *
+ * @return  Length written; the line is cut to cap - 1 bytes before its newline.
+ */
+size_t access_log_render(const AccessLogFormat *fmt, const AccessRecord *rec, char *out,
+                         size_t cap)
+{
+    if (cap < 2) return 0;
+    size_t limit = cap - 1;
+    size_t len   = 0;
+    char text[INET6_ADDRSTRLEN + 8];
+    for (int i = 0; i < fmt->token_count && len < limit; i++)
+    {
+        const AccessToken *token = &fmt->tokens[i];
+        switch (token->var)
+        {
+        case ACCESS_VAR_LITERAL:
+            len = put_text(out, limit, len, token->text, token->len);
+            break;
+        case ACCESS_VAR_REMOTE_ADDR:
+            text[0] = '\0';
+            if (rec->family == AF_INET || rec->family == AF_INET6)
+                inet_ntop(rec->family, rec->addr, text, sizeof(text));
+            len = put_field(out, limit, len, text);
+            break;
+        case ACCESS_VAR_TIME_LOCAL:
+            len = put_time(out, limit, len, rec->time_us, "%d/%b/%Y:%H:%M:%S %z");
+            break;
+        case ACCESS_VAR_TIME_ISO8601:
+            len = put_time(out, limit, len, rec->time_us, "%Y-%m-%dT%H:%M:%S%z");
+            break;
+        case ACCESS_VAR_MSEC:
+            snprintf(text, sizeof(text), "%lu.%03lu", (unsigned long)(rec->time_us / 1000000),
+                     (unsigned long)(rec->time_us / 1000 % 1000));
+            len = put_field(out, limit, len, text);
+            break;
+        case ACCESS_VAR_REQUEST:
+            if (!rec->method[0])
+            {
+                len = put_field(out, limit, len, "");
+                break;
+            }
+            len = put_field(out, limit, len, rec->method);
+            len = put_text(out, limit, len, " ", 1);
+            len = put_escaped(out, limit, len, rec->uri, rec->uri_len);
+            len = put_text(out, limit, len, " ", 1);
+            len = put_field(out, limit, len, rec->protocol);
+            break;
+        case ACCESS_VAR_METHOD:
+            len = put_field(out, limit, len, rec->method);
+            break;
+        case ACCESS_VAR_URI:
+            len = rec->uri_len ? put_escaped(out, limit, len, rec->uri, rec->uri_len)
+                               : put_field(out, limit, len, "");
+            break;
+        case ACCESS_VAR_PROTOCOL:
+            len = put_field(out, limit, len, rec->protocol);
+            break;
+        case ACCESS_VAR_STATUS:
+            len = rec->status ? put_number(out, limit, len, rec->status)
+                              : put_field(out, limit, len, "");
+            break;
+        case ACCESS_VAR_BYTES_SENT:
+            len = put_number(out, limit, len, rec->bytes_sent);
+            break;
+        case ACCESS_VAR_WORKER:
+            len = put_number(out, limit, len, rec->worker);
+            break;
+        case ACCESS_VAR_REQUEST_TIME_US:
+        {
+            uint64_t first = rec->phases[ACCESS_FIRST_BYTE];
+            uint64_t last  = rec->phases[ACCESS_LAST_BYTE];
+            len = first == ACCESS_UNSET || last == ACCESS_UNSET || last < first
+                      ? put_field(out, limit, len, "")
+                      : put_number(out, limit, len, (last - first) / 1000);
+            break;
+        }
+        case ACCESS_VAR_PHASE:
+            len = rec->phases[token->phase] == ACCESS_UNSET
+                      ? put_field(out, limit, len, "")
+                      : put_number(out, limit, len, rec->phases[token->phase] / 1000);
+            break;
+        }
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+// ---------- BINARY FORMAT ----------
+
+static size_t put_varint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static size_t put_le(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out[i] = (uint8_t)(value >> (8 * i));
+    return bytes;
+}
+
+static bool get_le(const uint8_t **p, const uint8_t *end, int bytes, uint64_t *value)
+{
+    if (end - *p < bytes) return false;
+    *value = 0;
+    for (int i = 0; i < bytes; i++)
+        *value |= (uint64_t)(*p)[i] << (8 * i);
+    *p += bytes;
+    return true;
+}
+
+static size_t address_length(uint8_t family)
+{
+    return family == AF_INET ? 4 : family == AF_INET6 ? 16 : 0;
+}
+
+/**
+ * @brief   Encodes one record for the binary log.
+ *
+ * Layout, little-endian: u16 length of what follows, u64 time_us, u16
+ * status, u8 worker, u8 family, the 0, 4 or 16 address bytes, then varints
+ * of bytes_sent and of each phase in microseconds plus one (0 when not
+ * reached), then method and protocol with a u8 length and the URI with a
+ * u16 length.
+ *
+ * @return  Bytes written, or 0 if cap is below ACCESS_BINARY_RECORD_MAX.
+ */
+size_t access_log_encode(const AccessRecord *rec, uint8_t *out, size_t cap)
+{
+    if (cap < ACCESS_BINARY_RECORD_MAX) return 0;
+
+    size_t n = 2;
+    n += put_le(out + n, rec->time_us, 8);
+    n += put_le(out + n, rec->status, 2);
+    out[n++] = rec->worker;
+    out[n++] = rec->family;
+    memcpy(out + n, rec->addr, address_length(rec->family));
+    n += address_length(rec->family);
+
+    n += put_varint(out + n, rec->bytes_sent);
+    for (int i = 0; i < ACCESS_PHASES; i++)
+        n += put_varint(out + n, rec->phases[i] == ACCESS_UNSET ? 0 : rec->phases[i] / 1000 + 1);
+
+    size_t method_len   = strnlen(rec->method, sizeof(rec->method) - 1);
+    size_t protocol_len = strnlen(rec->protocol, sizeof(rec->protocol) - 1);
+    size_t uri_len      = rec->uri_len < ACCESS_URI_MAX ? rec->uri_len : ACCESS_URI_MAX;
+    out[n++]            = (uint8_t)method_len;
+    memcpy(out + n, rec->method, method_len);
+    n += method_len;
+    out[n++] = (uint8_t)protocol_len;
+    memcpy(out + n, rec->protocol, protocol_len);
+    n += protocol_len;
+    n += put_le(out + n, uri_len, 2);
+    memcpy(out + n, rec->uri, uri_len);
+    n += uri_len;
+
+    put_le(out, n - 2, 2);
+    return n;
+}
+
+/**
+ * @brief   Decodes one record written by access_log_encode().
+ *
+ * Phases come back in microsecond precision.
+ *
+ * @return  Bytes consumed, 0 if in holds only part of the record, or -1
+ *          if the record is malformed.
+ */
+ssize_t access_log_decode(const uint8_t *in, size_t len, AccessRecord *rec)
+{
+    if (len < 2) return 0;
+    size_t body = in[0] | (size_t)in[1] << 8;
+    if (len < 2 + body) return 0;
+
+    memset(rec, 0, sizeof(*rec));
+    const uint8_t *p   = in + 2;
+    const uint8_t *end = p + body;
+    uint64_t value;
+
+    if (!get_le(&p, end, 8, &rec->time_us) || !get_le(&p, end, 2, &value)) return -1;
+    rec->status = (uint16_t)value;
+    if (!get_le(&p, end, 1, &value)) return -1;
+    rec->worker = (uint8_t)value;
+    if (!get_le(&p, end, 1, &value)) return -1;
+    rec->family     = (uint8_t)value;
+    size_t addr_len = address_length(rec->family);
+    if ((size_t)(end - p) < addr_len) return -1;
+    memcpy(rec->addr, p, addr_len);
+    p += addr_len;
+
+    if (!get_varint(&p, end, &rec->bytes_sent)) return -1;
+    for (int i = 0; i < ACCESS_PHASES; i++)
+    {
+        if (!get_varint(&p, end, &value)) return -1;
+        rec->phases[i] = value == 0 ? ACCESS_UNSET : (value - 1) * 1000;
+    }
+
+    if (!get_le(&p, end, 1, &value) || value >= sizeof(rec->method) ||
+        (size_t)(end - p) < value)
+        return -1;
+    memcpy(rec->method, p, value);
+    p += value;
+    if (!get_le(&p, end, 1, &value) || value >= sizeof(rec->protocol) ||
+        (size_t)(end - p) < value)
+        return -1;
+    memcpy(rec->protocol, p, value);
+    p += value;
+    if (!get_le(&p, end, 2, &value) || value > ACCESS_URI_MAX || (size_t)(end - p) != value)
+        return -1;
+    memcpy(rec->uri, p, value);
+    rec->uri_len = (uint16_t)value;
+    return 2 + body;
+}
+
+// ---------- WRITER ----------
+
+static void write_out(void)
+{
+    size_t written = 0;
+    while (written < out_len)
+    {
+        ssize_t n = write(log_fd, out_buf + written, out_len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            LOG(LOG_ERROR, "Failed to write the access log: %s", strerror(errno));
+            break;
+        }
+        written += n;
+    }
+    out_len = 0;
+}
+
+/**
+ * @brief   Renders a batch of records into the output buffer.
+ */
+static void render_records(void *ctx, void *const *records, size_t count)
+{
+    (void)ctx;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t room = log_binary ? ACCESS_BINARY_RECORD_MAX : ACCESS_LINE_MAX;
+        if (ACCESS_BUFFER_SIZE - out_len < room) write_out();
+
+        const AccessRecord *rec = records[i];
+        out_len += log_binary
+                       ? access_log_encode(rec, (uint8_t *)out_buf + out_len, room)
+                       : access_log_render(&log_format, rec, out_buf + out_len, room);
+    }
+}
+
+/**
+ * @brief   Drains the rings until the log closes.
+ *
+ * Sleeps while every ring is empty: with nothing buffered until a record
+ * comes, otherwise at most until the buffer is due to be written.
+ */
+static void *writer_loop(void *arg)
+{
+    (void)arg;
+    uint64_t reported_dropped = 0;
+    uint64_t last_write       = monotonic_ns();
+    const uint64_t interval   = ACCESS_FLUSH_INTERVAL_MS * 1000000ull;
+
+    while (atomic_load_explicit(&running, memory_order_acquire))
+    {
+        size_t taken = thread_rings_drain(&rings, render_records, NULL);
+
+        uint64_t now = monotonic_ns();
+        if (out_len == 0 || now - last_write >= interval)
+        {
+            if (out_len > 0) write_out();
+            last_write = now;
+        }
+
+        uint64_t dropped = access_log_dropped();
+        if (dropped != reported_dropped)
+        {
+            LOG(LOG_WARN, "Dropped %lu access log records.",
+                (unsigned long)(dropped - reported_dropped));
+            reported_dropped = dropped;
+        }
+
+        if (taken > 0) continue;
+        int timeout_ms = -1; // nothing buffered: sleep until a record comes
+        if (out_len > 0) timeout_ms = (int)((interval - (now - last_write)) / 1000000) + 1;
+        thread_rings_wait(&rings, timeout_ms);
+    }
+
+    thread_rings_drain(&rings, render_records, NULL);
+    write_out();
+    return NULL;
+}
+
+/**
+ * @brief   Checks, or writes, the header of a binary log.
+ *
+ * A new file gets the header; an existing one must already be a binary
+ * log, or records would be appended to something else.
+ */
+static int binary_header(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -1;
+
+    uint8_t header[ACCESS_BINARY_HEADER_SIZE] = ACCESS_BINARY_MAGIC;
+    header[4]                                 = ACCESS_BINARY_VERSION;
+    if (st.st_size == 0)
+        return write(fd, header, sizeof(header)) == sizeof(header) ? OK : -1;
+
+    uint8_t found[ACCESS_BINARY_HEADER_SIZE];
+    if (pread(fd, found, sizeof(found), 0) != sizeof(found) ||
+        memcmp(found, header, sizeof(header)) != 0)
+    {
+        LOG(LOG_ERROR, "Existing file is not a version %d binary access log.",
+            ACCESS_BINARY_VERSION);
+        return -1;
+    }
+    return OK;
+}
+
+static void release_writer(void)
+{
+    if (log_fd >= 0) close(log_fd);
+    log_fd = -1;
+    free(out_buf);
+    out_buf = NULL;
+    access_log_format_free(&log_format);
+}
+
+/**
+ * @brief   Opens the log file and starts the writer thread.
+ *
+ * Does nothing when opts->path is not set. Records are appended, so an
+ * existing log is continued.
+ *
+ * @return  OK, or -1 if the format does not compile or the file cannot be opened.
+ */
+int access_log_open(const AccessLogOptions *opts)
+{
+    if (!opts->path || !opts->path[0] || atomic_load(&running)) return OK;
+    if (thread_rings_init(&rings) < 0)
+    {
+        LOG(LOG_ERROR, "Failed to set up the access log rings: %s", strerror(errno));
+        return -1;
+    }
+
+    if (access_log_format_compile(&log_format,
+                                  opts->format ? opts->format : DEFAULT_ACCESS_LOG_FORMAT) < 0)
+        return -1;
+
+    log_binary = opts->binary;
+    log_fd     = open(opts->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    out_buf    = malloc(ACCESS_BUFFER_SIZE);
+    out_len    = 0;
+    if (log_fd < 0 || !out_buf || (log_binary && binary_header(log_fd) < 0))
+    {
+        LOG(LOG_ERROR, "Failed to open access log %s: %s", opts->path, strerror(errno));
+        release_writer();
+        return -1;
+    }
+
+    atomic_store(&running, true);
+    if (pthread_create(&writer_thread, NULL, writer_loop, NULL) != 0)
+    {
+        LOG(LOG_ERROR, "Failed to start the access log writer.");
+        atomic_store(&running, false);
+        release_writer();
+        return -1;
+    }
+    access_log_on = true;
+    return OK;
+}
+
+/**
+ * @brief   Queues a record for the writer; never blocks.
+ *
+ * When the calling thread's ring is full the record is dropped and counted.
+ */
+void access_log_write(const AccessRecord *rec)
+{
+    if (!atomic_load_explicit(&running, memory_order_acquire)) return;
+    ThreadRing *ring = thread_ring_local(&rings, &local_ring);
+    if (!ring) return;
+    AccessRecord *slot = thread_ring_reserve(&rings, ring);
+    if (!slot) return;
+
+    // Only the URI bytes in use are copied
+    memcpy(slot, rec, offsetof(AccessRecord, uri) + rec->uri_len);
+    thread_ring_commit(&rings, ring);
+}
+
+/**
+ * @brief   Stops the writer after it has written out every queued record.
+ *
+ * Rings of threads still running stay theirs for the next open; those of
+ * exited threads are freed by the writer as it drains them.
+ */
+void access_log_close(void)
+{
+    access_log_on = false;
+    if (!atomic_exchange(&running, false)) return;
+    thread_rings_wake(&rings);
+    pthread_join(writer_thread, NULL);
+    release_writer();
+}
+
+/**
+ * @brief   Total records dropped because a ring was full.
+ */
+uint64_t access_log_dropped(void)
+{
+    return thread_rings_dropped(&rings);
+}
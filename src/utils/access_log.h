@@ -0,0 +1,132 @@
+/**
+ * @file    access_log.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Access log of timed requests, text or binary, written off the event loop.
+ *
+ * @details Each request carries monotonic timestamps of its phases, from the
+ *          accept of its connection to the last byte of its response. Once
+ *          the response is out, the event loop copies one fixed-size
+ *          AccessRecord into its thread's ring (thread_ring.h), as the
+ *          logger does with its lines. A background thread drains the
+ *          rings, renders the records into a large buffer and writes it out
+ *          when it fills or has waited ACCESS_FLUSH_INTERVAL_MS, so the loop
+ *          neither formats nor writes anything. The thread sleeps on an
+ *          eventfd while the rings are empty.
+ *
+ *          The text format is a template with $variables (see
+ *          access_log_format_compile()). The binary format is a file header
+ *          followed by length-prefixed little-endian records with varint
+ *          times, a fraction of the text's size; cserve_logdecode renders
+ *          it with any template afterwards.
+ */
+
+#ifndef UTILS_ACCESS_LOG_H
+#define UTILS_ACCESS_LOG_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define ACCESS_RING_CAPACITY 4096 // records per thread, must be a power of two
+#define ACCESS_BUFFER_SIZE (256 * 1024)
+#define ACCESS_FLUSH_INTERVAL_MS 1000
+#define ACCESS_URI_MAX 400 // longer URIs are truncated
+#define ACCESS_FORMAT_MAX_TOKENS 64
+#define ACCESS_BINARY_MAGIC "CSAL"
+#define ACCESS_BINARY_VERSION 1
+#define ACCESS_BINARY_HEADER_SIZE 8
+#define ACCESS_BINARY_RECORD_MAX (sizeof(AccessRecord) + 64) // encoded size bound
+#define ACCESS_LINE_MAX 4096 // rendered text lines are cut here
+#define ACCESS_UNSET UINT64_MAX // a phase the request never reached
+
+#define DEFAULT_ACCESS_LOG_FORMAT                                                                  \
+    "$remote_addr [$time_local] \"$request\" $status $bytes_sent $request_time_us "                \
+    "$first_byte_us $parsed_us $handler_us $upstream_connect_us $upstream_first_byte_us "          \
+    "$last_byte_us"
+
+/* Phases timed for every request, as nanoseconds since its connection was accepted */
+typedef enum
+{
+    ACCESS_FIRST_BYTE,          // first byte of the request read, or reached in the buffer
+    ACCESS_PARSED,              // request line and headers parsed
+    ACCESS_HANDLER,             // handler started
+    ACCESS_UPSTREAM_CONNECT,    // backend connection established, or taken from the pool
+    ACCESS_UPSTREAM_FIRST_BYTE, // first byte of the backend response
+    ACCESS_LAST_BYTE,           // last byte of the response handed to the socket
+    ACCESS_PHASES
+} AccessPhase;
+
+typedef struct AccessRecord
+{
+    uint64_t time_us;               // wall clock when the response was done, microseconds
+    uint64_t phases[ACCESS_PHASES]; // ns since accept, ACCESS_UNSET if not reached
+    uint64_t bytes_sent;            // response bytes that reached the socket
+    uint16_t status;                // 0 if no response was sent
+    uint8_t worker;                 // event loop that served the request
+    uint8_t family;                 // AF_INET, AF_INET6, or 0 if unknown
+    uint8_t addr[16];               // client address: 4 or 16 bytes by family
+    char method[16];                // NUL-terminated; empty for unparsed requests
+    char protocol[12];              // NUL-terminated
+    uint16_t uri_len;
+    char uri[ACCESS_URI_MAX];
+} AccessRecord;
+
+typedef enum
+{
+    ACCESS_VAR_LITERAL,
+    ACCESS_VAR_REMOTE_ADDR,
+    ACCESS_VAR_TIME_LOCAL,
+    ACCESS_VAR_TIME_ISO8601,
+    ACCESS_VAR_MSEC,
+    ACCESS_VAR_REQUEST,
+    ACCESS_VAR_METHOD,
+    ACCESS_VAR_URI,
+    ACCESS_VAR_PROTOCOL,
+    ACCESS_VAR_STATUS,
+    ACCESS_VAR_BYTES_SENT,
+    ACCESS_VAR_WORKER,
+    ACCESS_VAR_REQUEST_TIME_US,
+    ACCESS_VAR_PHASE, // one of AccessPhase, in microseconds
+} AccessVar;
+
+typedef struct AccessToken
+{
+    AccessVar var;
+    AccessPhase phase; // ACCESS_VAR_PHASE
+    const char *text;  // ACCESS_VAR_LITERAL: into the compiled format's spec
+    size_t len;
+} AccessToken;
+
+typedef struct AccessLogFormat
+{
+    char *spec; // owned copy of the template the tokens point into
+    AccessToken tokens[ACCESS_FORMAT_MAX_TOKENS];
+    int token_count;
+} AccessLogFormat;
+
+typedef struct AccessLogOptions
+{
+    char *path;   // log file; NULL disables the access log
+    char *format; // text template; NULL is DEFAULT_ACCESS_LOG_FORMAT
+    bool binary;  // write binary records instead of text
+} AccessLogOptions;
+
+extern bool access_log_on;
+
+void access_log_options_defaults(AccessLogOptions *opts);
+void access_log_options_free(AccessLogOptions *opts);
+
+int access_log_format_compile(AccessLogFormat *fmt, const char *spec);
+void access_log_format_free(AccessLogFormat *fmt);
+size_t access_log_render(const AccessLogFormat *fmt, const AccessRecord *rec, char *out,
+                         size_t cap);
+
+size_t access_log_encode(const AccessRecord *rec, uint8_t *out, size_t cap);
+ssize_t access_log_decode(const uint8_t *in, size_t len, AccessRecord *rec);
+
+int access_log_open(const AccessLogOptions *opts);
+void access_log_write(const AccessRecord *rec);
+void access_log_close(void);
+uint64_t access_log_dropped(void);
+
+#endif /* UTILS_ACCESS_LOG_H */
@@ -0,0 +1,227 @@
+/**
+ * @file    affinity.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Worker count, CPU pinning and NUMA placement of event loops.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#ifdef CSERVE_HAVE_NUMA
+#include <numa.h>
+#endif
+
+#include "affinity.h"
+
+// ---------- OPTIONS ----------
+
+void worker_options_defaults(WorkerOptions *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->count    = 1;
+    opts->affinity = AFFINITY_OFF;
+}
+
+/**
+ * @brief   Parses the worker count: a number, or "auto" for one per CPU.
+ *
+ * @return  OK, or -1 if the value is neither.
+ */
+int worker_options_set_count(WorkerOptions *opts, const char *value)
+{
+    if (strcmp(value, "auto") == 0)
+    {
+        opts->count = WORKERS_AUTO;
+        return OK;
+    }
+
+    char *end;
+    long count = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || count < 1) return -1;
+    opts->count = count < MAX_WORKERS ? (int)count : MAX_WORKERS;
+    return OK;
+}
+
+/**
+ * @brief   Parses the CPU affinity: "off", "auto", or a list of CPUs such
+ *          as "0 2 4-7" or "0,2,4-7", one per worker in order.
+ *
+ * @return  OK, or -1 if the list is malformed; opts is left unchanged then.
+ */
+int worker_options_set_affinity(WorkerOptions *opts, const char *value)
+{
+    if (strcmp(value, "off") == 0 || strcmp(value, "auto") == 0)
+    {
+        opts->affinity = strcmp(value, "auto") == 0 ? AFFINITY_AUTO : AFFINITY_OFF;
+        return OK;
+    }
+
+    int cpus[MAX_WORKERS];
+    int count     = 0;
+    const char *p = value;
+    while (*p)
+    {
+        if (*p == ' ' || *p == ',' || *p == '\t')
+        {
+            p++;
+            continue;
+        }
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last  = first;
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return -1;
+        if (*end == '-')
+        {
+            p    = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) return -1;
+        }
+        for (long cpu = first; cpu <= last && count < MAX_WORKERS; cpu++)
+            cpus[count++] = (int)cpu;
+        p = end;
+    }
+    if (count == 0) return -1;
+
+    memcpy(opts->cpus, cpus, count * sizeof(int));
+    opts->cpu_count = count;
+    opts->affinity  = AFFINITY_LIST;
+    return OK;
+}
+
+/**
+ * @brief   Number of event loops to run, resolving "auto" against the CPUs
+ *          the process is allowed on.
+ */
+int worker_count(const WorkerOptions *opts)
+{
+    if (opts->count != WORKERS_AUTO) return opts->count > 1 ? opts->count : 1;
+
+    cpu_set_t set;
+    int cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+    if (cpus < 1) cpus = 1;
+    return cpus < MAX_WORKERS ? cpus : MAX_WORKERS;
+}
+
+/**
+ * @brief   CPU a worker is pinned to, or -1 with affinity off.
+ *
+ * Automatic placement walks the CPUs the process is allowed on, so a
+ * taskset or cgroup restriction is respected.
+ */
+int worker_cpu(const WorkerOptions *opts, int worker)
+{
+    if (opts->affinity == AFFINITY_LIST) return opts->cpus[worker % opts->cpu_count];
+    if (opts->affinity == AFFINITY_OFF) return -1;
+
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0 || CPU_COUNT(&set) == 0) return -1;
+    int nth = worker % CPU_COUNT(&set);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set) && nth-- == 0) return cpu;
+    }
+    return -1;
+}
+
+// ---------- PLACEMENT ----------
+
+/**
+ * @brief   Binds the calling thread to one CPU.
+ *
+ * @return  OK, or -1 if the CPU does not exist or is outside the process's set.
+ */
+int pin_thread_to_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+    {
+        LOG(LOG_WARN, "Failed to pin worker to CPU %d: %s", cpu, strerror(err));
+        return -1;
+    }
+    return OK;
+}
+
+/**
+ * @brief   Allocates zeroed memory on the NUMA node of cpu.
+ *
+ * The pages are bound to the node with libnuma when it is available and
+ * cpu is known. Otherwise they are only reserved here, and the default
+ * first-touch policy places them on the node of the thread that first
+ * writes them, which is the pinned worker itself.
+ *
+ * @return  The memory, to be released with node_free(), or NULL.
+ */
+void *node_alloc(size_t size, int cpu)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) return NULL;
+
+#ifdef CSERVE_HAVE_NUMA
+    if (cpu >= 0 && numa_available() >= 0)
+    {
+        int node = numa_node_of_cpu(cpu);
+        if (node >= 0) numa_tonode_memory(ptr, size, node);
+    }
+#else
+    (void)cpu;
+#endif
+    return ptr;
+}
+
+void node_free(void *ptr, size_t size)
+{
+    if (ptr) munmap(ptr, size);
+}
+
+// ---------- STEERING ----------
+
+/**
+ * @brief   Marks a listener as the one for connections arriving on cpu.
+ *
+ * The kernel scores a listener whose incoming CPU matches the CPU handling
+ * the SYN above others; a hint only, so failures are ignored.
+ */
+void prefer_incoming_cpu(int socket, int cpu)
+{
+    setsockopt(socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+}
+
+/**
+ * @brief   Makes a SO_REUSEPORT group pick its listener by receiving CPU.
+ *
+ * socket is any member of the group, whose listeners were opened in worker
+ * order. The classic BPF program maps the CPU a connection arrived on to
+ * the index of the worker pinned there, and spreads CPUs without a worker
+ * over the group by CPU number.
+ *
+ * @return  OK, or -1 if the kernel refused the program; the group then
+ *          keeps balancing by hash.
+ */
+int steer_reuseport_group(int socket, const int *cpus, int count)
+{
+    struct sock_filter code[2 * MAX_WORKERS + 3];
+    int n     = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (int i = 0; i < count && i < MAX_WORKERS; i++)
+    {
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+    struct sock_fprog prog = {.len = n, .filter = code};
+    if (setsockopt(socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+    {
+        LOG(LOG_WARN, "Failed to attach the reuseport CPU selector: %s", strerror(errno));
+        return -1;
+    }
+    return OK;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file    affinity.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Worker count, CPU pinning and NUMA placement of event loops.
+ *
+ * @details Each worker runs its own event loop on its own SO_REUSEPORT
+ *          listener. With affinity on, worker i is pinned to one CPU and
+ *          the kernel is asked to hand it the connections whose packets
+ *          arrive on that CPU, so a connection is received, accepted and
+ *          served without leaving the core (or the socket) that took its
+ *          interrupt.
+ *
+ *          Per-loop memory is allocated by the pinned worker thread: on the
+ *          worker's NUMA node through libnuma when it is available, and by
+ *          first touch otherwise.
+ */
+
+#ifndef UTILS_AFFINITY_H
+#define UTILS_AFFINITY_H
+
+#include "common.h"
+#include "utils/metrics.h"
+
+#define WORKERS_AUTO -1 // WorkerOptions.count: one worker per CPU
+
+typedef enum
+{
+    AFFINITY_OFF,  // workers float over every CPU
+    AFFINITY_AUTO, // worker i on the i-th CPU the process may use
+    AFFINITY_LIST, // worker i on cpus[i % cpu_count]
+} AffinityMode;
+
+typedef struct WorkerOptions
+{
+    int count; // event loops, or WORKERS_AUTO; 0 is one
+    AffinityMode affinity;
+    int cpus[MAX_WORKERS]; // AFFINITY_LIST only
+    int cpu_count;
+} WorkerOptions;
+
+void worker_options_defaults(WorkerOptions *opts);
+int worker_options_set_count(WorkerOptions *opts, const char *value);
+int worker_options_set_affinity(WorkerOptions *opts, const char *value);
+int worker_count(const WorkerOptions *opts);
+int worker_cpu(const WorkerOptions *opts, int worker);
+
+int pin_thread_to_cpu(int cpu);
+void *node_alloc(size_t size, int cpu);
+void node_free(void *ptr, size_t size);
+
+void prefer_incoming_cpu(int socket, int cpu);
+int steer_reuseport_group(int socket, const int *cpus, int count);
+
+#endif /* UTILS_AFFINITY_H */
@@ -8,6 +8,100 @@
 
 #include "config.h"
 
+static int add_backend(Config *cfg, const char *value)
+{
+    if (cfg->backend_count == MAX_BACKENDS) return -1;
+    cfg->backends[cfg->backend_count++] = strdup(value);
+    return OK;
+}
+
+/**
+ * @brief   Starts the "[location ...]" or "[upstream name]" section of a header line.
+ *
+ * @return  OK, or -1 if the header is malformed, repeats an upstream name or
+ *          exceeds MAX_LOCATIONS/MAX_UPSTREAM_GROUPS.
+ */
+static int open_section(Config *cfg, char *header, Location **location, UpstreamGroup **group)
+{
+    size_t len = strlen(header);
+    *location  = NULL;
+    *group     = NULL;
+    if (len < 2 || header[len - 1] != ']')
+    {
+        fprintf(stderr, "Malformed section header '%s'.\n", header);
+        return -1;
+    }
+    header[len - 1] = '\0';
+    char *name      = strip_whitespace(header + 1);
+
+    if (strncmp(name, "location", 8) == 0 && isspace((unsigned char)name[8]))
+    {
+        if (cfg->location_count == MAX_LOCATIONS ||
+            location_init(&cfg->locations[cfg->location_count], name + 8) < 0)
+        {
+            fprintf(stderr, "Invalid section [%s].\n", name);
+            return -1;
+        }
+        *location = &cfg->locations[cfg->location_count++];
+        return OK;
+    }
+
+    if (strncmp(name, "upstream", 8) == 0 && isspace((unsigned char)name[8]))
+    {
+        char *group_name = strip_whitespace(name + 8);
+        for (size_t i = 0; i < cfg->upstream_count; i++)
+        {
+            if (strcmp(cfg->upstreams[i].name, group_name) == 0) group_name = NULL;
+        }
+        if (!group_name || cfg->upstream_count == MAX_UPSTREAM_GROUPS)
+        {
+            fprintf(stderr, "Invalid section [%s].\n", name);
+            return -1;
+        }
+        *group          = &cfg->upstreams[cfg->upstream_count++];
+        (*group)->name  = strdup(group_name);
+        (*group)->first = (int)cfg->backend_count;
+        (*group)->count = 0;
+        return OK;
+    }
+
+    fprintf(stderr, "Unknown section [%s].\n", name);
+    return -1;
+}
+
+/**
+ * @brief   Checks every location has a handler and points proxy locations
+ *          at their upstream group.
+ *
+ * @return  OK, or -1 (reported on stderr) if a location cannot be served.
+ */
+static int resolve_locations(Config *cfg)
+{
+    for (size_t i = 0; i < cfg->location_count; i++)
+    {
+        Location *loc = &cfg->locations[i];
+        if (loc->handler == ROUTE_NONE)
+        {
+            fprintf(stderr, "Location %s has no static, proxy, return or content key.\n",
+                    loc->path);
+            return -1;
+        }
+        if (loc->handler != ROUTE_PROXY || !loc->upstream) continue;
+
+        for (size_t g = 0; g < cfg->upstream_count && loc->group < 0; g++)
+        {
+            if (strcmp(cfg->upstreams[g].name, loc->upstream) == 0) loc->group = (int)g;
+        }
+        if (loc->group < 0 || cfg->upstreams[loc->group].count == 0)
+        {
+            fprintf(stderr, "Location %s proxies to unknown or empty upstream '%s'.\n",
+                    loc->path, loc->upstream);
+            return -1;
+        }
+    }
+    return OK;
+}
+
 /**
  * @brief   Parses a config file and initializes a Config struct.
  *
@@ -21,16 +115,125 @@
  * - port
  * - root
  * - static_dir
- * - backend
+ * - backend           (host[:port], or unix:/path/to.sock for a unix domain socket)
+ * - backlog           (listen queue length, default SOMAXCONN)
+ * - accept_batch      (max accepts per listen-socket event, default 64)
+ * - tcp_defer_accept  (seconds, 0 disables)
+ * - tcp_fastopen      (TFO queue length, 0 disables)
+ * - tcp_nodelay       (on/off)
+ * - so_rcvbuf         (bytes, 0 keeps the kernel default)
+ * - so_sndbuf         (bytes, 0 keeps the kernel default)
+ * - log_level         (DEBUG, INFO, WARN, ERROR or OFF, default DEBUG)
+ * - stats_uri         (path serving internal metrics, e.g. /_stats; unset disables)
+ * - compression             (on/off, compress text assets on the fly, default on)
+ * - compression_cache_size  (bytes of compressed variants kept, default 16 MiB)
+ * - compression_min_length  (smaller files are not compressed, default 256)
+ * - compression_max_length  (nor larger ones, which are read whole to compress; default 4 MiB)
+ * - gzip_level              (1-9, default 6)
+ * - brotli_quality          (0-11, default 6)
+ * - cache_max_age           ("<prefix> <seconds>", Cache-Control for static paths
+ *                           under prefix; repeatable, the longest prefix wins)
+ * - proxy_cache             (on/off, cache cacheable /api responses, default off)
+ * - proxy_cache_size        (bytes of responses kept in memory, default 32 MiB)
+ * - proxy_cache_key_headers (comma-separated request headers added to the key)
+ * - proxy_cache_path        (file for the mmap disk tier; unset keeps memory only)
+ * - proxy_cache_disk_size   (bytes of the disk tier, default 256 MiB)
+ * - proxy_cache_disk_slots  (disk index entries, default 16384)
+ * - proxy_coalesce          (on/off, concurrent identical /api misses share one
+ *                           upstream request, default off)
+ * - workers                 (event loops, each on its own SO_REUSEPORT listener,
+ *                           "auto" for one per CPU, default 1)
+ * - worker_cpu_affinity     (off, auto, or CPUs such as "0 2 4-7" for worker
+ *                           0, 1, ... in turn; pinned workers get connections
+ *                           arriving on their CPU, default off)
+ * - keepalive_requests      (requests served on one client connection before it
+ *                           is closed, 1 disables keep-alive, 0 is unlimited,
+ *                           default 1000)
+ * - keepalive_timeout       (seconds a client connection may sit idle between
+ *                           requests, 0 never times out, default 75)
+ * - max_connections         (client connections each worker can hold, tunnels
+ *                           included, default 1000)
+ * - tunnel_timeout          (seconds a WebSocket or CONNECT tunnel may pass no
+ *                           bytes either way, 0 never times out, default 600)
+ * - proxy_connect           (on/off, let CONNECT requests open tunnels to the
+ *                           configured backends, named as in their backend
+ *                           entries, default off)
+ * - overload_connections    (open connections per worker at which it stops
+ *                           accepting and closes idle keep-alive connections,
+ *                           0 disables, default 9/10 of max_connections)
+ * - overload_latency_ms     (event loop lag at which a worker also answers new
+ *                           requests with 503, 0 disables, default 200)
+ * - overload_memory         (resident bytes at which workers do the same,
+ *                           0 disables, default 0)
+ * - overload_retry_after    (Retry-After seconds of those 503s, default 1)
+ * - upstream_keepalive      (idle backend connections kept per backend and
+ *                           event loop for reuse, 0 disables, default 16)
+ * - upstream_keepalive_timeout (seconds an idle backend connection is kept,
+ *                           default 60)
+ * - upstream_splice_min     (Content-Length from which a proxied body goes
+ *                           from backend to client with splice(), never
+ *                           entering userspace; bodies that are cached,
+ *                           coalesced, chunked or sent over TLS or HTTP/2
+ *                           are always buffered, 0 disables, default 65536)
+ * - static_io_threads       (threads shared by all workers that open, stat
+ *                           and read static files, so a slow disk does not
+ *                           stall the event loops, 0 does it on the loops,
+ *                           default 4)
+ * - http2                   (on/off, accept HTTP/2 over cleartext via prior
+ *                           knowledge or Upgrade: h2c, default on)
+ * - tls_port                (port of an additional TLS listener, 0 disables)
+ * - tls_certificate         (PEM certificate chain for the TLS listener)
+ * - tls_certificate_key     (PEM private key for the TLS listener)
+ * - tls_session_cache       (sessions kept for resumption by ID, 0 disables,
+ *                           default 20480)
+ * - tls_session_timeout     (seconds a TLS session can be resumed, default 300)
+ * - tls_session_tickets     (on/off, resume from client-held tickets, default on)
+ * - ktls                    (on/off, let the kernel encrypt records so files are
+ *                           still sent with sendfile(), default on)
+ * - limit_req               (requests per client address, "10r/s" or "600r/m";
+ *                           excess requests get 429, 0 disables, default 0)
+ * - limit_req_burst         (requests a client may send ahead of limit_req, default 0)
+ * - limit_conn              (open connections per client address; excess ones
+ *                           get 429 at accept, 0 disables, default 0)
+ * - limit_zone_slots        (client addresses tracked at once, IPv6 ones per /64;
+ *                           clients beyond share one entry, default 65536)
+ * - access_log              (file each request is logged to once its response
+ *                           is sent, unset disables)
+ * - access_log_format       (template of a text log line; $remote_addr,
+ *                           $time_local, $time_iso8601, $msec, $request,
+ *                           $method, $uri, $protocol, $status, $bytes_sent,
+ *                           $worker, $request_time_us
+ *                           and the phase times $first_byte_us, $parsed_us,
+ *                           $handler_us, $upstream_connect_us,
+ *                           $upstream_first_byte_us and $last_byte_us, in
+ *                           microseconds since accept, "-" if never reached)
+ * - access_log_binary       (on/off, write compact binary records for
+ *                           cserve_logdecode instead of text, default off)
  *
- * If a key is not recognized, it will be ignored.
+ * Keys the core does not know are offered to the modules (see module.h),
+ * e.g. rewrite, allow and deny. If no module knows a key either, it will
+ * be ignored.
  *
  * If a key is repeated, the last value will be used.
  *
- * The backend key can be repeated multiple times to specify multiple backends.
+ * The backend and cache_max_age keys can be repeated.
+ *
+ * The keys above come first. Sections follow them, each running until the
+ * next section header:
+ * - [upstream <name>]   (a backend group; its repeated backend keys are
+ *                       balanced round-robin)
+ * - [location /prefix]  (requests under /prefix; the longest prefix wins)
+ * - [location = /path]  (requests for exactly /path, ahead of any prefix)
+ *
+ * A location takes one handler key (static, proxy, return or content) and
+ * its settings; see location_set(). "proxy =" with no group name uses the
+ * top-level backends. Without any location, /static serves files and /api
+ * is proxied to the top-level backends with the prefix stripped.
  *
  * The function returns a pointer to a Config struct if the config file is
- * parsed successfully, otherwise it returns NULL.
+ * parsed successfully, otherwise it returns NULL. Malformed section headers,
+ * locations without a handler and proxy locations naming an unknown or
+ * empty upstream make parsing fail.
  */
 Config *parse_config(const char *filename)
 {
@@ -44,19 +247,64 @@ Config *parse_config(const char *filename)
     Config *cfg        = calloc(1, sizeof(Config));
     cfg->backends      = calloc(MAX_BACKENDS, sizeof(char *));
     cfg->backend_count = 0;
+    cfg->locations     = calloc(MAX_LOCATIONS, sizeof(Location));
+    socket_options_defaults(&cfg->socket_options);
+    static_options_defaults(&cfg->static_options);
+    proxy_cache_options_defaults(&cfg->proxy_cache);
+    tls_options_defaults(&cfg->tls);
+    rate_limit_options_defaults(&cfg->limits);
+    worker_options_defaults(&cfg->workers);
+    access_log_options_defaults(&cfg->access_log);
+    cfg->log_level                  = LOG_DEBUG;
+    cfg->http2                      = true;
+    cfg->upstream_keepalive         = DEFAULT_UPSTREAM_KEEPALIVE;
+    cfg->upstream_keepalive_timeout = DEFAULT_UPSTREAM_KEEPALIVE_TIMEOUT;
+    cfg->upstream_splice_min        = DEFAULT_UPSTREAM_SPLICE_MIN;
+    cfg->keepalive_requests         = DEFAULT_KEEPALIVE_REQUESTS;
+    cfg->keepalive_timeout          = DEFAULT_KEEPALIVE_TIMEOUT;
+    cfg->max_connections            = DEFAULT_MAX_CONNECTIONS;
+    cfg->tunnel_timeout             = DEFAULT_TUNNEL_TIMEOUT;
+    cfg->overload_connections       = -1; // follows max_connections unless set
+    cfg->overload_latency_ms        = DEFAULT_OVERLOAD_LATENCY_MS;
+    cfg->overload_retry_after       = DEFAULT_OVERLOAD_RETRY_AFTER;
+    cfg->static_io_threads          = DEFAULT_IO_THREADS;
+
+    Location *location  = NULL;
+    UpstreamGroup *group = NULL;
+    bool failed          = false;
 
     char line[512];
-    while (fgets(line, sizeof(line), f))
+    while (!failed && fgets(line, sizeof(line), f))
     {
         if (line[0] == '#' || line[0] == '\n') continue;
-        char *eq = strchr(line, '=');
+        char *text = strip_whitespace(line);
+        if (text[0] == '[')
+        {
+            failed = open_section(cfg, text, &location, &group) < 0;
+            continue;
+        }
+
+        char *eq = strchr(text, '=');
         if (!eq) continue;
         *eq = 0;
 
-        char *key   = strip_whitespace(line);
+        char *key   = strip_whitespace(text);
         char *value = strip_whitespace(eq + 1);
 
-        if (strcmp(key, "port") == 0)
+        if (location)
+        {
+            if (location_set(location, key, value) < 0)
+                fprintf(stderr, "Ignoring '%s = %s' in location %s.\n", key, value,
+                        location->path);
+        }
+        else if (group)
+        {
+            if (strcmp(key, "backend") == 0 && add_backend(cfg, value) == OK)
+                group->count++;
+            else
+                fprintf(stderr, "Ignoring '%s = %s' in upstream %s.\n", key, value, group->name);
+        }
+        else if (strcmp(key, "port") == 0)
         {
             cfg->port = atoi(value);
         }
@@ -70,14 +318,256 @@ Config *parse_config(const char *filename)
         }
         else if (strcmp(key, "backend") == 0)
         {
-            if (cfg->backend_count < MAX_BACKENDS)
-            {
-                cfg->backends[cfg->backend_count++] = strdup(value);
-            }
+            add_backend(cfg, value);
+        }
+        else if (strcmp(key, "backlog") == 0)
+        {
+            cfg->socket_options.backlog = atoi(value);
+        }
+        else if (strcmp(key, "accept_batch") == 0)
+        {
+            cfg->socket_options.accept_batch = atoi(value);
+        }
+        else if (strcmp(key, "tcp_defer_accept") == 0)
+        {
+            cfg->socket_options.defer_accept = atoi(value);
+        }
+        else if (strcmp(key, "tcp_fastopen") == 0)
+        {
+            cfg->socket_options.fastopen = atoi(value);
+        }
+        else if (strcmp(key, "tcp_nodelay") == 0)
+        {
+            cfg->socket_options.nodelay = parse_bool(value);
+        }
+        else if (strcmp(key, "so_rcvbuf") == 0)
+        {
+            cfg->socket_options.rcvbuf = atoi(value);
+        }
+        else if (strcmp(key, "so_sndbuf") == 0)
+        {
+            cfg->socket_options.sndbuf = atoi(value);
+        }
+        else if (strcmp(key, "stats_uri") == 0)
+        {
+            free(cfg->stats_uri);
+            cfg->stats_uri = strdup(value);
+        }
+        else if (strcmp(key, "compression") == 0)
+        {
+            cfg->static_options.compression = parse_bool(value);
+        }
+        else if (strcmp(key, "compression_cache_size") == 0)
+        {
+            cfg->static_options.compression_cache_size = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "compression_min_length") == 0)
+        {
+            cfg->static_options.compression_min_length = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "compression_max_length") == 0)
+        {
+            cfg->static_options.compression_max_length = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "gzip_level") == 0)
+        {
+            cfg->static_options.gzip_level = atoi(value);
+        }
+        else if (strcmp(key, "brotli_quality") == 0)
+        {
+            cfg->static_options.brotli_quality = atoi(value);
+        }
+        else if (strcmp(key, "cache_max_age") == 0)
+        {
+            if (static_options_add_cache_rule(&cfg->static_options, value) < 0)
+                fprintf(stderr, "Ignoring cache_max_age '%s'.\n", value);
+        }
+        else if (strcmp(key, "proxy_cache") == 0)
+        {
+            cfg->proxy_cache.enabled = parse_bool(value);
+        }
+        else if (strcmp(key, "proxy_cache_size") == 0)
+        {
+            cfg->proxy_cache.memory_size = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "proxy_cache_key_headers") == 0)
+        {
+            if (proxy_cache_options_set_key_headers(&cfg->proxy_cache, value) < 0)
+                fprintf(stderr,
+                        "proxy_cache_key_headers: keeping at most %d headers that are "
+                        "forwarded upstream.\n",
+                        MAX_CACHE_KEY_HEADERS);
+        }
+        else if (strcmp(key, "proxy_cache_path") == 0)
+        {
+            free(cfg->proxy_cache.disk_path);
+            cfg->proxy_cache.disk_path = strdup(value);
+        }
+        else if (strcmp(key, "proxy_cache_disk_size") == 0)
+        {
+            cfg->proxy_cache.disk_size = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "proxy_cache_disk_slots") == 0)
+        {
+            cfg->proxy_cache.disk_slots = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "proxy_coalesce") == 0)
+        {
+            cfg->proxy_cache.coalesce = parse_bool(value);
+        }
+        else if (strcmp(key, "workers") == 0)
+        {
+            if (worker_options_set_count(&cfg->workers, value) < 0)
+                fprintf(stderr, "Ignoring workers '%s'.\n", value);
+        }
+        else if (strcmp(key, "worker_cpu_affinity") == 0)
+        {
+            if (worker_options_set_affinity(&cfg->workers, value) < 0)
+                fprintf(stderr, "Ignoring worker_cpu_affinity '%s'.\n", value);
+        }
+        else if (strcmp(key, "keepalive_requests") == 0)
+        {
+            cfg->keepalive_requests = atoi(value);
+        }
+        else if (strcmp(key, "keepalive_timeout") == 0)
+        {
+            cfg->keepalive_timeout = atoi(value);
+        }
+        else if (strcmp(key, "max_connections") == 0)
+        {
+            int max = atoi(value);
+            if (max > 0)
+                cfg->max_connections = max;
+            else
+                fprintf(stderr, "Ignoring max_connections '%s'.\n", value);
+        }
+        else if (strcmp(key, "tunnel_timeout") == 0)
+        {
+            cfg->tunnel_timeout = atoi(value);
+        }
+        else if (strcmp(key, "proxy_connect") == 0)
+        {
+            cfg->proxy_connect = parse_bool(value);
+        }
+        else if (strcmp(key, "overload_connections") == 0)
+        {
+            cfg->overload_connections = atoi(value);
+        }
+        else if (strcmp(key, "overload_latency_ms") == 0)
+        {
+            cfg->overload_latency_ms = atoi(value);
+        }
+        else if (strcmp(key, "overload_memory") == 0)
+        {
+            cfg->overload_memory = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "overload_retry_after") == 0)
+        {
+            cfg->overload_retry_after = atoi(value);
+        }
+        else if (strcmp(key, "upstream_keepalive") == 0)
+        {
+            cfg->upstream_keepalive = atoi(value);
+        }
+        else if (strcmp(key, "upstream_keepalive_timeout") == 0)
+        {
+            cfg->upstream_keepalive_timeout = atoi(value);
+        }
+        else if (strcmp(key, "upstream_splice_min") == 0)
+        {
+            cfg->upstream_splice_min = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "static_io_threads") == 0)
+        {
+            cfg->static_io_threads = atoi(value);
+        }
+        else if (strcmp(key, "http2") == 0)
+        {
+            cfg->http2 = parse_bool(value);
+        }
+        else if (strcmp(key, "tls_port") == 0)
+        {
+            cfg->tls.port = atoi(value);
+        }
+        else if (strcmp(key, "tls_certificate") == 0)
+        {
+            free(cfg->tls.certificate);
+            cfg->tls.certificate = strdup(value);
+        }
+        else if (strcmp(key, "tls_certificate_key") == 0)
+        {
+            free(cfg->tls.certificate_key);
+            cfg->tls.certificate_key = strdup(value);
+        }
+        else if (strcmp(key, "tls_session_cache") == 0)
+        {
+            cfg->tls.session_cache_size = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "tls_session_timeout") == 0)
+        {
+            cfg->tls.session_timeout = atol(value);
+        }
+        else if (strcmp(key, "tls_session_tickets") == 0)
+        {
+            cfg->tls.session_tickets = parse_bool(value);
+        }
+        else if (strcmp(key, "ktls") == 0)
+        {
+            cfg->tls.ktls = parse_bool(value);
+        }
+        else if (strcmp(key, "limit_req") == 0)
+        {
+            if (rate_limit_options_set_rate(&cfg->limits, value) < 0)
+                fprintf(stderr, "Ignoring limit_req '%s'.\n", value);
+        }
+        else if (strcmp(key, "limit_req_burst") == 0)
+        {
+            cfg->limits.burst = atoi(value);
+        }
+        else if (strcmp(key, "limit_conn") == 0)
+        {
+            cfg->limits.conn = atoi(value);
+        }
+        else if (strcmp(key, "limit_zone_slots") == 0)
+        {
+            cfg->limits.slots = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(key, "access_log") == 0)
+        {
+            free(cfg->access_log.path);
+            cfg->access_log.path = strdup(value);
+        }
+        else if (strcmp(key, "access_log_format") == 0)
+        {
+            free(cfg->access_log.format);
+            cfg->access_log.format = strdup(value);
+        }
+        else if (strcmp(key, "access_log_binary") == 0)
+        {
+            cfg->access_log.binary = parse_bool(value);
+        }
+        else if (strcmp(key, "log_level") == 0)
+        {
+            int level = log_level_from_string(value);
+            if (level < 0)
+                fprintf(stderr, "Unknown log_level '%s', keeping the default.\n", value);
+            else
+                cfg->log_level = level;
+        }
+        else if (modules_directive(cfg->modules, key, value) < 0)
+        {
+            fprintf(stderr, "Ignoring '%s = %s'.\n", key, value);
         }
     }
 
     fclose(f);
+    if (cfg->overload_connections < 0)
+        cfg->overload_connections = DEFAULT_OVERLOAD_CONNECTIONS(cfg->max_connections);
+    if (failed || resolve_locations(cfg) < 0)
+    {
+        free_config(cfg);
+        return NULL;
+    }
     return cfg;
 }
 
@@ -109,6 +599,17 @@ char *strip_whitespace(char *str)
     return str;
 }
 
+/**
+ * @brief   Interprets a config flag value.
+ *
+ * @returns true for "on", "yes", "true" or "1" (case-insensitive), false otherwise.
+ */
+bool parse_bool(const char *value)
+{
+    return strcasecmp(value, "on") == 0 || strcasecmp(value, "yes") == 0 ||
+           strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0;
+}
+
 void free_config(Config *cfg)
 {
     for (size_t i = 0; i < cfg->backend_count; ++i)
@@ -116,7 +617,22 @@ void free_config(Config *cfg)
         free(cfg->backends[i]);
     }
     free(cfg->backends);
+    for (size_t i = 0; i < cfg->upstream_count; ++i)
+    {
+        free(cfg->upstreams[i].name);
+    }
+    for (size_t i = 0; i < cfg->location_count; ++i)
+    {
+        location_free(&cfg->locations[i]);
+    }
+    free(cfg->locations);
     free(cfg->root);
     free(cfg->static_dir);
+    free(cfg->stats_uri);
+    static_options_free(&cfg->static_options);
+    proxy_cache_options_free(&cfg->proxy_cache);
+    tls_options_free(&cfg->tls);
+    access_log_options_free(&cfg->access_log);
+    modules_free_conf(cfg->modules);
     free(cfg);
 }
\ No newline at end of file
@@ -16,17 +16,57 @@
 #include <unistd.h>
 #include "linux/limits.h"
 #include "common.h"
+#include "sock/server.h"
+#include "sock/tls.h"
+#include "http/static_files.h"
+#include "http/proxy_cache.h"
+#include "http/upstream.h"
+#include "http/router.h"
+#include "http/module.h"
+#include "http/rate_limit.h"
+#include "utils/affinity.h"
+#include "utils/access_log.h"
+#include "utils/io_pool.h"
 
 typedef struct
 {
     int port;
     char *root;
     char *static_dir;
-    char **backends;
+    char **backends; // top-level backend entries first, then each upstream section's
     size_t backend_count;
+    UpstreamGroup upstreams[MAX_UPSTREAM_GROUPS]; // "[upstream name]" sections
+    size_t upstream_count;
+    Location *locations; // "[location ...]" sections, in file order
+    size_t location_count;
+    SocketOptions socket_options;
+    int log_level;
+    char *stats_uri;
+    StaticOptions static_options;
+    ProxyCacheOptions proxy_cache;
+    bool http2;
+    TLSOptions tls;
+    int upstream_keepalive;         // idle backend connections kept per backend
+    int upstream_keepalive_timeout; // seconds an idle backend connection is kept
+    size_t upstream_splice_min;     // body size from which responses are spliced through
+    int keepalive_requests;         // requests per client connection; 0 is unlimited
+    int keepalive_timeout;          // seconds an idle client connection is kept; 0 is forever
+    int max_connections;            // connection slots of each worker
+    int tunnel_timeout;             // seconds an idle tunnel is kept; 0 is forever
+    bool proxy_connect;             // CONNECT may open tunnels to the configured backends
+    int overload_connections;       // open connections at which a worker stops accepting
+    int overload_latency_ms;        // event loop lag at which requests are shed
+    size_t overload_memory;         // resident bytes at which requests are shed
+    int overload_retry_after;       // Retry-After seconds of the 503 sent when shedding
+    int static_io_threads;          // threads opening and reading static files; 0 is inline
+    RateLimitOptions limits;
+    WorkerOptions workers;
+    AccessLogOptions access_log;
+    void *modules[MAX_MODULES]; // settings each module built from its directives, or NULL
 } Config;
 
 char *strip_whitespace(char *str);
+bool parse_bool(const char *value);
 Config *parse_config(const char *filename);
 void free_config(Config *cfg);
 
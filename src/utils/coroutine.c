@@ -0,0 +1,570 @@
+/**
+ * @file    coroutine.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Coroutine context switch, stacks, scheduler and yielding I/O calls.
+ *
+ */
+
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "coroutine.h"
+#include "utils/metrics.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+// Scheduler whose coroutine is running on this thread, or NULL on the loop's own stack
+static _Thread_local CoScheduler *running = NULL;
+
+// Idle stacks of this thread; see alloc_stack()
+static _Thread_local void *stack_pool[CO_STACK_POOL];
+static _Thread_local int stack_pool_count = 0;
+
+// ---------- CONTEXT SWITCH ----------
+
+/*
+ * co_switch(save_sp, load_sp) pushes the callee-saved registers (and the
+ * floating point control words) on the current stack, stores the stack
+ * pointer in *save_sp, switches to load_sp and pops the registers saved
+ * there. A new coroutine's stack is laid out so that the first switch to
+ * it "returns" into co_start, which passes the Coroutine on to co_main().
+ */
+void co_switch(void **save_sp, void *load_sp) __attribute__((visibility("hidden")));
+void co_start(void) __attribute__((visibility("hidden")));
+void co_main(Coroutine *co) __attribute__((visibility("hidden"), noreturn));
+
+#if defined(__x86_64__)
+
+__asm__(".text\n"
+        ".globl co_switch\n"
+        ".hidden co_switch\n"
+        ".type co_switch, @function\n"
+        "co_switch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size co_switch, .-co_switch\n"
+        ".globl co_start\n"
+        ".hidden co_start\n"
+        ".type co_start, @function\n"
+        "co_start:\n"
+        "    movq %r12, %rdi\n"
+        "    call co_main\n"
+        "    ud2\n"
+        ".size co_start, .-co_start\n");
+
+#define FRAME_WORDS 8 // control words, r15, r14, r13, r12, rbx, rbp, return address
+
+static void **initial_frame(void *top, Coroutine *co)
+{
+    // After the final ret the stack is 16-byte aligned again, as a call into co_main needs
+    void **frame = (void **)top - FRAME_WORDS;
+    memset(frame, 0, FRAME_WORDS * sizeof(void *));
+    frame[0] = (void *)(0x1F80 | (0x037FULL << 32)); // default MXCSR and x87 control word
+    frame[4] = co;                                    // r12
+    frame[7] = (void *)co_start;
+    return frame;
+}
+
+#elif defined(__aarch64__)
+
+__asm__(".text\n"
+        ".globl co_switch\n"
+        ".hidden co_switch\n"
+        ".type co_switch, %function\n"
+        "co_switch:\n"
+        "    sub sp, sp, #160\n"
+        "    stp x19, x20, [sp, #0]\n"
+        "    stp x21, x22, [sp, #16]\n"
+        "    stp x23, x24, [sp, #32]\n"
+        "    stp x25, x26, [sp, #48]\n"
+        "    stp x27, x28, [sp, #64]\n"
+        "    stp x29, x30, [sp, #80]\n"
+        "    stp d8, d9, [sp, #96]\n"
+        "    stp d10, d11, [sp, #112]\n"
+        "    stp d12, d13, [sp, #128]\n"
+        "    stp d14, d15, [sp, #144]\n"
+        "    mov x2, sp\n"
+        "    str x2, [x0]\n"
+        "    mov sp, x1\n"
+        "    ldp x19, x20, [sp, #0]\n"
+        "    ldp x21, x22, [sp, #16]\n"
+        "    ldp x23, x24, [sp, #32]\n"
+        "    ldp x25, x26, [sp, #48]\n"
+        "    ldp x27, x28, [sp, #64]\n"
+        "    ldp x29, x30, [sp, #80]\n"
+        "    ldp d8, d9, [sp, #96]\n"
+        "    ldp d10, d11, [sp, #112]\n"
+        "    ldp d12, d13, [sp, #128]\n"
+        "    ldp d14, d15, [sp, #144]\n"
+        "    add sp, sp, #160\n"
+        "    ret\n"
+        ".size co_switch, .-co_switch\n"
+        ".globl co_start\n"
+        ".hidden co_start\n"
+        ".type co_start, %function\n"
+        "co_start:\n"
+        "    mov x0, x19\n"
+        "    bl co_main\n"
+        "    brk #0\n"
+        ".size co_start, .-co_start\n");
+
+#define FRAME_WORDS 20 // x19-x30, d8-d15
+
+static void **initial_frame(void *top, Coroutine *co)
+{
+    void **frame = (void **)top - FRAME_WORDS;
+    memset(frame, 0, FRAME_WORDS * sizeof(void *));
+    frame[0]  = co;               // x19
+    frame[11] = (void *)co_start; // x30
+    return frame;
+}
+
+#else
+#error "Coroutines need a context switch for this architecture (x86-64 and AArch64 have one)."
+#endif
+
+// ---------- STACKS ----------
+
+static size_t guard_size(void)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page : 4096;
+}
+
+/**
+ * @brief   Takes a stack from the thread's pool, or maps a new one with an
+ *          inaccessible guard page below it.
+ *
+ * @return  The mapping (guard page first), or NULL.
+ */
+static void *alloc_stack(void)
+{
+    if (stack_pool_count > 0) return stack_pool[--stack_pool_count];
+
+    size_t guard = guard_size();
+    void *stack  = mmap(NULL, guard + CO_STACK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) return NULL;
+    if (mprotect(stack, guard, PROT_NONE) < 0)
+    {
+        munmap(stack, guard + CO_STACK_SIZE);
+        return NULL;
+    }
+    return stack;
+}
+
+static void release_stack(void *stack)
+{
+    if (stack_pool_count < CO_STACK_POOL)
+        stack_pool[stack_pool_count++] = stack;
+    else
+        munmap(stack, guard_size() + CO_STACK_SIZE);
+}
+
+static void *stack_top(const Coroutine *co)
+{
+    return (char *)co->stack + guard_size() + CO_STACK_SIZE;
+}
+
+// ---------- SWITCHING ----------
+
+/**
+ * @brief   Runs a coroutine until it waits or returns; called on the loop's stack.
+ *
+ * A coroutine that returned is freed here, and its done callback runs.
+ */
+static void resume(Coroutine *co)
+{
+    CoScheduler *s = co->sched;
+    s->current     = co;
+    co->state      = CO_RUNNING;
+    running        = s;
+
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_start_switch_fiber(&s->fake_stack, (char *)co->stack + guard_size(),
+                                   CO_STACK_SIZE);
+#endif
+    co_switch(&s->sp, co->sp);
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(s->fake_stack, NULL, NULL);
+#endif
+
+    running    = NULL;
+    s->current = NULL;
+    if (co->state != CO_DONE) return;
+
+    if (co->prev)
+        co->prev->next = co->next;
+    else
+        s->all = co->next;
+    if (co->next) co->next->prev = co->prev;
+    s->count--;
+    release_stack(co->stack);
+
+    void (*done)(void *arg) = co->done;
+    void *arg               = co->arg;
+    free(co);
+    if (done) done(arg);
+}
+
+/**
+ * @brief   Switches from the running coroutine back to the loop until resume().
+ */
+static void yield(Coroutine *co)
+{
+    CoScheduler *s = co->sched;
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_start_switch_fiber(&co->fake_stack, s->loop_stack, s->loop_stack_size);
+#endif
+    co_switch(&co->sp, s->sp);
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(co->fake_stack, &s->loop_stack, &s->loop_stack_size);
+#endif
+}
+
+void co_main(Coroutine *co)
+{
+    CoScheduler *s = co->sched;
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_finish_switch_fiber(NULL, &s->loop_stack, &s->loop_stack_size);
+#endif
+    co->entry(co->arg);
+
+    co->state = CO_DONE;
+#if defined(__SANITIZE_ADDRESS__)
+    __sanitizer_start_switch_fiber(NULL, s->loop_stack, s->loop_stack_size);
+#endif
+    co_switch(&co->sp, s->sp);
+    __builtin_unreachable();
+}
+
+// ---------- SCHEDULER ----------
+
+void co_scheduler_init(CoScheduler *s, int epoll_fd, int kind)
+{
+    memset(s, 0, sizeof(*s));
+    s->epoll_fd = epoll_fd;
+    s->kind     = kind;
+}
+
+static void add_timer(CoScheduler *s, Coroutine *co, uint64_t wake_at)
+{
+    co->wake_at       = wake_at;
+    Coroutine **link = &s->timers;
+    while (*link && (*link)->wake_at <= wake_at)
+        link = &(*link)->next_timer;
+    co->next_timer = *link;
+    *link          = co;
+}
+
+static void remove_timer(CoScheduler *s, Coroutine *co)
+{
+    if (co->wake_at == 0) return;
+    Coroutine **link = &s->timers;
+    while (*link && *link != co)
+        link = &(*link)->next_timer;
+    if (*link) *link = co->next_timer;
+    co->wake_at = 0;
+}
+
+/**
+ * @brief   Creates a coroutine running entry(arg); it starts at the loop's
+ *          next co_run_due(), never inside this call.
+ *
+ * done(arg), if set, is called on the loop's stack after entry returned and
+ * the coroutine is gone. Must be called on the loop's own stack.
+ *
+ * @return  OK, or -1 if out of memory or called on a coroutine.
+ */
+int co_spawn(CoScheduler *s, void (*entry)(void *arg), void (*done)(void *arg), void *arg)
+{
+    if (running) return -1;
+
+    Coroutine *co = calloc(1, sizeof(Coroutine));
+    void *stack   = co ? alloc_stack() : NULL;
+    if (!stack)
+    {
+        free(co);
+        return -1;
+    }
+    co->kind    = s->kind;
+    co->stack   = stack;
+    co->entry   = entry;
+    co->done    = done;
+    co->arg     = arg;
+    co->sched   = s;
+    co->wait_fd = -1;
+    co->sp      = initial_frame(stack_top(co), co);
+    co->state   = CO_WAITING;
+
+    co->next = s->all;
+    if (s->all) s->all->prev = co;
+    s->all = co;
+    s->count++;
+    add_timer(s, co, monotonic_ns());
+    return OK;
+}
+
+/**
+ * @brief   Resumes a coroutine whose socket became ready; the loop calls it
+ *          for events carrying the scheduler's kind.
+ */
+void co_handle_event(Coroutine *co, uint32_t events)
+{
+    if (co->state != CO_WAITING || co->wait_fd < 0) return;
+    co->events = events;
+    resume(co);
+}
+
+/**
+ * @brief   Starts coroutines spawned since the last call and resumes those
+ *          whose deadline has passed.
+ */
+void co_run_due(CoScheduler *s)
+{
+    uint64_t now = monotonic_ns();
+    while (s->timers && s->timers->wake_at <= now)
+    {
+        Coroutine *co = s->timers;
+        s->timers     = co->next_timer;
+        co->wake_at   = 0;
+        co->events    = 0;
+        resume(co);
+    }
+}
+
+/**
+ * @brief   Milliseconds until the next deadline, for epoll_wait(); at most max_ms.
+ */
+int co_next_timeout(const CoScheduler *s, int max_ms)
+{
+    if (!s->timers) return max_ms;
+    uint64_t now = monotonic_ns();
+    if (s->timers->wake_at <= now) return 0;
+    uint64_t ms = (s->timers->wake_at - now + 999999) / 1000000;
+    return ms < (uint64_t)max_ms ? (int)ms : max_ms;
+}
+
+/**
+ * @brief   Makes every co_*() call fail with ECANCELED and runs each
+ *          coroutine to its end; for a loop shutting down.
+ */
+void co_scheduler_cancel(CoScheduler *s)
+{
+    s->cancelling = true;
+    while (s->all)
+    {
+        Coroutine *co = s->all;
+        remove_timer(s, co);
+        if (co->wait_fd >= 0) epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, co->wait_fd, NULL);
+        co->wait_fd = -1;
+        resume(co);
+    }
+}
+
+/**
+ * @brief   Releases the idle stacks of the calling thread; every coroutine
+ *          must have ended (see co_scheduler_cancel()).
+ */
+void co_scheduler_free(CoScheduler *s)
+{
+    while (stack_pool_count > 0)
+        munmap(stack_pool[--stack_pool_count], guard_size() + CO_STACK_SIZE);
+    s->timers = NULL;
+}
+
+// ---------- YIELDING CALLS ----------
+
+bool co_active(void)
+{
+    return running != NULL;
+}
+
+/**
+ * @brief   Waits until fd is ready for events, or timeout_ms passes (0 waits
+ *          on the deadline alone).
+ *
+ * On a coroutine the loop runs meanwhile; off one the thread blocks in poll().
+ *
+ * @return  1 once fd is ready, 0 when the deadline passed first, or -1 with
+ *          errno set (ECANCELED while the scheduler is cancelling).
+ */
+static int wait_for(int fd, uint32_t events, int timeout_ms)
+{
+    if (!running)
+    {
+        if (fd < 0)
+        {
+            usleep((useconds_t)timeout_ms * 1000);
+            return 0;
+        }
+        struct pollfd pfd = {.fd = fd, .events = (events & EPOLLIN ? POLLIN : 0) |
+                                                 (events & EPOLLOUT ? POLLOUT : 0)};
+        int ready         = poll(&pfd, 1, timeout_ms);
+        return ready < 0 ? -1 : ready > 0;
+    }
+
+    CoScheduler *s = running;
+    Coroutine *co  = s->current;
+    if (s->cancelling)
+    {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (fd >= 0)
+    {
+        struct epoll_event ev = {.events = events, .data.ptr = co};
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) return -1;
+        co->wait_fd = fd;
+    }
+    add_timer(s, co, monotonic_ns() + (uint64_t)timeout_ms * 1000000);
+    co->events = 0;
+    co->state  = CO_WAITING;
+    yield(co);
+
+    // Woken by the event, by the deadline, or by co_scheduler_cancel()
+    if (co->wait_fd >= 0) epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, co->wait_fd, NULL);
+    co->wait_fd = -1;
+    remove_timer(s, co);
+    if (s->cancelling)
+    {
+        errno = ECANCELED;
+        return -1;
+    }
+    return co->events != 0;
+}
+
+static int wait_io(int fd, uint32_t events)
+{
+    int ready = wait_for(fd, events, CO_IO_TIMEOUT_MS);
+    if (ready == 0) errno = ETIMEDOUT;
+    return ready > 0 ? OK : -1;
+}
+
+/**
+ * @brief   recv() that waits for data by yielding to the loop when on a coroutine.
+ *
+ * @return  Bytes received (0 at EOF), or -1 with errno set; ETIMEDOUT after
+ *          CO_IO_TIMEOUT_MS without data.
+ */
+ssize_t co_recv(int fd, void *buf, size_t len, int flags)
+{
+    if (running) flags |= MSG_DONTWAIT;
+    while (1)
+    {
+        ssize_t n = recv(fd, buf, len, flags);
+        if (n >= 0) return n;
+        if (errno == EINTR) continue;
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_io(fd, EPOLLIN) < 0) return -1;
+    }
+}
+
+/**
+ * @brief   Sends all of buf, yielding to the loop whenever the socket is full
+ *          when on a coroutine.
+ *
+ * @return  len, or -1 with errno set; ETIMEDOUT after CO_IO_TIMEOUT_MS
+ *          without progress.
+ */
+ssize_t co_send(int fd, const void *buf, size_t len, int flags)
+{
+    if (running) flags |= MSG_DONTWAIT;
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t n = send(fd, (const char *)buf + sent, len - sent, flags);
+        if (n >= 0)
+        {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_io(fd, EPOLLOUT) < 0) return -1;
+    }
+    return (ssize_t)len;
+}
+
+/**
+ * @brief   connect() that, on a coroutine, yields to the loop until the
+ *          connection is established or fails.
+ *
+ * A blocking fd is switched to nonblocking for the connect and back after it.
+ *
+ * @return  0, or -1 with errno set.
+ */
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (!running) return connect(fd, addr, addr_len);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return -1;
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    int ret = connect(fd, addr, addr_len);
+    if (ret < 0 && errno == EINPROGRESS)
+    {
+        int err           = 0;
+        socklen_t err_len = sizeof(err);
+        ret               = wait_io(fd, EPOLLOUT);
+        if (ret == OK && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) ret = -1;
+        if (ret == OK && err != 0)
+        {
+            errno = err;
+            ret   = -1;
+        }
+    }
+
+    if (!(flags & O_NONBLOCK))
+    {
+        int saved = errno;
+        fcntl(fd, F_SETFL, flags);
+        errno = saved;
+    }
+    return ret;
+}
+
+/**
+ * @brief   Waits until fd is ready for events; on a coroutine the loop runs meanwhile.
+ *
+ * For code that drives a nonblocking exchange of its own, such as an
+ * Upstream, rather than calling co_recv() or co_send().
+ *
+ * @return  0 once fd is ready, or -1 with errno set; ETIMEDOUT after
+ *          CO_IO_TIMEOUT_MS.
+ */
+int co_wait(int fd, uint32_t events)
+{
+    return wait_io(fd, events);
+}
+
+/**
+ * @brief   Sleeps for ms milliseconds; on a coroutine the loop runs meanwhile.
+ *
+ * @return  0, or -1 with errno ECANCELED while the scheduler is cancelling.
+ */
+int co_sleep(int ms)
+{
+    return wait_for(-1, 0, ms < 0 ? 0 : ms) < 0 ? -1 : 0;
+}
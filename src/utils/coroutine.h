@@ -0,0 +1,100 @@
+/**
+ * @file    coroutine.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Stackful coroutines scheduled by an epoll event loop.
+ *
+ * @details A coroutine runs a function on a stack of its own, so handler
+ *          code that waits on sockets can be written straight-line instead
+ *          of as a state machine. co_recv(), co_send(), co_connect(),
+ *          co_wait() and co_sleep() behave like their blocking
+ *          counterparts; on a coroutine, where they would block they
+ *          register the socket (or a deadline) with the scheduler's epoll
+ *          instance and switch back to the event loop, which resumes the
+ *          coroutine once it can go on. Off a coroutine they simply block,
+ *          so the same code also serves callers that are not on an event
+ *          loop.
+ *
+ *          Context switches are a few instructions of hand-written
+ *          assembly (x86-64 and AArch64) saving the callee-saved registers
+ *          on the stack being left. Stacks are mmap()ed with a PROT_NONE
+ *          guard page below them, so an overflow faults instead of
+ *          corrupting memory, and are recycled through a per-thread pool.
+ *
+ *          Every scheduler belongs to one thread; coroutines never migrate.
+ */
+
+#ifndef UTILS_COROUTINE_H
+#define UTILS_COROUTINE_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define CO_STACK_SIZE (256 * 1024) // usable bytes of a coroutine stack; touched pages only
+#define CO_STACK_POOL 64           // idle stacks kept per thread
+#define CO_IO_TIMEOUT_MS 60000     // a co_*() call waiting longer fails with ETIMEDOUT
+
+typedef enum
+{
+    CO_RUNNING,
+    CO_WAITING, // on wait_fd, a deadline, or both
+    CO_DONE,
+} CoState;
+
+struct CoScheduler;
+
+typedef struct Coroutine
+{
+    int kind; // the scheduler's event tag; epoll data.ptr of wait_fd points here
+    CoState state;
+    void *sp;    // saved stack pointer while switched out
+    void *stack; // mapping, guard page first
+    void (*entry)(void *arg);
+    void (*done)(void *arg); // called on the scheduler's stack once entry returned
+    void *arg;
+    struct CoScheduler *sched;
+    int wait_fd;                  // registered with epoll while waiting on it, or -1
+    uint32_t events;              // epoll events that woke the coroutine, 0 for a deadline
+    uint64_t wake_at;             // monotonic ns deadline while waiting, 0 if none
+    struct Coroutine *prev;       // in the scheduler's list of live coroutines
+    struct Coroutine *next;
+    struct Coroutine *next_timer; // in the scheduler's deadlines, soonest first
+#if defined(__SANITIZE_ADDRESS__)
+    void *fake_stack; // AddressSanitizer state of the stack switched away from
+#endif
+} Coroutine;
+
+typedef struct CoScheduler
+{
+    int epoll_fd;
+    int kind;           // value every Coroutine.kind gets, to tell its events apart
+    void *sp;           // the loop's stack pointer while a coroutine runs
+    Coroutine *current; // running coroutine, or NULL on the loop's own stack
+    Coroutine *all;     // live coroutines
+    Coroutine *timers;  // coroutines with a deadline, soonest first
+    size_t count;       // live coroutines
+    bool cancelling;    // co_*() calls fail with ECANCELED
+#if defined(__SANITIZE_ADDRESS__)
+    void *fake_stack;       // AddressSanitizer state of the loop's stack
+    const void *loop_stack; // bounds of the loop's stack, for switching back
+    size_t loop_stack_size;
+#endif
+} CoScheduler;
+
+void co_scheduler_init(CoScheduler *s, int epoll_fd, int kind);
+void co_scheduler_cancel(CoScheduler *s);
+void co_scheduler_free(CoScheduler *s);
+
+int co_spawn(CoScheduler *s, void (*entry)(void *arg), void (*done)(void *arg), void *arg);
+void co_handle_event(Coroutine *co, uint32_t events);
+void co_run_due(CoScheduler *s);
+int co_next_timeout(const CoScheduler *s, int max_ms);
+
+bool co_active(void);
+ssize_t co_recv(int fd, void *buf, size_t len, int flags);
+ssize_t co_send(int fd, const void *buf, size_t len, int flags);
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addr_len);
+int co_wait(int fd, uint32_t events);
+int co_sleep(int ms);
+
+#endif /* UTILS_COROUTINE_H */
@@ -0,0 +1,177 @@
+/**
+ * @file    io_pool.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Blocking file I/O thread pool and its eventfd completions.
+ *
+ */
+
+#include <sys/eventfd.h>
+
+#include "io_pool.h"
+
+// ---------- COMPLETIONS ----------
+
+int io_completions_init(IOCompletions *done)
+{
+    done->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done->fd < 0) return -1;
+    pthread_mutex_init(&done->lock, NULL);
+    done->head = NULL;
+    done->tail = NULL;
+    return OK;
+}
+
+/**
+ * @brief   Appends a task that has run to its loop's list and wakes the loop.
+ */
+static void complete(IOTask *task)
+{
+    IOCompletions *done = task->done;
+    task->next          = NULL;
+
+    pthread_mutex_lock(&done->lock);
+    bool was_empty = done->head == NULL;
+    if (was_empty)
+        done->head = task;
+    else
+        done->tail->next = task;
+    done->tail = task;
+    pthread_mutex_unlock(&done->lock);
+
+    // One wakeup covers every task appended before the loop takes the list
+    uint64_t one = 1;
+    if (was_empty && write(done->fd, &one, sizeof(one)) < 0)
+        LOG(LOG_ERROR, "Failed to signal I/O completions: %s", strerror(errno));
+}
+
+/**
+ * @brief   Takes every completed task, oldest first, and rearms the eventfd.
+ *
+ * @return  The first task, linked through next, or NULL if none completed.
+ */
+IOTask *io_completions_take(IOCompletions *done)
+{
+    uint64_t count;
+    if (read(done->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        LOG(LOG_ERROR, "Failed to read I/O completions: %s", strerror(errno));
+
+    pthread_mutex_lock(&done->lock);
+    IOTask *tasks = done->head;
+    done->head    = NULL;
+    done->tail    = NULL;
+    pthread_mutex_unlock(&done->lock);
+    return tasks;
+}
+
+void io_completions_free(IOCompletions *done)
+{
+    if (done->fd < 0) return;
+    close(done->fd);
+    done->fd = -1;
+    pthread_mutex_destroy(&done->lock);
+}
+
+// ---------- POOL ----------
+
+static void *pool_thread(void *arg)
+{
+    IOPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        IOTask *task = pool->head;
+        if (!task) break; // stopping with nothing left to run
+
+        pool->head = task->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        task->run(task);
+        complete(task);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * @brief   Starts the pool's threads; 0 threads leaves the pool off.
+ *
+ * @return  OK, or -1 if no thread could be started.
+ */
+int io_pool_start(IOPool *pool, int threads)
+{
+    pool->thread_count = 0;
+    pool->head         = NULL;
+    pool->tail         = NULL;
+    pool->stopping     = false;
+    if (threads <= 0) return OK;
+    if (threads > MAX_IO_THREADS) threads = MAX_IO_THREADS;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, pool) != 0)
+        {
+            LOG(LOG_ERROR, "Started %d of %d I/O threads.", i, threads);
+            break;
+        }
+        pool->thread_count++;
+    }
+    if (pool->thread_count > 0) return OK;
+
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    return -1;
+}
+
+/**
+ * @brief   Queues a task for a pool thread; task->run and task->done must be set.
+ *
+ * @return  OK, or -1 if the pool is not running: the caller does the work itself.
+ */
+int io_pool_submit(IOPool *pool, IOTask *task)
+{
+    if (pool->thread_count == 0) return -1;
+
+    task->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stopping)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+    return OK;
+}
+
+/**
+ * @brief   Stops the pool once every queued task has run and been completed.
+ */
+void io_pool_stop(IOPool *pool)
+{
+    if (pool->thread_count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+    pool->thread_count = 0;
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file    io_pool.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Thread pool running blocking file I/O off the event loops.
+ *
+ * @details An event loop hands a task that may block on the disk (open,
+ *          fstat, read) to the pool and goes on serving other connections.
+ *          A pool thread runs the task, appends it to the completion list
+ *          of the loop that submitted it and bumps that list's eventfd, so
+ *          the loop wakes up in epoll_wait() and finishes the task on its
+ *          own thread. The pool is shared by all loops; every loop has its
+ *          own IOCompletions.
+ */
+
+#ifndef UTILS_IO_POOL_H
+#define UTILS_IO_POOL_H
+
+#include <pthread.h>
+#include "common.h"
+
+#define DEFAULT_IO_THREADS 4
+#define MAX_IO_THREADS 64
+
+struct IOCompletions;
+
+/*
+ * A unit of blocking work. Embedded as the first member of the caller's own
+ * job struct, so run() and the completion side can get back to it.
+ */
+typedef struct IOTask
+{
+    void (*run)(struct IOTask *task); // called on a pool thread
+    struct IOCompletions *done;       // list the task is appended to once run
+    struct IOTask *next;
+} IOTask;
+
+/* Tasks of one event loop that have run, signaled through an eventfd */
+typedef struct IOCompletions
+{
+    int fd; // eventfd, readable while tasks are waiting
+    pthread_mutex_t lock;
+    IOTask *head; // in completion order
+    IOTask *tail;
+} IOCompletions;
+
+typedef struct IOPool
+{
+    pthread_t threads[MAX_IO_THREADS];
+    int thread_count; // 0 while the pool is not running
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // signaled when a task is queued or the pool stops
+    IOTask *head;         // submitted tasks not yet picked up, in order
+    IOTask *tail;
+    bool stopping;
+} IOPool;
+
+int io_pool_start(IOPool *pool, int threads);
+int io_pool_submit(IOPool *pool, IOTask *task);
+void io_pool_stop(IOPool *pool);
+
+int io_completions_init(IOCompletions *done);
+IOTask *io_completions_take(IOCompletions *done);
+void io_completions_free(IOCompletions *done);
+
+#endif /* UTILS_IO_POOL_H */
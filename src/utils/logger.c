@@ -1,20 +1,248 @@
+/**
+ * @file    logger.c
+ * @author  Samandar Komil
+ * @date    24 April 2025
+ * @brief   Asynchronous, lock-free logger implementation.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
 #include "logger.h"
+#include "thread_ring.h"
+
+typedef struct LogRecord
+{
+    uint16_t len;
+    char data[LOG_RECORD_SIZE - sizeof(uint16_t)];
+} LogRecord;
+
+static const char *const level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+int log_runtime_level = LOG_DEBUG;
+
+static ThreadRings rings   = THREAD_RINGS_INIT(LogRecord, LOG_RING_CAPACITY);
+static atomic_bool running = false;
+static pthread_t drain_thread;
+
+static _Thread_local ThreadRing *local_ring = NULL;
+static _Thread_local time_t cached_second = 0;
+static _Thread_local char cached_timestamp[32];
+
+/**
+ * @brief   Returns the calling thread's formatted timestamp, refreshed once a second.
+ *
+ * CLOCK_REALTIME_COARSE is served from the vDSO, so the common path is a
+ * single comparison and localtime_r()/strftime() run at most once per second.
+ */
+static const char *current_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != cached_second)
+    {
+        struct tm t;
+        localtime_r(&ts.tv_sec, &t);
+        strftime(cached_timestamp, sizeof(cached_timestamp), "%Y-%m-%d %H:%M:%S", &t);
+        cached_second = ts.tv_sec;
+    }
+    return cached_timestamp;
+}
 
-void log_message(const char *level, const char *file, int line, const char *fmt, ...)
+static size_t format_record(char *dst, size_t cap, int level, const char *file, int line,
+                            const char *fmt, va_list args)
 {
-    time_t now   = time(NULL);
-    struct tm *t = localtime(&now);
+    const char *name = (level >= LOG_DEBUG && level < LOG_OFF) ? level_names[level] : "?";
+    int n = snprintf(dst, cap, "[%s] [%s] (%s:%d) ", current_timestamp(), name, file, line);
+    if (n < 0) n = 0;
+    size_t len = (size_t)n < cap ? (size_t)n : cap - 1;
 
-    char buf[64];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", t);
+    n = vsnprintf(dst + len, cap - len, fmt, args);
+    if (n > 0) len += ((size_t)n < cap - len) ? (size_t)n : cap - len - 1;
 
-    fprintf(stdout, "[%s] [%s] (%s:%d) ", buf, level, file, line);
+    // Always terminate with a newline, overwriting the last byte if truncated
+    if (len >= cap - 1) len = cap - 2;
+    dst[len++] = '\n';
+    return len;
+}
 
+void log_message(int level, const char *file, int line, const char *fmt, ...)
+{
     va_list args;
     va_start(args, fmt);
-    vfprintf(stdout, fmt, args);
+
+    ThreadRing *ring = atomic_load_explicit(&running, memory_order_acquire)
+                           ? thread_ring_local(&rings, &local_ring)
+                           : NULL;
+    if (!ring)
+    {
+        // No drain thread (startup, tests, shutdown): write synchronously
+        char buf[LOG_RECORD_SIZE];
+        size_t len = format_record(buf, sizeof(buf), level, file, line, fmt, args);
+        va_end(args);
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    LogRecord *rec = thread_ring_reserve(&rings, ring);
+    if (!rec)
+    {
+        va_end(args);
+        return;
+    }
+    rec->len = format_record(rec->data, sizeof(rec->data), level, file, line, fmt, args);
     va_end(args);
+    thread_ring_commit(&rings, ring);
+}
+
+static void write_all(struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(STDOUT_FILENO, iov, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return; // stdout is gone, nothing sensible left to do
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * @brief   Writes a batch of records with one writev().
+ */
+static void write_records(void *ctx, void *const *records, size_t count)
+{
+    (void)ctx;
+    struct iovec iov[THREAD_RING_BATCH];
+    for (size_t i = 0; i < count; i++)
+    {
+        const LogRecord *rec = records[i];
+        iov[i].iov_base      = (void *)rec->data;
+        iov[i].iov_len       = rec->len;
+    }
+    write_all(iov, (int)count);
+}
 
-    fprintf(stdout, "\n");
+static void *drain_loop(void *arg)
+{
+    (void)arg;
+    uint64_t reported_dropped = 0;
+
+    while (atomic_load_explicit(&running, memory_order_acquire))
+    {
+        size_t written = thread_rings_drain(&rings, write_records, NULL);
+
+        uint64_t total = logger_dropped();
+        if (total != reported_dropped)
+        {
+            char buf[96];
+            int len = snprintf(buf, sizeof(buf), "[%s] [WARN] (logger) dropped %lu log records\n",
+                               current_timestamp(), (unsigned long)(total - reported_dropped));
+            struct iovec iov = {buf, len};
+            write_all(&iov, 1);
+            reported_dropped = total;
+        }
+
+        if (written == 0) thread_rings_wait(&rings, -1);
+    }
+
+    thread_rings_drain(&rings, write_records, NULL);
+    return NULL;
+}
+
+/**
+ * @brief   Sets the runtime log level; messages below it are skipped before formatting.
+ *
+ * Levels below CSERVE_LOG_MIN_LEVEL stay compiled out regardless.
+ */
+void logger_set_level(int level)
+{
+    if (level < LOG_DEBUG) level = LOG_DEBUG;
+    if (level > LOG_OFF) level = LOG_OFF;
+    log_runtime_level = level;
+}
+
+/**
+ * @brief   Maps a level name ("DEBUG", "INFO", "WARN", "ERROR", "OFF") to its value.
+ *
+ * @return  The level, or -1 if the name is not recognized.
+ */
+int log_level_from_string(const char *name)
+{
+    for (int level = LOG_DEBUG; level < LOG_OFF; level++)
+    {
+        if (strcasecmp(name, level_names[level]) == 0) return level;
+    }
+    if (strcasecmp(name, "OFF") == 0) return LOG_OFF;
+    return -1;
+}
+
+/**
+ * @brief   Starts the background drain thread.
+ *
+ * Until this is called (and after logger_shutdown()), log_message() writes
+ * synchronously. Registers logger_shutdown() with atexit() so queued records
+ * are flushed when the process exits.
+ *
+ * @return  0 on success, -1 if the thread could not be started.
+ */
+int logger_init(void)
+{
+    if (atomic_load(&running)) return 0;
+
+    if (thread_rings_init(&rings) < 0) return -1;
+    atomic_store(&running, true);
+    if (pthread_create(&drain_thread, NULL, drain_loop, NULL) != 0)
+    {
+        atomic_store(&running, false);
+        return -1;
+    }
+
+    static bool registered = false;
+    if (!registered)
+    {
+        atexit(logger_shutdown);
+        registered = true;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Stops the drain thread after flushing every ring.
+ */
+void logger_shutdown(void)
+{
+    if (!atomic_exchange(&running, false)) return;
+    thread_rings_wake(&rings);
+    pthread_join(drain_thread, NULL);
     fflush(stdout);
 }
+
+/**
+ * @brief   Total records dropped because a ring was full.
+ */
+uint64_t logger_dropped(void)
+{
+    return thread_rings_dropped(&rings);
+}
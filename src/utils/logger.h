@@ -1,7 +1,63 @@
+/**
+ * @file    logger.h
+ * @author  Samandar Komil
+ * @date    24 April 2025
+ * @brief   Logging macro and asynchronous log pipeline.
+ *
+ * @details Each thread that logs owns a single-producer/single-consumer ring
+ *          of fixed-size records. A background thread started by logger_init()
+ *          drains every ring in batches with writev(), so the event loop never
+ *          blocks on stdout. When a ring is full the record is dropped and
+ *          counted instead of waiting for the writer. The writer sleeps on an
+ *          eventfd while every ring is empty, and a thread's ring is freed
+ *          once the thread has exited and the ring is drained. The rings are
+ *          those of thread_ring.h, which the access log uses as well.
+ *
+ *          LOG() takes a numeric level. Levels below CSERVE_LOG_MIN_LEVEL
+ *          (set by the CSERVE_LOG_LEVEL CMake option) are removed by the
+ *          compiler, arguments included. The remaining levels are compared
+ *          against the runtime level from the config file before anything
+ *          is formatted.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <stdarg.h>
 
-#define LOG(level, fmt, ...) log_message(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_RING_CAPACITY 1024 // records per thread, must be a power of two
+#define LOG_RECORD_SIZE 256    // bytes per record, longer lines are truncated
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define LOG_OFF 4
+
+#ifndef CSERVE_LOG_MIN_LEVEL
+#define CSERVE_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+#define LOG(level, fmt, ...)                                                                       \
+    do                                                                                             \
+    {                                                                                              \
+        if ((level) >= CSERVE_LOG_MIN_LEVEL && __builtin_expect((level) >= log_runtime_level, 0))  \
+            log_message(level, __FILE__, __LINE__, fmt, ##__VA_ARGS__);                            \
+    } while (0)
+
+extern int log_runtime_level;
+
+void log_message(int level, const char *file, int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+void logger_set_level(int level);
+int log_level_from_string(const char *name);
+
+int logger_init(void);
+void logger_shutdown(void);
+uint64_t logger_dropped(void);
 
-void log_message(const char *level, const char *file, int line, const char *fmt, ...);
\ No newline at end of file
+#endif /* LOGGER_H */
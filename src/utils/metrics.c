@@ -0,0 +1,470 @@
+/**
+ * @file    metrics.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Per-worker counters, histograms and the stats renderer.
+ *
+ */
+
+#include "metrics.h"
+
+static _Atomic(WorkerMetrics *) slots[MAX_WORKERS];
+static atomic_int slot_count = 0;
+static atomic_int event_loops = 0;
+static WorkerMetrics overflow_slot; // shared by threads beyond MAX_WORKERS, updated atomically
+static atomic_bool overflowed = false;
+
+static _Thread_local WorkerMetrics *local_slot = NULL;
+_Thread_local bool metrics_shared_slot         = false;
+
+static char **backend_names = NULL;
+static int backend_count    = 0;
+
+static const char *const phase_names[PHASE_COUNT] = {"parse", "handle", "send", "loop"};
+
+static void share_overflow_slot(void)
+{
+    local_slot          = &overflow_slot;
+    metrics_shared_slot = true;
+    if (!atomic_exchange(&overflowed, true))
+        LOG(LOG_WARN, "More than %d threads record metrics; the rest share one slot.",
+            MAX_WORKERS);
+}
+
+/**
+ * @brief   Gives the calling thread its own metrics slot.
+ *
+ * The slot is allocated and zeroed by the calling thread, so on NUMA hosts it
+ * lands on the worker's local node under the default first-touch policy.
+ *
+ * @return  Slot index, or -1 if MAX_WORKERS slots are already taken.
+ */
+static int register_slot(void)
+{
+    if (local_slot) return local_slot == &overflow_slot ? -1 : 0;
+
+    int index = atomic_fetch_add(&slot_count, 1);
+    if (index >= MAX_WORKERS)
+    {
+        atomic_fetch_sub(&slot_count, 1);
+        share_overflow_slot();
+        return -1;
+    }
+
+    WorkerMetrics *slot = aligned_alloc(_Alignof(WorkerMetrics), sizeof(WorkerMetrics));
+    if (!slot)
+    {
+        // The index stays reserved with no slot behind it; the snapshot skips it
+        share_overflow_slot();
+        return -1;
+    }
+    memset(slot, 0, sizeof(*slot));
+
+    atomic_store_explicit(&slots[index], slot, memory_order_release);
+    local_slot = slot;
+    return index;
+}
+
+/**
+ * @brief   Registers the calling thread as an event loop, with its own slot.
+ *
+ * Other threads (the I/O pool, a benchmark's clients) get a slot the first
+ * time they record a metric but are not counted as event loops.
+ *
+ * @return  Slot index, or -1 if the loop shares the overflow slot.
+ */
+int metrics_register_worker(void)
+{
+    int index = register_slot();
+    atomic_fetch_add(&event_loops, 1);
+    return index;
+}
+
+WorkerMetrics *metrics_local(void)
+{
+    if (!local_slot) register_slot();
+    return local_slot;
+}
+
+/**
+ * @brief   Names backends for the upstream section of the stats output.
+ *
+ * The array is borrowed, not copied; it must outlive the server (it is owned
+ * by the Config).
+ */
+void metrics_set_backends(char **names, int count)
+{
+    backend_names = names;
+    backend_count = count < MAX_BACKENDS ? count : MAX_BACKENDS;
+}
+
+// ---------- HISTOGRAMS ----------
+
+int histogram_bucket_index(uint64_t value)
+{
+    if (value < HIST_SUB_BUCKETS) return (int)value;
+    if (value >= (1ull << HIST_MAX_BITS)) return HIST_BUCKETS - 1;
+
+    int msb   = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BUCKET_BITS;
+    int sub   = (int)(value >> shift) - HIST_SUB_BUCKETS;
+    return (shift + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+/**
+ * @brief   Highest value that maps to the given bucket.
+ */
+uint64_t histogram_bucket_value(int index)
+{
+    if (index < HIST_SUB_BUCKETS) return (uint64_t)index;
+
+    int shift      = index / HIST_SUB_BUCKETS - 1;
+    uint64_t sub   = index % HIST_SUB_BUCKETS;
+    uint64_t lower = (HIST_SUB_BUCKETS + sub) << shift;
+    return lower + (1ull << shift) - 1;
+}
+
+void histogram_record(Histogram *hist, uint64_t value)
+{
+    metric_add(&hist->count, 1);
+    metric_add(&hist->sum, value);
+    metric_add(&hist->buckets[histogram_bucket_index(value)], 1);
+    uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    if (!metrics_shared_slot)
+    {
+        if (value > max) atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+        return;
+    }
+    while (value > max && !atomic_compare_exchange_weak_explicit(&hist->max, &max, value,
+                                                                 memory_order_relaxed,
+                                                                 memory_order_relaxed))
+        ;
+}
+
+/**
+ * @brief   Value at the given percentile (0-100), within one bucket's precision.
+ *
+ * @return  0 for an empty histogram.
+ */
+uint64_t histogram_percentile(const Histogram *hist, double percentile)
+{
+    uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    if (count == 0) return 0;
+
+    uint64_t target = (uint64_t)(percentile / 100.0 * count + 0.5);
+    if (target == 0) target = 1;
+    if (target > count) target = count;
+
+    uint64_t max  = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen >= target)
+        {
+            uint64_t value = histogram_bucket_value(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+static void histogram_merge(Histogram *dst, const Histogram *src)
+{
+    metric_add(&dst->count, atomic_load_explicit(&src->count, memory_order_relaxed));
+    metric_add(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed));
+    uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+    if (max > atomic_load_explicit(&dst->max, memory_order_relaxed))
+        atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        metric_add(&dst->buckets[i], atomic_load_explicit(&src->buckets[i], memory_order_relaxed));
+}
+
+// ---------- RECORDING HELPERS ----------
+
+void metrics_count_status(int status_code)
+{
+    if (status_code < METRICS_STATUS_MIN || status_code > METRICS_STATUS_MAX) return;
+    metric_add(&metrics_local()->status[status_code - METRICS_STATUS_MIN], 1);
+}
+
+void metrics_record_phase(MetricsPhase phase, uint64_t start_ns)
+{
+    histogram_record(&metrics_local()->phases[phase], monotonic_ns() - start_ns);
+}
+
+void metrics_record_upstream(int backend, uint64_t start_ns, bool failed)
+{
+    if (backend < 0 || backend >= MAX_BACKENDS) return;
+    UpstreamMetrics *up = &metrics_local()->upstreams[backend];
+    metric_add(&up->requests, 1);
+    if (failed)
+        metric_add(&up->failures, 1);
+    else
+        histogram_record(&up->latency, monotonic_ns() - start_ns);
+}
+
+// ---------- AGGREGATION ----------
+
+#define LOAD(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+
+static void add_slot(WorkerMetrics *total, const WorkerMetrics *slot)
+{
+    metric_add(&total->connections_accepted, LOAD(slot->connections_accepted));
+    metric_add(&total->connections_active, LOAD(slot->connections_active));
+    metric_add(&total->requests, LOAD(slot->requests));
+    metric_add(&total->parse_errors, LOAD(slot->parse_errors));
+    metric_add(&total->bytes_in, LOAD(slot->bytes_in));
+    metric_add(&total->bytes_out, LOAD(slot->bytes_out));
+    metric_add(&total->upstream_coalesced, LOAD(slot->upstream_coalesced));
+    metric_add(&total->upstream_reused, LOAD(slot->upstream_reused));
+    metric_add(&total->upstream_spliced, LOAD(slot->upstream_spliced));
+    metric_add(&total->static_offloaded, LOAD(slot->static_offloaded));
+    metric_add(&total->tls_handshakes, LOAD(slot->tls_handshakes));
+    metric_add(&total->tls_resumed, LOAD(slot->tls_resumed));
+    metric_add(&total->tls_ktls, LOAD(slot->tls_ktls));
+    metric_add(&total->limited_requests, LOAD(slot->limited_requests));
+    metric_add(&total->limited_connections, LOAD(slot->limited_connections));
+    metric_add(&total->shed_requests, LOAD(slot->shed_requests));
+    metric_add(&total->shed_connections, LOAD(slot->shed_connections));
+    metric_add(&total->accept_pauses, LOAD(slot->accept_pauses));
+    metric_add(&total->tunnels_opened, LOAD(slot->tunnels_opened));
+    metric_add(&total->tunnels_active, LOAD(slot->tunnels_active));
+    metric_add(&total->tunnel_bytes, LOAD(slot->tunnel_bytes));
+    for (int s = 0; s <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; s++)
+        metric_add(&total->status[s], LOAD(slot->status[s]));
+    for (int p = 0; p < PHASE_COUNT; p++)
+        histogram_merge(&total->phases[p], &slot->phases[p]);
+    for (int b = 0; b < MAX_BACKENDS; b++)
+    {
+        metric_add(&total->upstreams[b].requests, LOAD(slot->upstreams[b].requests));
+        metric_add(&total->upstreams[b].failures, LOAD(slot->upstreams[b].failures));
+        histogram_merge(&total->upstreams[b].latency, &slot->upstreams[b].latency);
+    }
+}
+
+/**
+ * @brief   Sums every worker's slot into a freshly allocated WorkerMetrics.
+ *
+ * Counters are read without stopping the writers, so the snapshot is not an
+ * atomic cut across workers; each individual counter is still exact.
+ *
+ * @return  Snapshot owned by the caller (free()), or NULL on allocation failure.
+ */
+WorkerMetrics *metrics_snapshot(void)
+{
+    WorkerMetrics *total = aligned_alloc(_Alignof(WorkerMetrics), sizeof(WorkerMetrics));
+    if (!total) return NULL;
+    memset(total, 0, sizeof(*total));
+
+    int n = atomic_load(&slot_count);
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+    for (int w = 0; w < n; w++)
+    {
+        WorkerMetrics *slot = atomic_load_explicit(&slots[w], memory_order_acquire);
+        if (slot) add_slot(total, slot);
+    }
+    add_slot(total, &overflow_slot);
+
+    return total;
+}
+
+// ---------- RENDERING ----------
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+__attribute__((format(printf, 2, 3))) static void appendf(OutBuf *out, const char *fmt, ...)
+{
+    if (!out->data) return; // an earlier allocation failed
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out->data + out->len, out->cap - out->len, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+
+    if (out->len + n >= out->cap)
+    {
+        size_t cap = out->cap * 2;
+        while (out->len + n >= cap)
+            cap *= 2;
+        char *data = realloc(out->data, cap);
+        if (!data)
+        {
+            free(out->data);
+            out->data = NULL;
+            return;
+        }
+        out->data = data;
+        out->cap  = cap;
+
+        va_start(args, fmt);
+        vsnprintf(out->data + out->len, out->cap - out->len, fmt, args);
+        va_end(args);
+    }
+    out->len += n;
+}
+
+static void render_histogram_text(OutBuf *out, const char *name, const char *label,
+                                  const Histogram *h)
+{
+    uint64_t count = LOAD(h->count);
+    appendf(out, "%s{%s} count=%lu avg=%lu p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n", name, label,
+            (unsigned long)count, (unsigned long)(count ? LOAD(h->sum) / count : 0),
+            (unsigned long)histogram_percentile(h, 50), (unsigned long)histogram_percentile(h, 90),
+            (unsigned long)histogram_percentile(h, 99),
+            (unsigned long)histogram_percentile(h, 99.9), (unsigned long)LOAD(h->max));
+}
+
+static void render_histogram_json(OutBuf *out, const Histogram *h)
+{
+    uint64_t count = LOAD(h->count);
+    appendf(out,
+            "{\"count\":%lu,\"avg\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,"
+            "\"max\":%lu}",
+            (unsigned long)count, (unsigned long)(count ? LOAD(h->sum) / count : 0),
+            (unsigned long)histogram_percentile(h, 50), (unsigned long)histogram_percentile(h, 90),
+            (unsigned long)histogram_percentile(h, 99),
+            (unsigned long)histogram_percentile(h, 99.9), (unsigned long)LOAD(h->max));
+}
+
+static void render_text(OutBuf *out, const WorkerMetrics *m)
+{
+    appendf(out, "event_loops %d\n", atomic_load(&event_loops));
+    appendf(out, "metrics_threads %d\n", atomic_load(&slot_count));
+    appendf(out, "connections_accepted %lu\n", (unsigned long)LOAD(m->connections_accepted));
+    appendf(out, "connections_active %lu\n", (unsigned long)LOAD(m->connections_active));
+    appendf(out, "requests %lu\n", (unsigned long)LOAD(m->requests));
+    appendf(out, "parse_errors %lu\n", (unsigned long)LOAD(m->parse_errors));
+    appendf(out, "bytes_in %lu\n", (unsigned long)LOAD(m->bytes_in));
+    appendf(out, "bytes_out %lu\n", (unsigned long)LOAD(m->bytes_out));
+    appendf(out, "upstream_coalesced %lu\n", (unsigned long)LOAD(m->upstream_coalesced));
+    appendf(out, "upstream_reused %lu\n", (unsigned long)LOAD(m->upstream_reused));
+    appendf(out, "upstream_spliced %lu\n", (unsigned long)LOAD(m->upstream_spliced));
+    appendf(out, "static_offloaded %lu\n", (unsigned long)LOAD(m->static_offloaded));
+    appendf(out, "tls_handshakes %lu\n", (unsigned long)LOAD(m->tls_handshakes));
+    appendf(out, "tls_resumed %lu\n", (unsigned long)LOAD(m->tls_resumed));
+    appendf(out, "tls_ktls %lu\n", (unsigned long)LOAD(m->tls_ktls));
+    appendf(out, "limited_requests %lu\n", (unsigned long)LOAD(m->limited_requests));
+    appendf(out, "limited_connections %lu\n", (unsigned long)LOAD(m->limited_connections));
+    appendf(out, "shed_requests %lu\n", (unsigned long)LOAD(m->shed_requests));
+    appendf(out, "shed_connections %lu\n", (unsigned long)LOAD(m->shed_connections));
+    appendf(out, "accept_pauses %lu\n", (unsigned long)LOAD(m->accept_pauses));
+    appendf(out, "tunnels_opened %lu\n", (unsigned long)LOAD(m->tunnels_opened));
+    appendf(out, "tunnels_active %lu\n", (unsigned long)LOAD(m->tunnels_active));
+    appendf(out, "tunnel_bytes %lu\n", (unsigned long)LOAD(m->tunnel_bytes));
+
+    for (int s = 0; s <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; s++)
+    {
+        uint64_t n = LOAD(m->status[s]);
+        if (!n) continue;
+        appendf(out, "responses{status=\"%d\"} %lu\n", s + METRICS_STATUS_MIN, (unsigned long)n);
+    }
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "phase=\"%s\"", phase_names[p]);
+        render_histogram_text(out, "latency_ns", label, &m->phases[p]);
+    }
+
+    for (int b = 0; b < backend_count; b++)
+    {
+        const UpstreamMetrics *up = &m->upstreams[b];
+        char label[PATH_MAX];
+        snprintf(label, sizeof(label), "backend=\"%s\"", backend_names[b]);
+        appendf(out, "upstream_requests{%s} %lu\n", label, (unsigned long)LOAD(up->requests));
+        appendf(out, "upstream_failures{%s} %lu\n", label, (unsigned long)LOAD(up->failures));
+        render_histogram_text(out, "upstream_latency_ns", label, &up->latency);
+    }
+}
+
+static void render_json(OutBuf *out, const WorkerMetrics *m)
+{
+    appendf(out, "{\"event_loops\":%d,\"metrics_threads\":%d,", atomic_load(&event_loops),
+            atomic_load(&slot_count));
+    appendf(out, "\"connections\":{\"accepted\":%lu,\"active\":%lu},",
+            (unsigned long)LOAD(m->connections_accepted),
+            (unsigned long)LOAD(m->connections_active));
+    appendf(out, "\"requests\":%lu,\"parse_errors\":%lu,", (unsigned long)LOAD(m->requests),
+            (unsigned long)LOAD(m->parse_errors));
+    appendf(out, "\"bytes\":{\"in\":%lu,\"out\":%lu},", (unsigned long)LOAD(m->bytes_in),
+            (unsigned long)LOAD(m->bytes_out));
+    appendf(out, "\"upstream_coalesced\":%lu,", (unsigned long)LOAD(m->upstream_coalesced));
+    appendf(out, "\"upstream_reused\":%lu,", (unsigned long)LOAD(m->upstream_reused));
+    appendf(out, "\"upstream_spliced\":%lu,", (unsigned long)LOAD(m->upstream_spliced));
+    appendf(out, "\"static_offloaded\":%lu,", (unsigned long)LOAD(m->static_offloaded));
+    appendf(out, "\"tls\":{\"handshakes\":%lu,\"resumed\":%lu,\"ktls\":%lu},",
+            (unsigned long)LOAD(m->tls_handshakes), (unsigned long)LOAD(m->tls_resumed),
+            (unsigned long)LOAD(m->tls_ktls));
+    appendf(out, "\"limited\":{\"requests\":%lu,\"connections\":%lu},",
+            (unsigned long)LOAD(m->limited_requests), (unsigned long)LOAD(m->limited_connections));
+    appendf(out, "\"shed\":{\"requests\":%lu,\"connections\":%lu,\"accept_pauses\":%lu},",
+            (unsigned long)LOAD(m->shed_requests), (unsigned long)LOAD(m->shed_connections),
+            (unsigned long)LOAD(m->accept_pauses));
+    appendf(out, "\"tunnels\":{\"opened\":%lu,\"active\":%lu,\"bytes\":%lu},",
+            (unsigned long)LOAD(m->tunnels_opened), (unsigned long)LOAD(m->tunnels_active),
+            (unsigned long)LOAD(m->tunnel_bytes));
+
+    appendf(out, "\"responses\":{");
+    const char *sep = "";
+    for (int s = 0; s <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; s++)
+    {
+        uint64_t n = LOAD(m->status[s]);
+        if (!n) continue;
+        appendf(out, "%s\"%d\":%lu", sep, s + METRICS_STATUS_MIN, (unsigned long)n);
+        sep = ",";
+    }
+
+    appendf(out, "},\"latency_ns\":{");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        appendf(out, "%s\"%s\":", p ? "," : "", phase_names[p]);
+        render_histogram_json(out, &m->phases[p]);
+    }
+
+    appendf(out, "},\"upstreams\":[");
+    for (int b = 0; b < backend_count; b++)
+    {
+        const UpstreamMetrics *up = &m->upstreams[b];
+        appendf(out, "%s{\"backend\":\"%s\",\"requests\":%lu,\"failures\":%lu,\"latency_ns\":",
+                b ? "," : "", backend_names[b], (unsigned long)LOAD(up->requests),
+                (unsigned long)LOAD(up->failures));
+        render_histogram_json(out, &up->latency);
+        appendf(out, "}");
+    }
+    appendf(out, "]}\n");
+}
+
+/**
+ * @brief   Renders aggregated metrics as plain text or JSON.
+ *
+ * @param   json     true for JSON, false for one "name{labels} value" line per metric.
+ * @param   out_len  Receives the length of the returned string.
+ *
+ * @return  Heap-allocated, NUL-terminated text (caller frees), or NULL on failure.
+ */
+char *metrics_render(bool json, size_t *out_len)
+{
+    WorkerMetrics *snapshot = metrics_snapshot();
+    if (!snapshot) return NULL;
+
+    OutBuf out = {malloc(INITIAL_RESPONSE_SIZE), 0, INITIAL_RESPONSE_SIZE};
+    if (out.data)
+    {
+        out.data[0] = '\0';
+        if (json)
+            render_json(&out, snapshot);
+        else
+            render_text(&out, snapshot);
+    }
+    free(snapshot);
+
+    if (out.data && out_len) *out_len = out.len;
+    return out.data;
+}
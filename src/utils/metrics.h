@@ -0,0 +1,131 @@
+/**
+ * @file    metrics.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Per-worker counters and latency histograms.
+ *
+ * @details Every worker thread owns one cache-line aligned WorkerMetrics slot
+ *          and is its only writer, so updates are plain relaxed loads and
+ *          stores with no shared cache lines. Readers sum all slots on demand
+ *          (metrics_snapshot()), which is only done when the stats URI is hit.
+ *          Threads beyond MAX_WORKERS share one overflow slot and update it
+ *          with atomic read-modify-writes instead.
+ *
+ *          Histograms are HDR-style log-linear: each power of two is split into
+ *          HIST_SUB_BUCKETS linear buckets, which bounds the relative error of
+ *          any reported percentile to 1/HIST_SUB_BUCKETS.
+ */
+
+#ifndef UTILS_METRICS_H
+#define UTILS_METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "common.h"
+
+#define MAX_WORKERS 64
+#define HIST_SUB_BUCKET_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BUCKET_BITS)
+#define HIST_MAX_BITS 40 // values are nanoseconds, ~18 minutes max
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BUCKET_BITS + 1) * HIST_SUB_BUCKETS)
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_MAX 599
+
+typedef enum
+{
+    PHASE_PARSE,
+    PHASE_HANDLE,
+    PHASE_SEND,
+    PHASE_LOOP, // one pass over a batch of ready events: the delay any of them can see
+    PHASE_COUNT
+} MetricsPhase;
+
+typedef struct Histogram
+{
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct UpstreamMetrics
+{
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t failures;
+    Histogram latency;
+} UpstreamMetrics;
+
+typedef struct WorkerMetrics
+{
+    _Alignas(64) atomic_uint_fast64_t connections_accepted;
+    atomic_uint_fast64_t connections_active;
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t parse_errors;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    atomic_uint_fast64_t upstream_coalesced;  // requests that joined a fetch already in flight
+    atomic_uint_fast64_t upstream_reused;     // fetches sent on a pooled keep-alive connection
+    atomic_uint_fast64_t upstream_spliced;    // body bytes relayed with splice(), never copied
+    atomic_uint_fast64_t static_offloaded;    // static requests served by the I/O pool
+    atomic_uint_fast64_t tls_handshakes;      // completed, resumed ones included
+    atomic_uint_fast64_t tls_resumed;         // handshakes that resumed a session
+    atomic_uint_fast64_t tls_ktls;            // connections whose records the kernel encrypts
+    atomic_uint_fast64_t limited_requests;    // answered 429 by limit_req
+    atomic_uint_fast64_t limited_connections; // refused at accept by limit_conn
+    atomic_uint_fast64_t shed_requests;       // answered 503 under overload
+    atomic_uint_fast64_t shed_connections;    // refused or closed early under overload
+    atomic_uint_fast64_t accept_pauses;       // times a loop stopped accepting
+    atomic_uint_fast64_t tunnels_opened;      // upgrades and CONNECTs turned into tunnels
+    atomic_uint_fast64_t tunnels_active;
+    atomic_uint_fast64_t tunnel_bytes;        // relayed through tunnels, both ways
+    atomic_uint_fast64_t status[METRICS_STATUS_MAX - METRICS_STATUS_MIN + 1];
+    Histogram phases[PHASE_COUNT];
+    UpstreamMetrics upstreams[MAX_BACKENDS];
+} WorkerMetrics;
+
+extern _Thread_local bool metrics_shared_slot; // the calling thread writes the overflow slot
+
+/* Single writer per slot: a relaxed load/store pair is enough and avoids a locked RMW */
+static inline void metric_add(atomic_uint_fast64_t *counter, uint64_t n)
+{
+    if (__builtin_expect(metrics_shared_slot, 0))
+        atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+    else
+        atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                              memory_order_relaxed);
+}
+
+static inline void metric_sub(atomic_uint_fast64_t *counter, uint64_t n)
+{
+    if (__builtin_expect(metrics_shared_slot, 0))
+        atomic_fetch_sub_explicit(counter, n, memory_order_relaxed);
+    else
+        atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) - n,
+                              memory_order_relaxed);
+}
+
+static inline uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int metrics_register_worker(void);
+WorkerMetrics *metrics_local(void);
+void metrics_set_backends(char **names, int count);
+
+int histogram_bucket_index(uint64_t value);
+uint64_t histogram_bucket_value(int index);
+void histogram_record(Histogram *hist, uint64_t value);
+uint64_t histogram_percentile(const Histogram *hist, double percentile);
+
+void metrics_count_status(int status_code);
+void metrics_record_phase(MetricsPhase phase, uint64_t start_ns);
+void metrics_record_upstream(int backend, uint64_t start_ns, bool failed);
+
+WorkerMetrics *metrics_snapshot(void);
+char *metrics_render(bool json, size_t *out_len);
+
+#endif /* UTILS_METRICS_H */
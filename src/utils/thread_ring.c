@@ -0,0 +1,185 @@
+/**
+ * @file    thread_ring.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Per-thread rings: registration, retirement, draining and wakeups.
+ *
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "thread_ring.h"
+
+/**
+ * @brief   Hands a ring back when its thread exits: the consumer drains
+ *          what is left in it, then frees it.
+ */
+static void retire_ring(void *arg)
+{
+    ThreadRing *ring = arg;
+    *ring->owner     = NULL;
+    atomic_store_explicit(&ring->retired, true, memory_order_release);
+    thread_rings_wake(ring->set);
+}
+
+/**
+ * @brief   Creates the wakeup eventfd and the key that retires rings.
+ *
+ * Called before the consumer starts; later calls do nothing.
+ *
+ * @return  0 on success, -1 if either could not be created.
+ */
+int thread_rings_init(ThreadRings *set)
+{
+    if (set->wake_fd >= 0) return 0;
+    if (pthread_key_create(&set->key, retire_ring) != 0) return -1;
+    set->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (set->wake_fd < 0)
+    {
+        pthread_key_delete(set->key);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief   Creates the calling thread's ring and publishes it to the consumer.
+ *
+ * @return  The ring, or NULL if it could not be allocated.
+ */
+ThreadRing *thread_ring_attach(ThreadRings *set, ThreadRing **local)
+{
+    size_t size = sizeof(ThreadRing) + set->capacity * set->record_size;
+    size        = (size + THREAD_RING_CACHE_LINE - 1) & ~(size_t)(THREAD_RING_CACHE_LINE - 1);
+    ThreadRing *ring = aligned_alloc(THREAD_RING_CACHE_LINE, size);
+    if (!ring) return NULL;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->retired, false);
+    ring->owner = local;
+    ring->set   = set;
+    pthread_setspecific(set->key, ring);
+
+    // The consumer only ever walks the list forward
+    ring->next = atomic_load_explicit(&set->rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&set->rings, &ring->next, ring,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+
+    *local = ring;
+    return ring;
+}
+
+void thread_rings_wake(ThreadRings *set)
+{
+    // Fails only with the counter saturated, and then the consumer wakes anyway
+    uint64_t one = 1;
+    ssize_t n    = write(set->wake_fd, &one, sizeof(one));
+    (void)n;
+}
+
+/**
+ * @brief   Hands everything currently queued in one ring to consume.
+ *
+ * @return  Number of records consumed.
+ */
+static size_t drain_ring(ThreadRings *set, ThreadRing *ring, ThreadRingConsumer consume,
+                         void *ctx)
+{
+    void *batch[THREAD_RING_BATCH];
+    size_t taken = 0;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (tail != head)
+    {
+        size_t count = 0;
+        while (tail + count != head && count < THREAD_RING_BATCH)
+        {
+            size_t slot    = (tail + count) & (set->capacity - 1);
+            batch[count++] = ring->records + slot * set->record_size;
+        }
+        consume(ctx, batch, count);
+        taken += count;
+
+        // Slots are handed back only once consume() is done with them
+        tail += count;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    return taken;
+}
+
+/**
+ * @brief   Drains every ring of the set, freeing those of exited threads.
+ *
+ * Producers only ever push at the head of the list, so a retired ring
+ * behind the head is unlinked with a plain store. One at the head stays
+ * until a newer ring is pushed in front of it.
+ *
+ * @return  Number of records consumed.
+ */
+size_t thread_rings_drain(ThreadRings *set, ThreadRingConsumer consume, void *ctx)
+{
+    size_t taken     = 0;
+    ThreadRing *prev = NULL;
+    ThreadRing *ring = atomic_load_explicit(&set->rings, memory_order_acquire);
+    while (ring)
+    {
+        bool retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+        taken += drain_ring(set, ring, consume, ctx);
+        ThreadRing *next = ring->next;
+        if (retired && prev)
+        {
+            prev->next = next;
+            free(ring);
+        }
+        else
+        {
+            prev = ring;
+        }
+        ring = next;
+    }
+    return taken;
+}
+
+/**
+ * @brief   True if a ring holds records, or a retired ring the drain can free.
+ */
+static bool records_pending(ThreadRings *set)
+{
+    ThreadRing *first = atomic_load_explicit(&set->rings, memory_order_acquire);
+    for (ThreadRing *ring = first; ring; ring = ring->next)
+    {
+        if (atomic_load_explicit(&ring->head, memory_order_acquire) !=
+            atomic_load_explicit(&ring->tail, memory_order_relaxed))
+            return true;
+        if (ring != first && atomic_load_explicit(&ring->retired, memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief   Blocks the consumer until a record is queued, a thread exits,
+ *          thread_rings_wake() is called or timeout_ms passes (-1: no timeout).
+ */
+void thread_rings_wait(ThreadRings *set, int timeout_ms)
+{
+    atomic_store_explicit(&set->sleeping, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!records_pending(set))
+    {
+        struct pollfd pfd = {.fd = set->wake_fd, .events = POLLIN};
+        while (poll(&pfd, 1, timeout_ms) < 0 && errno == EINTR)
+            ;
+        uint64_t count;
+        ssize_t n = read(set->wake_fd, &count, sizeof(count));
+        (void)n;
+    }
+    atomic_store_explicit(&set->sleeping, false, memory_order_relaxed);
+}
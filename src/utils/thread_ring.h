@@ -0,0 +1,117 @@
+/**
+ * @file    thread_ring.h
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Per-thread single-producer rings drained by one background thread.
+ *
+ * @details A ThreadRings set hands every producing thread its own ring of
+ *          fixed-size records, so producers never share a cache line or
+ *          take a lock. One consumer thread drains all rings of a set in
+ *          batches. While every ring is empty it sleeps on an eventfd, and
+ *          the first record committed after that wakes it. A thread's ring
+ *          is retired when the thread exits and freed by the consumer once
+ *          drained. A record that finds its ring full is dropped and
+ *          counted instead of waiting.
+ *
+ *          The logger and the access log each own one set.
+ */
+
+#ifndef UTILS_THREAD_RING_H
+#define UTILS_THREAD_RING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define THREAD_RING_CACHE_LINE 64
+#define THREAD_RING_BATCH 64 // records handed to the consumer at once
+
+struct ThreadRings;
+
+typedef struct ThreadRing
+{
+    _Alignas(THREAD_RING_CACHE_LINE) atomic_size_t head; // next slot the producer fills
+    _Alignas(THREAD_RING_CACHE_LINE) atomic_size_t tail; // next slot the consumer takes
+    atomic_bool retired;       // its thread exited; freed by the consumer once empty
+    struct ThreadRing **owner; // the thread-local pointer to clear when retired
+    struct ThreadRings *set;
+    struct ThreadRing *next;
+    _Alignas(THREAD_RING_CACHE_LINE) unsigned char records[];
+} ThreadRing;
+
+typedef struct ThreadRings
+{
+    size_t record_size;
+    size_t capacity;              // records per ring, a power of two
+    _Atomic(ThreadRing *) rings;  // lock-free list of every live ring, newest first
+    atomic_bool sleeping;         // the consumer waits on wake_fd
+    atomic_uint_fast64_t dropped; // records lost to full rings
+    int wake_fd;
+    pthread_key_t key;            // its destructor retires the ring of an exiting thread
+} ThreadRings;
+
+#define THREAD_RINGS_INIT(type, ring_capacity)                                                    \
+    {                                                                                              \
+        .record_size = sizeof(type), .capacity = (ring_capacity), .wake_fd = -1                    \
+    }
+
+/* Called with up to THREAD_RING_BATCH records; their slots are reused once it returns */
+typedef void (*ThreadRingConsumer)(void *ctx, void *const *records, size_t count);
+
+int thread_rings_init(ThreadRings *set);
+ThreadRing *thread_ring_attach(ThreadRings *set, ThreadRing **local);
+void thread_rings_wake(ThreadRings *set);
+size_t thread_rings_drain(ThreadRings *set, ThreadRingConsumer consume, void *ctx);
+void thread_rings_wait(ThreadRings *set, int timeout_ms);
+
+/**
+ * @brief   Returns the calling thread's ring, creating it on first use.
+ *
+ * local is the caller's _Thread_local pointer for this set.
+ *
+ * @return  The ring, or NULL if it could not be allocated.
+ */
+static inline ThreadRing *thread_ring_local(ThreadRings *set, ThreadRing **local)
+{
+    return *local ? *local : thread_ring_attach(set, local);
+}
+
+/**
+ * @brief   Returns the slot the next record goes into, to be filled and then
+ *          published with thread_ring_commit().
+ *
+ * @return  The slot, or NULL if the ring is full and the record was counted
+ *          as dropped.
+ */
+static inline void *thread_ring_reserve(ThreadRings *set, ThreadRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= set->capacity)
+    {
+        atomic_fetch_add_explicit(&set->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return ring->records + (head & (set->capacity - 1)) * set->record_size;
+}
+
+static inline void thread_ring_commit(ThreadRings *set, ThreadRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    // Pairs with the fence in thread_rings_wait(): either it sees the record or we see it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&set->sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&set->sleeping, false, memory_order_relaxed))
+        thread_rings_wake(set);
+}
+
+static inline uint64_t thread_rings_dropped(ThreadRings *set)
+{
+    return atomic_load_explicit(&set->dropped, memory_order_relaxed);
+}
+
+#endif /* UTILS_THREAD_RING_H */
@@ -0,0 +1,37 @@
+/**
+ * @file    test.h
+ * @brief   Minimal test framework shared by the unit test runners.
+ */
+
+#ifndef TESTS_TEST_H
+#define TESTS_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ------------------------------------------------------------------ */
+/* Minimal test framework                                               */
+/* ------------------------------------------------------------------ */
+
+static int g_tests_run    = 0;
+static int g_tests_passed = 0;
+
+/* On failure: print the location and exit non-zero so CTest marks as failed */
+#define ASSERT(expr)                                                        \
+    do {                                                                    \
+        if (!(expr)) {                                                      \
+            fprintf(stderr, "  [FAIL] %s:%d  assertion failed: %s\n",      \
+                    __FILE__, __LINE__, #expr);                             \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+#define RUN(fn)                                                             \
+    do {                                                                    \
+        g_tests_run++;                                                      \
+        fn();                                                               \
+        g_tests_passed++;                                                   \
+        printf("  [PASS] %s\n", #fn);                                      \
+    } while (0)
+
+#endif /* TESTS_TEST_H */
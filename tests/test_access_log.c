@@ -0,0 +1,298 @@
+/**
+ * @file    test_access_log.c
+ * @brief   Unit tests for access log templates, the binary format and the writer.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils/access_log.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static void make_record(AccessRecord *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->time_us = 1760000000123456ull;
+    rec->status  = 200;
+    rec->worker  = 3;
+    rec->family  = AF_INET;
+    inet_pton(AF_INET, "192.0.2.7", rec->addr);
+    rec->bytes_sent = 1234;
+    strcpy(rec->method, "GET");
+    strcpy(rec->protocol, "HTTP/1.1");
+    rec->uri_len = 9;
+    memcpy(rec->uri, "/api/item", 9);
+
+    rec->phases[ACCESS_FIRST_BYTE]          = 1000;
+    rec->phases[ACCESS_PARSED]              = 25000;
+    rec->phases[ACCESS_HANDLER]             = 30000;
+    rec->phases[ACCESS_UPSTREAM_CONNECT]    = ACCESS_UNSET;
+    rec->phases[ACCESS_UPSTREAM_FIRST_BYTE] = ACCESS_UNSET;
+    rec->phases[ACCESS_LAST_BYTE]           = 2501000;
+}
+
+static char *render(const char *spec, const AccessRecord *rec)
+{
+    static char line[ACCESS_LINE_MAX];
+    AccessLogFormat fmt;
+    ASSERT(access_log_format_compile(&fmt, spec) == OK);
+    size_t len    = access_log_render(&fmt, rec, line, sizeof(line));
+    line[len - 1] = '\0'; // the newline
+    access_log_format_free(&fmt);
+    return line;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    ASSERT(f != NULL);
+    static char data[64 * 1024];
+    *len = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    return data;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_format_compile(void)
+{
+    AccessLogFormat fmt;
+    ASSERT(access_log_format_compile(&fmt, DEFAULT_ACCESS_LOG_FORMAT) == OK);
+    access_log_format_free(&fmt);
+
+    // A '$' without a name is text; an unknown name is an error
+    ASSERT(access_log_format_compile(&fmt, "cost $5 $status") == OK);
+    ASSERT(fmt.token_count == 2);
+    access_log_format_free(&fmt);
+    ASSERT(access_log_format_compile(&fmt, "$status $referer") < 0);
+    ASSERT(fmt.spec == NULL);
+
+    char many[ACCESS_FORMAT_MAX_TOKENS * 8 + 1] = "";
+    for (int i = 0; i <= ACCESS_FORMAT_MAX_TOKENS / 2; i++)
+        strcat(many, "$status ");
+    ASSERT(access_log_format_compile(&fmt, many) < 0);
+}
+
+static void test_render(void)
+{
+    AccessRecord rec;
+    make_record(&rec);
+
+    ASSERT(strcmp(render("$remote_addr \"$request\" $status $bytes_sent $worker", &rec),
+                  "192.0.2.7 \"GET /api/item HTTP/1.1\" 200 1234 3") == 0);
+    ASSERT(strcmp(render("$method $uri $protocol", &rec), "GET /api/item HTTP/1.1") == 0);
+    ASSERT(strcmp(render("$msec", &rec), "1760000000.123") == 0);
+
+    // Phases are microseconds since accept, "-" for those never reached
+    ASSERT(strcmp(render("$first_byte_us $parsed_us $handler_us $upstream_connect_us "
+                         "$upstream_first_byte_us $last_byte_us $request_time_us",
+                         &rec),
+                  "1 25 30 - - 2501 2500") == 0);
+
+    // A request turned away before parsing has no request line
+    AccessRecord bare;
+    memset(&bare, 0, sizeof(bare));
+    for (int i = 0; i < ACCESS_PHASES; i++)
+        bare.phases[i] = ACCESS_UNSET;
+    ASSERT(strcmp(render("$remote_addr \"$request\" $uri $status $request_time_us", &bare),
+                  "- \"-\" - - -") == 0);
+
+    // Lines are cut to the buffer, newline kept
+    char small[8];
+    AccessLogFormat fmt;
+    ASSERT(access_log_format_compile(&fmt, "$request") == OK);
+    ASSERT(access_log_render(&fmt, &rec, small, sizeof(small)) == sizeof(small));
+    ASSERT(memcmp(small, "GET /ap\n", 8) == 0);
+    access_log_format_free(&fmt);
+}
+
+static void test_render_escapes(void)
+{
+    AccessRecord rec;
+    make_record(&rec);
+
+    // Quotes, backslashes, controls and high bytes cannot forge fields
+    static const char uri[] = "/a\" 200 1\t\\\x1b[2J\xff";
+    rec.uri_len             = sizeof(uri) - 1;
+    memcpy(rec.uri, uri, rec.uri_len);
+    strcpy(rec.method, "G\"T");
+    ASSERT(strcmp(render("\"$request\" $status", &rec),
+                  "\"G\\x22T /a\\x22 200 1\\x09\\x5C\\x1B[2J\\xFF HTTP/1.1\" 200") == 0);
+    ASSERT(strcmp(render("$uri", &rec), "/a\\x22 200 1\\x09\\x5C\\x1B[2J\\xFF") == 0);
+
+    // An escape that does not fit is left out whole
+    char small[6];
+    AccessLogFormat fmt;
+    ASSERT(access_log_format_compile(&fmt, "$uri") == OK);
+    ASSERT(access_log_render(&fmt, &rec, small, sizeof(small)) == 3);
+    ASSERT(memcmp(small, "/a\n", 3) == 0);
+    access_log_format_free(&fmt);
+}
+
+static void test_binary_round_trip(void)
+{
+    AccessRecord rec, back;
+    make_record(&rec);
+    rec.phases[ACCESS_PARSED] = 25999; // kept to the microsecond
+
+    uint8_t buf[ACCESS_BINARY_RECORD_MAX];
+    ASSERT(access_log_encode(&rec, buf, sizeof(buf) - 1) == 0);
+    size_t len = access_log_encode(&rec, buf, sizeof(buf));
+    ASSERT(len > 0 && len < 64);
+
+    ASSERT(access_log_decode(buf, len, &back) == (ssize_t)len);
+    ASSERT(back.time_us == rec.time_us && back.status == 200 && back.worker == 3);
+    ASSERT(back.family == AF_INET && memcmp(back.addr, rec.addr, 4) == 0);
+    ASSERT(back.bytes_sent == 1234);
+    ASSERT(strcmp(back.method, "GET") == 0 && strcmp(back.protocol, "HTTP/1.1") == 0);
+    ASSERT(back.uri_len == 9 && memcmp(back.uri, "/api/item", 9) == 0);
+    ASSERT(back.phases[ACCESS_PARSED] == 25000);
+    ASSERT(back.phases[ACCESS_UPSTREAM_CONNECT] == ACCESS_UNSET);
+    ASSERT(back.phases[ACCESS_LAST_BYTE] == 2501000);
+
+    // IPv6 and a URI at the length limit
+    rec.family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::1", rec.addr);
+    rec.uri_len = ACCESS_URI_MAX;
+    memset(rec.uri, 'u', ACCESS_URI_MAX);
+    len = access_log_encode(&rec, buf, sizeof(buf));
+    ASSERT(access_log_decode(buf, len, &back) == (ssize_t)len);
+    ASSERT(back.family == AF_INET6 && memcmp(back.addr, rec.addr, 16) == 0);
+    ASSERT(back.uri_len == ACCESS_URI_MAX);
+
+    // Partial input asks for more; a corrupt record is rejected
+    ASSERT(access_log_decode(buf, 1, &back) == 0);
+    ASSERT(access_log_decode(buf, len - 1, &back) == 0);
+    buf[len - ACCESS_URI_MAX - 2 - strlen("HTTP/1.1") - 1 - strlen("GET") - 1] = 200; // method
+    ASSERT(access_log_decode(buf, len, &back) < 0);
+}
+
+static void test_writer(void)
+{
+    char path[] = "/tmp/cserve_test_access_log.XXXXXX";
+    int fd      = mkstemp(path);
+    ASSERT(fd >= 0);
+    close(fd);
+
+    AccessRecord rec;
+    make_record(&rec);
+
+    // Text: records written before close are all in the file, in order
+    AccessLogOptions opts;
+    access_log_options_defaults(&opts);
+    opts.path   = path;
+    opts.format = "$status $uri";
+    ASSERT(access_log_open(&opts) == OK && access_log_on);
+    for (int i = 0; i < 100; i++)
+    {
+        rec.status = 200 + i;
+        access_log_write(&rec);
+    }
+    access_log_close();
+    ASSERT(!access_log_on);
+
+    size_t len;
+    char *data = read_file(path, &len);
+    ASSERT(len == 100 * strlen("200 /api/item\n"));
+    ASSERT(memcmp(data, "200 /api/item\n201 /api/item\n", 28) == 0);
+    ASSERT(memcmp(data + len - 14, "299 /api/item\n", 14) == 0);
+
+    // Binary refuses to append to a text log; a fresh file gets the header
+    opts.binary = true;
+    ASSERT(access_log_open(&opts) < 0 && !access_log_on);
+    ASSERT(truncate(path, 0) == 0);
+    ASSERT(access_log_open(&opts) == OK);
+    access_log_write(&rec);
+    access_log_write(&rec);
+    access_log_close();
+
+    uint8_t *bytes = (uint8_t *)read_file(path, &len);
+    ASSERT(len > ACCESS_BINARY_HEADER_SIZE && memcmp(bytes, ACCESS_BINARY_MAGIC, 4) == 0);
+    AccessRecord back;
+    len -= ACCESS_BINARY_HEADER_SIZE;
+    bytes += ACCESS_BINARY_HEADER_SIZE;
+    ssize_t first = access_log_decode(bytes, len, &back);
+    ASSERT(first > 0 && back.status == 299);
+    ASSERT(access_log_decode(bytes + first, len - first, &back) == first);
+    ASSERT(2 * (size_t)first == len);
+
+    // A bad template fails the open; no path leaves the log off
+    opts.format = "$nonsense";
+    ASSERT(access_log_open(&opts) < 0);
+    access_log_options_defaults(&opts);
+    ASSERT(access_log_open(&opts) == OK && !access_log_on);
+
+    unlink(path);
+}
+
+static void *write_and_exit(void *arg)
+{
+    (void)arg;
+    AccessRecord rec;
+    make_record(&rec);
+    for (int i = 0; i < 10; i++)
+        access_log_write(&rec);
+    return NULL;
+}
+
+static void test_writer_flushes_while_idle(void)
+{
+    char path[] = "/tmp/cserve_test_access_log.XXXXXX";
+    int fd      = mkstemp(path);
+    ASSERT(fd >= 0);
+    close(fd);
+
+    AccessLogOptions opts;
+    access_log_options_defaults(&opts);
+    opts.path   = path;
+    opts.format = "$status $uri";
+    ASSERT(access_log_open(&opts) == OK);
+
+    // Records of a thread that has exited are written once the interval is up, log still open
+    pthread_t thread;
+    ASSERT(pthread_create(&thread, NULL, write_and_exit, NULL) == 0);
+    pthread_join(thread, NULL);
+
+    struct stat st;
+    size_t expected = 10 * strlen("200 /api/item\n");
+    for (int i = 0; i < 300 && (stat(path, &st) < 0 || (size_t)st.st_size < expected); i++)
+        usleep(10000);
+    ASSERT((size_t)st.st_size == expected);
+
+    access_log_close();
+    unlink(path);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve access log tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ access log ]\n");
+    RUN(test_format_compile);
+    RUN(test_render);
+    RUN(test_render_escapes);
+    RUN(test_binary_round_trip);
+    RUN(test_writer);
+    RUN(test_writer_flushes_while_idle);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
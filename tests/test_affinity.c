@@ -0,0 +1,144 @@
+/**
+ * @file    test_affinity.c
+ * @brief   Unit tests for worker options, CPU placement and listener steering.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "utils/affinity.h"
+#include "sock/server.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_worker_count(void)
+{
+    WorkerOptions opts;
+    worker_options_defaults(&opts);
+    ASSERT(worker_count(&opts) == 1 && worker_cpu(&opts, 0) == -1);
+
+    ASSERT(worker_options_set_count(&opts, "4") == OK && worker_count(&opts) == 4);
+    ASSERT(worker_options_set_count(&opts, "100000") == OK && worker_count(&opts) == MAX_WORKERS);
+    ASSERT(worker_options_set_count(&opts, "0") < 0);
+    ASSERT(worker_options_set_count(&opts, "4x") < 0);
+    ASSERT(worker_options_set_count(&opts, "many") < 0);
+
+    cpu_set_t set;
+    ASSERT(sched_getaffinity(0, sizeof(set), &set) == 0);
+    ASSERT(worker_options_set_count(&opts, "auto") == OK);
+    ASSERT(worker_count(&opts) == (CPU_COUNT(&set) < MAX_WORKERS ? CPU_COUNT(&set) : MAX_WORKERS));
+
+    // A zeroed Config still means one worker
+    memset(&opts, 0, sizeof(opts));
+    ASSERT(worker_count(&opts) == 1);
+}
+
+static void test_affinity_parsing(void)
+{
+    WorkerOptions opts;
+    worker_options_defaults(&opts);
+
+    ASSERT(worker_options_set_affinity(&opts, "0 2 4-6,9") == OK);
+    ASSERT(opts.affinity == AFFINITY_LIST && opts.cpu_count == 6);
+    int expected[] = {0, 2, 4, 5, 6, 9};
+    for (int i = 0; i < 6; i++)
+        ASSERT(worker_cpu(&opts, i) == expected[i]);
+    ASSERT(worker_cpu(&opts, 6) == 0); // more workers than CPUs listed wrap around
+
+    ASSERT(worker_options_set_affinity(&opts, "") < 0);
+    ASSERT(worker_options_set_affinity(&opts, "3-1") < 0);
+    ASSERT(worker_options_set_affinity(&opts, "1-") < 0);
+    ASSERT(worker_options_set_affinity(&opts, "cpu0") < 0);
+    ASSERT(opts.affinity == AFFINITY_LIST && opts.cpu_count == 6);
+
+    ASSERT(worker_options_set_affinity(&opts, "off") == OK && worker_cpu(&opts, 0) == -1);
+
+    // Automatic placement only hands out CPUs the process may run on
+    cpu_set_t set;
+    ASSERT(sched_getaffinity(0, sizeof(set), &set) == 0);
+    ASSERT(worker_options_set_affinity(&opts, "auto") == OK);
+    for (int i = 0; i < 8; i++)
+    {
+        int cpu = worker_cpu(&opts, i);
+        ASSERT(cpu >= 0 && CPU_ISSET(cpu, &set));
+    }
+}
+
+static void test_pinning_and_node_memory(void)
+{
+    WorkerOptions opts;
+    worker_options_defaults(&opts);
+    ASSERT(worker_options_set_affinity(&opts, "auto") == OK);
+    int cpu = worker_cpu(&opts, 0);
+    ASSERT(pin_thread_to_cpu(cpu) == OK);
+    ASSERT(sched_getcpu() == cpu);
+    ASSERT(pin_thread_to_cpu(CPU_SETSIZE - 1) < 0);
+
+    size_t size   = 1 << 20;
+    uint8_t *data = node_alloc(size, cpu);
+    ASSERT(data != NULL);
+    bool zeroed = true;
+    for (size_t i = 0; i < size; i += 4096)
+        zeroed = zeroed && data[i] == 0;
+    ASSERT(zeroed);
+    memset(data, 0xab, size);
+    node_free(data, size);
+}
+
+static void test_reuseport_steering(void)
+{
+    SocketOptions options;
+    socket_options_defaults(&options);
+    options.reuseport = true;
+
+    // Two listeners on one port form a group the selector can be attached to
+    SocketServer *first = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_LOOPBACK, 0, &options);
+    ASSERT(bind(first->socket, (struct sockaddr *)&first->address, sizeof(first->address)) == 0);
+    ASSERT(listen(first->socket, 16) == 0);
+    struct sockaddr_in bound;
+    socklen_t len = sizeof(bound);
+    ASSERT(getsockname(first->socket, (struct sockaddr *)&bound, &len) == 0);
+
+    SocketServer *second = server_constructor(AF_INET, SOCK_STREAM, 0, INADDR_LOOPBACK,
+                                              ntohs(bound.sin_port), &options);
+    ASSERT(bind(second->socket, (struct sockaddr *)&second->address, sizeof(second->address)) ==
+           0);
+    ASSERT(listen(second->socket, 16) == 0);
+
+    int cpus[] = {0, 1};
+    prefer_incoming_cpu(first->socket, 0);
+    prefer_incoming_cpu(second->socket, 1);
+    ASSERT(steer_reuseport_group(first->socket, cpus, 2) == OK);
+
+    server_destructor(second);
+    server_destructor(first);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve affinity tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ affinity ]\n");
+    RUN(test_worker_count);
+    RUN(test_affinity_parsing);
+    RUN(test_pinning_and_node_memory);
+    RUN(test_reuseport_steering);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
@@ -0,0 +1,297 @@
+/**
+ * @file    test_coroutine.c
+ * @brief   Unit tests for the coroutine scheduler and its yielding socket calls.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/coroutine.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+#define TEST_KIND 42
+
+static int trace[32];
+static int trace_len;
+static int done_count;
+
+static void record(int step)
+{
+    if (trace_len < (int)(sizeof(trace) / sizeof(trace[0]))) trace[trace_len++] = step;
+}
+
+static void count_done(void *arg)
+{
+    (void)arg;
+    done_count++;
+}
+
+/* Runs the scheduler's loop until every coroutine has ended, or 2 s pass */
+static void run_until_idle(CoScheduler *s)
+{
+    struct epoll_event events[16];
+    for (int rounds = 0; s->count > 0 && rounds < 200; rounds++)
+    {
+        int n = epoll_wait(s->epoll_fd, events, 16, co_next_timeout(s, 10));
+        for (int i = 0; i < n; i++)
+        {
+            ASSERT(*(int *)events[i].data.ptr == TEST_KIND);
+            co_handle_event(events[i].data.ptr, events[i].events);
+        }
+        co_run_due(s);
+    }
+}
+
+static void sleeper(void *arg)
+{
+    int ms = (int)(intptr_t)arg;
+    ASSERT(co_active());
+    ASSERT(co_sleep(ms) == 0);
+    record(ms);
+}
+
+/* Deep enough to need more than a page of stack, with registers live across the switch */
+static int deep(int depth)
+{
+    volatile char frame[512];
+    frame[0] = (char)depth;
+    if (depth == 0)
+    {
+        co_sleep(1);
+        return frame[0];
+    }
+    return deep(depth - 1) + frame[0];
+}
+
+static void recurse(void *arg)
+{
+    *(int *)arg = deep(32);
+}
+
+typedef struct Echo
+{
+    int fd;
+    char received[64];
+    ssize_t received_len;
+} Echo;
+
+/* Reads one message, then answers it */
+static void echo(void *arg)
+{
+    Echo *e         = arg;
+    e->received_len = co_recv(e->fd, e->received, sizeof(e->received), 0);
+    if (e->received_len > 0) co_send(e->fd, e->received, e->received_len, MSG_NOSIGNAL);
+}
+
+typedef struct Dial
+{
+    struct sockaddr_in addr;
+    int fd;
+    int result;
+} Dial;
+
+static void dial(void *arg)
+{
+    Dial *d   = arg;
+    d->result = co_connect(d->fd, (struct sockaddr *)&d->addr, sizeof(d->addr));
+}
+
+typedef struct Waiter
+{
+    int fd;
+    ssize_t received;
+    int recv_errno;
+    int slept;
+} Waiter;
+
+/* Waits on a socket nobody writes to, then sleeps a minute */
+static void wait_forever(void *arg)
+{
+    Waiter *w = arg;
+    char byte;
+    w->received   = co_recv(w->fd, &byte, 1, 0);
+    w->recv_errno = errno;
+    w->slept      = co_sleep(60000);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_sleep_order(void)
+{
+    CoScheduler s;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    co_scheduler_init(&s, epoll_fd, TEST_KIND);
+    trace_len  = 0;
+    done_count = 0;
+
+    // Spawning never runs the coroutine; the loop starts it
+    ASSERT(!co_active());
+    ASSERT(co_spawn(&s, sleeper, count_done, (void *)(intptr_t)30) == OK);
+    ASSERT(co_spawn(&s, sleeper, count_done, (void *)(intptr_t)10) == OK);
+    ASSERT(co_spawn(&s, sleeper, count_done, (void *)(intptr_t)20) == OK);
+    ASSERT(s.count == 3 && trace_len == 0);
+    ASSERT(co_next_timeout(&s, 60) == 0);
+
+    // Each wakes by its own deadline, and done runs once it is gone
+    run_until_idle(&s);
+    ASSERT(s.count == 0 && done_count == 3);
+    ASSERT(trace_len == 3 && trace[0] == 10 && trace[1] == 20 && trace[2] == 30);
+    ASSERT(co_next_timeout(&s, 60) == 60);
+
+    co_scheduler_free(&s);
+    close(epoll_fd);
+}
+
+static void test_stack(void)
+{
+    CoScheduler s;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    co_scheduler_init(&s, epoll_fd, TEST_KIND);
+
+    // Locals survive switches on a stack deeper than one page
+    int results[4] = {0};
+    for (int i = 0; i < 4; i++)
+        ASSERT(co_spawn(&s, recurse, NULL, &results[i]) == OK);
+    run_until_idle(&s);
+    for (int i = 0; i < 4; i++)
+        ASSERT(results[i] == 32 * 33 / 2);
+
+    // Finished stacks are reused rather than mapped again
+    void *stack = NULL;
+    ASSERT(co_spawn(&s, recurse, NULL, &results[0]) == OK);
+    stack = s.all->stack;
+    run_until_idle(&s);
+    ASSERT(co_spawn(&s, recurse, NULL, &results[0]) == OK);
+    ASSERT(s.all->stack == stack);
+    run_until_idle(&s);
+
+    co_scheduler_free(&s);
+    close(epoll_fd);
+}
+
+static void test_socket_io(void)
+{
+    CoScheduler s;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    co_scheduler_init(&s, epoll_fd, TEST_KIND);
+
+    int pair[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+
+    // The coroutine waits in co_recv() without blocking the loop
+    Echo e = {.fd = pair[0]};
+    ASSERT(co_spawn(&s, echo, NULL, &e) == OK);
+    co_run_due(&s);
+    ASSERT(s.count == 1 && s.all->state == CO_WAITING && s.all->wait_fd == pair[0]);
+
+    ASSERT(send(pair[1], "ping", 4, 0) == 4);
+    run_until_idle(&s);
+    ASSERT(e.received_len == 4 && memcmp(e.received, "ping", 4) == 0);
+
+    char reply[8];
+    ASSERT(recv(pair[1], reply, sizeof(reply), MSG_DONTWAIT) == 4);
+    ASSERT(memcmp(reply, "ping", 4) == 0);
+
+    // Off a coroutine the same calls just block
+    ASSERT(!co_active());
+    ASSERT(co_send(pair[1], "pong", 4, 0) == 4);
+    ASSERT(co_recv(pair[0], reply, sizeof(reply), 0) == 4);
+
+    close(pair[0]);
+    close(pair[1]);
+    co_scheduler_free(&s);
+    close(epoll_fd);
+}
+
+static void test_connect(void)
+{
+    CoScheduler s;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    co_scheduler_init(&s, epoll_fd, TEST_KIND);
+
+    int listener            = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len      = sizeof(addr);
+    ASSERT(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    ASSERT(listen(listener, 4) == 0);
+    ASSERT(getsockname(listener, (struct sockaddr *)&addr, &addr_len) == 0);
+
+    // A blocking socket connects on a coroutine and comes back blocking
+    Dial d = {.addr = addr, .fd = socket(AF_INET, SOCK_STREAM, 0), .result = 1};
+    ASSERT(co_spawn(&s, dial, NULL, &d) == OK);
+    run_until_idle(&s);
+    ASSERT(d.result == 0);
+    ASSERT(!(fcntl(d.fd, F_GETFL) & O_NONBLOCK));
+    close(d.fd);
+
+    // A refused connect reports the socket's error
+    close(listener);
+    d.fd     = socket(AF_INET, SOCK_STREAM, 0);
+    d.result = 1;
+    ASSERT(co_spawn(&s, dial, NULL, &d) == OK);
+    run_until_idle(&s);
+    ASSERT(d.result == -1);
+    close(d.fd);
+
+    co_scheduler_free(&s);
+    close(epoll_fd);
+}
+
+static void test_cancel(void)
+{
+    CoScheduler s;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    co_scheduler_init(&s, epoll_fd, TEST_KIND);
+    done_count = 0;
+
+    int pair[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    Waiter started = {.fd = pair[0]}, pending = {.fd = pair[0]};
+    ASSERT(co_spawn(&s, wait_forever, count_done, &started) == OK);
+    co_run_due(&s);
+    ASSERT(co_spawn(&s, wait_forever, count_done, &pending) == OK);
+    ASSERT(s.count == 2);
+
+    // Waits fail with ECANCELED and every coroutine runs to its end, started or not
+    co_scheduler_cancel(&s);
+    ASSERT(s.count == 0 && done_count == 2);
+    ASSERT(started.received == -1 && started.recv_errno == ECANCELED && started.slept == -1);
+    ASSERT(pending.received == -1 && pending.recv_errno == ECANCELED && pending.slept == -1);
+
+    close(pair[0]);
+    close(pair[1]);
+    co_scheduler_free(&s);
+    close(epoll_fd);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve coroutine tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ coroutine ]\n");
+    RUN(test_sleep_order);
+    RUN(test_stack);
+    RUN(test_socket_io);
+    RUN(test_connect);
+    RUN(test_cancel);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
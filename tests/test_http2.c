@@ -0,0 +1,562 @@
+/**
+ * @file    test_http2.c
+ * @brief   Unit tests for HPACK and the HTTP/2 session.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http/hpack.h"
+#include "http/http2.h"
+#include "http/parsers.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static size_t unhex(const char *hex, uint8_t *out)
+{
+    size_t n = 0;
+    for (const char *p = hex; p[0] && p[1];)
+    {
+        if (*p == ' ')
+        {
+            p++;
+            continue;
+        }
+        unsigned int byte;
+        sscanf(p, "%2x", &byte);
+        out[n++] = (uint8_t)byte;
+        p += 2;
+    }
+    return n;
+}
+
+static bool field_equals(const HPackField *f, const char *name, const char *value)
+{
+    return f->name_len == strlen(name) && memcmp(f->name, name, f->name_len) == 0 &&
+           f->value_len == strlen(value) && memcmp(f->value, value, f->value_len) == 0;
+}
+
+/* The client side of a session: collects what the server writes */
+typedef struct Peer
+{
+    uint8_t out[1 << 16];
+    size_t out_len;
+    size_t read_pos;
+    size_t file_bytes; // sent through send_file(), recorded in out as 'F' bytes
+    int released_fd;
+    char request[256]; // "METHOD uri host=... body=..." of the last request
+    bool defer;
+    const char *body; // response body
+    int file_fd;      // when >= 0, responses are this file instead of body
+} Peer;
+
+static int peer_send(void *ctx, const char *data, size_t len)
+{
+    Peer *p = ctx;
+    ASSERT(p->out_len + len <= sizeof(p->out));
+    memcpy(p->out + p->out_len, data, len);
+    p->out_len += len;
+    return 0;
+}
+
+static int peer_send_file(void *ctx, int fd, off_t offset, size_t length)
+{
+    Peer *p = ctx;
+    (void)offset;
+    ASSERT(fd == p->file_fd);
+    ASSERT(p->out_len + length <= sizeof(p->out));
+    memset(p->out + p->out_len, 'F', length);
+    p->out_len += length;
+    p->file_bytes += length;
+    return 0;
+}
+
+static void peer_release_file(void *ctx, int fd)
+{
+    Peer *p        = ctx;
+    p->released_fd = fd;
+    close(fd);
+}
+
+static HTTPResponse *peer_handle(void *ctx, HTTPRequest *req, uint32_t stream_id)
+{
+    Peer *p = ctx;
+    (void)stream_id;
+    const HTTPHeader *host = find_header(req, "Host");
+    snprintf(p->request, sizeof(p->request), "%.*s %.*s host=%.*s body=%.*s",
+             (int)req->request_line.method_len, req->request_line.method,
+             (int)req->request_line.uri_len, req->request_line.uri,
+             host ? (int)host->value_len : 0, host ? host->value : "", (int)req->body_len,
+             req->body ? req->body : "");
+    if (p->defer) return NULL;
+
+    HTTPResponse *res = response_builder(200, "OK", p->body, strlen(p->body), "text/plain");
+    if (p->file_fd >= 0)
+    {
+        res->file_fd        = dup(p->file_fd);
+        res->content_length = 10;
+        httpresponse_add_file_range(res, 0, 10, NULL);
+        p->file_fd = res->file_fd;
+    }
+    return res;
+}
+
+static H2Session *new_session(Peer *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->body        = "hello";
+    p->file_fd     = -1;
+    p->released_fd = -1;
+    H2Callbacks callbacks = {p, peer_send, peer_send_file, peer_release_file, peer_handle};
+    H2Session *s          = h2_session_new(&callbacks);
+    ASSERT(s != NULL);
+    return s;
+}
+
+/* Reads the next frame the server wrote; returns its payload or NULL */
+static const uint8_t *next_frame(Peer *p, uint8_t *type, uint8_t *flags, uint32_t *id,
+                                 size_t *len)
+{
+    if (p->out_len - p->read_pos < H2_FRAME_HEADER_LEN) return NULL;
+    const uint8_t *h = p->out + p->read_pos;
+    *len             = (size_t)h[0] << 16 | (size_t)h[1] << 8 | h[2];
+    *type            = h[3];
+    *flags           = h[4];
+    *id              = ((uint32_t)h[5] << 24 | h[6] << 16 | h[7] << 8 | h[8]) & 0x7fffffff;
+    p->read_pos += H2_FRAME_HEADER_LEN + *len;
+    ASSERT(p->read_pos <= p->out_len);
+    return h + H2_FRAME_HEADER_LEN;
+}
+
+static void expect_frame(Peer *p, uint8_t type, uint8_t flags, uint32_t id, size_t *len)
+{
+    uint8_t t, f;
+    uint32_t i;
+    size_t l;
+    ASSERT(next_frame(p, &t, &f, &i, &l) != NULL);
+    ASSERT(t == type && f == flags && i == id);
+    if (len) *len = l;
+}
+
+static size_t frame(uint8_t *out, uint8_t type, uint8_t flags, uint32_t id, const void *payload,
+                    size_t len)
+{
+    out[0] = len >> 16;
+    out[1] = len >> 8;
+    out[2] = len;
+    out[3] = type;
+    out[4] = flags;
+    out[5] = id >> 24;
+    out[6] = id >> 16;
+    out[7] = id >> 8;
+    out[8] = id;
+    memcpy(out + H2_FRAME_HEADER_LEN, payload, len);
+    return H2_FRAME_HEADER_LEN + len;
+}
+
+/* Preface and an empty SETTINGS frame */
+static size_t client_preface(uint8_t *out)
+{
+    memcpy(out, H2_PREFACE, H2_PREFACE_LEN);
+    return H2_PREFACE_LEN + frame(out + H2_PREFACE_LEN, 0x4, 0, 0, NULL, 0);
+}
+
+static size_t request_headers(HPackEncoder *enc, uint8_t *out, uint32_t id, uint8_t flags,
+                              const char *method, const char *path)
+{
+    HPackField fields[] = {
+        {":method", 7, method, strlen(method)},
+        {":scheme", 7, "http", 4},
+        {":path", 5, path, strlen(path)},
+        {":authority", 10, "example.com", 11},
+    };
+    uint8_t block[256];
+    ssize_t n = hpack_encode(enc, fields, 4, block, sizeof(block));
+    ASSERT(n > 0);
+    return frame(out, 0x1, flags, id, block, n);
+}
+
+static void feed(H2Session *s, const uint8_t *data, size_t len)
+{
+    ASSERT(h2_session_recv(s, (const char *)data, len) == (ssize_t)len);
+}
+
+/* ------------------------------------------------------------------ */
+/* HPACK                                                                */
+/* ------------------------------------------------------------------ */
+
+/* RFC 7541 C.4: requests with Huffman coding, sharing one dynamic table */
+static void test_hpack_rfc_requests(void)
+{
+    HPackDecoder dec;
+    hpack_decoder_init(&dec, HPACK_DEFAULT_TABLE_SIZE);
+    HPackField fields[16];
+    char scratch[1024];
+    uint8_t block[128];
+
+    size_t len = unhex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 16, scratch, sizeof(scratch)) == 4);
+    ASSERT(field_equals(&fields[0], ":method", "GET"));
+    ASSERT(field_equals(&fields[1], ":scheme", "http"));
+    ASSERT(field_equals(&fields[2], ":path", "/"));
+    ASSERT(field_equals(&fields[3], ":authority", "www.example.com"));
+    ASSERT(dec.table.size == 57);
+
+    len = unhex("8286 84be 5886 a8eb 1064 9cbf", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 16, scratch, sizeof(scratch)) == 5);
+    ASSERT(field_equals(&fields[3], ":authority", "www.example.com"));
+    ASSERT(field_equals(&fields[4], "cache-control", "no-cache"));
+    ASSERT(dec.table.size == 110);
+
+    len = unhex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 16, scratch, sizeof(scratch)) == 5);
+    ASSERT(field_equals(&fields[1], ":scheme", "https"));
+    ASSERT(field_equals(&fields[2], ":path", "/index.html"));
+    ASSERT(field_equals(&fields[4], "custom-key", "custom-value"));
+    ASSERT(dec.table.size == 164);
+    hpack_decoder_free(&dec);
+}
+
+/* RFC 7541 C.6.1: a response that fills most of a 256-byte table */
+static void test_hpack_rfc_response_eviction(void)
+{
+    HPackDecoder dec;
+    hpack_decoder_init(&dec, 256);
+    HPackField fields[8];
+    char scratch[1024];
+    uint8_t block[128];
+
+    size_t len = unhex("4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81"
+                       " 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+                       block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 8, scratch, sizeof(scratch)) == 4);
+    ASSERT(field_equals(&fields[0], ":status", "302"));
+    ASSERT(field_equals(&fields[1], "cache-control", "private"));
+    ASSERT(field_equals(&fields[2], "date", "Mon, 21 Oct 2013 20:13:21 GMT"));
+    ASSERT(field_equals(&fields[3], "location", "https://www.example.com"));
+    ASSERT(dec.table.size == 222);
+
+    /* C.6.2: ":status: 307" evicts the oldest entry */
+    len = unhex("4883 640e ff c1 c0 bf", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 8, scratch, sizeof(scratch)) == 4);
+    ASSERT(field_equals(&fields[0], ":status", "307"));
+    ASSERT(field_equals(&fields[3], "location", "https://www.example.com"));
+    ASSERT(dec.table.size == 222);
+
+    /* Size updates above the advertised limit, or after a field, are errors */
+    len = unhex("3fe1 1f", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 8, scratch, sizeof(scratch)) < 0);
+    len = unhex("82 20", block);
+    ASSERT(hpack_decode(&dec, block, len, fields, 8, scratch, sizeof(scratch)) < 0);
+    hpack_decoder_free(&dec);
+}
+
+static void test_huffman(void)
+{
+    uint8_t encoded[64], expected[64];
+    size_t n = unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff", expected);
+    ASSERT(hpack_huffman_encoded_len("www.example.com", 15) == n);
+    ASSERT(hpack_huffman_encode("www.example.com", 15, encoded) == n);
+    ASSERT(memcmp(encoded, expected, n) == 0);
+
+    char decoded[64];
+    ASSERT(hpack_huffman_decode(encoded, n, decoded, sizeof(decoded)) == 15);
+    ASSERT(memcmp(decoded, "www.example.com", 15) == 0);
+
+    /* Every byte value survives a round trip */
+    char all[256];
+    uint8_t big[1024];
+    for (int i = 0; i < 256; i++)
+        all[i] = (char)i;
+    size_t big_len = hpack_huffman_encode(all, 256, big);
+    char back[256];
+    ASSERT(hpack_huffman_decode(big, big_len, back, sizeof(back)) == 256);
+    ASSERT(memcmp(back, all, 256) == 0);
+
+    /* "a" is 00011: padding must be ones, and shorter than a byte */
+    ASSERT(hpack_huffman_decode((const uint8_t *)"\x1f", 1, decoded, 64) == 1);
+    ASSERT(hpack_huffman_decode((const uint8_t *)"\x18", 1, decoded, 64) < 0);
+    ASSERT(hpack_huffman_decode((const uint8_t *)"\x1f\xff", 2, decoded, 64) < 0);
+}
+
+static void test_hpack_encoder_roundtrip(void)
+{
+    HPackEncoder enc;
+    HPackDecoder dec;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+    hpack_decoder_init(&dec, HPACK_DEFAULT_TABLE_SIZE);
+    HPackField in[] = {
+        {":status", 7, "200", 3},
+        {"content-type", 12, "text/html", 9},
+        {"content-length", 14, "1234", 4},
+        {"x-custom", 8, "some value", 10},
+    };
+    uint8_t block[256];
+    HPackField out[8];
+    char scratch[512];
+
+    ssize_t first = hpack_encode(&enc, in, 4, block, sizeof(block));
+    ASSERT(first > 0);
+    ASSERT(hpack_decode(&dec, block, first, out, 8, scratch, sizeof(scratch)) == 4);
+    ASSERT(field_equals(&out[3], "x-custom", "some value"));
+
+    /* Repeated fields come from the dynamic table; content-length is never indexed */
+    ssize_t second = hpack_encode(&enc, in, 4, block, sizeof(block));
+    ASSERT(second > 0 && second < first);
+    ASSERT(hpack_decode(&dec, block, second, out, 8, scratch, sizeof(scratch)) == 4);
+    ASSERT(field_equals(&out[1], "content-type", "text/html"));
+    ASSERT(field_equals(&out[2], "content-length", "1234"));
+    ASSERT(enc.table.size == dec.table.size);
+
+    /* A smaller peer table is announced before the next block */
+    hpack_encoder_set_max_size(&enc, 0);
+    ssize_t third = hpack_encode(&enc, in, 4, block, sizeof(block));
+    ASSERT(third > 0 && block[0] == 0x20);
+    ASSERT(hpack_decode(&dec, block, third, out, 8, scratch, sizeof(scratch)) == 4);
+    ASSERT(dec.table.size == 0 && enc.table.size == 0);
+
+    ASSERT(hpack_encode(&enc, in, 4, block, 8) < 0);
+    hpack_encoder_free(&enc);
+    hpack_decoder_free(&dec);
+}
+
+/* ------------------------------------------------------------------ */
+/* Session                                                              */
+/* ------------------------------------------------------------------ */
+
+static void test_session_request_response(void)
+{
+    Peer p;
+    H2Session *s = new_session(&p);
+    HPackEncoder enc;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+
+    uint8_t in[512];
+    size_t n = client_preface(in);
+    n += request_headers(&enc, in + n, 1, 0x4, "POST", "/api/items");
+    n += frame(in + n, 0x0, 0x1, 1, "abc", 3);
+
+    /* Partial input waits for the rest of the frame */
+    ASSERT(h2_session_recv(s, (const char *)in, n - 2) == (ssize_t)(n - 3 - 9));
+    ASSERT(h2_session_recv(s, (const char *)in + n - 12, 12) == 12);
+    ASSERT(strcmp(p.request, "POST /api/items host=example.com body=abc") == 0);
+
+    size_t len;
+    expect_frame(&p, 0x4, 0, 0, &len);   // server SETTINGS
+    expect_frame(&p, 0x4, 0x1, 0, NULL); // ACK of ours
+    expect_frame(&p, 0x8, 0, 0, NULL);   // connection window refill for the DATA
+    expect_frame(&p, 0x1, 0x4, 1, &len); // response HEADERS
+    expect_frame(&p, 0x0, 0x1, 1, &len); // DATA with END_STREAM
+    ASSERT(len == 5 && memcmp(p.out + p.read_pos - 5, "hello", 5) == 0);
+    ASSERT(!h2_session_finished(s));
+
+    /* GOAWAY from the client ends the session once nothing is in flight */
+    uint8_t goaway[8] = {0};
+    n = frame(in, 0x7, 0, 0, goaway, 8);
+    feed(s, in, n);
+    ASSERT(h2_session_finished(s));
+
+    hpack_encoder_free(&enc);
+    h2_session_free(s);
+}
+
+static void test_session_flow_control(void)
+{
+    Peer p;
+    H2Session *s = new_session(&p);
+    p.body       = "0123456789abcdefghijklmno"; // 25 bytes
+    HPackEncoder enc;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+
+    /* The client allows 10 bytes per stream */
+    uint8_t in[512];
+    memcpy(in, H2_PREFACE, H2_PREFACE_LEN);
+    uint8_t settings[6] = {0, 0x4, 0, 0, 0, 10};
+    size_t n = H2_PREFACE_LEN + frame(in + H2_PREFACE_LEN, 0x4, 0, 0, settings, 6);
+    n += request_headers(&enc, in + n, 1, 0x5, "GET", "/");
+    feed(s, in, n);
+
+    size_t len;
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x4, 0x1, 0, NULL);
+    expect_frame(&p, 0x1, 0x4, 1, NULL);
+    expect_frame(&p, 0x0, 0, 1, &len);
+    ASSERT(len == 10 && p.read_pos == p.out_len);
+
+    /* The rest goes out once the stream window opens */
+    uint8_t increment[4] = {0, 0, 0, 100};
+    feed(s, in, frame(in, 0x8, 0, 1, increment, 4));
+    expect_frame(&p, 0x0, 0x1, 1, &len);
+    ASSERT(len == 15 && memcmp(p.out + p.read_pos - 15, "abcdefghijklmno", 15) == 0);
+
+    hpack_encoder_free(&enc);
+    h2_session_free(s);
+}
+
+static void test_session_deferred_and_reset(void)
+{
+    Peer p;
+    H2Session *s = new_session(&p);
+    p.defer      = true;
+    HPackEncoder enc;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+
+    uint8_t in[512];
+    size_t n = client_preface(in);
+    n += request_headers(&enc, in + n, 1, 0x5, "GET", "/api/a");
+    n += request_headers(&enc, in + n, 3, 0x5, "HEAD", "/api/b");
+    feed(s, in, n);
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x4, 0x1, 0, NULL);
+    ASSERT(p.read_pos == p.out_len);
+
+    /* The client cancels stream 1; its late response is dropped */
+    uint8_t code[4] = {0, 0, 0, 0x8};
+    feed(s, in, frame(in, 0x3, 0, 1, code, 4));
+    h2_submit_response(s, 1, response_builder(200, "OK", "x", 1, "text/plain"));
+    ASSERT(p.read_pos == p.out_len);
+
+    /* A HEAD response has headers only */
+    h2_submit_response(s, 3, response_builder(200, "OK", "body", 4, "text/plain"));
+    expect_frame(&p, 0x1, 0x5, 3, NULL);
+    ASSERT(p.read_pos == p.out_len);
+
+    hpack_encoder_free(&enc);
+    h2_session_free(s);
+}
+
+static void test_session_file_body(void)
+{
+    char path[] = "/tmp/cserve_test_http2.XXXXXX";
+    int fd      = mkstemp(path);
+    ASSERT(fd >= 0);
+    ASSERT(write(fd, "0123456789", 10) == 10);
+    unlink(path);
+
+    Peer p;
+    H2Session *s = new_session(&p);
+    p.file_fd    = fd;
+    HPackEncoder enc;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+
+    uint8_t in[512];
+    size_t n = client_preface(in);
+    n += request_headers(&enc, in + n, 1, 0x5, "GET", "/static/f");
+    feed(s, in, n);
+
+    size_t len;
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x4, 0x1, 0, NULL);
+    expect_frame(&p, 0x1, 0x4, 1, NULL);
+    expect_frame(&p, 0x0, 0x1, 1, &len);
+    ASSERT(len == 10 && p.file_bytes == 10);
+    ASSERT(p.released_fd == p.file_fd && p.released_fd != fd);
+
+    close(fd);
+    hpack_encoder_free(&enc);
+    h2_session_free(s);
+}
+
+static void test_session_protocol_errors(void)
+{
+    Peer p;
+    uint8_t in[512];
+    size_t len;
+
+    /* The preface must be followed by SETTINGS */
+    H2Session *s = new_session(&p);
+    memcpy(in, H2_PREFACE, H2_PREFACE_LEN);
+    uint8_t ping[8] = {0};
+    size_t n        = H2_PREFACE_LEN + frame(in + H2_PREFACE_LEN, 0x6, 0, 0, ping, 8);
+    ASSERT(h2_session_recv(s, (const char *)in, n) < 0);
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x7, 0, 0, &len);
+    ASSERT(h2_session_finished(s));
+    h2_session_free(s);
+
+    /* Not HTTP/2 at all */
+    s = new_session(&p);
+    ASSERT(h2_session_recv(s, "GET / HTTP/1.1\r\n", 16) < 0);
+    h2_session_free(s);
+
+    /* Streams beyond the concurrency limit are refused, not fatal */
+    s       = new_session(&p);
+    p.defer = true;
+    HPackEncoder enc;
+    hpack_encoder_init(&enc, HPACK_DEFAULT_TABLE_SIZE);
+    n = client_preface(in);
+    feed(s, in, n);
+    for (uint32_t id = 1; id <= 2 * H2_MAX_CONCURRENT_STREAMS + 1; id += 2)
+        feed(s, in, request_headers(&enc, in, id, 0x5, "GET", "/api/x"));
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x4, 0x1, 0, NULL);
+    expect_frame(&p, 0x3, 0, 2 * H2_MAX_CONCURRENT_STREAMS + 1, NULL);
+    ASSERT(!h2_session_finished(s));
+
+    /* Client streams have odd ids */
+    ASSERT(h2_session_recv(s, (const char *)in, request_headers(&enc, in, 400, 0x5, "GET", "/")) <
+           0);
+    hpack_encoder_free(&enc);
+    h2_session_free(s);
+}
+
+static void test_session_upgrade(void)
+{
+    Peer p;
+    H2Session *s = new_session(&p);
+
+    /* SETTINGS_MAX_CONCURRENT_STREAMS=100, SETTINGS_INITIAL_WINDOW_SIZE=33554432 */
+    const char settings[] = "AAMAAABkAAQCAAAA";
+    char raw[]            = "HEAD / HTTP/1.1\r\nHost: x\r\n\r\n";
+    HTTPRequest *req      = create_http_request();
+    ASSERT(parse_http_request(raw, strlen(raw), req) > 0);
+    ASSERT(h2_session_upgrade(s, "!!", 2, req) < 0);
+    ASSERT(h2_session_upgrade(s, settings, strlen(settings), req) == 0);
+    free_http_request(req);
+
+    h2_submit_response(s, 1, response_builder(200, "OK", "hi", 2, "text/plain"));
+    expect_frame(&p, 0x4, 0, 0, NULL);
+    expect_frame(&p, 0x1, 0x5, 1, NULL);
+
+    /* The client preface still follows */
+    uint8_t in[64];
+    feed(s, in, client_preface(in));
+    expect_frame(&p, 0x4, 0x1, 0, NULL);
+    h2_session_free(s);
+}
+
+/* ------------------------------------------------------------------ */
+/* Main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve HTTP/2 tests ===\n\n");
+
+    logger_set_level(LOG_ERROR);
+
+    printf("[ hpack ]\n");
+    RUN(test_hpack_rfc_requests);
+    RUN(test_hpack_rfc_response_eviction);
+    RUN(test_huffman);
+    RUN(test_hpack_encoder_roundtrip);
+
+    printf("\n[ session ]\n");
+    RUN(test_session_request_response);
+    RUN(test_session_flow_control);
+    RUN(test_session_deferred_and_reset);
+    RUN(test_session_file_body);
+    RUN(test_session_protocol_errors);
+    RUN(test_session_upgrade);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
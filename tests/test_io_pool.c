@@ -0,0 +1,176 @@
+/**
+ * @file    test_io_pool.c
+ * @brief   Unit tests for the file I/O thread pool and its eventfd completions.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+#include "utils/io_pool.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+typedef struct Job
+{
+    IOTask task;
+    int id;
+    bool ran;
+} Job;
+
+static atomic_int gate_open; // jobs spin on it, so a test can hold the pool busy
+
+static void run_job(IOTask *task)
+{
+    while (!atomic_load(&gate_open))
+        usleep(100);
+    ((Job *)task)->ran = true;
+}
+
+static void submit(IOPool *pool, IOCompletions *done, Job *job, int id)
+{
+    memset(job, 0, sizeof(*job));
+    job->id        = id;
+    job->task.run  = run_job;
+    job->task.done = done;
+    ASSERT(io_pool_submit(pool, &job->task) == OK);
+}
+
+static bool readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+/* Collects completions until count jobs are back; returns their ids in order */
+static int take_all(IOCompletions *done, int *ids, int count)
+{
+    int taken = 0;
+    while (taken < count && readable(done->fd, 2000))
+    {
+        for (IOTask *task = io_completions_take(done); task; task = task->next)
+        {
+            ASSERT(((Job *)task)->ran);
+            ids[taken++] = ((Job *)task)->id;
+        }
+    }
+    return taken;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_completions(void)
+{
+    IOPool pool;
+    IOCompletions done;
+    ASSERT(io_completions_init(&done) == OK);
+    ASSERT(io_pool_start(&pool, 1) == OK);
+
+    // Nothing completed: the eventfd stays quiet
+    ASSERT(!readable(done.fd, 0));
+    ASSERT(io_completions_take(&done) == NULL);
+
+    // One thread runs the tasks in submission order; one wakeup may cover several
+    atomic_store(&gate_open, 0);
+    Job jobs[8];
+    for (int i = 0; i < 8; i++)
+        submit(&pool, &done, &jobs[i], i);
+    ASSERT(!readable(done.fd, 20));
+    atomic_store(&gate_open, 1);
+
+    int ids[8];
+    ASSERT(take_all(&done, ids, 8) == 8);
+    for (int i = 0; i < 8; i++)
+        ASSERT(ids[i] == i);
+    ASSERT(!readable(done.fd, 0));
+
+    io_pool_stop(&pool);
+    io_completions_free(&done);
+    ASSERT(done.fd == -1);
+}
+
+static void test_two_loops(void)
+{
+    IOPool pool;
+    IOCompletions a, b;
+    ASSERT(io_completions_init(&a) == OK && io_completions_init(&b) == OK);
+    ASSERT(io_pool_start(&pool, 4) == OK && pool.thread_count == 4);
+
+    // Each task comes back to the loop that submitted it
+    atomic_store(&gate_open, 1);
+    Job jobs[64];
+    for (int i = 0; i < 64; i++)
+        submit(&pool, i % 2 ? &b : &a, &jobs[i], i);
+
+    int ids[32];
+    ASSERT(take_all(&a, ids, 32) == 32);
+    for (int i = 0; i < 32; i++)
+        ASSERT(ids[i] % 2 == 0);
+    ASSERT(take_all(&b, ids, 32) == 32);
+    for (int i = 0; i < 32; i++)
+        ASSERT(ids[i] % 2 == 1);
+
+    io_pool_stop(&pool);
+    io_completions_free(&a);
+    io_completions_free(&b);
+}
+
+static void test_stop(void)
+{
+    IOPool pool;
+    IOCompletions done;
+    ASSERT(io_completions_init(&done) == OK);
+
+    // A pool without threads takes nothing; the caller does the work itself
+    ASSERT(io_pool_start(&pool, 0) == OK && pool.thread_count == 0);
+    Job job = {.task = {.run = run_job, .done = &done}};
+    ASSERT(io_pool_submit(&pool, &job.task) < 0);
+    io_pool_stop(&pool);
+
+    // Stopping runs what was queued before the threads exit
+    ASSERT(io_pool_start(&pool, 2) == OK);
+    atomic_store(&gate_open, 0);
+    Job jobs[16];
+    for (int i = 0; i < 16; i++)
+        submit(&pool, &done, &jobs[i], i);
+    atomic_store(&gate_open, 1);
+    io_pool_stop(&pool);
+    for (int i = 0; i < 16; i++)
+        ASSERT(jobs[i].ran);
+
+    int ids[16];
+    ASSERT(take_all(&done, ids, 16) == 16);
+    ASSERT(io_pool_submit(&pool, &job.task) < 0);
+
+    io_completions_free(&done);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve I/O pool tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ io pool ]\n");
+    RUN(test_completions);
+    RUN(test_two_loops);
+    RUN(test_stop);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
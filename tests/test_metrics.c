@@ -0,0 +1,153 @@
+/**
+ * @file    test_metrics.c
+ * @brief   Unit tests for the metrics histograms and stats rendering.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils/metrics.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Histogram tests                                                      */
+/* ------------------------------------------------------------------ */
+
+static void test_histogram_small_values_exact(void)
+{
+    for (uint64_t v = 0; v < 2 * HIST_SUB_BUCKETS; v++)
+    {
+        ASSERT(histogram_bucket_value(histogram_bucket_index(v)) == v);
+    }
+}
+
+static void test_histogram_bucket_bounds(void)
+{
+    /* Every value falls into a bucket whose upper bound is >= it and within 1/16 */
+    uint64_t values[] = {100, 1000, 12345, 999999, 123456789ull, (1ull << 39) + 7};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        uint64_t upper = histogram_bucket_value(histogram_bucket_index(values[i]));
+        ASSERT(upper >= values[i]);
+        ASSERT(upper - values[i] <= values[i] / HIST_SUB_BUCKETS);
+    }
+
+    /* Out of range values clamp into the last bucket */
+    ASSERT(histogram_bucket_index(UINT64_MAX) == HIST_BUCKETS - 1);
+}
+
+static void test_histogram_percentiles(void)
+{
+    Histogram *h = calloc(1, sizeof(Histogram));
+    ASSERT(h != NULL);
+
+    ASSERT(histogram_percentile(h, 50) == 0);
+
+    /* 1..1000 microseconds, in nanoseconds */
+    for (uint64_t us = 1; us <= 1000; us++)
+        histogram_record(h, us * 1000);
+
+    uint64_t p50 = histogram_percentile(h, 50);
+    uint64_t p99 = histogram_percentile(h, 99);
+    ASSERT(p50 >= 500000 && p50 <= 500000 + 500000 / HIST_SUB_BUCKETS);
+    ASSERT(p99 >= 990000 && p99 <= 990000 + 990000 / HIST_SUB_BUCKETS);
+    ASSERT(histogram_percentile(h, 100) == 1000000);
+
+    free(h);
+}
+
+/* ------------------------------------------------------------------ */
+/* Rendering tests                                                      */
+/* ------------------------------------------------------------------ */
+
+static void test_metrics_render(void)
+{
+    metric_add(&metrics_local()->requests, 3);
+    metrics_count_status(200);
+    metrics_count_status(404);
+
+    size_t len = 0;
+    char *text = metrics_render(false, &len);
+    ASSERT(text != NULL);
+    ASSERT(len == strlen(text));
+    ASSERT(strstr(text, "requests 3\n") != NULL);
+    ASSERT(strstr(text, "responses{status=\"404\"} 1\n") != NULL);
+    free(text);
+
+    char *json = metrics_render(true, &len);
+    ASSERT(json != NULL);
+    ASSERT(json[0] == '{');
+    ASSERT(strstr(json, "\"requests\":3") != NULL);
+    ASSERT(strstr(json, "\"200\":1") != NULL);
+    free(json);
+}
+
+#define OVERFLOW_THREADS (MAX_WORKERS + 36)
+#define OVERFLOW_ADDS 10000
+
+static pthread_barrier_t overflow_start;
+
+static void *add_requests(void *arg)
+{
+    (void)arg;
+    WorkerMetrics *slot = metrics_local();
+    pthread_barrier_wait(&overflow_start);
+    for (int i = 0; i < OVERFLOW_ADDS; i++)
+        metric_add(&slot->requests, 1);
+    histogram_record(&slot->phases[PHASE_SEND], 1000);
+    return NULL;
+}
+
+static void test_metrics_overflow_threads(void)
+{
+    // More threads than slots, all at once: the ones sharing the overflow slot lose nothing
+    pthread_t threads[OVERFLOW_THREADS];
+    ASSERT(pthread_barrier_init(&overflow_start, NULL, OVERFLOW_THREADS) == 0);
+    for (int i = 0; i < OVERFLOW_THREADS; i++)
+        ASSERT(pthread_create(&threads[i], NULL, add_requests, NULL) == 0);
+    for (int i = 0; i < OVERFLOW_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&overflow_start);
+
+    WorkerMetrics *total = metrics_snapshot();
+    ASSERT(total != NULL);
+    ASSERT(atomic_load(&total->requests) == 3 + (uint64_t)OVERFLOW_THREADS * OVERFLOW_ADDS);
+    ASSERT(atomic_load(&total->phases[PHASE_SEND].count) == OVERFLOW_THREADS);
+    free(total);
+
+    // None of them is an event loop
+    size_t len = 0;
+    char *text = metrics_render(false, &len);
+    ASSERT(text != NULL);
+    ASSERT(strstr(text, "event_loops 0\n") != NULL);
+    free(text);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve metrics tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ histogram ]\n");
+    RUN(test_histogram_small_values_exact);
+    RUN(test_histogram_bucket_bounds);
+    RUN(test_histogram_percentiles);
+
+    printf("\n[ render ]\n");
+    RUN(test_metrics_render);
+    RUN(test_metrics_overflow_threads);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file    test_modules.c
+ * @brief   Unit tests for the module table and the built-in modules.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http/module.h"
+#include "http/parsers.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static HTTPRequest *request(const char *raw)
+{
+    HTTPRequest *req = create_http_request();
+    ASSERT(parse_http_request(raw, strlen(raw), req) > 0);
+    return req;
+}
+
+static bool uri_is(const HTTPRequest *req, const char *uri)
+{
+    return req->request_line.uri_len == strlen(uri) &&
+           memcmp(req->request_line.uri, uri, strlen(uri)) == 0;
+}
+
+static struct sockaddr_storage client(int family, const char *addr)
+{
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_family = family;
+    if (family == AF_INET)
+        ASSERT(inet_pton(AF_INET, addr, &((struct sockaddr_in *)&ss)->sin_addr) == 1);
+    else
+        ASSERT(inet_pton(AF_INET6, addr, &((struct sockaddr_in6 *)&ss)->sin6_addr) == 1);
+    return ss;
+}
+
+static int status_of(HTTPResponse *response)
+{
+    int status = response ? response->status_code : 0;
+    httpresponse_free(response);
+    return status;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_directives(void)
+{
+    void *confs[MAX_MODULES] = {NULL};
+
+    // Keys no module knows are left to the caller
+    ASSERT(modules_directive(confs, "no_such_key", "1") == 0);
+
+    ASSERT(modules_directive(confs, "rewrite", "/old /new") == 1);
+    ASSERT(modules_directive(confs, "rewrite", "/moved https://example.com permanent") == 1);
+    ASSERT(modules_directive(confs, "rewrite", "/only-one") < 0);
+    ASSERT(modules_directive(confs, "rewrite", "relative /new") < 0);
+    ASSERT(modules_directive(confs, "rewrite", "/a /b sometimes") < 0);
+
+    ASSERT(modules_directive(confs, "deny", "10.0.0.0/8") == 1);
+    ASSERT(modules_directive(confs, "allow", "2001:db8::/32") == 1);
+    ASSERT(modules_directive(confs, "deny", "all") == 1);
+    ASSERT(modules_directive(confs, "deny", "10.0.0.0/33") < 0);
+    ASSERT(modules_directive(confs, "allow", "example.com") < 0);
+
+    // Only modules with a content hook can answer a location
+    ASSERT(module_find_content("echo") >= 0);
+    ASSERT(module_find_content("rewrite") < 0);
+    ASSERT(module_find_content("missing") < 0);
+
+    modules_free_conf(confs);
+    for (int i = 0; i < MAX_MODULES; i++)
+        ASSERT(confs[i] == NULL);
+}
+
+static void test_rewrite(void)
+{
+    void *confs[MAX_MODULES] = {NULL};
+    ASSERT(modules_directive(confs, "rewrite", "/old /new") == 1);
+    ASSERT(modules_directive(confs, "rewrite", "/moved https://example.com permanent") == 1);
+    ASSERT(modules_init(confs) == OK);
+
+    // The first matching rule replaces the prefix; the query goes along
+    HTTPRequest *req = request("GET /old/a?b=1 HTTP/1.1\r\nHost: x\r\n\r\n");
+    ASSERT(modules_rewrite(req) == NULL);
+    ASSERT(uri_is(req, "/new/a?b=1"));
+    ASSERT(modules_rewrite(req) == NULL && uri_is(req, "/new/a?b=1"));
+
+    // A copy of a rewritten request carries the new URI
+    HTTPRequest *copy = copy_http_request(req);
+    ASSERT(copy && uri_is(copy, "/new/a?b=1"));
+    free_http_request(copy);
+    free_http_request(req);
+
+    // A permanent rule redirects instead
+    req                    = request("GET /moved/page HTTP/1.1\r\nHost: x\r\n\r\n");
+    HTTPResponse *response = modules_rewrite(req);
+    ASSERT(response && response->status_code == 301);
+    bool found = false;
+    for (int i = 0; i < response->header_count; i++)
+        found |= strcmp(response->headers[i], "Location: https://example.com/page") == 0;
+    ASSERT(found);
+    ASSERT(uri_is(req, "/moved/page"));
+    httpresponse_free(response);
+    free_http_request(req);
+
+    // Without rules nothing changes
+    modules_free_conf(confs);
+    ASSERT(modules_init(confs) == OK);
+    req = request("GET /old/a HTTP/1.1\r\nHost: x\r\n\r\n");
+    ASSERT(modules_rewrite(req) == NULL && uri_is(req, "/old/a"));
+    free_http_request(req);
+}
+
+static void test_access(void)
+{
+    void *confs[MAX_MODULES] = {NULL};
+    ASSERT(modules_directive(confs, "allow", "10.1.0.0/16") == 1);
+    ASSERT(modules_directive(confs, "deny", "10.0.0.0/8") == 1);
+    ASSERT(modules_directive(confs, "deny", "2001:db8::1") == 1);
+    ASSERT(modules_init(confs) == OK);
+
+    HTTPRequest *req = request("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    struct sockaddr_storage ss;
+
+    // The first matching rule decides; no match allows
+    ss = client(AF_INET, "10.1.2.3");
+    ASSERT(modules_access(req, &ss) == NULL);
+    ss = client(AF_INET, "10.2.0.1");
+    ASSERT(status_of(modules_access(req, &ss)) == 403);
+    ss = client(AF_INET, "192.168.0.1");
+    ASSERT(modules_access(req, &ss) == NULL);
+    ss = client(AF_INET6, "2001:db8::1");
+    ASSERT(status_of(modules_access(req, &ss)) == 403);
+    ss = client(AF_INET6, "2001:db8::2");
+    ASSERT(modules_access(req, &ss) == NULL);
+
+    // IPv4 clients of a dual-stack listener match IPv4 rules
+    ss = client(AF_INET6, "::ffff:10.9.9.9");
+    ASSERT(status_of(modules_access(req, &ss)) == 403);
+
+    // A client of unknown address is let through
+    ASSERT(modules_access(req, NULL) == NULL);
+
+    free_http_request(req);
+    modules_free_conf(confs);
+    ASSERT(modules_init(confs) == OK);
+}
+
+static void test_content(void)
+{
+    void *confs[MAX_MODULES] = {NULL};
+    ASSERT(modules_init(confs) == OK);
+    ASSERT(!modules_logging());
+
+    Location loc = {0};
+    ASSERT(location_init(&loc, " /echo") == OK);
+    ASSERT(location_set(&loc, "content", "echo") == OK && loc.handler == ROUTE_MODULE);
+
+    HTTPRequest *req       = request("GET /echo?x HTTP/1.1\r\nHost: example\r\n\r\n");
+    HTTPResponse *response = module_content(loc.module, req, &loc);
+    ASSERT(response && response->status_code == 200);
+    const char expected[] = "GET /echo?x HTTP/1.1\nHost: example\n\n";
+    ASSERT((size_t)response->body_length == strlen(expected));
+    ASSERT(memcmp(response->body, expected, strlen(expected)) == 0);
+
+    httpresponse_free(response);
+    free_http_request(req);
+    location_free(&loc);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve module tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ modules ]\n");
+    RUN(test_directives);
+    RUN(test_rewrite);
+    RUN(test_access);
+    RUN(test_content);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
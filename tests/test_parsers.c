@@ -13,30 +13,7 @@
 #include "http/request.h"
 #include "http/response.h"
 
-/* ------------------------------------------------------------------ */
-/* Minimal test framework                                               */
-/* ------------------------------------------------------------------ */
-
-static int g_tests_run    = 0;
-static int g_tests_passed = 0;
-
-/* On failure: print the location and exit non-zero so CTest marks as failed */
-#define ASSERT(expr)                                                        \
-    do {                                                                    \
-        if (!(expr)) {                                                      \
-            fprintf(stderr, "  [FAIL] %s:%d  assertion failed: %s\n",      \
-                    __FILE__, __LINE__, #expr);                             \
-            exit(1);                                                        \
-        }                                                                   \
-    } while (0)
-
-#define RUN(fn)                                                             \
-    do {                                                                    \
-        g_tests_run++;                                                      \
-        fn();                                                               \
-        g_tests_passed++;                                                   \
-        printf("  [PASS] %s\n", #fn);                                      \
-    } while (0)
+#include "test.h"
 
 /* ------------------------------------------------------------------ */
 /* Parser tests                                                         */
@@ -124,6 +101,116 @@ static void test_parse_full_request_headers(void)
     free_http_request(req);
 }
 
+static void test_parse_incomplete_request(void)
+{
+    char raw[] = "GET /hello HTTP/1.1\r\nHost: local";
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+    ASSERT(parse_http_request(raw, strlen(raw), req) == 0);
+
+    free_http_request(req);
+}
+
+static void test_parse_request_body_framing(void)
+{
+    char raw[] = "POST /api HTTP/1.1\r\nContent-Length: 5\r\n\r\nhel";
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+
+    /* Body not fully received yet */
+    ASSERT(parse_http_request(raw, strlen(raw), req) == 0);
+    free_http_request(req);
+
+    char full[] = "POST /api HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello";
+    req         = create_http_request();
+    ASSERT(parse_http_request(full, strlen(full), req) == (int)strlen(full));
+    ASSERT(req->body_len == 5);
+    ASSERT(strncmp(req->body, "hello", 5) == 0);
+
+    free_http_request(req);
+}
+
+static int parse_once(const char *raw)
+{
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+    int result = parse_http_request(raw, strlen(raw), req);
+    free_http_request(req);
+    return result;
+}
+
+static void test_parse_request_smuggling(void)
+{
+    /* A body framed any other way than by one Content-Length is never guessed at */
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                      "5\r\nhello\r\n0\r\n\r\n") == PARSE_UNSUPPORTED);
+    ASSERT(parse_once("POST /a HTTP/1.1\r\ntransfer-encoding: gzip, chunked\r\n\r\n") ==
+           PARSE_UNSUPPORTED);
+
+    /* Framings two hops could read differently */
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n") == -1);
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+                      "Content-Length: 5\r\n\r\nhello") == -1);
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "Content-Length: 6\r\n\r\nhello!") == -1);
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "content-length: 5\r\n\r\nhello") == -1);
+    ASSERT(parse_once("POST /a HTTP/1.1\r\nTransfer-Encoding : chunked\r\n"
+                      "Content-Length: 5\r\n\r\nhello") == -1);
+
+    char single[] = "POST /a HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello";
+    ASSERT(parse_once(single) == (int)strlen(single));
+}
+
+static void test_parse_pipelined_requests(void)
+{
+    char first[] = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n";
+    char raw[]   = "GET /a HTTP/1.1\r\nHost: x\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+
+    /* Only the first request is consumed */
+    int consumed = parse_http_request(raw, strlen(raw), req);
+    ASSERT(consumed == (int)strlen(first));
+    ASSERT(strncmp(req->request_line.uri, "/a", 2) == 0);
+    free_http_request(req);
+
+    req = create_http_request();
+    ASSERT(parse_http_request(raw + consumed, strlen(raw) - consumed, req) > 0);
+    ASSERT(strncmp(req->request_line.uri, "/b", 2) == 0);
+
+    const HTTPHeader *host = find_header(req, "host");
+    ASSERT(host == NULL);
+
+    free_http_request(req);
+}
+
+static void test_copy_request(void)
+{
+    char raw[] = "POST /api?x=1 HTTP/1.1\r\nHost: x\r\nContent-Length: 2\r\n\r\nhi";
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(parse_http_request(raw, strlen(raw), req) == (int)strlen(raw));
+
+    /* The copy survives the buffer it was parsed from */
+    HTTPRequest *copy = copy_http_request(req);
+    free_http_request(req);
+    memset(raw, 'z', sizeof(raw) - 1);
+    ASSERT(copy != NULL);
+    ASSERT(copy->request_line.uri_len == 8 && strcmp(copy->request_line.uri, "/api?x=1") == 0);
+    ASSERT(strcmp(copy->request_line.method, "POST") == 0);
+    ASSERT(copy->header_count == 2);
+    const HTTPHeader *host = find_header(copy, "host");
+    ASSERT(host != NULL && host->value_len == 1 && host->value[0] == 'x');
+    ASSERT(copy->body_len == 2 && strcmp(copy->body, "hi") == 0);
+
+    free_http_request(copy);
+}
+
 /* ------------------------------------------------------------------ */
 /* MIME type tests                                                       */
 /* ------------------------------------------------------------------ */
@@ -179,11 +266,58 @@ static void test_response_serialize_status_line(void)
 
     /* Status line must be present */
     ASSERT(strstr(serialized, "HTTP/1.1 200 OK") != NULL);
+    ASSERT(strstr(serialized, "\r\nContent-Length: 2\r\n") != NULL);
 
     free(serialized);
     httpresponse_free(res);
 }
 
+static void test_forwarded_request_headers(void)
+{
+    ASSERT(is_forwarded_request_header("Accept", 6, NULL, 0));
+    ASSERT(is_forwarded_request_header("Cookie", 6, NULL, 0));
+    ASSERT(!is_forwarded_request_header("host", 4, NULL, 0));
+    ASSERT(!is_forwarded_request_header("Content-Length", 14, NULL, 0));
+    ASSERT(!is_forwarded_request_header("Transfer-Encoding", 17, NULL, 0));
+    ASSERT(!is_forwarded_request_header("keep-alive", 10, NULL, 0));
+
+    /* Whatever Connection names stays on this hop too */
+    const char *connection = "keep-alive, X-Trace";
+    ASSERT(!is_forwarded_request_header("x-trace", 7, connection, strlen(connection)));
+    ASSERT(is_forwarded_request_header("X-Trace-Id", 10, connection, strlen(connection)));
+}
+
+static void test_end_to_end_response_headers(void)
+{
+    const char headers[] = "Content-Type: text/plain\r\n"
+                           "Content-Length: 2\r\n"
+                           "Connection: keep-alive, X-Hop\r\n"
+                           "X-Hop: 1\r\n"
+                           "Transfer-Encoding: chunked\r\n"
+                           "Set-Cookie: a=1\r\n"
+                           "Set-Cookie: b=2\r\n"
+                           "Location:  /next \r\n"
+                           "\r\n";
+    HTTPResponse *res = response_builder(302, "Found", "ok", 2, "text/plain");
+    ASSERT(res != NULL);
+    ASSERT(add_end_to_end_headers(res, headers, strlen(headers)) == OK);
+    ASSERT(res->header_count == 3);
+    ASSERT(strcmp(res->headers[0], "Set-Cookie: a=1") == 0);
+    ASSERT(strcmp(res->headers[1], "Set-Cookie: b=2") == 0);
+    ASSERT(strcmp(res->headers[2], "Location: /next") == 0);
+
+    HTTPResponse *copy = httpresponse_copy(res);
+    ASSERT(copy != NULL);
+    ASSERT(copy->status_code == 302);
+    ASSERT(copy->body_length == 2 && memcmp(copy->body, "ok", 2) == 0);
+    ASSERT(strcmp(copy->content_type, "text/plain") == 0);
+    ASSERT(copy->header_count == 3);
+    ASSERT(strcmp(copy->headers[2], "Location: /next") == 0);
+
+    httpresponse_free(copy);
+    httpresponse_free(res);
+}
+
 /* ------------------------------------------------------------------ */
 /* main                                                                 */
 /* ------------------------------------------------------------------ */
@@ -197,6 +331,11 @@ int main(void)
     RUN(test_parse_request_line_post);
     RUN(test_parse_request_line_missing_crlf);
     RUN(test_parse_full_request_headers);
+    RUN(test_parse_incomplete_request);
+    RUN(test_parse_request_body_framing);
+    RUN(test_parse_request_smuggling);
+    RUN(test_parse_pipelined_requests);
+    RUN(test_copy_request);
 
     printf("\n[ mime ]\n");
     RUN(test_get_mime_type);
@@ -205,6 +344,8 @@ int main(void)
     RUN(test_response_builder_200);
     RUN(test_response_builder_404);
     RUN(test_response_serialize_status_line);
+    RUN(test_forwarded_request_headers);
+    RUN(test_end_to_end_response_headers);
 
     printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
 
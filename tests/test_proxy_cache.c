@@ -0,0 +1,354 @@
+/**
+ * @file    test_proxy_cache.c
+ * @brief   Unit tests for the reverse-proxy response cache.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http/parsers.h"
+#include "http/proxy_cache.h"
+
+#include "test.h"
+
+static char scratch_dir[] = "/tmp/cserve_test_proxy_cache.XXXXXX";
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static HTTPRequest *make_request(const char *raw_request)
+{
+    static char raw[512]; // the request points into it
+    snprintf(raw, sizeof(raw), "%s", raw_request);
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+    ASSERT(parse_http_request(raw, strlen(raw), req) > 0);
+    return req;
+}
+
+static bool has_header(const HTTPResponse *res, const char *header)
+{
+    for (int i = 0; i < res->header_count; i++)
+    {
+        if (strcmp(res->headers[i], header) == 0) return true;
+    }
+    return false;
+}
+
+/* Offers a 200 with the given upstream headers; returns whether it was stored */
+static bool store(const char *raw_request, const char *upstream_headers, const char *body,
+                  const ProxyCacheOptions *opts)
+{
+    HTTPRequest *req       = make_request(raw_request);
+    HTTPResponse *response = response_builder(200, "OK", body, strlen(body), "application/json");
+    char key[512];
+    size_t key_len = proxy_cache_key(req, opts, key, sizeof(key));
+    bool stored    = proxy_cache_store(key, key_len, opts, upstream_headers,
+                                       strlen(upstream_headers), response);
+    httpresponse_free(response);
+    free_http_request(req);
+    return stored;
+}
+
+/* Looks a request up; on a hit, checks the body and status header */
+static CacheStatus lookup(const char *raw_request, const char *expected_body,
+                          const ProxyCacheOptions *opts)
+{
+    HTTPRequest *req = make_request(raw_request);
+    CacheStatus status;
+    HTTPResponse *res = proxy_cache_lookup(req, opts, &status);
+    free_http_request(req);
+    if (res)
+    {
+        ASSERT(status == CACHE_HIT);
+        ASSERT(res->status_code == 200);
+        ASSERT((size_t)res->body_length == strlen(expected_body));
+        ASSERT(memcmp(res->body, expected_body, res->body_length) == 0);
+        ASSERT(has_header(res, "X-Cache-Status: HIT"));
+        ASSERT(has_header(res, "Age: 0"));
+        httpresponse_free(res);
+    }
+    return status;
+}
+
+static void memory_options(ProxyCacheOptions *opts)
+{
+    proxy_cache_options_defaults(opts);
+    opts->enabled = true;
+}
+
+#define GET_USERS "GET /api/users HTTP/1.1\r\nHost: x\r\n\r\n"
+
+/* ------------------------------------------------------------------ */
+/* Freshness and cacheability                                           */
+/* ------------------------------------------------------------------ */
+
+static void test_disabled_cache(void)
+{
+    ProxyCacheOptions opts;
+    proxy_cache_options_defaults(&opts);
+    ASSERT(!store(GET_USERS, "Cache-Control: max-age=60\r\n", "[]", &opts));
+    ASSERT(lookup(GET_USERS, "[]", &opts) == CACHE_OFF);
+    ASSERT(lookup(GET_USERS, "[]", NULL) == CACHE_OFF);
+}
+
+static void test_miss_then_hit(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    ASSERT(lookup(GET_USERS, "", &opts) == CACHE_MISS);
+    ASSERT(store(GET_USERS, "Content-Type: application/json\r\nCache-Control: max-age=60\r\n",
+                 "[1,2]", &opts));
+    ASSERT(lookup(GET_USERS, "[1,2]", &opts) == CACHE_HIT);
+
+    /* Method and URI are part of the key */
+    ASSERT(lookup("HEAD /api/users HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+    ASSERT(lookup("GET /api/users?page=2 HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+    proxy_cache_shutdown();
+}
+
+static void test_upstream_directives(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    ASSERT(store(GET_USERS, "Cache-Control: public, s-maxage=30, max-age=0\r\n", "a", &opts));
+    ASSERT(store(GET_USERS,
+                 "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                 "Expires: Sun, 06 Nov 1994 08:50:37 GMT\r\n",
+                 "b", &opts));
+
+    ASSERT(!store(GET_USERS, "", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: no-store\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: private, max-age=60\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: no-cache, max-age=60\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: max-age=0\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Expires: 0\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: max-age=60\r\nSet-Cookie: id=1\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: max-age=60\r\nVary: *\r\n", "c", &opts));
+    ASSERT(!store(GET_USERS, "Cache-Control: max-age=60\r\nVary: Accept\r\n", "c", &opts));
+    ASSERT(lookup(GET_USERS, "b", &opts) == CACHE_HIT);
+    proxy_cache_shutdown();
+}
+
+static void test_request_bypass(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    const char *requests[] = {
+        "POST /api/users HTTP/1.1\r\nContent-Length: 0\r\n\r\n",
+        "GET /api/users HTTP/1.1\r\nAuthorization: Bearer t\r\n\r\n",
+        "GET /api/users HTTP/1.1\r\nCache-Control: no-cache\r\n\r\n",
+        "GET /api/users HTTP/1.1\r\nPragma: no-cache\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+    {
+        ASSERT(lookup(requests[i], "", &opts) == CACHE_BYPASS);
+        ASSERT(!store(requests[i], "Cache-Control: max-age=60\r\n", "x", &opts));
+    }
+    proxy_cache_shutdown();
+}
+
+static void test_key_headers(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    ASSERT(proxy_cache_options_set_key_headers(&opts, "Accept-Language, Accept") == OK);
+    ASSERT(opts.key_header_count == 2);
+
+    const char *en = "GET /api/hello HTTP/1.1\r\nAccept-Language: en\r\n\r\n";
+    const char *de = "GET /api/hello HTTP/1.1\r\nAccept-Language: de\r\n\r\n";
+    ASSERT(store(en, "Cache-Control: max-age=60\r\nVary: accept-language\r\n", "hello", &opts));
+    ASSERT(store(de, "Cache-Control: max-age=60\r\nVary: Accept-Language\r\n", "hallo", &opts));
+    ASSERT(lookup(en, "hello", &opts) == CACHE_HIT);
+    ASSERT(lookup(de, "hallo", &opts) == CACHE_HIT);
+    ASSERT(lookup("GET /api/hello HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+
+    /* A key header the client names in Connection is not forwarded */
+    ASSERT(lookup("GET /api/hello HTTP/1.1\r\nConnection: Accept-Language\r\n"
+                  "Accept-Language: en\r\n\r\n",
+                  "", &opts) == CACHE_MISS);
+    proxy_cache_options_free(&opts);
+
+    /* Only forwarded headers can be part of the key */
+    ASSERT(proxy_cache_options_set_key_headers(&opts, "Host, Accept, Keep-Alive, TE") < 0);
+    ASSERT(opts.key_header_count == 1);
+    ASSERT(strcmp(opts.key_headers[0], "Accept") == 0);
+
+    proxy_cache_options_free(&opts);
+    proxy_cache_shutdown();
+}
+
+/* Stores a response carrying relayed upstream headers */
+static void store_with_headers(const char *raw_request, const ProxyCacheOptions *opts)
+{
+    HTTPRequest *req       = make_request(raw_request);
+    HTTPResponse *response = response_builder(301, "Moved Permanently", "", 0, "text/html");
+    const char upstream[]  = "Cache-Control: max-age=60\r\nLocation: /v2/users\r\n"
+                             "ETag: \"v1\"\r\nContent-Encoding: gzip\r\nAge: 7\r\n";
+    ASSERT(add_end_to_end_headers(response, upstream, strlen(upstream)) == OK);
+
+    char key[512];
+    size_t key_len = proxy_cache_key(req, opts, key, sizeof(key));
+    ASSERT(proxy_cache_store(key, key_len, opts, upstream, strlen(upstream), response));
+    httpresponse_free(response);
+    free_http_request(req);
+}
+
+static void check_stored_headers(const char *raw_request, const ProxyCacheOptions *opts)
+{
+    HTTPRequest *req = make_request(raw_request);
+    CacheStatus status;
+    HTTPResponse *res = proxy_cache_lookup(req, opts, &status);
+    free_http_request(req);
+    ASSERT(res != NULL && status == CACHE_HIT);
+    ASSERT(res->status_code == 301);
+    ASSERT(has_header(res, "Location: /v2/users"));
+    ASSERT(has_header(res, "ETag: \"v1\""));
+    ASSERT(has_header(res, "Content-Encoding: gzip"));
+    ASSERT(has_header(res, "Cache-Control: max-age=60"));
+
+    /* Age is restated for the hit, once */
+    int ages = 0;
+    for (int i = 0; i < res->header_count; i++)
+        ages += strncmp(res->headers[i], "Age:", 4) == 0;
+    ASSERT(ages == 1 && has_header(res, "Age: 0"));
+    httpresponse_free(res);
+}
+
+static void test_stored_headers(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    store_with_headers(GET_USERS, &opts);
+    check_stored_headers(GET_USERS, &opts);
+    proxy_cache_shutdown();
+}
+
+static void test_memory_lru(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    opts.memory_size = 1024; // room for a few small entries
+
+    char raw[64], body[8];
+    for (int i = 0; i < 32; i++)
+    {
+        snprintf(raw, sizeof(raw), "GET /api/item/%d HTTP/1.1\r\n\r\n", i);
+        snprintf(body, sizeof(body), "%d", i);
+        ASSERT(store(raw, "Cache-Control: max-age=60\r\n", body, &opts));
+        if (i > 0) ASSERT(lookup("GET /api/item/0 HTTP/1.1\r\n\r\n", "0", &opts) == CACHE_HIT);
+    }
+    /* Item 0 stayed hot; early cold items were evicted */
+    ASSERT(lookup("GET /api/item/1 HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+    ASSERT(lookup("GET /api/item/31 HTTP/1.1\r\n\r\n", "31", &opts) == CACHE_HIT);
+    proxy_cache_shutdown();
+}
+
+/* ------------------------------------------------------------------ */
+/* Disk tier                                                            */
+/* ------------------------------------------------------------------ */
+
+static void test_disk_tier_survives_restart(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    opts.disk_path  = strdup("cache.bin");
+    opts.disk_size  = 64 * 1024;
+    opts.disk_slots = 16;
+    ASSERT(proxy_cache_init(&opts) == OK);
+    ASSERT(store(GET_USERS, "Cache-Control: max-age=60\r\n", "[\"disk\"]", &opts));
+
+    /* Too big for a 4 KiB cell: memory only */
+    char big[6000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    ASSERT(store("GET /api/big HTTP/1.1\r\n\r\n", "Cache-Control: max-age=60\r\n", big, &opts));
+
+    /* Shutdown drops memory; the mapped file keeps the entry */
+    proxy_cache_shutdown();
+    ASSERT(proxy_cache_init(&opts) == OK);
+    ASSERT(lookup(GET_USERS, "[\"disk\"]", &opts) == CACHE_HIT);
+    ASSERT(lookup("GET /api/big HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+
+    /* A different layout starts over */
+    /* Relayed headers survive the restart too */
+    store_with_headers("GET /api/moved HTTP/1.1\r\n\r\n", &opts);
+    proxy_cache_shutdown();
+    ASSERT(proxy_cache_init(&opts) == OK);
+    check_stored_headers("GET /api/moved HTTP/1.1\r\n\r\n", &opts);
+
+    proxy_cache_shutdown();
+    opts.disk_slots = 32;
+    ASSERT(proxy_cache_init(&opts) == OK);
+    ASSERT(lookup(GET_USERS, "", &opts) == CACHE_MISS);
+
+    proxy_cache_shutdown();
+    proxy_cache_options_free(&opts);
+    unlink("cache.bin");
+}
+
+static void test_disk_lru_within_set(void)
+{
+    ProxyCacheOptions opts;
+    memory_options(&opts);
+    opts.disk_path  = strdup("lru.bin");
+    opts.disk_size  = 8 * 512;
+    opts.disk_slots = 8; // a single set
+    ASSERT(proxy_cache_init(&opts) == OK);
+
+    char raw[64], body[8];
+    for (int i = 0; i < 9; i++)
+    {
+        snprintf(raw, sizeof(raw), "GET /api/item/%d HTTP/1.1\r\n\r\n", i);
+        snprintf(body, sizeof(body), "%d", i);
+        ASSERT(store(raw, "Cache-Control: max-age=60\r\n", body, &opts));
+        if (i == 7)
+        {
+            // Touch item 0 so item 1 becomes the least recently used
+            ASSERT(lookup("GET /api/item/0 HTTP/1.1\r\n\r\n", "0", &opts) == CACHE_HIT);
+        }
+    }
+
+    proxy_cache_shutdown(); // only the disk tier is left
+    ASSERT(proxy_cache_init(&opts) == OK);
+    ASSERT(lookup("GET /api/item/0 HTTP/1.1\r\n\r\n", "0", &opts) == CACHE_HIT);
+    ASSERT(lookup("GET /api/item/1 HTTP/1.1\r\n\r\n", "", &opts) == CACHE_MISS);
+    ASSERT(lookup("GET /api/item/8 HTTP/1.1\r\n\r\n", "8", &opts) == CACHE_HIT);
+
+    proxy_cache_shutdown();
+    proxy_cache_options_free(&opts);
+    unlink("lru.bin");
+}
+
+int main(void)
+{
+    printf("=== cserve proxy cache tests ===\n\n");
+
+    logger_set_level(LOG_ERROR);
+    ASSERT(mkdtemp(scratch_dir) != NULL);
+    ASSERT(chdir(scratch_dir) == 0);
+
+    printf("[ memory ]\n");
+    RUN(test_disabled_cache);
+    RUN(test_miss_then_hit);
+    RUN(test_upstream_directives);
+    RUN(test_request_bypass);
+    RUN(test_key_headers);
+    RUN(test_stored_headers);
+    RUN(test_memory_lru);
+
+    printf("\n[ disk ]\n");
+    RUN(test_disk_tier_survives_restart);
+    RUN(test_disk_lru_within_set);
+
+    rmdir(scratch_dir);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
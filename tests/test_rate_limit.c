@@ -0,0 +1,213 @@
+/**
+ * @file    test_rate_limit.c
+ * @brief   Unit tests for the limit_req / limit_conn client table.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "http/rate_limit.h"
+
+#include "test.h"
+
+#define SEC 1000000000ull
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static void init(RateLimiter *rl, double rate, int burst, int conn, size_t slots)
+{
+    RateLimitOptions opts;
+    rate_limit_options_defaults(&opts);
+    opts.rate  = rate;
+    opts.burst = burst;
+    opts.conn  = conn;
+    opts.slots = slots;
+    ASSERT(rate_limiter_init(rl, &opts) == OK);
+}
+
+static uint64_t key_v4(const RateLimiter *rl, const char *ip)
+{
+    struct sockaddr_in sin = {.sin_family = AF_INET, .sin_port = htons(1234)};
+    inet_pton(AF_INET, ip, &sin.sin_addr);
+    return rate_limit_key(rl, (struct sockaddr *)&sin);
+}
+
+static uint64_t key_v6(const RateLimiter *rl, const char *ip)
+{
+    struct sockaddr_in6 sin6 = {.sin6_family = AF_INET6, .sin6_port = htons(4321)};
+    inet_pton(AF_INET6, ip, &sin6.sin6_addr);
+    return rate_limit_key(rl, (struct sockaddr *)&sin6);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_rate_parsing(void)
+{
+    RateLimitOptions opts;
+    rate_limit_options_defaults(&opts);
+    ASSERT(opts.rate == 0 && opts.conn == 0 && opts.slots == DEFAULT_LIMIT_SLOTS);
+
+    ASSERT(rate_limit_options_set_rate(&opts, "10") == OK && opts.rate == 10);
+    ASSERT(rate_limit_options_set_rate(&opts, "5r/s") == OK && opts.rate == 5);
+    ASSERT(rate_limit_options_set_rate(&opts, "120r/m") == OK && opts.rate == 2);
+    ASSERT(rate_limit_options_set_rate(&opts, "fast") < 0);
+    ASSERT(rate_limit_options_set_rate(&opts, "10r/h") < 0);
+    ASSERT(rate_limit_options_set_rate(&opts, "-1") < 0);
+    ASSERT(opts.rate == 2);
+}
+
+static void test_disabled(void)
+{
+    RateLimiter rl;
+    init(&rl, 0, 0, 0, 0);
+    ASSERT(rl.slots == NULL);
+
+    uint64_t key = key_v4(&rl, "10.0.0.1");
+    for (int i = 0; i < 1000; i++)
+        ASSERT(rate_limit_request(&rl, key, 0));
+    ASSERT(rate_limit_connect(&rl, key, 0) == -1);
+    rate_limit_disconnect(&rl, -1);
+    rate_limiter_free(&rl);
+}
+
+static void test_burst_and_refill(void)
+{
+    RateLimiter rl;
+    init(&rl, 2, 3, 0, 64); // a token every 500ms, 3 ahead
+    uint64_t a   = key_v4(&rl, "10.0.0.1");
+    uint64_t b   = key_v4(&rl, "10.0.0.2");
+    uint64_t now = 100 * SEC;
+
+    // burst + 1 requests at once, then nothing until a token comes back
+    for (int i = 0; i < 4; i++)
+        ASSERT(rate_limit_request(&rl, a, now));
+    ASSERT(!rate_limit_request(&rl, a, now));
+    ASSERT(!rate_limit_request(&rl, a, now + SEC / 4));
+    ASSERT(rate_limit_request(&rl, a, now + SEC / 2));
+    ASSERT(!rate_limit_request(&rl, a, now + SEC / 2));
+
+    // Other clients have their own bucket
+    ASSERT(rate_limit_request(&rl, b, now));
+
+    // An idle client is back to a full bucket, never more
+    now += 10 * SEC;
+    for (int i = 0; i < 4; i++)
+        ASSERT(rate_limit_request(&rl, a, now));
+    ASSERT(!rate_limit_request(&rl, a, now));
+
+    // Steady traffic at the rate never runs into the limit
+    now += 10 * SEC;
+    for (int i = 0; i < 50; i++)
+        ASSERT(rate_limit_request(&rl, b, now + (uint64_t)i * SEC / 2));
+    rate_limiter_free(&rl);
+}
+
+static void test_connection_limit(void)
+{
+    RateLimiter rl;
+    init(&rl, 0, 0, 2, 64);
+    uint64_t a = key_v4(&rl, "192.168.1.10");
+    uint64_t b = key_v4(&rl, "192.168.1.11");
+
+    int first  = rate_limit_connect(&rl, a, 0);
+    int second = rate_limit_connect(&rl, a, 0);
+    ASSERT(first >= 0 && second == first);
+    ASSERT(rate_limit_connect(&rl, a, 0) == RATE_LIMITED);
+    ASSERT(rate_limit_connect(&rl, b, 0) >= 0);
+
+    rate_limit_disconnect(&rl, first);
+    int third = rate_limit_connect(&rl, a, 0);
+    ASSERT(third == first);
+    ASSERT(rate_limit_connect(&rl, a, 0) == RATE_LIMITED);
+
+    // limit_req is off: requests are never refused
+    ASSERT(rate_limit_request(&rl, a, 0));
+    rate_limiter_free(&rl);
+}
+
+static void test_keys(void)
+{
+    RateLimiter rl;
+    init(&rl, 1, 0, 0, 64);
+
+    // The port is not part of the key, and v4-mapped v6 is the same client
+    ASSERT(key_v4(&rl, "10.1.2.3") == key_v6(&rl, "::ffff:10.1.2.3"));
+    ASSERT(key_v4(&rl, "10.1.2.3") != key_v4(&rl, "10.1.2.4"));
+    ASSERT(key_v6(&rl, "2001:db8::1") != 0);
+
+    // IPv6 clients are keyed by their /64
+    ASSERT(key_v6(&rl, "2001:db8::1") == key_v6(&rl, "2001:db8::2"));
+    ASSERT(key_v6(&rl, "2001:db8:0:0:ffff:1:2:3") == key_v6(&rl, "2001:db8::1"));
+    ASSERT(key_v6(&rl, "2001:db8:0:1::1") != key_v6(&rl, "2001:db8::1"));
+    rate_limiter_free(&rl);
+}
+
+static void test_full_table(void)
+{
+    RateLimiter rl;
+    init(&rl, 1, 0, 1, 1); // rounded up to a single probe window
+    ASSERT(rl.mask + 1 == LIMIT_PROBES);
+
+    // Fill the table with clients holding a connection open
+    char ip[32];
+    int slots[LIMIT_PROBES];
+    for (int i = 0; i < LIMIT_PROBES; i++)
+    {
+        snprintf(ip, sizeof(ip), "10.9.0.%d", i + 1);
+        slots[i] = rate_limit_connect(&rl, key_v4(&rl, ip), 0);
+        ASSERT(slots[i] >= 0);
+    }
+
+    // No room: newcomers share the overflow entry, and its limits
+    uint64_t late  = key_v4(&rl, "10.9.1.1");
+    uint64_t later = key_v4(&rl, "10.9.1.2");
+    int overflow   = rate_limit_connect(&rl, late, 0);
+    ASSERT(overflow == LIMIT_PROBES);
+    ASSERT(rate_limit_connect(&rl, later, 0) == RATE_LIMITED);
+    ASSERT(rate_limit_request(&rl, late, 0));
+    ASSERT(!rate_limit_request(&rl, later, 0));
+    ASSERT(!rate_limit_request(&rl, late, SEC / 2));
+    ASSERT(rate_limit_request(&rl, later, SEC));
+
+    // Once a client is idle, its entry goes to the next client needing one
+    rate_limit_disconnect(&rl, slots[5]);
+    int taken = rate_limit_connect(&rl, late, SEC);
+    ASSERT(taken == slots[5]);
+    ASSERT(rate_limit_connect(&rl, late, SEC) == RATE_LIMITED);
+
+    // The overflow count drops when its connection closes
+    rate_limit_disconnect(&rl, overflow);
+    ASSERT(rate_limit_connect(&rl, later, SEC) == overflow);
+    rate_limiter_free(&rl);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve rate limit tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ rate limit ]\n");
+    RUN(test_rate_parsing);
+    RUN(test_disabled);
+    RUN(test_burst_and_refill);
+    RUN(test_connection_limit);
+    RUN(test_keys);
+    RUN(test_full_table);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
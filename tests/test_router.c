@@ -0,0 +1,203 @@
+/**
+ * @file    test_router.c
+ * @brief   Unit tests for location parsing and the location radix trie.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http/router.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static void add(Router *router, const char *spec, RouteHandler handler)
+{
+    Location loc;
+    ASSERT(location_init(&loc, spec) == OK);
+    loc.handler = handler;
+    ASSERT(router_add(router, &loc) == OK);
+    location_free(&loc);
+}
+
+/* Path of the matching location, with "=" in front of exact ones; NULL if none */
+static const char *match(const Router *router, const char *path)
+{
+    static char found[128];
+    const Location *loc = router_match(router, path, strlen(path));
+    if (!loc) return NULL;
+    snprintf(found, sizeof(found), "%s%s", loc->match == MATCH_EXACT ? "=" : "", loc->path);
+    return found;
+}
+
+static bool matches(const Router *router, const char *path, const char *expected)
+{
+    const char *found = match(router, path);
+    if (!found || !expected) return found == expected;
+    return strcmp(found, expected) == 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_location_parsing(void)
+{
+    Location loc;
+    ASSERT(location_init(&loc, " /static") == OK);
+    ASSERT(loc.match == MATCH_PREFIX && strcmp(loc.path, "/static") == 0 && loc.group == -1);
+    location_free(&loc);
+
+    ASSERT(location_init(&loc, " = /health") == OK);
+    ASSERT(loc.match == MATCH_EXACT && strcmp(loc.path, "/health") == 0);
+    location_free(&loc);
+
+    ASSERT(location_init(&loc, "") < 0);
+    ASSERT(location_init(&loc, " static") < 0);
+    ASSERT(location_init(&loc, " /a b") < 0);
+    ASSERT(location_init(&loc, " =") < 0);
+
+    ASSERT(location_init(&loc, " /assets") == OK);
+    ASSERT(location_set(&loc, "static", "/var/www") == OK);
+    ASSERT(loc.handler == ROUTE_STATIC && strcmp(loc.root, "/var/www") == 0);
+    ASSERT(location_set(&loc, "strip_prefix", "on") == OK && loc.strip_prefix);
+    ASSERT(location_set(&loc, "coroutine", "on") == OK && loc.coroutine);
+    ASSERT(location_set(&loc, "proxy", "") == OK);
+    ASSERT(loc.handler == ROUTE_PROXY && loc.upstream == NULL);
+    ASSERT(location_set(&loc, "proxy", "app") == OK && strcmp(loc.upstream, "app") == 0);
+
+    ASSERT(location_set(&loc, "return", "301 https://example.com/") == OK);
+    ASSERT(loc.handler == ROUTE_RETURN && loc.status == 301);
+    ASSERT(strcmp(loc.body, "https://example.com/") == 0);
+    ASSERT(location_set(&loc, "return", "204") == OK && loc.status == 204 && loc.body == NULL);
+    ASSERT(location_set(&loc, "return", "99 too low") < 0);
+    ASSERT(location_set(&loc, "return", "200x") < 0);
+    ASSERT(location_set(&loc, "content", "echo") == OK && loc.handler == ROUTE_MODULE);
+    ASSERT(location_set(&loc, "content", "nonesuch") < 0);
+    ASSERT(location_set(&loc, "return", "gone") < 0);
+    ASSERT(location_set(&loc, "content_type", "application/json") == OK);
+    ASSERT(location_set(&loc, "backend", "localhost:8002") < 0);
+    location_free(&loc);
+}
+
+static void test_prefix_segments(void)
+{
+    Router router;
+    ASSERT(router_init(&router) == OK);
+    add(&router, "/static", ROUTE_STATIC);
+    add(&router, "/api", ROUTE_PROXY);
+    add(&router, "/docs/", ROUTE_STATIC);
+
+    ASSERT(matches(&router, "/static", "/static"));
+    ASSERT(matches(&router, "/static/", "/static"));
+    ASSERT(matches(&router, "/static/css/app.css", "/static"));
+    ASSERT(matches(&router, "/staticfoo", NULL));
+    ASSERT(matches(&router, "/stat", NULL));
+    ASSERT(matches(&router, "/api/users", "/api"));
+    ASSERT(matches(&router, "/apiary", NULL));
+    ASSERT(matches(&router, "/", NULL));
+    ASSERT(matches(&router, "", NULL));
+
+    // A prefix ending in '/' covers what is below it, not the bare directory
+    ASSERT(matches(&router, "/docs/intro", "/docs/"));
+    ASSERT(matches(&router, "/docs/", "/docs/"));
+    ASSERT(matches(&router, "/docs", NULL));
+
+    // "/" catches whatever no longer prefix claims
+    add(&router, "/", ROUTE_RETURN);
+    ASSERT(matches(&router, "/staticfoo", "/"));
+    ASSERT(matches(&router, "/", "/"));
+    ASSERT(matches(&router, "/static/x", "/static"));
+    router_free(&router);
+}
+
+static void test_exact_and_longest_match(void)
+{
+    Router router;
+    ASSERT(router_init(&router) == OK);
+    add(&router, "/api", ROUTE_PROXY);
+    add(&router, "/api/v1", ROUTE_PROXY);
+    add(&router, "= /api/health", ROUTE_RETURN);
+    add(&router, "= /api", ROUTE_RETURN);
+
+    ASSERT(matches(&router, "/api/v1/users", "/api/v1"));
+    ASSERT(matches(&router, "/api/v1", "/api/v1"));
+    ASSERT(matches(&router, "/api/v10", "/api"));
+    ASSERT(matches(&router, "/api/v", "/api"));
+    ASSERT(matches(&router, "/api/health", "=/api/health"));
+    ASSERT(matches(&router, "/api/health/deep", "/api"));
+    ASSERT(matches(&router, "/api/healthz", "/api"));
+    ASSERT(matches(&router, "/api", "=/api"));
+    ASSERT(matches(&router, "/api/", "/api"));
+
+    // The same path and match type cannot be routed twice; the other type can
+    Location loc;
+    ASSERT(location_init(&loc, "/api/v1") == OK);
+    loc.handler = ROUTE_STATIC;
+    ASSERT(router_add(&router, &loc) < 0);
+    location_free(&loc);
+    ASSERT(location_init(&loc, "= /api/v1") == OK);
+    ASSERT(router_add(&router, &loc) < 0); // no handler
+    loc.handler = ROUTE_STATIC;
+    ASSERT(router_add(&router, &loc) == OK);
+    location_free(&loc);
+    ASSERT(matches(&router, "/api/v1", "=/api/v1"));
+    ASSERT(matches(&router, "/api/v1/x", "/api/v1"));
+    ASSERT(router.location_count == 5);
+    router_free(&router);
+}
+
+static void test_many_locations(void)
+{
+    Router router;
+    ASSERT(router_init(&router) == OK);
+
+    // Shared prefixes in scrambled order split edges over and over
+    char spec[64];
+    for (int i = 0; i < MAX_LOCATIONS; i++)
+    {
+        int n = (i * 37) % MAX_LOCATIONS;
+        snprintf(spec, sizeof(spec), "/svc%d/v%d", n % 8, n);
+        add(&router, spec, ROUTE_PROXY);
+    }
+    ASSERT(router.location_count == MAX_LOCATIONS);
+
+    char path[64], expected[64];
+    for (int n = 0; n < MAX_LOCATIONS; n++)
+    {
+        snprintf(path, sizeof(path), "/svc%d/v%d/resource", n % 8, n);
+        snprintf(expected, sizeof(expected), "/svc%d/v%d", n % 8, n);
+        ASSERT(matches(&router, path, expected));
+        ASSERT(matches(&router, expected, expected));
+    }
+    ASSERT(matches(&router, "/svc1", NULL));
+    ASSERT(matches(&router, "/svc1/v", NULL));
+    router_free(&router);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve router tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ router ]\n");
+    RUN(test_location_parsing);
+    RUN(test_prefix_segments);
+    RUN(test_exact_and_longest_match);
+    RUN(test_many_locations);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
@@ -0,0 +1,453 @@
+/**
+ * @file    test_server.c
+ * @brief   End-to-end tests of the event loop: an in-process server, a
+ *          scripted backend and raw client sockets on loopback.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+
+#include "http/server.h"
+#include "utils/config.h"
+
+#include "test.h"
+
+#define IO_TIMEOUT_S 2
+
+static char scratch_dir[] = "/tmp/cserve_test_server.XXXXXX";
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static int listen_loopback(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT(fd >= 0);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len      = sizeof(addr);
+    ASSERT(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    ASSERT(listen(fd, SOMAXCONN) == 0);
+    ASSERT(getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int connect_to(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT(fd >= 0);
+    struct timeval tv = {IO_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_all(int fd, const char *data)
+{
+    size_t len = strlen(data);
+    ASSERT(send(fd, data, len, MSG_NOSIGNAL) == (ssize_t)len);
+}
+
+/* Reads one response; its body is framed by Content-Length unless bodiless */
+static size_t read_response(int fd, char *buf, size_t cap, bool bodiless)
+{
+    size_t len = 0;
+    while (len + 1 < cap)
+    {
+        buf[len]          = '\0';
+        const char *end   = strstr(buf, "\r\n\r\n");
+        const char *field = strcasestr(buf, "\r\nContent-Length:");
+        if (end)
+        {
+            size_t body = bodiless || !field || field > end ? 0 : strtoul(field + 17, NULL, 10);
+            if (len >= (size_t)(end + 4 - buf) + body) break;
+        }
+        ssize_t n = recv(fd, buf + len, cap - len - 1, 0);
+        if (n <= 0) break;
+        len += n;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* Reads until the server closes the connection */
+static size_t read_until_close(int fd, char *buf, size_t cap)
+{
+    size_t len = 0;
+    ssize_t n;
+    while (len + 1 < cap && (n = recv(fd, buf + len, cap - len - 1, 0)) > 0)
+        len += n;
+    buf[len] = '\0';
+    return len;
+}
+
+static int count_of(const char *haystack, const char *needle)
+{
+    int count = 0;
+    for (const char *p = strstr(haystack, needle); p; p = strstr(p + 1, needle))
+        count++;
+    return count;
+}
+
+/* ------------------------------------------------------------------ */
+/* Scripted backend                                                     */
+/* ------------------------------------------------------------------ */
+
+typedef struct Backend
+{
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    atomic_bool release; // the held response may go out
+    const char *response;
+    char request[2048]; // the one request received
+    int connections;    // accepted, including any after the response
+} Backend;
+
+/* Accepts one connection, holds its response until released, then counts stragglers */
+static void *backend_main(void *arg)
+{
+    Backend *b = arg;
+    int fd     = accept4(b->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) return NULL;
+    b->connections++;
+
+    size_t len = 0;
+    while (len + 1 < sizeof(b->request) && !memmem(b->request, len, "\r\n\r\n", 4))
+    {
+        ssize_t n = recv(fd, b->request + len, sizeof(b->request) - len - 1, 0);
+        if (n <= 0) break;
+        len += n;
+    }
+    b->request[len] = '\0';
+
+    while (!atomic_load(&b->release))
+        usleep(1000);
+    send(fd, b->response, strlen(b->response), MSG_NOSIGNAL);
+    close(fd);
+
+    struct pollfd pfd = {.fd = b->listen_fd, .events = POLLIN};
+    while (poll(&pfd, 1, 200) > 0)
+    {
+        int extra = accept4(b->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (extra < 0) break;
+        b->connections++;
+        close(extra);
+    }
+    return NULL;
+}
+
+static Backend backend;
+
+/* Starts the backend thread on a fresh script; a held response waits for release */
+static void start_backend(const char *response, bool hold)
+{
+    backend.response    = response;
+    backend.connections = 0;
+    atomic_store(&backend.release, !hold);
+    ASSERT(pthread_create(&backend.thread, NULL, backend_main, &backend) == 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* In-process server                                                    */
+/* ------------------------------------------------------------------ */
+
+static Config *config;
+static HTTPServer *server;
+static pthread_t server_thread;
+static int server_port;
+
+static void *server_main(void *arg)
+{
+    HTTPServer *self = arg;
+    self->launch(self);
+    return NULL;
+}
+
+static void start_server(void)
+{
+    int probe = listen_loopback(&server_port);
+    close(probe);
+    backend.listen_fd = listen_loopback(&backend.port);
+
+    FILE *f = fopen("cserver.ini", "w");
+    ASSERT(f != NULL);
+    fprintf(f,
+            "port=%d\n"
+            "backend=127.0.0.1:%d\n"
+            "log_level=OFF\n"
+            "proxy_coalesce=on\n"
+            "static_dir=static\n"
+            "static_io_threads=0\n"
+            "[location /static]\n"
+            "static =\n"
+            "[location /api]\n"
+            "proxy =\n"
+            "strip_prefix = on\n"
+            "[location /co]\n"
+            "proxy =\n"
+            "strip_prefix = on\n"
+            "coroutine = on\n",
+            server_port, backend.port);
+    ASSERT(fclose(f) == 0);
+
+    config = parse_config("cserver.ini");
+    ASSERT(config != NULL);
+    server = httpserver_constructor(config);
+    ASSERT(server != NULL);
+    ASSERT(pthread_create(&server_thread, NULL, server_main, server) == 0);
+
+    for (int i = 0; i < 500; i++)
+    {
+        int fd = connect_to(server_port);
+        if (fd >= 0)
+        {
+            close(fd);
+            return;
+        }
+        usleep(10000);
+    }
+    ASSERT(!"server did not come up");
+}
+
+static void stop_server(void)
+{
+    httpserver_stop(server);
+    pthread_join(server_thread, NULL);
+    httpserver_destructor(server);
+    free_config(config);
+    close(backend.listen_fd);
+    unlink("cserver.ini");
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+#define COALESCED_CLIENTS 4
+
+static void test_coalesced_waiters_get_every_header(void)
+{
+    start_backend("HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Content-Length: 2\r\n"
+                  "X-Upstream: one\r\n"
+                  "ETag: \"v1\"\r\n"
+                  "Connection: close\r\n"
+                  "\r\n"
+                  "[]",
+                  true);
+
+    int clients[COALESCED_CLIENTS];
+    for (int i = 0; i < COALESCED_CLIENTS; i++)
+    {
+        clients[i] = connect_to(server_port);
+        ASSERT(clients[i] >= 0);
+        send_all(clients[i], "GET /api/items HTTP/1.1\r\nHost: x\r\nX-Client: 7\r\n\r\n");
+    }
+    usleep(200000); // every request reaches the loop before the backend answers
+    atomic_store(&backend.release, true);
+
+    int coalesced = 0;
+    for (int i = 0; i < COALESCED_CLIENTS; i++)
+    {
+        char response[1024];
+        ASSERT(read_response(clients[i], response, sizeof(response), false) > 0);
+        ASSERT(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0);
+        ASSERT(strstr(response, "\r\nX-Upstream: one\r\n") != NULL);
+        ASSERT(strstr(response, "\r\nETag: \"v1\"\r\n") != NULL);
+        ASSERT(strstr(response, "\r\nContent-Type: application/json\r\n") != NULL);
+        ASSERT(count_of(response, "Connection: close") == 0);
+        ASSERT(strcmp(response + strlen(response) - 6, "\r\n\r\n[]") == 0);
+        coalesced += strstr(response, "X-Cache-Status: COALESCED") != NULL;
+        close(clients[i]);
+    }
+    pthread_join(backend.thread, NULL);
+
+    ASSERT(coalesced == COALESCED_CLIENTS - 1);
+    ASSERT(backend.connections == 1);
+    ASSERT(strstr(backend.request, "\r\nX-Client: 7\r\n") != NULL);
+}
+
+#define PAGE_SIZE_BYTES 4000
+
+static size_t content_length(const char *response)
+{
+    const char *field = strcasestr(response, "\r\nContent-Length:");
+    ASSERT(field != NULL && field < strstr(response, "\r\n\r\n"));
+    return strtoul(field + 17, NULL, 10);
+}
+
+static void write_page(void)
+{
+    ASSERT(mkdir("static", 0755) == 0);
+    FILE *f = fopen("static/page.html", "w");
+    ASSERT(f != NULL);
+    for (int i = 0; i < PAGE_SIZE_BYTES; i++)
+        fputc(i % 50 == 49 ? '\n' : 'a' + i % 26, f);
+    ASSERT(fclose(f) == 0);
+}
+
+static void test_pipelined_head_then_get(void)
+{
+    // A file sent with sendfile(): HEAD must not queue its slices
+    int fd = connect_to(server_port);
+    ASSERT(fd >= 0);
+    send_all(fd, "HEAD /static/page.html HTTP/1.1\r\nHost: x\r\n\r\n"
+                 "GET /static/page.html HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+
+    static char stream[2 * PAGE_SIZE_BYTES];
+    size_t len = read_until_close(fd, stream, sizeof(stream));
+    close(fd);
+
+    ASSERT(strncmp(stream, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    ASSERT(content_length(stream) == PAGE_SIZE_BYTES);
+    char *second = strstr(stream, "\r\n\r\n") + 4;
+    ASSERT(strncmp(second, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    ASSERT(content_length(second) == PAGE_SIZE_BYTES);
+    char *body = strstr(second, "\r\n\r\n") + 4;
+    ASSERT((size_t)(stream + len - body) == PAGE_SIZE_BYTES);
+    ASSERT(strncmp(body, "abcdef", 6) == 0);
+}
+
+static void test_head_never_compresses(void)
+{
+    // Nothing cached yet: HEAD describes the identity body and compresses nothing
+    int fd = connect_to(server_port);
+    ASSERT(fd >= 0);
+    send_all(fd, "HEAD /static/page.html HTTP/1.1\r\nHost: x\r\nAccept-Encoding: gzip\r\n\r\n"
+                 "GET /static/page.html HTTP/1.1\r\nHost: x\r\nAccept-Encoding: gzip\r\n\r\n"
+                 "HEAD /static/page.html HTTP/1.1\r\nHost: x\r\nAccept-Encoding: gzip\r\n"
+                 "Connection: close\r\n\r\n");
+
+    static char stream[2 * PAGE_SIZE_BYTES];
+    size_t len = read_until_close(fd, stream, sizeof(stream));
+    close(fd);
+
+    char *head  = stream;
+    char *get   = strstr(head, "\r\n\r\n") + 4;
+    size_t gzip = content_length(get);
+    char *again = strstr(get, "\r\n\r\n") + 4 + gzip;
+    ASSERT(content_length(head) == PAGE_SIZE_BYTES);
+    ASSERT(!strstr(head, "Content-Encoding") || strstr(head, "Content-Encoding") > get);
+    ASSERT(strstr(get, "\r\nContent-Encoding: gzip\r\n") < again);
+    ASSERT(gzip < PAGE_SIZE_BYTES);
+
+    // Once the GET has cached the gzip variant, HEAD reports it
+    ASSERT(strncmp(again, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    ASSERT(strstr(again, "\r\nContent-Encoding: gzip\r\n") != NULL);
+    ASSERT(content_length(again) == gzip);
+    ASSERT(stream + len == strstr(again, "\r\n\r\n") + 4);
+}
+
+static void test_proxied_head_keeps_length(void)
+{
+    start_backend("HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: close\r\n\r\n", false);
+    int fd = connect_to(server_port);
+    ASSERT(fd >= 0);
+    send_all(fd, "HEAD /api/items HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n");
+
+    char response[1024];
+    size_t len = read_until_close(fd, response, sizeof(response));
+    close(fd);
+    pthread_join(backend.thread, NULL);
+
+    ASSERT(strncmp(backend.request, "HEAD /items HTTP/1.1\r\n", 22) == 0);
+    ASSERT(content_length(response) == 5);
+    ASSERT(response + len == strstr(response, "\r\n\r\n") + 4);
+}
+
+static void test_transfer_encoding_refused(void)
+{
+    // The chunk that follows would be read as a request of its own: answer and close instead
+    int fd = connect_to(server_port);
+    ASSERT(fd >= 0);
+    send_all(fd, "POST /api/items HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n"
+                 "0\r\n\r\nGET /static/page.html HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    char response[1024];
+    size_t len = read_until_close(fd, response, sizeof(response));
+    close(fd);
+
+    ASSERT(strncmp(response, "HTTP/1.1 501 Not Implemented\r\n", 30) == 0);
+    ASSERT(strstr(response, "\r\nConnection: close\r\n") != NULL);
+    char *body = strstr(response, "\r\n\r\n") + 4;
+    ASSERT(response + len == body + content_length(response));
+    ASSERT(count_of(response, "HTTP/1.1 ") == 1);
+}
+
+static void test_coroutine_proxy_decodes_chunks(void)
+{
+    start_backend("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n"
+                  "\r\n5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n",
+                  false);
+    int fd = connect_to(server_port);
+    ASSERT(fd >= 0);
+    send_all(fd, "GET /co/items HTTP/1.1\r\nHost: x\r\n\r\n");
+
+    char response[1024];
+    read_response(fd, response, sizeof(response), false);
+    close(fd);
+    pthread_join(backend.thread, NULL);
+
+    ASSERT(strncmp(backend.request, "GET /items HTTP/1.1\r\n", 21) == 0);
+    ASSERT(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    ASSERT(!strcasestr(response, "Transfer-Encoding"));
+    ASSERT(content_length(response) == 11);
+    ASSERT(strcmp(strstr(response, "\r\n\r\n") + 4, "hello world") == 0);
+}
+
+int main(void)
+{
+    printf("=== cserve server tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+    signal(SIGPIPE, SIG_IGN);
+    ASSERT(mkdtemp(scratch_dir) != NULL);
+    ASSERT(chdir(scratch_dir) == 0);
+    start_server();
+
+    printf("[ proxy ]\n");
+    RUN(test_coalesced_waiters_get_every_header);
+    RUN(test_proxied_head_keeps_length);
+    RUN(test_coroutine_proxy_decodes_chunks);
+
+    printf("\n[ head ]\n");
+    write_page();
+    RUN(test_pipelined_head_then_get);
+    RUN(test_head_never_compresses);
+
+    printf("\n[ framing ]\n");
+    RUN(test_transfer_encoding_refused);
+
+    stop_server();
+    unlink("static/page.html");
+    rmdir("static");
+    rmdir(scratch_dir);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
@@ -0,0 +1,543 @@
+/**
+ * @file    test_static.c
+ * @brief   Unit tests for the static file handler, content negotiation and ranges.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "http/parsers.h"
+#include "http/static_files.h"
+
+#include "test.h"
+
+#define CSS_LINE "body { margin: 0; }\n" // 20 bytes; app.css is 200 of them
+
+static char scratch_dir[] = "/tmp/cserve_test_static.XXXXXX";
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static void write_text(const char *path, const char *line, int repeat)
+{
+    FILE *f = fopen(path, "w");
+    ASSERT(f != NULL);
+    for (int i = 0; i < repeat; i++)
+        fputs(line, f);
+    fclose(f);
+}
+
+static bool has_header(const HTTPResponse *res, const char *header)
+{
+    for (int i = 0; i < res->header_count; i++)
+    {
+        if (strcmp(res->headers[i], header) == 0) return true;
+    }
+    return false;
+}
+
+/* Value of a response header, or NULL */
+static const char *header_value(const HTTPResponse *res, const char *name)
+{
+    size_t len = strlen(name);
+    for (int i = 0; i < res->header_count; i++)
+    {
+        if (strncmp(res->headers[i], name, len) == 0 && res->headers[i][len] == ':')
+            return res->headers[i] + len + 2;
+    }
+    return NULL;
+}
+
+static HTTPResponse *serve_request(const char *raw_request, const StaticOptions *opts)
+{
+    char raw[512];
+    snprintf(raw, sizeof(raw), "%s", raw_request);
+
+    HTTPRequest *req = create_http_request();
+    ASSERT(req != NULL);
+    ASSERT(parse_http_request(raw, strlen(raw), req) > 0);
+    HTTPResponse *res = static_handler(req, opts, NULL, 0);
+    free_http_request(req);
+    ASSERT(res != NULL);
+    return res;
+}
+
+static HTTPResponse *serve(const char *uri, const char *accept, const StaticOptions *opts)
+{
+    char raw[256];
+    if (accept)
+        snprintf(raw, sizeof(raw), "GET %s HTTP/1.1\r\nAccept-Encoding: %s\r\n\r\n", uri, accept);
+    else
+        snprintf(raw, sizeof(raw), "GET %s HTTP/1.1\r\n\r\n", uri);
+    return serve_request(raw, opts);
+}
+
+/* Reassembles the body as the connection would send it; returns its length */
+static size_t body_of(const HTTPResponse *res, char *out, size_t cap)
+{
+    if (res->file_fd < 0)
+    {
+        ASSERT((size_t)res->body_length <= cap);
+        memcpy(out, res->body, res->body_length);
+        return res->body_length;
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < res->file_range_count; i++)
+    {
+        const ResponseFileRange *r = &res->file_ranges[i];
+        if (r->prefix)
+        {
+            ASSERT(len + strlen(r->prefix) <= cap);
+            memcpy(out + len, r->prefix, strlen(r->prefix));
+            len += strlen(r->prefix);
+        }
+        ASSERT(len + r->length <= cap);
+        ASSERT(pread(res->file_fd, out + len, r->length, r->offset) == (ssize_t)r->length);
+        len += r->length;
+    }
+    if (res->file_trailer)
+    {
+        ASSERT(len + strlen(res->file_trailer) <= cap);
+        memcpy(out + len, res->file_trailer, strlen(res->file_trailer));
+        len += strlen(res->file_trailer);
+    }
+    ASSERT(len == res->content_length);
+    return len;
+}
+
+/* ------------------------------------------------------------------ */
+/* Accept-Encoding tests                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_accept_encoding(void)
+{
+#define AE(s) parse_accept_encoding(s, strlen(s))
+    ASSERT(AE("") == ENCODING_IDENTITY);
+    ASSERT(AE("gzip") == ENCODING_GZIP);
+    ASSERT(AE("gzip, deflate, br") == (ENCODING_GZIP | ENCODING_BROTLI));
+    ASSERT(AE("BR;q=0.8, identity") == ENCODING_BROTLI);
+    ASSERT(AE("gzip;q=0, br") == ENCODING_BROTLI);
+    ASSERT(AE("gzip;q=0.000") == ENCODING_IDENTITY);
+    ASSERT(AE("*") == (ENCODING_GZIP | ENCODING_BROTLI));
+    ASSERT(AE("*, br;q=0") == ENCODING_GZIP);
+    ASSERT(AE("*;q=0") == ENCODING_IDENTITY);
+    ASSERT(AE("deflate, compress") == ENCODING_IDENTITY);
+#undef AE
+}
+
+/* ------------------------------------------------------------------ */
+/* Static handler tests                                                 */
+/* ------------------------------------------------------------------ */
+
+static void test_identity_without_accept_encoding(void)
+{
+    HTTPResponse *res = serve("/static/app.css", NULL, NULL);
+    ASSERT(res->status_code == 200);
+    ASSERT(res->file_fd >= 0);
+    ASSERT(res->content_length == 4000);
+    ASSERT(strcmp(res->content_type, "text/css") == 0);
+    ASSERT(has_header(res, "Vary: Accept-Encoding"));
+    ASSERT(has_header(res, "Accept-Ranges: bytes"));
+    ASSERT(!has_header(res, "Content-Encoding: gzip"));
+    httpresponse_free(res);
+}
+
+static void test_gzip_on_the_fly(void)
+{
+    HTTPResponse *res = serve("/static/app.css", "gzip", NULL);
+    ASSERT(res->status_code == 200);
+    ASSERT(has_header(res, "Content-Encoding: gzip"));
+    ASSERT(res->body_length < 4000);
+
+    /* The body must inflate back to the file */
+    char plain[8192];
+    z_stream zs = {0};
+    ASSERT(inflateInit2(&zs, 15 + 16) == Z_OK);
+    zs.next_in   = (Bytef *)res->body;
+    zs.avail_in  = res->body_length;
+    zs.next_out  = (Bytef *)plain;
+    zs.avail_out = sizeof(plain);
+    ASSERT(inflate(&zs, Z_FINISH) == Z_STREAM_END);
+    ASSERT(zs.total_out == 4000);
+    ASSERT(strncmp(plain, CSS_LINE, strlen(CSS_LINE)) == 0);
+    inflateEnd(&zs);
+
+    /* A second request is served from the cache with identical bytes */
+    HTTPResponse *again = serve("/static/app.css", "gzip", NULL);
+    ASSERT(again->body_length == res->body_length);
+    ASSERT(memcmp(again->body, res->body, res->body_length) == 0);
+
+    httpresponse_free(again);
+    httpresponse_free(res);
+}
+
+static void test_cache_invalidated_on_change(void)
+{
+    HTTPResponse *before = serve("/static/app.css", "gzip", NULL);
+    int before_len       = before->body_length;
+    httpresponse_free(before);
+
+    write_text("static/app.css", "p { margin: 0 auto; padding: 1em; }\n", 200);
+
+    HTTPResponse *after = serve("/static/app.css", "gzip", NULL);
+    ASSERT(has_header(after, "Content-Encoding: gzip"));
+    ASSERT(after->body_length != before_len);
+    httpresponse_free(after);
+
+    write_text("static/app.css", CSS_LINE, 200);
+}
+
+static void test_precompressed_sidecar(void)
+{
+    write_text("static/pre.js", "console.log('plain');\n", 50);
+    write_text("static/pre.js.gz", "not really gzip, served as is", 1);
+
+    char body[2048];
+    HTTPResponse *res = serve("/static/pre.js", "gzip", NULL);
+    ASSERT(has_header(res, "Content-Encoding: gzip"));
+    ASSERT(body_of(res, body, sizeof(body)) == 29);
+    ASSERT(memcmp(body, "not really gzip", 15) == 0);
+    ASSERT(strcmp(res->content_type, "application/javascript") == 0);
+    httpresponse_free(res);
+
+    /* Without gzip the original is sent, still with Vary */
+    res = serve("/static/pre.js", "br;q=0", NULL);
+    ASSERT(body_of(res, body, sizeof(body)) == 50 * 22);
+    ASSERT(has_header(res, "Vary: Accept-Encoding"));
+    httpresponse_free(res);
+}
+
+static void test_small_and_binary_files_not_compressed(void)
+{
+    write_text("static/tiny.txt", "hello\n", 1);
+    write_text("static/logo.png", "\x89PNG not compressible by type\n", 50);
+
+    HTTPResponse *res = serve("/static/tiny.txt", "gzip", NULL);
+    ASSERT(res->content_length == 6);
+    ASSERT(!has_header(res, "Vary: Accept-Encoding"));
+    httpresponse_free(res);
+
+    res = serve("/static/logo.png", "gzip", NULL);
+    ASSERT(!has_header(res, "Content-Encoding: gzip"));
+    ASSERT(!has_header(res, "Vary: Accept-Encoding"));
+    httpresponse_free(res);
+
+    /* Compression can be switched off entirely */
+    StaticOptions opts;
+    static_options_defaults(&opts);
+    opts.compression = false;
+    res              = serve("/static/app.css", "gzip", &opts);
+    ASSERT(res->content_length == 4000);
+    ASSERT(!has_header(res, "Content-Encoding: gzip"));
+    httpresponse_free(res);
+
+    /* Files above compression_max_length are not read whole; they go out with sendfile() */
+    opts.compression            = true;
+    opts.compression_max_length = 3999;
+    res                         = serve("/static/app.css", "gzip", &opts);
+    ASSERT(res->content_length == 4000 && res->file_fd >= 0);
+    ASSERT(!has_header(res, "Content-Encoding: gzip"));
+    ASSERT(!has_header(res, "Vary: Accept-Encoding"));
+    httpresponse_free(res);
+}
+
+static void test_not_found_and_traversal(void)
+{
+    HTTPResponse *res = serve("/static/missing.css", NULL, NULL);
+    ASSERT(res->status_code == 404);
+    httpresponse_free(res);
+
+    res = serve("/static/../secret.txt", NULL, NULL);
+    ASSERT(res->status_code == 404);
+    httpresponse_free(res);
+
+    res = serve("/static", NULL, NULL);
+    ASSERT(res->status_code == 404);
+    httpresponse_free(res);
+
+    /* Query strings are not part of the path */
+    res = serve("/static/tiny.txt?v=2", NULL, NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+}
+
+/* ------------------------------------------------------------------ */
+/* Range tests                                                          */
+/* ------------------------------------------------------------------ */
+
+static void test_parse_range(void)
+{
+    ByteRange r[MAX_RANGES];
+#define PR(s, size) parse_range(s, strlen(s), size, r, MAX_RANGES)
+    ASSERT(PR("bytes=0-99", 1000) == 1 && r[0].offset == 0 && r[0].length == 100);
+    ASSERT(PR("bytes=900-", 1000) == 1 && r[0].offset == 900 && r[0].length == 100);
+    ASSERT(PR("bytes=-100", 1000) == 1 && r[0].offset == 900 && r[0].length == 100);
+    ASSERT(PR("bytes=-5000", 1000) == 1 && r[0].offset == 0 && r[0].length == 1000);
+    ASSERT(PR("bytes=990-2000", 1000) == 1 && r[0].length == 10);
+    ASSERT(PR("bytes=0-0, 10-19 ,-1", 1000) == 3 && r[1].offset == 10 && r[2].offset == 999);
+
+    /* Unsatisfiable specs are dropped; none left means 416 */
+    ASSERT(PR("bytes=1000-", 1000) == 0);
+    ASSERT(PR("bytes=2000-3000, 0-1", 1000) == 1 && r[0].offset == 0);
+    ASSERT(PR("bytes=-0", 1000) == 0);
+
+    /* Malformed or excessive headers are ignored */
+    ASSERT(PR("bytes=5-1", 1000) == -1);
+    ASSERT(PR("bytes=abc", 1000) == -1);
+    ASSERT(PR("items=0-1", 1000) == -1);
+    ASSERT(PR("bytes=", 1000) == -1);
+    ASSERT(PR("bytes=0-1,2-3,4-5,6-7,8-9,10-11,12-13,14-15,16-17,18-19,20-21,22-23,24-25,"
+              "26-27,28-29,30-31,32-33", 1000) == -1);
+#undef PR
+}
+
+static void test_single_range(void)
+{
+    char body[8192];
+    HTTPResponse *res =
+        serve_request("GET /static/app.css HTTP/1.1\r\nRange: bytes=20-39\r\n\r\n", NULL);
+    ASSERT(res->status_code == 206);
+    ASSERT(has_header(res, "Content-Range: bytes 20-39/4000"));
+    ASSERT(body_of(res, body, sizeof(body)) == 20);
+    ASSERT(memcmp(body, CSS_LINE, 20) == 0);
+    httpresponse_free(res);
+
+    /* Ranges only apply to GET */
+    res = serve_request("POST /static/app.css HTTP/1.1\r\nRange: bytes=20-39\r\n\r\n", NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+
+    res = serve_request("GET /static/app.css HTTP/1.1\r\nRange: bytes=4000-\r\n\r\n", NULL);
+    ASSERT(res->status_code == 416);
+    ASSERT(has_header(res, "Content-Range: bytes */4000"));
+    httpresponse_free(res);
+}
+
+static void test_multipart_ranges(void)
+{
+    char body[8192];
+    HTTPResponse *res = serve_request(
+        "GET /static/app.css HTTP/1.1\r\nRange: bytes=0-3, -6\r\n\r\n", NULL);
+    ASSERT(res->status_code == 206);
+    ASSERT(strncmp(res->content_type, "multipart/byteranges; boundary=", 31) == 0);
+    const char *boundary = res->content_type + 31;
+
+    size_t len = body_of(res, body, sizeof(body));
+    body[len]  = '\0';
+
+    char expected[1024];
+    snprintf(expected, sizeof(expected),
+             "--%s\r\nContent-Type: text/css\r\nContent-Range: bytes 0-3/4000\r\n\r\nbody"
+             "\r\n--%s\r\nContent-Type: text/css\r\nContent-Range: bytes 3994-3999/4000\r\n\r\n"
+             " 0; }\n"
+             "\r\n--%s--\r\n",
+             boundary, boundary, boundary);
+    ASSERT(strcmp(body, expected) == 0);
+    httpresponse_free(res);
+}
+
+static void test_if_range(void)
+{
+    struct stat st;
+    ASSERT(stat("static/app.css", &st) == 0);
+    char date[64], raw[256];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&st.st_mtime));
+
+    /* Matching date: the range is honored */
+    snprintf(raw, sizeof(raw),
+             "GET /static/app.css HTTP/1.1\r\nRange: bytes=0-9\r\nIf-Range: %s\r\n\r\n", date);
+    HTTPResponse *res = serve_request(raw, NULL);
+    ASSERT(res->status_code == 206);
+    httpresponse_free(res);
+
+    /* Stale validator: the whole file comes back */
+    res = serve_request("GET /static/app.css HTTP/1.1\r\nRange: bytes=0-9\r\n"
+                        "If-Range: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n",
+                        NULL);
+    ASSERT(res->status_code == 200);
+    ASSERT(res->content_length == 4000);
+    httpresponse_free(res);
+
+    /* Strong ETag: honored; weak ETag: never */
+    res = serve("/static/app.css", NULL, NULL);
+    char etag[80];
+    snprintf(etag, sizeof(etag), "%s", header_value(res, "ETag"));
+    httpresponse_free(res);
+
+    snprintf(raw, sizeof(raw),
+             "GET /static/app.css HTTP/1.1\r\nRange: bytes=0-9\r\nIf-Range: %s\r\n\r\n", etag);
+    res = serve_request(raw, NULL);
+    ASSERT(res->status_code == 206);
+    httpresponse_free(res);
+
+    snprintf(raw, sizeof(raw),
+             "GET /static/app.css HTTP/1.1\r\nRange: bytes=0-9\r\nIf-Range: W/%s\r\n\r\n", etag);
+    res = serve_request(raw, NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+}
+
+/* ------------------------------------------------------------------ */
+/* Validators and caching                                               */
+/* ------------------------------------------------------------------ */
+
+static void test_validators_present(void)
+{
+    HTTPResponse *res = serve("/static/app.css", NULL, NULL);
+    const char *etag  = header_value(res, "ETag");
+    ASSERT(etag != NULL && etag[0] == '"');
+    ASSERT(header_value(res, "Last-Modified") != NULL);
+    ASSERT(header_value(res, "Cache-Control") == NULL);
+
+    /* The gzip variant is a different representation */
+    HTTPResponse *gz = serve("/static/app.css", "gzip", NULL);
+    ASSERT(header_value(gz, "ETag") != NULL);
+    ASSERT(strcmp(header_value(gz, "ETag"), etag) != 0);
+    httpresponse_free(gz);
+    httpresponse_free(res);
+}
+
+static void test_if_none_match(void)
+{
+    HTTPResponse *res = serve("/static/app.css", NULL, NULL);
+    char etag[80], raw[256];
+    snprintf(etag, sizeof(etag), "%s", header_value(res, "ETag"));
+    httpresponse_free(res);
+
+    const char *forms[] = {"%s", "\"other\", %s", "W/%s", "*"};
+    for (size_t i = 0; i < sizeof(forms) / sizeof(forms[0]); i++)
+    {
+        char value[200];
+        snprintf(value, sizeof(value), forms[i], etag);
+        snprintf(raw, sizeof(raw), "GET /static/app.css HTTP/1.1\r\nIf-None-Match: %s\r\n\r\n",
+                 value);
+        res = serve_request(raw, NULL);
+        ASSERT(res->status_code == 304);
+        ASSERT(res->content_length == 0 && res->file_fd < 0 && res->body == NULL);
+        ASSERT(strcmp(header_value(res, "ETag"), etag) == 0);
+
+        size_t len;
+        char *wire = httpresponse_serialize(res, &len);
+        ASSERT(wire != NULL && strstr(wire, "Content-Length") == NULL);
+        free(wire);
+        httpresponse_free(res);
+    }
+
+    res = serve_request("GET /static/app.css HTTP/1.1\r\nIf-None-Match: \"other\"\r\n\r\n", NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+}
+
+static void test_if_modified_since(void)
+{
+    struct stat st;
+    ASSERT(stat("static/app.css", &st) == 0);
+    char date[64], raw[256];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&st.st_mtime));
+
+    snprintf(raw, sizeof(raw), "GET /static/app.css HTTP/1.1\r\nIf-Modified-Since: %s\r\n\r\n",
+             date);
+    HTTPResponse *res = serve_request(raw, NULL);
+    ASSERT(res->status_code == 304);
+    httpresponse_free(res);
+
+    res = serve_request("GET /static/app.css HTTP/1.1\r\n"
+                        "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n",
+                        NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+
+    /* A non-matching If-None-Match wins over a matching date */
+    snprintf(raw, sizeof(raw),
+             "GET /static/app.css HTTP/1.1\r\nIf-None-Match: \"other\"\r\n"
+             "If-Modified-Since: %s\r\n\r\n",
+             date);
+    res = serve_request(raw, NULL);
+    ASSERT(res->status_code == 200);
+    httpresponse_free(res);
+}
+
+static void test_cache_control_rules(void)
+{
+    StaticOptions opts;
+    static_options_defaults(&opts);
+    ASSERT(static_options_add_cache_rule(&opts, "/static 60") == OK);
+    ASSERT(static_options_add_cache_rule(&opts, "/static/app.css 3600") == OK);
+    ASSERT(static_options_add_cache_rule(&opts, "/static/app 1") == OK);
+    ASSERT(static_options_add_cache_rule(&opts, "static 1") < 0);
+    ASSERT(static_options_add_cache_rule(&opts, "/static") < 0);
+
+    HTTPResponse *res = serve("/static/app.css?v=2", NULL, &opts);
+    ASSERT(strcmp(header_value(res, "Cache-Control"), "max-age=3600") == 0);
+    httpresponse_free(res);
+
+    res = serve("/static/tiny.txt", NULL, &opts);
+    ASSERT(strcmp(header_value(res, "Cache-Control"), "max-age=60") == 0);
+    httpresponse_free(res);
+
+    /* A repeated prefix replaces the earlier rule */
+    ASSERT(static_options_add_cache_rule(&opts, "/static 0") == OK);
+    ASSERT(opts.cache_rule_count == 3);
+    res = serve("/static/tiny.txt", NULL, &opts);
+    ASSERT(strcmp(header_value(res, "Cache-Control"), "max-age=0") == 0);
+    httpresponse_free(res);
+
+    static_options_free(&opts);
+}
+
+/* ------------------------------------------------------------------ */
+/* main                                                                 */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve static file tests ===\n\n");
+
+    logger_set_level(LOG_ERROR);
+    ASSERT(mkdtemp(scratch_dir) != NULL);
+    ASSERT(chdir(scratch_dir) == 0);
+    ASSERT(mkdir("static", 0755) == 0);
+    write_text("secret.txt", "secret\n", 1);
+    write_text("static/app.css", CSS_LINE, 200);
+
+    printf("[ negotiation ]\n");
+    RUN(test_accept_encoding);
+
+    printf("\n[ static ]\n");
+    RUN(test_identity_without_accept_encoding);
+    RUN(test_gzip_on_the_fly);
+    RUN(test_cache_invalidated_on_change);
+    RUN(test_precompressed_sidecar);
+    RUN(test_small_and_binary_files_not_compressed);
+    RUN(test_not_found_and_traversal);
+
+    printf("\n[ ranges ]\n");
+    RUN(test_parse_range);
+    RUN(test_single_range);
+    RUN(test_multipart_ranges);
+    RUN(test_if_range);
+
+    printf("\n[ validators ]\n");
+    RUN(test_validators_present);
+    RUN(test_if_none_match);
+    RUN(test_if_modified_since);
+    RUN(test_cache_control_rules);
+
+    static_cache_clear();
+    const char *files[] = {"static/app.css",  "static/pre.js",   "static/pre.js.gz",
+                           "static/tiny.txt", "static/logo.png", "secret.txt"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        unlink(files[i]);
+    rmdir("static");
+    rmdir(scratch_dir);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
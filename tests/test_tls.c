@@ -0,0 +1,357 @@
+/**
+ * @file    test_tls.c
+ * @brief   Unit tests for TLS termination: handshake, ALPN, resumption and I/O.
+ *
+ * Each test runs a real OpenSSL client against the server side over a
+ * nonblocking socketpair, with a self-signed certificate made at startup.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+#include "sock/tls.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static char cert_path[] = "/tmp/cserve_test_certXXXXXX";
+static char key_path[]  = "/tmp/cserve_test_keyXXXXXX";
+
+/* Writes a self-signed P-256 certificate and its key to cert_path and key_path */
+static void make_certificate(void)
+{
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *x509    = X509_new();
+    ASSERT(key && x509);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, key);
+    X509_NAME *name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1,
+                               -1, 0);
+    X509_set_issuer_name(x509, name);
+    ASSERT(X509_sign(x509, key, EVP_sha256()) > 0);
+
+    int cert_fd = mkstemp(cert_path);
+    int key_fd  = mkstemp(key_path);
+    ASSERT(cert_fd >= 0 && key_fd >= 0);
+    FILE *cert_file = fdopen(cert_fd, "w");
+    FILE *key_file  = fdopen(key_fd, "w");
+    ASSERT(PEM_write_X509(cert_file, x509) == 1);
+    ASSERT(PEM_write_PrivateKey(key_file, key, NULL, NULL, 0, NULL, NULL) == 1);
+    fclose(cert_file);
+    fclose(key_file);
+    X509_free(x509);
+    EVP_PKEY_free(key);
+}
+
+static TLSContext *make_context(bool tickets, size_t cache_size, bool http2)
+{
+    TLSOptions opts;
+    tls_options_defaults(&opts);
+    opts.certificate        = cert_path;
+    opts.certificate_key    = key_path;
+    opts.session_tickets    = tickets;
+    opts.session_cache_size = cache_size;
+    return tls_context_new(&opts, http2);
+}
+
+static SSL_CTX *make_client_context(const char *alpn, size_t alpn_len)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    ASSERT(ctx);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+    if (alpn) SSL_CTX_set_alpn_protos(ctx, (const unsigned char *)alpn, (unsigned)alpn_len);
+    return ctx;
+}
+
+typedef struct Pair
+{
+    int fds[2];
+    TLSConnection *server;
+    SSL *client;
+} Pair;
+
+/* Connects a client to the server side and runs both handshakes to completion */
+static void pair_open(Pair *p, TLSContext *ctx, SSL_CTX *client_ctx, SSL_SESSION *session)
+{
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, p->fds) == 0);
+    p->server = tls_accept(ctx, p->fds[0]);
+    p->client = SSL_new(client_ctx);
+    ASSERT(p->server && p->client);
+    SSL_set_fd(p->client, p->fds[1]);
+    SSL_set_connect_state(p->client);
+    if (session) SSL_set_session(p->client, session);
+
+    bool server_done = false, client_done = false;
+    for (int i = 0; i < 100 && !(server_done && client_done); i++)
+    {
+        if (!client_done)
+        {
+            int ret = SSL_do_handshake(p->client);
+            if (ret == 1)
+                client_done = true;
+            else
+                ASSERT(SSL_get_error(p->client, ret) == SSL_ERROR_WANT_READ);
+        }
+        if (!server_done)
+        {
+            uint32_t events = 0;
+            int ret         = tls_handshake(p->server, &events);
+            ASSERT(ret >= 0);
+            server_done = ret == 1;
+            if (!server_done) ASSERT(events == EPOLLIN);
+        }
+    }
+    ASSERT(server_done && client_done);
+}
+
+static void pair_close(Pair *p)
+{
+    tls_shutdown(p->server);
+    tls_free(p->server);
+    // Without close_notify OpenSSL treats the client's session as unfit for resumption
+    SSL_shutdown(p->client);
+    SSL_free(p->client);
+    close(p->fds[0]);
+    close(p->fds[1]);
+}
+
+/* Reads what the server sent until len bytes arrived; also takes in session tickets */
+static size_t client_read(Pair *p, char *buf, size_t len)
+{
+    size_t got = 0;
+    for (int i = 0; i < 1000 && got < len; i++)
+    {
+        size_t n;
+        if (SSL_read_ex(p->client, buf + got, len - got, &n) == 1)
+            got += n;
+        else
+            ASSERT(SSL_get_error(p->client, 0) == SSL_ERROR_WANT_READ);
+    }
+    return got;
+}
+
+/* Runs a handshake and a short exchange, and returns the client's session */
+static SSL_SESSION *first_session(TLSContext *ctx, SSL_CTX *client_ctx)
+{
+    Pair p;
+    char buf[2];
+    pair_open(&p, ctx, client_ctx, NULL);
+    ASSERT(!tls_session_reused(p.server));
+    ASSERT(tls_send(p.server, "ok", 2) == 2);
+    ASSERT(client_read(&p, buf, 2) == 2);
+    SSL_SESSION *session = SSL_get1_session(p.client);
+    pair_close(&p);
+    return session;
+}
+
+static bool resumes(TLSContext *ctx)
+{
+    SSL_CTX *client_ctx  = make_client_context(NULL, 0);
+    SSL_SESSION *session = first_session(ctx, client_ctx);
+
+    Pair p;
+    pair_open(&p, ctx, client_ctx, session);
+    bool reused = tls_session_reused(p.server);
+    pair_close(&p);
+    SSL_SESSION_free(session);
+    SSL_CTX_free(client_ctx);
+    return reused;
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_handshake_and_io(void)
+{
+    TLSContext *ctx     = make_context(true, DEFAULT_TLS_SESSION_CACHE_SIZE, true);
+    SSL_CTX *client_ctx = make_client_context(NULL, 0);
+    ASSERT(ctx);
+
+    Pair p;
+    pair_open(&p, ctx, client_ctx, NULL);
+
+    // Nothing sent yet: a read would block
+    char buf[64];
+    errno = 0;
+    ASSERT(tls_recv(p.server, buf, sizeof(buf)) == -1 && errno == EAGAIN);
+
+    size_t n;
+    ASSERT(SSL_write_ex(p.client, "GET / HTTP/1.1\r\n\r\n", 18, &n) == 1 && n == 18);
+    ssize_t got = tls_recv(p.server, buf, sizeof(buf));
+    ASSERT(got == 18 && memcmp(buf, "GET / HTTP/1.1\r\n\r\n", 18) == 0);
+
+    ASSERT(tls_send(p.server, "HTTP/1.1 200 OK\r\n", 17) == 17);
+    ASSERT(client_read(&p, buf, 17) == 17 && memcmp(buf, "HTTP/1.1 200 OK\r\n", 17) == 0);
+
+    // Unix sockets have no kTLS: file slices are encrypted in user space
+    ASSERT(!tls_ktls_send(p.server));
+
+    // The client closing the session is an EOF
+    SSL_shutdown(p.client);
+    ASSERT(tls_recv(p.server, buf, sizeof(buf)) == 0);
+
+    pair_close(&p);
+    SSL_CTX_free(client_ctx);
+    tls_context_free(ctx);
+}
+
+static void test_sendfile(void)
+{
+    TLSContext *ctx     = make_context(true, DEFAULT_TLS_SESSION_CACHE_SIZE, true);
+    SSL_CTX *client_ctx = make_client_context(NULL, 0);
+    ASSERT(ctx);
+
+    static char body[50000], received[50000];
+    for (size_t i = 0; i < sizeof(body); i++)
+        body[i] = (char)('a' + i % 23);
+    char path[] = "/tmp/cserve_test_bodyXXXXXX";
+    int fd      = mkstemp(path);
+    ASSERT(fd >= 0 && write(fd, body, sizeof(body)) == (ssize_t)sizeof(body));
+
+    Pair p;
+    pair_open(&p, ctx, client_ctx, NULL);
+
+    // Send from offset 100 onwards, draining the client whenever the socket fills up
+    off_t offset  = 100;
+    size_t left   = sizeof(body) - 100;
+    size_t copied = 0;
+    while (left > 0)
+    {
+        ssize_t sent = tls_sendfile(p.server, fd, &offset, left);
+        if (sent < 0)
+        {
+            ASSERT(errno == EAGAIN);
+            copied += client_read(&p, received + copied, 1);
+            continue;
+        }
+        ASSERT(sent > 0);
+        left -= sent;
+    }
+    ASSERT(offset == (off_t)sizeof(body));
+    copied += client_read(&p, received + copied, sizeof(body) - 100 - copied);
+    ASSERT(copied == sizeof(body) - 100);
+    ASSERT(memcmp(received, body + 100, copied) == 0);
+
+    // Past the end of the file: 0, which the server treats as truncation
+    ASSERT(tls_sendfile(p.server, fd, &offset, 10) == 0);
+
+    pair_close(&p);
+    close(fd);
+    unlink(path);
+    SSL_CTX_free(client_ctx);
+    tls_context_free(ctx);
+}
+
+static void test_alpn(void)
+{
+    static const char both[]    = "\x08http/1.1\x02h2";
+    static const char only_h2[] = "\x02h2";
+    size_t len;
+
+    TLSContext *with_h2  = make_context(true, 0, true);
+    TLSContext *http1    = make_context(true, 0, false);
+    SSL_CTX *both_client = make_client_context(both, sizeof(both) - 1);
+    SSL_CTX *h2_client   = make_client_context(only_h2, sizeof(only_h2) - 1);
+    SSL_CTX *no_alpn     = make_client_context(NULL, 0);
+    ASSERT(with_h2 && http1);
+
+    // The server's preference wins
+    Pair p;
+    pair_open(&p, with_h2, both_client, NULL);
+    const char *alpn = tls_alpn(p.server, &len);
+    ASSERT(alpn && len == 2 && memcmp(alpn, "h2", 2) == 0);
+    pair_close(&p);
+
+    pair_open(&p, http1, both_client, NULL);
+    alpn = tls_alpn(p.server, &len);
+    ASSERT(alpn && len == 8 && memcmp(alpn, "http/1.1", 8) == 0);
+    pair_close(&p);
+
+    // Nothing in common, or no ALPN at all: the handshake proceeds without it
+    pair_open(&p, http1, h2_client, NULL);
+    ASSERT(tls_alpn(p.server, &len) == NULL && len == 0);
+    pair_close(&p);
+
+    pair_open(&p, with_h2, no_alpn, NULL);
+    ASSERT(tls_alpn(p.server, &len) == NULL);
+    pair_close(&p);
+
+    SSL_CTX_free(both_client);
+    SSL_CTX_free(h2_client);
+    SSL_CTX_free(no_alpn);
+    tls_context_free(with_h2);
+    tls_context_free(http1);
+}
+
+static void test_session_resumption(void)
+{
+    // Stateless tickets, the server-side cache, or both
+    TLSContext *tickets = make_context(true, 0, true);
+    TLSContext *cache   = make_context(false, 64, true);
+    TLSContext *none    = make_context(false, 0, true);
+    ASSERT(tickets && cache && none);
+
+    ASSERT(resumes(tickets));
+    ASSERT(resumes(cache));
+    ASSERT(!resumes(none));
+
+    tls_context_free(tickets);
+    tls_context_free(cache);
+    tls_context_free(none);
+}
+
+static void test_context_errors(void)
+{
+    TLSOptions opts;
+    tls_options_defaults(&opts);
+    ASSERT(opts.session_tickets && opts.ktls);
+    ASSERT(opts.session_cache_size == DEFAULT_TLS_SESSION_CACHE_SIZE);
+
+    // Missing key, unreadable files, or a key file that holds a certificate
+    opts.certificate = cert_path;
+    ASSERT(tls_context_new(&opts, true) == NULL);
+    opts.certificate_key = "/nonexistent/key.pem";
+    ASSERT(tls_context_new(&opts, true) == NULL);
+    opts.certificate_key = cert_path;
+    ASSERT(tls_context_new(&opts, true) == NULL);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve TLS tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+    make_certificate();
+
+    printf("[ tls ]\n");
+    RUN(test_handshake_and_io);
+    RUN(test_sendfile);
+    RUN(test_alpn);
+    RUN(test_session_resumption);
+    RUN(test_context_errors);
+
+    unlink(cert_path);
+    unlink(key_path);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
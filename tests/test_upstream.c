@@ -0,0 +1,366 @@
+/**
+ * @file    test_upstream.c
+ * @brief   Unit tests for backend addresses, upstream response framing,
+ *          spliced bodies, upgrades and the keep-alive pool.
+ *
+ * The backend side of each exchange is the other end of a socketpair, or a
+ * unix socket listener in /tmp.
+ *
+ * Run via CTest: ctest --test-dir build --output-on-failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+#include "http/upstream.h"
+
+#include "test.h"
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Starts an exchange on one end of a socketpair, as if it came from the pool */
+static void start_pooled(Upstream *u, int backend[2], const char *request)
+{
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, backend) == 0);
+    UpstreamAddress addr;
+    ASSERT(upstream_parse_address("unix:/nonexistent.sock", &addr) == OK);
+    ASSERT(upstream_start(u, &addr, backend[0], strdup(request), strlen(request)) == OK);
+    ASSERT(u->reused && u->state == UPSTREAM_SENDING);
+    ASSERT(upstream_step(u, EPOLLOUT) == EPOLLIN);
+}
+
+/* Feeds response bytes from the backend side and steps the exchange once */
+static uint32_t respond(Upstream *u, int backend[2], const char *bytes)
+{
+    ASSERT(write(backend[1], bytes, strlen(bytes)) == (ssize_t)strlen(bytes));
+    return upstream_step(u, EPOLLIN);
+}
+
+static void finish(Upstream *u, int backend[2])
+{
+    upstream_release(u);
+    close(backend[1]);
+}
+
+/* ------------------------------------------------------------------ */
+/* Tests                                                                */
+/* ------------------------------------------------------------------ */
+
+static void test_parse_address(void)
+{
+    UpstreamAddress addr;
+    ASSERT(upstream_parse_address("localhost:8002", &addr) == OK);
+    ASSERT(!addr.is_unix && strcmp(addr.host, "localhost") == 0 && strcmp(addr.port, "8002") == 0);
+
+    ASSERT(upstream_parse_address("backend.internal", &addr) == OK);
+    ASSERT(strcmp(addr.host, "backend.internal") == 0 && strcmp(addr.port, "80") == 0);
+
+    ASSERT(upstream_parse_address("unix:/run/app.sock", &addr) == OK);
+    ASSERT(addr.is_unix && strcmp(addr.host, "/run/app.sock") == 0 && addr.port[0] == '\0');
+
+    char long_path[200] = "unix:/";
+    memset(long_path + 6, 'a', sizeof(long_path) - 7);
+    ASSERT(upstream_parse_address(long_path, &addr) < 0);
+    ASSERT(upstream_parse_address("unix:", &addr) < 0);
+    ASSERT(upstream_parse_address(":8002", &addr) < 0);
+}
+
+static void test_content_length_framing(void)
+{
+    Upstream u;
+    int backend[2];
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+
+    // Headers and part of the body: not done, the connection stays open
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n01234") == EPOLLIN);
+    ASSERT(u.state == UPSTREAM_RECEIVING);
+    ASSERT(respond(&u, backend, "56789") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && u.reusable);
+    ASSERT(strcmp(u.response + u.body_start, "0123456789") == 0);
+    finish(&u, backend);
+
+    // Connection: close, or bytes beyond the body, rule out reuse
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend,
+                   "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && !u.reusable);
+    finish(&u, backend);
+
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nokEXTRA") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && !u.reusable);
+    ASSERT(strcmp(u.response + u.body_start, "ok") == 0);
+    finish(&u, backend);
+}
+
+static void test_chunked_framing(void)
+{
+    Upstream u;
+    int backend[2];
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+
+    ASSERT(respond(&u, backend,
+                   "HTTP/1.1 100 Continue\r\n\r\n"
+                   "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n") ==
+           EPOLLIN);
+    ASSERT(respond(&u, backend, "7;ext=1\r\n, world\r\n0\r\n") == EPOLLIN);
+    ASSERT(respond(&u, backend, "X-Trailer: yes\r\n\r\n") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && u.reusable);
+    ASSERT(strncmp(u.response, "HTTP/1.1 200 OK", 15) == 0);
+    ASSERT(strcmp(u.response + u.body_start, "hello, world") == 0);
+    ASSERT(u.response_len == u.body_start + 12);
+    finish(&u, backend);
+
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n") ==
+           0);
+    ASSERT(u.state == UPSTREAM_FAILED && !u.retryable);
+    finish(&u, backend);
+}
+
+static void test_bodiless_and_eof_framing(void)
+{
+    Upstream u;
+    int backend[2];
+
+    // HEAD: Content-Length describes the GET body, which is not sent
+    start_pooled(&u, backend, "HEAD / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && u.reusable && u.body_start == u.response_len);
+    finish(&u, backend);
+
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 304 Not Modified\r\n\r\n") == 0);
+    ASSERT(u.state == UPSTREAM_DONE && u.reusable);
+    finish(&u, backend);
+
+    // Neither length nor chunks: the body ends at EOF and the connection with it
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.0 200 OK\r\n\r\nuntil eof") == EPOLLIN);
+    shutdown(backend[1], SHUT_WR);
+    ASSERT(upstream_step(&u, EPOLLIN) == 0);
+    ASSERT(u.state == UPSTREAM_DONE && !u.reusable);
+    ASSERT(strcmp(u.response + u.body_start, "until eof") == 0);
+    finish(&u, backend);
+
+    // Truncated before Content-Length was reached: a failure, not a short body
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nshort") == EPOLLIN);
+    shutdown(backend[1], SHUT_WR);
+    ASSERT(upstream_step(&u, EPOLLIN) == 0);
+    ASSERT(u.state == UPSTREAM_FAILED && !u.retryable);
+    finish(&u, backend);
+}
+
+static void test_splice_body(void)
+{
+    Upstream u;
+    int backend[2];
+    int pipe_fds[2];
+    char buf[64];
+    ASSERT(pipe2(pipe_fds, O_NONBLOCK) == 0);
+
+    // A large body stops the exchange after the headers and what came with them
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    u.splice_min = 16;
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 40\r\n\r\n0123") == 0);
+    ASSERT(u.state == UPSTREAM_SPLICING && u.body_left == 36);
+    ASSERT(strcmp(u.response + u.body_start, "0123") == 0);
+
+    // The rest goes to the pipe as it arrives, never past the body
+    ASSERT(write(backend[1], "4567890123456789", 16) == 16);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == 16);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == -1 && errno == EAGAIN);
+    ASSERT(u.state == UPSTREAM_SPLICING && u.body_left == 20);
+    ASSERT(read(pipe_fds[0], buf, sizeof(buf)) == 16 && memcmp(buf, "4567890123456789", 16) == 0);
+
+    ASSERT(write(backend[1], "01234567890123456789", 20) == 20);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 8) == 8);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == 12);
+    ASSERT(u.state == UPSTREAM_DONE && u.reusable && u.body_left == 0);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == 0);
+    ASSERT(read(pipe_fds[0], buf, sizeof(buf)) == 20);
+    finish(&u, backend);
+
+    // Small and chunked bodies are buffered as usual
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    u.splice_min = 16;
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 8\r\n\r\n0123") == EPOLLIN);
+    ASSERT(u.state == UPSTREAM_RECEIVING);
+    finish(&u, backend);
+
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    u.splice_min = 1;
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n") ==
+           EPOLLIN);
+    ASSERT(u.state == UPSTREAM_RECEIVING);
+    finish(&u, backend);
+
+    // The backend closing mid-body fails the exchange
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    u.splice_min = 16;
+    ASSERT(respond(&u, backend, "HTTP/1.1 200 OK\r\nContent-Length: 40\r\n\r\n") == 0);
+    ASSERT(write(backend[1], "0123456789", 10) == 10);
+    shutdown(backend[1], SHUT_WR);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == 10);
+    ASSERT(upstream_splice(&u, pipe_fds[1], 1000) == -1);
+    ASSERT(u.state == UPSTREAM_FAILED && !u.retryable);
+    finish(&u, backend);
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+static void test_upgrade(void)
+{
+    Upstream u;
+    int backend[2];
+
+    // A 101 to an upgrade request ends the exchange; what follows is the new protocol's
+    start_pooled(&u, backend, "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\n\r\n");
+    u.upgrade = true;
+    ASSERT(respond(&u, backend, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                "Connection: Upgrade\r\n\r\n\x81\x02hi") == 0);
+    ASSERT(u.state == UPSTREAM_UPGRADED && !u.reusable);
+    ASSERT(u.response_len - u.body_start == 4);
+    ASSERT(memcmp(u.response + u.body_start, "\x81\x02hi", 4) == 0);
+    finish(&u, backend);
+
+    // Refused, the upgrade request is answered like any other
+    start_pooled(&u, backend, "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\n\r\n");
+    u.upgrade = true;
+    ASSERT(respond(&u, backend, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n") == 0);
+    ASSERT(u.state == UPSTREAM_DONE);
+    finish(&u, backend);
+
+    // Without upgrade set, a 101 is an interim response like 100
+    start_pooled(&u, backend, "GET /ws HTTP/1.1\r\n\r\n");
+    ASSERT(respond(&u, backend, "HTTP/1.1 101 Switching Protocols\r\n\r\n") == EPOLLIN);
+    ASSERT(u.state == UPSTREAM_RECEIVING);
+    finish(&u, backend);
+
+    // CONNECT sends nothing: the exchange is over once the connection is made
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, backend) == 0);
+    UpstreamAddress addr;
+    ASSERT(upstream_parse_address("unix:/nonexistent.sock", &addr) == OK);
+    ASSERT(upstream_start(&u, &addr, backend[0], NULL, 0) == OK);
+    u.upgrade = true;
+    ASSERT(upstream_step(&u, EPOLLOUT) == 0 && u.state == UPSTREAM_UPGRADED);
+    int fd = upstream_detach(&u);
+    ASSERT(fd == backend[0] && u.fd < 0);
+    close(fd);
+    finish(&u, backend);
+}
+
+static void test_stale_connection_retry(void)
+{
+    Upstream u;
+    int backend[2];
+
+    // The backend closed the pooled connection: an idempotent request is sent again
+    start_pooled(&u, backend, "GET / HTTP/1.1\r\n\r\n");
+    close(backend[1]);
+    ASSERT(upstream_step(&u, EPOLLIN) == 0);
+    ASSERT(u.state == UPSTREAM_FAILED && u.retryable);
+    upstream_release(&u);
+
+    // POST may already have been processed; it is not repeated
+    start_pooled(&u, backend, "POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+    close(backend[1]);
+    ASSERT(upstream_step(&u, EPOLLIN) == 0);
+    ASSERT(u.state == UPSTREAM_FAILED && !u.retryable);
+    upstream_release(&u);
+}
+
+static void test_unix_backend_and_pool(void)
+{
+    char path[] = "/tmp/cserve_test_upstreamXXXXXX";
+    int tmp     = mkstemp(path);
+    ASSERT(tmp >= 0);
+    close(tmp);
+    unlink(path);
+
+    int listener           = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un sun = {.sun_family = AF_UNIX};
+    strcpy(sun.sun_path, path);
+    ASSERT(bind(listener, (struct sockaddr *)&sun, sizeof(sun)) == 0 && listen(listener, 4) == 0);
+
+    char backend[64];
+    snprintf(backend, sizeof(backend), "unix:%s", path);
+    UpstreamAddress addr;
+    ASSERT(upstream_parse_address(backend, &addr) == OK);
+
+    // A fresh unix connection is established at once
+    Upstream u;
+    ASSERT(upstream_start(&u, &addr, -1, strdup("GET / HTTP/1.1\r\n\r\n"), 18) == OK);
+    ASSERT(!u.reused && u.state == UPSTREAM_CONNECTING);
+    ASSERT(upstream_step(&u, EPOLLOUT) == EPOLLIN);
+    int server = accept(listener, NULL, NULL);
+    char request[64];
+    ASSERT(recv(server, request, sizeof(request), 0) == 18);
+    ASSERT(write(server, "HTTP/1.1 204 No Content\r\n\r\n", 27) == 27);
+    ASSERT(upstream_step(&u, EPOLLIN) == 0 && u.state == UPSTREAM_DONE && u.reusable);
+
+    // Back to the pool and out again for the next request
+    UpstreamPool pool;
+    ASSERT(upstream_pool_init(&pool, 2, 60) == OK);
+    int fd = upstream_detach(&u);
+    upstream_release(&u);
+    upstream_pool_put(&pool, 3, fd);
+    ASSERT(upstream_pool_get(&pool, 0) == -1);
+    ASSERT(upstream_pool_get(&pool, 3) == fd);
+    ASSERT(upstream_pool_get(&pool, 3) == -1);
+
+    // A pooled connection the backend closed meanwhile is dropped
+    upstream_pool_put(&pool, 3, fd);
+    close(server);
+    ASSERT(upstream_pool_get(&pool, 3) == -1);
+
+    // Expired entries are dropped too, and a disabled pool keeps nothing
+    int pair[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    upstream_pool_put(&pool, 1, pair[0]);
+    pool.idle[pool.capacity].since -= 120;
+    ASSERT(upstream_pool_get(&pool, 1) == -1);
+    upstream_pool_free(&pool);
+    close(pair[1]);
+
+    ASSERT(upstream_pool_init(&pool, 0, 60) == OK);
+    ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    upstream_pool_put(&pool, 0, pair[0]);
+    ASSERT(upstream_pool_get(&pool, 0) == -1);
+    upstream_pool_free(&pool);
+    close(pair[1]);
+
+    close(listener);
+    unlink(path);
+}
+
+/* ------------------------------------------------------------------ */
+/* Entry point                                                          */
+/* ------------------------------------------------------------------ */
+
+int main(void)
+{
+    printf("=== cserve upstream tests ===\n\n");
+
+    logger_set_level(LOG_OFF);
+
+    printf("[ upstream ]\n");
+    RUN(test_parse_address);
+    RUN(test_content_length_framing);
+    RUN(test_chunked_framing);
+    RUN(test_bodiless_and_eof_framing);
+    RUN(test_splice_body);
+    RUN(test_upgrade);
+    RUN(test_stale_connection_retry);
+    RUN(test_unix_backend_and_pool);
+
+    printf("\n=== %d/%d passed ===\n", g_tests_passed, g_tests_run);
+
+    return (g_tests_passed == g_tests_run) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file    cserve_logdecode.c
+ * @author  Samandar Komil
+ * @date    19 October 2026
+ * @brief   Renders a binary access log as text.
+ *
+ * @details Reads a log written with access_log_binary on, from a file or
+ *          from stdin, and prints every record with the same templates the
+ *          server uses for text logs. Phase times keep microsecond
+ *          precision. Run with --help for the options.
+ */
+
+#include <getopt.h>
+
+#include "common.h"
+#include "utils/access_log.h"
+
+#define DECODE_CHUNK (64 * 1024)
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [FILE|-]\n"
+            "  -f, --format STR      line template (default: the server's default format)\n",
+            prog);
+}
+
+/**
+ * @brief   Decodes every record of an open log and prints it to stdout.
+ *
+ * @return  OK, or -1 if the header or a record is malformed or reading fails.
+ */
+static int decode_stream(FILE *in, const AccessLogFormat *fmt)
+{
+    uint8_t header[ACCESS_BINARY_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        memcmp(header, ACCESS_BINARY_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "Not a binary access log.\n");
+        return -1;
+    }
+    if (header[4] != ACCESS_BINARY_VERSION)
+    {
+        fprintf(stderr, "Unsupported binary access log version %d.\n", header[4]);
+        return -1;
+    }
+
+    uint8_t *buf = malloc(DECODE_CHUNK);
+    if (!buf) return -1;
+    char line[ACCESS_LINE_MAX];
+    size_t len     = 0;
+    uint64_t count = 0;
+    int ret        = OK;
+
+    while (1)
+    {
+        size_t n = fread(buf + len, 1, DECODE_CHUNK - len, in);
+        len += n;
+
+        size_t used = 0;
+        while (used < len)
+        {
+            AccessRecord rec;
+            ssize_t taken = access_log_decode(buf + used, len - used, &rec);
+            if (taken == 0) break;
+            if (taken < 0)
+            {
+                fprintf(stderr, "Malformed record %lu.\n", (unsigned long)count + 1);
+                ret = -1;
+                break;
+            }
+            fwrite(line, 1, access_log_render(fmt, &rec, line, sizeof(line)), stdout);
+            used += taken;
+            count++;
+        }
+        len -= used;
+        memmove(buf, buf + used, len);
+
+        if (ret < 0) break;
+        if (n == 0)
+        {
+            if (ferror(in))
+            {
+                perror("Failed to read the log");
+                ret = -1;
+            }
+            else if (len > 0)
+            {
+                // The server was still writing, or was stopped mid-record
+                fprintf(stderr, "Ignoring %zu bytes of an incomplete last record.\n", len);
+            }
+            break;
+        }
+    }
+
+    free(buf);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    const char *format = DEFAULT_ACCESS_LOG_FORMAT;
+
+    static const struct option long_options[] = {{"format", required_argument, NULL, 'f'},
+                                                 {"help", no_argument, NULL, 'h'},
+                                                 {NULL, 0, NULL, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            format = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind > 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    AccessLogFormat fmt;
+    if (access_log_format_compile(&fmt, format) < 0)
+    {
+        fprintf(stderr, "Invalid format '%s'.\n", format);
+        return EXIT_FAILURE;
+    }
+
+    const char *path = optind < argc ? argv[optind] : "-";
+    FILE *in         = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!in)
+    {
+        perror("Could not open the log");
+        access_log_format_free(&fmt);
+        return EXIT_FAILURE;
+    }
+
+    int ret = decode_stream(in, &fmt);
+    if (in != stdin) fclose(in);
+    access_log_format_free(&fmt);
+    return ret == OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}